@@ -40,10 +40,37 @@ int   g_fd;          // 全局变量，文件描述符，即open()函数打开
 int   g_verbose;     // 全局变量，输出信息的详细程度
 char  g_error_desc[128]; // 全局变量，错误代码的含义
 uchar g_error_code;      // 全局变量，模块返回的确认码，如果函数返回值不为true，读取此变量
+bool (*g_detect_finger)() = NULL; // 全局变量，检测手指的函数，为NULL时读取detect_pin
 
 uchar g_order[64] = { 0 }; // 发送给模块的指令包
 uchar g_reply[64] = { 0 }; // 模块的应答包 
 
+// 预先分配的传输缓冲区，收发数据不在堆上分配内存
+#define MAX_PACKET_SIZE 256
+uchar g_packet[11 + MAX_PACKET_SIZE];  // 一个完整的数据包(包头9字节 + 数据 + 检校和2字节)
+uchar g_image[73728];                  // 图像 256*288(PS_UpImage、PS_DownImage)
+
+// 指纹库索引表的缓存，第p位为1表示第p页已存储模板
+// 从模块读取一次后，由 PS_StoreChar、PS_DeleteChar、PS_Empty、PS_Enroll 同步更新
+unsigned long long g_index_bits[8] = { 0 };
+bool g_index_valid = false;
+
+// 模板缓存，按 (串口, 芯片地址, 页码) 保存 PS_LoadCharToBuf 读取的模板，满时淘汰最久未用的
+// 由 PS_StoreChar、PS_DeleteChar、PS_Empty、PS_Enroll、PS_Identify 使对应的页失效
+#define PS_TCACHE_DEFAULT_SIZE 64
+#define PS_TCACHE_MAX_SIZE     1024
+typedef struct {
+  int   fd;
+  uint  addr;
+  int   page;
+  unsigned long long lastUse;  // 0 表示空闲
+  uchar data[768];
+} TemplateCacheEntry;
+TemplateCacheEntry* g_tcache = NULL;      // 第一次缓存时分配
+int  g_tcache_size = PS_TCACHE_DEFAULT_SIZE;
+unsigned long long g_tcache_clock = 0;
+TemplateCacheStats g_tcache_stats = { 0 };
+
 /*
 **********************************END********************************/
 
@@ -212,11 +239,15 @@ void PrintProcess(int done, int all) {
 bool RecvPacket(uchar* pData, int validDataSize) {
   if (g_as608.packet_size <= 0)
     return false;
+  if (g_as608.packet_size > MAX_PACKET_SIZE) {
+    g_error_code = 0xC5;
+    return false;
+  }
   int realPacketSize = 11 + g_as608.packet_size; // 实际每个数据包的大小
   int realDataSize = validDataSize * realPacketSize / g_as608.packet_size;  // 总共需要接受的数据大小
 
   uchar readBufTmp[8] = { 0 };  // 每次read至多8个字节，追加到readBuf中
-  uchar* readBuf = (uchar*)malloc(realPacketSize); // 收满realPacketSize字节，说明收到了一个完整的数据包，追加到pData中
+  uchar* readBuf = g_packet; // 收满realPacketSize字节，说明收到了一个完整的数据包，追加到pData中
 
   int availSize      = 0;
   int readSize       = 0;
@@ -261,7 +292,6 @@ bool RecvPacket(uchar* pData, int validDataSize) {
         int count_ = 0;
         Merge(&count_, readBuf+realPacketSize-2, 2);
         if (Calibrate(readBuf, realPacketSize) != count_) {
-          free(readBuf);
           g_error_code = 0x01;
           return false;
         }
@@ -278,7 +308,6 @@ bool RecvPacket(uchar* pData, int validDataSize) {
 
       // 接受到 validDataSize 个字节的有效数据，但仍未收到结束包，
       if (readCount >= realDataSize) {
-        free(readBuf);
         g_error_code = 0xC4;
         return false;
       }
@@ -291,8 +320,6 @@ bool RecvPacket(uchar* pData, int validDataSize) {
     }
   } // end while
 
-  free(readBuf);
-
   // 最大阻塞时间内未接受到指定大小的数据，返回false
   if (readCount < realDataSize) {
     g_error_code = 0xC3;
@@ -313,6 +340,10 @@ bool RecvPacket(uchar* pData, int validDataSize) {
 bool SendPacket(uchar* pData, int validDataSize) {
   if (g_as608.packet_size <= 0)
     return false;
+  if (g_as608.packet_size > MAX_PACKET_SIZE) {
+    g_error_code = 0xC5;
+    return false;
+  }
   if (validDataSize % g_as608.packet_size != 0) {
     g_error_code = 0xC8;
     return false;
@@ -321,7 +352,7 @@ bool SendPacket(uchar* pData, int validDataSize) {
   int realDataSize = validDataSize * realPacketSize / g_as608.packet_size;  // 总共需要发送的数据大小
 
   // 构造数据包
-  uchar* writeBuf = (uchar*)malloc(realPacketSize);
+  uchar* writeBuf = g_packet;
   writeBuf[0] = 0xef;  // 包头
   writeBuf[1] = 0x01;  // 包头
   Split(g_as608.chip_addr, writeBuf+2, 4);  // 芯片地址
@@ -367,7 +398,6 @@ bool SendPacket(uchar* pData, int validDataSize) {
       break;
   } // end while
 
-  free(writeBuf);
   g_error_code = 0x00;
   return true; 
 }
@@ -462,6 +492,124 @@ int GenOrder(uchar orderCode, const char* fmt, ...) {
   } // end else (count != 0)
 }
 
+/*
+ * 辅助函数
+ * 更新索引表缓存中 [startPageID, startPageID+count) 的状态
+*/
+void MarkIndex(int startPageID, int count, bool used) {
+  if (!g_index_valid)
+    return;
+  for (int page = startPageID; page < startPageID + count && page < 512; ++page) {
+    if (page < 0)
+      continue;
+    if (used)
+      g_index_bits[page / 64] |= 1ULL << (page % 64);
+    else
+      g_index_bits[page / 64] &= ~(1ULL << (page % 64));
+  }
+}
+
+/*
+ * 辅助函数
+ * 索引表缓存无效时，从模块读取
+*/
+bool LoadIndex() {
+  if (g_index_valid)
+    return true;
+  uchar bitmap[64];
+  return PS_ReadIndexBitmap(bitmap, 64);
+}
+
+/*
+ * 辅助函数
+ * 在 [from, to) 中查找第一个状态为used的页，没有则返回-1
+*/
+int FindIndex(int from, int to, bool used) {
+  if (from < 0)
+    from = 0;
+  if (to > 512)
+    to = 512;
+  while (from < to) {
+    unsigned long long word = g_index_bits[from / 64];
+    if (!used)
+      word = ~word;
+    word &= ~0ULL << (from % 64);   // 忽略from之前的位
+    if (word) {
+      int page = from / 64 * 64 + __builtin_ctzll(word);
+      return page < to ? page : -1;
+    }
+    from = (from / 64 + 1) * 64;
+  }
+  return -1;
+}
+
+/*
+ * 辅助函数
+ * 在模板缓存中查找当前设备的第pageID页，没有则返回-1
+*/
+int FindTemplate(int pageID) {
+  if (!g_tcache)
+    return -1;
+  for (int i = 0; i < g_tcache_size; ++i) {
+    TemplateCacheEntry* e = &g_tcache[i];
+    if (e->lastUse != 0 && e->page == pageID && e->fd == g_fd && e->addr == g_as608.chip_addr)
+      return i;
+  }
+  return -1;
+}
+
+/*
+ * 辅助函数
+ * 缓存当前设备第pageID页的模板，没有空闲位置时替换最久未用的
+*/
+void CacheTemplate(int pageID, const uchar* pData) {
+  if (g_tcache_size == 0)
+    return;
+  if (!g_tcache) {
+    g_tcache = (TemplateCacheEntry*)calloc(g_tcache_size, sizeof(TemplateCacheEntry));
+    if (!g_tcache)
+      return;
+  }
+
+  int victim = 0;
+  for (int i = 0; i < g_tcache_size; ++i) {
+    if (g_tcache[i].lastUse == 0) {
+      victim = i;
+      break;
+    }
+    if (g_tcache[i].lastUse < g_tcache[victim].lastUse)
+      victim = i;
+  }
+  TemplateCacheEntry* e = &g_tcache[victim];
+  if (e->lastUse != 0)
+    g_tcache_stats.evictions++;
+  else
+    g_tcache_stats.count++;
+  e->fd = g_fd;
+  e->addr = g_as608.chip_addr;
+  e->page = pageID;
+  e->lastUse = ++g_tcache_clock;
+  memcpy(e->data, pData, 768);
+}
+
+/*
+ * 辅助函数
+ * 丢弃模板缓存中当前设备 [startPageID, startPageID+count) 的模板
+*/
+void DropTemplates(int startPageID, int count) {
+  if (!g_tcache)
+    return;
+  for (int i = 0; i < g_tcache_size; ++i) {
+    TemplateCacheEntry* e = &g_tcache[i];
+    if (e->lastUse != 0 && e->page >= startPageID && e->page < startPageID + count &&
+        e->fd == g_fd && e->addr == g_as608.chip_addr) {
+      e->lastUse = 0;
+      g_tcache_stats.count--;
+      g_tcache_stats.invalidations++;
+    }
+  }
+}
+
 /***************************************************************************
  *
  * 第二部分：
@@ -477,6 +625,7 @@ int GenOrder(uchar orderCode, const char* fmt, ...) {
 bool PS_Setup(uint chipAddr, uint password) {
   g_as608.chip_addr = chipAddr;
   g_as608.password  = password;
+  g_index_valid = false;
 
   if (g_verbose == 1)
     printf("-------------------------Initializing-------------------------\n");
@@ -499,6 +648,24 @@ bool PS_Setup(uint chipAddr, uint password) {
   return false;
 }
 
+/*
+ * 使用已写入 g_as608 的参数初始化(如主机缓存的参数)，不读取系统参数
+ *   有密码时仍需验证密码(模块重新上电后必须重新验证)
+*/
+bool PS_SetupCached(uint chipAddr, uint password) {
+  g_as608.chip_addr = chipAddr;
+  g_as608.password  = password;
+  g_index_valid = false;
+
+  if (g_as608.packet_size == 0) {
+    g_error_code = 0xC7;
+    return false;
+  }
+  if (g_as608.has_password)
+    return PS_VfyPwd(password);
+  return true;
+}
+
 /*
  * 函数名：PS_GetImage
  * 功能说明：探测手指，探测到后录入指纹图像存于ImgageBuffer。返回确认码表示：录入成功、无手指等。
@@ -629,12 +796,16 @@ bool PS_RegModel() {
  *   确认码=18H 表示写 FLASH 出错；
 */
 bool PS_StoreChar(uchar bufferID, int pageID) {
+  DropTemplates(pageID, 1);   // 写入失败时该页的内容也不确定
   int size = GenOrder(0x06, "%d%2d", bufferID, pageID);
   SendOrder(g_order, size);
 
   // 接收应答包，核对确认码和检校和
-  return (RecvReply(g_reply, 12) && 
-        Check(g_reply, 12));
+  if (!(RecvReply(g_reply, 12) && Check(g_reply, 12)))
+    return false;
+
+  MarkIndex(pageID, 1, true);
+  return true;
 }
 
 
@@ -667,17 +838,9 @@ bool PS_LoadChar(uchar bufferID, int pageID) {
  *   确认码=0dH 表示指令执行失败；
 */
 bool PS_UpChar(uchar bufferID, const char* filename) {
-  int size = GenOrder(0x08, "%d", bufferID);
-  SendOrder(g_order, size);
-
-  // 接收应答包，核对确认码和检校和
-  if (!(RecvReply(g_reply, 12) && Check(g_reply, 12))) {
-    return false;
-  }
-
   // 接收数据包，将有效数据存储到 pData 中
   uchar pData[768] = { 0 };
-  if (!RecvPacket(pData, 768)) {
+  if (!PS_UpCharToBuf(bufferID, pData, 768)) {
     return false;
   }
 
@@ -694,6 +857,58 @@ bool PS_UpChar(uchar bufferID, const char* filename) {
   return true;
 }
 
+/*
+ * 函数名称：PS_UpCharToBuf
+ * 说明：同 PS_UpChar，但特征文件保存到内存 pData 中，而不是写入本地文件
+ * 参数：bufferID(缓冲区号)，pData(存放特征文件)，size(pData大小，>=768)
+ * 返回值 ：true(成功)，false(出现错误)，确认码赋值给g_error_code
+*/
+bool PS_UpCharToBuf(uchar bufferID, uchar* pData, int size/*>=768*/) {
+  if (size < 768) {
+    g_error_code = 0xC1;
+    return false;
+  }
+
+  int orderSize = GenOrder(0x08, "%d", bufferID);
+  SendOrder(g_order, orderSize);
+
+  // 接收应答包，核对确认码和检校和
+  if (!(RecvReply(g_reply, 12) && Check(g_reply, 12))) {
+    return false;
+  }
+
+  // 接收数据包，将有效数据存储到 pData 中
+  return RecvPacket(pData, 768);
+}
+
+/*
+ * 函数名称：PS_LoadCharToBuf
+ * 说明：读取指纹库第 pageID 页的模板到内存 pData，即 PS_LoadChar + PS_UpCharToBuf
+ *   模板缓存中有该页时直接复制，不与模块通信，此时 CharBuffer 的内容不变
+ * 参数：bufferID(未命中时使用的缓冲区号)，pageID，pData(存放模板)，size(pData大小，>=768)
+ * 返回值 ：true(成功)，false(出现错误)，确认码赋值给g_error_code
+*/
+bool PS_LoadCharToBuf(uchar bufferID, int pageID, uchar* pData, int size/*>=768*/) {
+  if (size < 768) {
+    g_error_code = 0xC1;
+    return false;
+  }
+
+  int i = FindTemplate(pageID);
+  if (i != -1) {
+    g_tcache[i].lastUse = ++g_tcache_clock;
+    memcpy(pData, g_tcache[i].data, 768);
+    g_tcache_stats.hits++;
+    return true;
+  }
+
+  g_tcache_stats.misses++;
+  if (!(PS_LoadChar(bufferID, pageID) && PS_UpCharToBuf(bufferID, pData, size)))
+    return false;
+  CacheTemplate(pageID, pData);
+  return true;
+}
+
 
 /*
  * 函数名称：PS_DownChar
@@ -704,14 +919,6 @@ bool PS_UpChar(uchar bufferID, const char* filename) {
  *   确认码=0eH 表示不能接收后续数据包；
 */
 bool PS_DownChar(uchar bufferID, const char* filename) {
-  // 发送指令
-  int size = GenOrder(0x09, "%d", bufferID);
-  SendOrder(g_order, size);
-
-  // 接收应答包，如果确认码为0x00，说明可以发送后续数据包
-  if ( !(RecvReply(g_reply, 12) && Check(g_reply, 12)) )
-    return false;
-
   // 打开本地文件
   FILE* fp = fopen(filename, "rb");
   if (!fp) {
@@ -736,8 +943,31 @@ bool PS_DownChar(uchar bufferID, const char* filename) {
 
   fclose(fp);
 
+  return PS_DownCharFromBuf(bufferID, charBuf, 768);
+}
+
+/*
+ * 函数名称：PS_DownCharFromBuf
+ * 说明：同 PS_DownChar，但特征文件来自内存 pData，而不是本地文件
+ * 参数：bufferID(缓冲区号)，pData(特征文件)，size(必须为768)
+ * 返回值 ：true(成功)，false(出现错误)，确认码赋值给g_error_code
+*/
+bool PS_DownCharFromBuf(uchar bufferID, const uchar* pData, int size/*==768*/) {
+  if (size != 768) {
+    g_error_code = 0x09;
+    return false;
+  }
+
+  // 发送指令
+  int orderSize = GenOrder(0x09, "%d", bufferID);
+  SendOrder(g_order, orderSize);
+
+  // 接收应答包，如果确认码为0x00，说明可以发送后续数据包
+  if ( !(RecvReply(g_reply, 12) && Check(g_reply, 12)) )
+    return false;
+
   // 发送数据包
-  return SendPacket(charBuf, 768);
+  return SendPacket((uchar*)pData, 768);
 }
 
 
@@ -751,22 +981,11 @@ bool PS_DownChar(uchar bufferID, const char* filename) {
  *  确认码=0fH 表示不能发送后续数据包；
 */
 bool PS_UpImage(const char* filename) {
-  int size = GenOrder(0x0a, "");
-  SendOrder(g_order, size);
-
-  // 接收应答包，核对确认码和检校和
-  if (!(RecvReply(g_reply, 12) && Check(g_reply, 12))) {
+  // 图像尺寸 256*288 = 73728，每个像素一个字节
+  if (!PS_UpImageToBuf(g_image, 73728))
     return false;
-  }
 
-  // 接收数据包，将有效数据存储到 pData 中
-  // 图像尺寸 128*288 = 36864
-  uchar* pData = (uchar*)malloc(36864);
-  if (!RecvPacket(pData, 36864)) {
-    return false;
-  }
-
-  // 将pData写入文件中
+  // 将图像写入文件中
   FILE* fp = fopen(filename, "w+");
   if (!fp) {
     g_error_code = 0xC2;
@@ -790,21 +1009,48 @@ bool PS_UpImage(const char* filename) {
   fwrite(palette, 1, 1024, fp);
 
   // bmp像素数据
-  uchar* pBody = (uchar*)malloc(73728);
-  for (int i = 0; i < 73728; i += 2) {
-    pBody[i] = pData[i/2] & 0xf0;  
+  fwrite(g_image, 1, 73728, fp);
+
+  fclose(fp);
+
+  return true; 
+}
+
+/*
+ * 函数名称：PS_UpImageToBuf
+ * 说明：同 PS_UpImage，但图像保存到内存 pImage 中，而不是写入bmp文件
+ *   图像 256*288，每个像素一个字节(模块只有高4位有效)，按模块发送的行顺序存放
+ * 参数：pImage(存放图像)，size(pImage大小，>=73728)
+ * 返回值 ：true(成功)，false(出现错误)，确认码赋值给g_error_code
+*/
+bool PS_UpImageToBuf(uchar* pImage, int size/*>=73728*/) {
+  if (size < 73728) {
+    g_error_code = 0xC1;
+    return false;
   }
-  for (int i = 1; i < 73728; i += 2) {
-    pBody[i] = (pData[i/2] & 0x0f) << 4;
+
+  int orderSize = GenOrder(0x0a, "");
+  SendOrder(g_order, orderSize);
+
+  // 接收应答包，核对确认码和检校和
+  if (!(RecvReply(g_reply, 12) && Check(g_reply, 12))) {
+    return false;
   }
 
-  fwrite(pBody, 1, 73728, fp);
+  // 接收数据包，每个字节两个像素，先存放到 pImage 的后半部分
+  uchar* pData = pImage + 36864;
+  if (!RecvPacket(pData, 36864)) {
+    return false;
+  }
 
-  free(pBody);
-  free(pData);
-  fclose(fp);
+  // 从前往后展开，写入的位置不会超过尚未读取的字节
+  for (int i = 0; i < 36864; ++i) {
+    uchar byte = pData[i];
+    pImage[2*i]   = byte & 0xf0;
+    pImage[2*i+1] = (byte & 0x0f) << 4;
+  }
 
-  return true; 
+  return true;
 }
 
 
@@ -818,57 +1064,40 @@ bool PS_UpImage(const char* filename) {
  *   确认码=0eH 表示不能接收后续数据包；
 */
 bool PS_DownImage(const char* filename) {
-  int size = GenOrder(0x0b, "");
-  SendOrder(g_order, size);
-
-  if (!RecvReply(g_reply, 12) && Check(g_reply, 12))
-    return false;
-
-  // 指纹图像文件大小 748069 bytes
-  uchar imageBuf[74806] = { 0 };
-
+  // 先检查文件，再发送指令(发送指令后模块等待数据包)
   FILE* fp = fopen(filename, "rb");
   if (!fp) {
     g_error_code = 0xC2;
     return false;
   }
 
-  // 获取图像文件大小
+  // 获取图像文件大小，指纹图像文件大小 74806 bytes
   int imageSize = 0;
   fseek(fp, 0, SEEK_END);
   imageSize = ftell(fp);
-  rewind(fp);
   if (imageSize != 74806) { // 指纹图像大小 必须为74806kb
     g_error_code = 0xC9;
     fclose(fp);
     return false;
   }
 
-  // 读文件
-  if (fread(imageBuf, 1, 74806, fp) != 74806) {
+  // 跳过bmp头和调色板，偏移量54+1024=1078，像素数据大小128*256*2=73728
+  fseek(fp, 1078, SEEK_SET);
+  if (fread(g_image, 1, 73728, fp) != 73728) {
     g_error_code = 0xCA;
     fclose(fp);
     return false;
   }
   fclose(fp);
 
-  //FILE* fpx = fopen("temp.bmp", "wb");
-  //if (!fpx) {
-  //  printf("Error\n");
-  //  return false;
-  //}
-  //fwrite(imageBuf, 1, 74806, fpx);
-  //fclose(fpx);
-  //return true;
+  int size = GenOrder(0x0b, "");
+  SendOrder(g_order, size);
 
-  //uchar dataBuf[128*288] = { 0 };
-  //for (uint i = 0, size=128*288; i < size; ++i) {
-  //  dataBuf[i] = imageBuf[1078 + i*2] + (imageBuf[1078 + i*2 + 1] >> 4);
-  //}
+  if (!(RecvReply(g_reply, 12) && Check(g_reply, 12)))
+    return false;
 
-  // 发送图像的像素数据，偏移量54+1024=1078，大小128*256*2=73728
-  //return SendPacket(dataBuf, 128*288);
-  return SendPacket(imageBuf+1078, 73728);
+  // 发送图像的像素数据
+  return SendPacket(g_image, 73728);
 }
 
 
@@ -882,12 +1111,16 @@ bool PS_DownImage(const char* filename) {
  *   确认码=10H 表示删除模板失败；
 */
 bool PS_DeleteChar(int startPageID, int count) {
+  DropTemplates(startPageID, count);
   int size = GenOrder(0x0c, "%2d%2d", startPageID, count);
   SendOrder(g_order, size);
 
   // 接收数据，核对确认码和检校和
-  return (RecvReply(g_reply, 12) &&
-         Check(g_reply, 12));
+  if (!(RecvReply(g_reply, 12) && Check(g_reply, 12)))
+    return false;
+
+  MarkIndex(startPageID, count, false);
+  return true;
 }
 
 /*
@@ -900,11 +1133,16 @@ bool PS_DeleteChar(int startPageID, int count) {
  *   确认码=11H 表示清空失败；
 */
 bool PS_Empty() {
+  DropTemplates(0, 512);
   int size = GenOrder(0x0d, "");
   SendOrder(g_order, size);
 
   // 接收数据，核对确认码和检校和
-  return (RecvReply(g_reply, 12) && Check(g_reply, 12));
+  if (!(RecvReply(g_reply, 12) && Check(g_reply, 12)))
+    return false;
+
+  MarkIndex(0, 512, false);
+  return true;
 }
 
 /*
@@ -969,10 +1207,14 @@ bool PS_Enroll(int* pPageID) {
   SendOrder(g_order, size);
 
   // 接收数据，核对确认码和检校和
-  return (RecvReply(g_reply, 14) &&
-          Check(g_reply, 14) &&
-          Merge(pPageID, g_reply+10, 2)
-         );
+  if (!(RecvReply(g_reply, 14) &&
+        Check(g_reply, 14) &&
+        Merge(pPageID, g_reply+10, 2)))
+    return false;
+
+  MarkIndex(*pPageID, 1, true);
+  DropTemplates(*pPageID, 1);
+  return true;
 }
 
 /*
@@ -991,11 +1233,15 @@ bool PS_Identify(int* pPageID, int* pScore) {
   SendOrder(g_order, size);
 
   // 接收数据，核对确认码和检校和
-  return (RecvReply(g_reply, 16) &&
-          Check(g_reply, 16) &&
-          Merge(pPageID, g_reply+10, 2) &&
-          Merge(pScore,  g_reply+12, 2)
-         );
+  if (!(RecvReply(g_reply, 16) &&
+        Check(g_reply, 16) &&
+        Merge(pPageID, g_reply+10, 2) &&
+        Merge(pScore,  g_reply+12, 2)))
+    return false;
+
+  // 模块可能用本次采集的特征更新了搜索到的模板
+  DropTemplates(*pPageID, 1);
+  return true;
 }
 
 /*
@@ -1073,7 +1319,9 @@ bool PS_SetChipAddr(uint addr) {
   // 接收数据，核对确认码和检校和
   return (RecvReply(g_reply, 12) && 
           Check(g_reply, 12) && 
-          ((g_as608.chip_addr = addr) || true)); // 防止addr=0x00
+          (DropTemplates(0, 512), true) &&
+          ((g_as608.chip_addr = addr) || true) && // 防止addr=0x00
+          ((g_index_valid = false) || true));     // 换了设备，索引表缓存失效
 }
 
 /*
@@ -1120,14 +1368,16 @@ bool PS_ReadINFpage(uchar* pInfo, int pInfoSize/*>=512*/) {
  *   确认码=00H 表示 OK；
  *   确认码=01H 表示收包有错；
 */
-bool PS_WriteNotepad(int notePageID, uchar* pContent, int contentSize) {
+bool PS_WriteNotepad(int notePageID, const uchar* pContent, int contentSize) {
   if (contentSize > 32) {
     g_error_code = 0xC6;
     return false;
   }
 
-  pContent[32] = 0; // 字符串结束符
-  int size = GenOrder(0x18, "%d%32s", notePageID, pContent);
+  // 不足32字节的部分补0
+  uchar page[32] = { 0 };
+  memcpy(page, pContent, contentSize);
+  int size = GenOrder(0x18, "%d%32s", notePageID, page);
   SendOrder(g_order, size);
 
   return (RecvReply(g_reply, 12) && Check(g_reply, 12));
@@ -1206,7 +1456,7 @@ bool PS_ValidTempleteNum(int* pValidN) {
 /*
  * 函数名称：PS_ReadIndexTable
  * 说明：读取录入模版的索引表。
- * 参数：
+ * 参数：indexList(存放已录入模板的页码，升序，其余元素为-1)，size(数组大小)
  * 返回值 ：true(成功)，false(出现错误)，确认码赋值给g_error_code
  *   确认码=00H 表示 OK；
  *   确认码=01H 表示收包有错；
@@ -1216,32 +1466,53 @@ bool PS_ReadIndexTable(int* indexList, int size) {
   for (int i = 0; i < size; ++i)
     indexList[i] = -1;
 
+  uchar bitmap[64];
+  if (!PS_ReadIndexBitmap(bitmap, 64))
+    return false;
+
   int nIndex = 0;
+  for (int page = FindIndex(0, 512, true); page != -1; page = FindIndex(page + 1, 512, true)) {
+    if (nIndex >= size) {
+      g_error_code = 0xC1;    // 数组太小
+      return false;
+    }
+    indexList[nIndex++] = page;
+  }
+
+  return true;
+}
+
+/*
+ * 函数名称：PS_ReadIndexBitmap
+ * 说明：读取录入模版的索引表，以位图的形式返回，并刷新索引表缓存
+ * 参数：bitmap(第i字节的第j位为1，表示第 8*i+j 页已录入模板)，size(>=64)
+ * 返回值 ：true(成功)，false(出现错误)，确认码赋值给g_error_code
+*/
+bool PS_ReadIndexBitmap(uchar* bitmap, int size/*>=64*/) {
+  if (size < 64) {
+    g_error_code = 0xC1;
+    return false;
+  }
 
   for (int page = 0; page < 2; ++page) {
     // 发送数据（两次，每页256个指纹模板，需要请求两页），
-    int size = GenOrder(0x1f, "%d", page);
-    SendOrder(g_order, size);
+    int orderSize = GenOrder(0x1f, "%d", page);
+    SendOrder(g_order, orderSize);
 
     // 接收数据，核对确认码和检校和
     if (!(RecvReply(g_reply, 44) && Check(g_reply, 44)))
       return false;
 
-    for (int i = 0; i < 32; ++i) {
-      for (int j = 0; j < 8; ++j) {
-        if ( ( (g_reply[10+i] & (0x01 << j) ) >> j) == 1 ) {
-          if (nIndex > size) {
-            g_error_code = 0xC1;    // 数组太小
-            return false;
-          }
-          indexList[nIndex++] = page*256 + 8 * i + j;
-        } // end if
-
-      } // end internel for
-
-    } // end middle for
+    memcpy(bitmap + 32*page, g_reply+10, 32);
+  }
 
-  }// end outer for
+  // 刷新缓存，按小端序把字节合并为64位整数
+  for (int w = 0; w < 8; ++w) {
+    g_index_bits[w] = 0;
+    for (int i = 0; i < 8; ++i)
+      g_index_bits[w] |= (unsigned long long)bitmap[8*w + i] << (8*i);
+  }
+  g_index_valid = true;
 
   return true;
 }
@@ -1257,6 +1528,8 @@ bool PS_ReadIndexTable(int* indexList, int size) {
 // 如果status为HEGH，则模块上有指纹时返回true，没指纹时返回false
 // 如果status为LOW， 则模块上有指纹时返回false，没指纹时返回true
 bool PS_DetectFinger() {
+  if (g_detect_finger)
+    return g_detect_finger();
   return digitalRead(g_as608.detect_pin) == HIGH;
 }
 
@@ -1313,6 +1586,261 @@ bool PS_Flush() {
   return false;
 }
 
+/*
+ * 获取索引表缓存(位图格式同 PS_ReadIndexBitmap)，缓存无效时从模块读取
+*/
+bool PS_GetIndexBitmap(uchar* bitmap, int size/*>=64*/) {
+  if (size < 64) {
+    g_error_code = 0xC1;
+    return false;
+  }
+  if (!LoadIndex())
+    return false;
+
+  for (int i = 0; i < 64; ++i)
+    bitmap[i] = (g_index_bits[i / 8] >> (8 * (i % 8))) & 0xff;
+  return true;
+}
+
+/*
+ * 丢弃索引表缓存，下次使用时重新从模块读取
+ * 绕过本库修改了指纹库时(如其他程序)，需调用此函数
+*/
+void PS_InvalidateIndex() {
+  g_index_valid = false;
+}
+
+/*
+ * 丢弃模板缓存中当前设备 [startPageID, startPageID+count) 的模板
+ * 绕过本库写入模板时(如直接发送编码好的 StoreChar 指令包)，需调用此函数
+*/
+void PS_InvalidateTemplates(int startPageID, int count) {
+  DropTemplates(startPageID, count);
+}
+
+/*
+ * 设置模板缓存的容量(模板个数，每个约780字节)，0表示不缓存
+ *   已缓存的模板全部丢弃，统计数据保留
+*/
+bool PS_SetTemplateCacheSize(int size) {
+  if (size < 0 || size > PS_TCACHE_MAX_SIZE) {
+    g_error_code = 0xC1;
+    return false;
+  }
+  free(g_tcache);
+  g_tcache = NULL;
+  g_tcache_size = size;
+  g_tcache_stats.count = 0;
+  return true;
+}
+
+void PS_GetTemplateCacheStats(TemplateCacheStats* stats) {
+  *stats = g_tcache_stats;
+  stats->size = g_tcache_size;
+}
+
+// 第pageID页是否已录入模板
+bool PS_IsPageUsed(int pageID) {
+  if (pageID < 0 || pageID >= 512 || !LoadIndex())
+    return false;
+  return (g_index_bits[pageID / 64] >> (pageID % 64)) & 1;
+}
+
+// [startPageID, startPageID+count) 中已录入的模板个数，出错返回-1
+int PS_CountUsed(int startPageID, int count) {
+  if (!LoadIndex())
+    return -1;
+  int end = startPageID + count;
+  if (startPageID < 0)
+    startPageID = 0;
+  if (end > 512)
+    end = 512;
+
+  int n = 0;
+  for (int w = startPageID / 64; w * 64 < end; ++w) {
+    unsigned long long word = g_index_bits[w];
+    if (w == startPageID / 64)
+      word &= ~0ULL << (startPageID % 64);
+    if ((w + 1) * 64 > end)
+      word &= ~(~0ULL << (end % 64));
+    n += __builtin_popcountll(word);
+  }
+  return n;
+}
+
+// 从fromPageID开始(包括)，下一个已录入模板的页，没有返回-1
+int PS_NextUsedPage(int fromPageID) {
+  if (!LoadIndex())
+    return -1;
+  return FindIndex(fromPageID, g_as608.capacity, true);
+}
+
+// 从fromPageID开始(包括)，下一个空页，没有返回-1
+int PS_NextFreePage(int fromPageID) {
+  if (!LoadIndex())
+    return -1;
+  return FindIndex(fromPageID, g_as608.capacity, false);
+}
+
+/*
+ * 分配一个空页(页码最小的)
+ * 并不写入模块，需随后调用 PS_StoreChar
+*/
+bool PS_AllocFreePage(int* pPageID) {
+  if (!LoadIndex())
+    return false;
+  *pPageID = FindIndex(0, g_as608.capacity, false);
+  if (*pPageID == -1) {
+    g_error_code = 0xFF;  // 指纹库已满
+    return false;
+  }
+  return true;
+}
+
+/*
+ * 生成搜索计划：把已录入模板的页划分为若干段，按命中可能性从高到低排列
+ * 参数：ranges(存放结果)，maxRanges(最多分为几段)
+ *      weights(每一页的权重，如历史命中次数，为NULL时每个模板权重相同)
+ * 返回值：段数，出错返回-1
+ * 说明：
+ *   每多一段就多一次指令往返，所以间隔不超过 PS_SEARCH_MAX_GAP 的段会合并，
+ *   段数超过maxRanges时，优先合并间隔最小的相邻段。
+*/
+#define PS_SEARCH_MAX_GAP 16
+
+int PS_PlanSearch(PageRange* ranges, int maxRanges, const uint* weights) {
+  if (maxRanges <= 0 || !LoadIndex())
+    return -1;
+
+  // 1.连续的已占用页为一段，间隔较小的合并
+  PageRange runs[256];
+  int n = 0;
+  for (int page = PS_NextUsedPage(0); page != -1; ) {
+    int end = PS_NextFreePage(page);
+    if (end == -1)
+      end = g_as608.capacity;
+    if (n > 0 && page - (runs[n-1].start + runs[n-1].count) <= PS_SEARCH_MAX_GAP) {
+      runs[n-1].count = end - runs[n-1].start;
+    }
+    else {
+      runs[n].start = page;
+      runs[n].count = end - page;
+      n++;
+    }
+    page = PS_NextUsedPage(end);
+  }
+
+  // 2.段数太多时，合并间隔最小的相邻段
+  while (n > maxRanges) {
+    int best = 0;
+    for (int i = 1; i < n - 1; ++i) {
+      int gap  = runs[i+1].start - (runs[i].start + runs[i].count);
+      int gap0 = runs[best+1].start - (runs[best].start + runs[best].count);
+      if (gap < gap0)
+        best = i;
+    }
+    runs[best].count = runs[best+1].start + runs[best+1].count - runs[best].start;
+    memmove(runs + best + 1, runs + best + 2, sizeof(PageRange) * (n - best - 2));
+    n--;
+  }
+
+  // 3.按权重排序，权重相同时页数少的在前(搜索更快)
+  double score[256];
+  for (int i = 0; i < n; ++i) {
+    runs[i].used = PS_CountUsed(runs[i].start, runs[i].count);
+    double weight = 0;
+    for (int page = runs[i].start; page < runs[i].start + runs[i].count; ++page) {
+      if (PS_IsPageUsed(page))
+        weight += weights ? weights[page] + 1 : 1;
+    }
+    // 单位页数的权重作为次要排序条件
+    score[i] = weight + weight / runs[i].count / (g_as608.capacity + 1);
+  }
+  for (int i = 1; i < n; ++i) {
+    PageRange r = runs[i];
+    double s = score[i];
+    int j = i - 1;
+    while (j >= 0 && score[j] < s) {
+      runs[j+1] = runs[j];
+      score[j+1] = score[j];
+      j--;
+    }
+    runs[j+1] = r;
+    score[j+1] = s;
+  }
+
+  memcpy(ranges, runs, sizeof(PageRange) * n);
+  return n;
+}
+
+/*
+ * 按搜索计划依次搜索各段，直到搜索到为止
+ * 参数：highSpeed(为true时使用 PS_HighSpeedSearch，否则使用 PS_Search)
+ *      weights(同 PS_PlanSearch)
+ * 返回值 ：true(搜索到)，false(没搜索到或出现错误)，确认码赋值给g_error_code
+ *   指纹库为空时不发送任何指令，确认码为09H
+*/
+bool PS_SearchPlanned(uchar bufferID, bool highSpeed, const uint* weights, int* pPageID, int* pScore) {
+  PageRange ranges[8];
+  int n = PS_PlanSearch(ranges, 8, weights);
+  if (n < 0)
+    return false;
+
+  for (int i = 0; i < n; ++i) {
+    bool found = highSpeed ?
+      PS_HighSpeedSearch(bufferID, ranges[i].start, ranges[i].count, pPageID, pScore) :
+      PS_Search(bufferID, ranges[i].start, ranges[i].count, pPageID, pScore);
+    if (found)
+      return true;
+    if (g_error_code != 0x09)
+      return false;
+  }
+
+  *pPageID = 0;
+  *pScore  = 0;
+  g_error_code = 0x09;
+  return false;
+}
+
+/*
+ * 编码一个指令包到 order 中(不使用 g_order，可以在任意线程中调用)
+ * 参数：order(>=12+paramSize 字节)  params, paramSize(指令的参数，已按大端拆分)
+ * 返回值：指令包长度
+*/
+int PS_EncodeOrder(uchar* order, uint chipAddr, uchar orderCode, const uchar* params, int paramSize) {
+  order[0] = 0xef;
+  order[1] = 0x01;
+  Split(chipAddr, order+2, 4);
+  order[6] = 0x01;
+  Split(paramSize + 3, order+7, 2);   // 包长度：指令1字节 + 参数 + 检校和2字节
+  order[9] = orderCode;
+  if (paramSize > 0)
+    memcpy(order+10, params, paramSize);
+  int size = 12 + paramSize;
+  Split(Calibrate(order, size), order+size-2, 2);
+  return size;
+}
+
+/*
+ * 发送预先编码的指令包，接收 replySize 字节的应答包
+ *   只检查检校和，不检查确认码，确认码为 reply[9](同时赋值给g_error_code)
+ *   串口同一时刻只能由一个线程使用
+ * 返回值：true(收到检校和正确的应答包)
+*/
+bool PS_Transact(const uchar* order, int orderSize, uchar* reply, int replySize) {
+  SendOrder(order, orderSize);
+  if (!RecvReply(reply, replySize))
+    return false;
+
+  uint sum = 0;
+  Merge(&sum, reply+replySize-2, 2);
+  if ((int)sum != Calibrate(reply, replySize)) {
+    g_error_code = 0x01;
+    return false;
+  }
+  return true;
+}
+
 /*
  * 获取错误码的描述
  * 赋值给全局变量 g_error_desc, 并返回 g_error_desc
@@ -1370,6 +1898,10 @@ char* PS_GetErrorDesc() {
   case 0xC8: strcpy(g_error_desc, "The size of the data to send must be an integral multiple of the g_as608.packet_size"); break;
   case 0xC9: strcpy(g_error_desc, "The size of the fingerprint image is not 74806bytes(about73.1kb)");break;
   case 0xCA: strcpy(g_error_desc, "Error while reading local fingerprint imgae"); break;
+  case 0xCB: strcpy(g_error_desc, "The key-value store in notepad is corrupted"); break;
+  case 0xCC: strcpy(g_error_desc, "The key-value store in notepad is full"); break;
+  case 0xCD: strcpy(g_error_desc, "The database has changed since the plan was made"); break;
+  case 0xCE: strcpy(g_error_desc, "The fingerprint is already enrolled"); break;
   
   }
 
@@ -47,6 +47,23 @@ typedef struct AS608_Module_Info {
   uint has_password;    // 是否有密码
 } AS608;
 
+// 指纹库中连续的一段页
+typedef struct AS608_Page_Range {
+  int start;    // 起始页码
+  int count;    // 页数
+  int used;     // 其中已录入模板的个数
+} PageRange;
+
+// 模板缓存的统计数据
+typedef struct AS608_Template_Cache_Stats {
+  int size;                  // 容量(模板个数)
+  int count;                 // 已缓存的模板个数
+  long long hits;
+  long long misses;
+  long long evictions;       // 因容量不足被替换的模板个数
+  long long invalidations;   // 因写入、删除而丢弃的模板个数
+} TemplateCacheStats;
+
 
 /*******************************BEGIN**********************************
  * 全局变量
@@ -56,6 +73,7 @@ extern int   g_fd;          // 文件描述符，即open()函数打开串口的
 extern int   g_verbose;     // 输出信息的详细程度
 extern char  g_error_desc[128]; // 错误代码的含义
 extern uchar g_error_code;      // 模块返回的确认码，如果函数返回值不为true，读取此变量
+extern bool (*g_detect_finger)(); // 检测手指的函数(如按边沿事件维护的电平)，为NULL时读取detect_pin
 /*
 **********************************END********************************/
 
@@ -65,6 +83,7 @@ extern "C" {
 #endif
 
 extern bool PS_Setup(uint chipAddr, uint password);       // 0x00000000 ~ 0xffffffff
+extern bool PS_SetupCached(uint chipAddr, uint password); // 参数已由调用者写入 g_as608
 
 extern bool PS_GetImage();
 extern bool PS_GenChar(uchar bufferID);
@@ -75,7 +94,11 @@ extern bool PS_StoreChar(uchar bufferID, int pageID);
 extern bool PS_LoadChar(uchar bufferID, int pageID);
 extern bool PS_UpChar(uchar bufferID, const char* filename);
 extern bool PS_DownChar(uchar bufferID, const char* filename);
+extern bool PS_UpCharToBuf(uchar bufferID, uchar* pData, int size/*>=768*/);
+extern bool PS_LoadCharToBuf(uchar bufferID, int pageID, uchar* pData, int size/*>=768*/); // 经过模板缓存
+extern bool PS_DownCharFromBuf(uchar bufferID, const uchar* pData, int size/*==768*/);
 extern bool PS_UpImage(const char* filename);
+extern bool PS_UpImageToBuf(uchar* pImage, int size/*>=73728*/);
 extern bool PS_DownImage(const char* filename);
 extern bool PS_DeleteChar(int startpageID, int count);
 extern bool PS_Empty();
@@ -88,11 +111,12 @@ extern bool PS_VfyPwd(uint passwd);   // 4字节无符号整数
 extern bool PS_GetRandomCode(uint* pRandom);
 extern bool PS_SetChipAddr(uint newAddr);
 extern bool PS_ReadINFpage(uchar* pInfo, int size/*>=512*/);
-extern bool PS_WriteNotepad(int notePageID, uchar* pContent, int contentSize);
+extern bool PS_WriteNotepad(int notePageID, const uchar* pContent, int contentSize);
 extern bool PS_ReadNotepad(int notePageID, uchar* pContent, int contentSize);
 extern bool PS_HighSpeedSearch(uchar bufferID, int startPageID, int count, int* pPageID, int* pScore);
 extern bool PS_ValidTempleteNum(int* pValidN);
 extern bool PS_ReadIndexTable(int* indexList, int size);
+extern bool PS_ReadIndexBitmap(uchar* bitmap, int size/*>=64*/);
 
 // 封装函数
 extern bool PS_DetectFinger();
@@ -102,6 +126,28 @@ extern bool PS_SetPacketSize(int size);
 extern bool PS_GetAllInfo();
 extern bool PS_Flush();
 
+// 索引表缓存(从模块读取一次，之后随存储、删除等指令同步更新)
+extern bool PS_GetIndexBitmap(uchar* bitmap, int size/*>=64*/);
+extern void PS_InvalidateIndex();
+extern bool PS_IsPageUsed(int pageID);
+extern int  PS_CountUsed(int startPageID, int count);
+extern int  PS_NextUsedPage(int fromPageID);
+extern int  PS_NextFreePage(int fromPageID);
+extern bool PS_AllocFreePage(int* pPageID);
+
+// 模板缓存(PS_LoadCharToBuf 读取的模板保存在内存中，写入、删除时自动失效)
+extern void PS_InvalidateTemplates(int startPageID, int count);
+extern bool PS_SetTemplateCacheSize(int size/*0~1024*/);
+extern void PS_GetTemplateCacheStats(TemplateCacheStats* stats);
+
+// 只搜索已录入模板的页
+extern int  PS_PlanSearch(PageRange* ranges, int maxRanges, const uint* weights);
+extern bool PS_SearchPlanned(uchar bufferID, bool highSpeed, const uint* weights, int* pPageID, int* pScore);
+
+// 预先编码指令包(线程安全)，由使用串口的线程发送并接收应答包
+extern int  PS_EncodeOrder(uchar* order, uint chipAddr, uchar orderCode, const uchar* params, int paramSize);
+extern bool PS_Transact(const uchar* order, int orderSize, uchar* reply, int replySize);
+
 // 获得错误代码g_error_code的含义，并赋值给g_error_desc
 extern char* PS_GetErrorDesc(); 
 
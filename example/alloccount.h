@@ -0,0 +1,38 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+
+#ifndef __ALLOCCOUNT_H__
+#define __ALLOCCOUNT_H__
+
+/*
+ * 堆分配计数，用于检查指令和传输路径不分配内存(allocbench)
+ *
+ * fp 链接时加 -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc，
+ *   本程序各目标文件中调用的 malloc/calloc/realloc 先经过这里计数，再交给C库。
+ *   C库内部的分配(如 fopen)不经过链接器替换，不计入。
+*/
+
+// 程序启动以来 malloc/calloc/realloc 的调用次数(所有线程)
+long long AllocCount_Get();
+
+#endif // __ALLOCCOUNT_H__
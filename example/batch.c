@@ -0,0 +1,312 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+
+#include "./batch.h"
+#include "./sync.h"
+#include "./utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// 分割参数，支持双引号
+static bool tokenize(BatchCommand* cmd, const char* str) {
+  strncpy(cmd->args, str, BATCH_MAX_LINE - 1);
+  cmd->args[BATCH_MAX_LINE - 1] = '\0';
+  cmd->argc = 0;
+  cmd->argv[cmd->argc++] = "fp";
+
+  char* p = cmd->args;
+  while (true) {
+    while (*p == ' ' || *p == '\t')
+      ++p;
+    if (*p == '\0')
+      break;
+    if (cmd->argc > BATCH_MAX_ARGS) {
+      printf("Line %d: too many arguments\n", cmd->line);
+      return false;
+    }
+
+    char* start = p;
+    char* out = p;
+    bool quoted = false;
+    while (*p && (quoted || (*p != ' ' && *p != '\t'))) {
+      if (*p == '"') {
+        quoted = !quoted;
+        ++p;
+      }
+      else {
+        *out++ = *p++;
+      }
+    }
+    if (quoted) {
+      printf("Line %d: unterminated quote\n", cmd->line);
+      return false;
+    }
+    bool end = (*p == '\0');
+    *out = '\0';
+    if (!end)
+      ++p;
+    cmd->argv[cmd->argc++] = start;
+  }
+
+  // 可以省略开头的 "fp"
+  if (cmd->argc > 1 && strcmp(cmd->argv[1], "fp") == 0) {
+    for (int i = 1; i < cmd->argc - 1; ++i)
+      cmd->argv[i] = cmd->argv[i + 1];
+    cmd->argc--;
+  }
+  cmd->argv[cmd->argc] = "-y";
+  cmd->argv[cmd->argc + 1] = NULL;
+  return true;
+}
+
+int Batch_Load(FILE* fp, BatchCommand** pCmds) {
+  int size = 64;
+  int n = 0;
+  BatchCommand* cmds = (BatchCommand*)malloc(size * sizeof(BatchCommand));
+  if (!cmds) {
+    printf("Out of memory\n");
+    return -1;
+  }
+
+  char line[BATCH_MAX_LINE + 2] = { 0 };
+  char text[BATCH_MAX_LINE + 2] = { 0 };
+  int lineNo = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    lineNo++;
+    int len = strlen(line);
+    trim(line, text);
+    if (strlen(text) >= BATCH_MAX_LINE || (len == sizeof(line) - 1 && line[len - 1] != '\n')) {
+      printf("Line %d: too long (max %d characters)\n", lineNo, BATCH_MAX_LINE - 1);
+      free(cmds);
+      return -1;
+    }
+    if (text[0] == '\0' || text[0] == '#')
+      continue;
+
+    if (n == size) {
+      size *= 2;
+      BatchCommand* p = (BatchCommand*)realloc(cmds, size * sizeof(BatchCommand));
+      if (!p) {
+        printf("Out of memory\n");
+        free(cmds);
+        return -1;
+      }
+      cmds = p;
+    }
+
+    BatchCommand* cmd = &cmds[n];
+    memset(cmd, 0, sizeof(BatchCommand));
+    cmd->line = lineNo;
+    cmd->mergedInto = -1;
+    cmd->skipAfter = -1;
+    strcpy(cmd->text, text);
+    if (!tokenize(cmd, text)) {
+      free(cmds);
+      return -1;
+    }
+    if (cmd->argc < 2)
+      continue;
+    if (strcmp(cmd->argv[1], "batch") == 0 || strcmp(cmd->argv[1], "daemon") == 0) {
+      printf("Line %d: \"%s\" can not be used in a batch\n", lineNo, cmd->argv[1]);
+      free(cmds);
+      return -1;
+    }
+    n++;
+  }
+
+  // argv 指向 args，realloc 移动之后需要重新分割
+  for (int i = 0; i < n; ++i)
+    tokenize(&cmds[i], cmds[i].text);
+
+  *pCmds = cmds;
+  return n;
+}
+
+static bool parseInt(const char* str, int* value) {
+  char* end = NULL;
+  long v = strtol(str, &end, 10);
+  if (*str == '\0' || *end != '\0' || v < 0)
+    return false;
+  *value = (int)v;
+  return true;
+}
+
+// 解析 delete startPageID [count]
+static bool deleteRange(const BatchCommand* cmd, int* start, int* count) {
+  if (strcmp(cmd->argv[1], "delete") != 0)
+    return false;
+  if (cmd->argc == 3) {
+    *count = 1;
+    return parseInt(cmd->argv[2], start);
+  }
+  if (cmd->argc == 4)
+    return parseInt(cmd->argv[2], start) && parseInt(cmd->argv[3], count) && *count > 0;
+  return false;
+}
+
+// 合并相邻且页码连续的 delete
+static int mergeDelete(BatchCommand* cmds, int n, int capacity) {
+  int nMerged = 0;
+  for (int i = 0; i < n; ) {
+    int start = 0, count = 0;
+    if (!deleteRange(&cmds[i], &start, &count) || start + count > capacity) {
+      ++i;
+      continue;
+    }
+
+    int j = i + 1;
+    for (; j < n; ++j) {
+      int s = 0, c = 0;
+      if (!deleteRange(&cmds[j], &s, &c) || s + c > capacity)
+        break;
+      if (s == start + count)
+        count += c;
+      else if (s + c == start) {
+        start = s;
+        count += c;
+      }
+      else
+        break;
+      cmds[j].mergedInto = i;
+      nMerged++;
+    }
+
+    if (j > i + 1) {
+      char merged[64] = { 0 };
+      sprintf(merged, "delete %d %d", start, count);
+      tokenize(&cmds[i], merged);
+    }
+    i = j;
+  }
+  return nMerged;
+}
+
+// 文件内容的哈希，0表示无法读取
+static SyncHash fileHash(const char* filename) {
+  uchar buf[1024];
+  FILE* fp = fopen(filename, "rb");
+  if (!fp)
+    return 0;
+  int size = fread(buf, 1, sizeof(buf), fp);
+  fclose(fp);
+  if (size <= 0 || size == sizeof(buf))
+    return 0;
+  return Sync_Hash(buf, size);
+}
+
+// 不改变特征缓冲区的命令
+static bool keepBuffer(const char* command) {
+  return strcmp(command, "storechar") == 0 ||
+         strcmp(command, "delete") == 0 ||
+         strcmp(command, "count") == 0 ||
+         strcmp(command, "match") == 0 ||
+         strcmp(command, "random") == 0;
+}
+
+// 跳过把缓冲区中已有的模板再次下载到该缓冲区的 downchar
+static void skipDownChar(BatchCommand* cmds, int n) {
+  SyncHash held[3] = { 0 };   // 缓冲区1、2中的模板
+  int loader[3] = { -1, -1, -1 };
+
+  for (int i = 0; i < n; ++i) {
+    BatchCommand* cmd = &cmds[i];
+    int bufferID = 0;
+    if (strcmp(cmd->argv[1], "downchar") == 0 && cmd->argc == 4 &&
+        parseInt(cmd->argv[2], &bufferID) && (bufferID == 1 || bufferID == 2)) {
+      SyncHash hash = fileHash(cmd->argv[3]);
+      if (hash != 0 && hash == held[bufferID]) {
+        cmd->skipAfter = loader[bufferID];
+      }
+      else {
+        held[bufferID] = hash;
+        loader[bufferID] = i;
+      }
+    }
+    else if (!keepBuffer(cmd->argv[1])) {
+      held[1] = held[2] = 0;
+      loader[1] = loader[2] = -1;
+    }
+  }
+}
+
+void Batch_Optimize(BatchCommand* cmds, int n, int capacity) {
+  mergeDelete(cmds, n, capacity);
+  skipDownChar(cmds, n);
+}
+
+bool Batch_Run(BatchCommand* cmds, int n, DaemonHandler handler, bool stopOnError, BatchReport* report) {
+  memset(report, 0, sizeof(BatchReport));
+  report->nCommand = n;
+  long long start = getTimeUs();
+  bool stopped = false;
+
+  for (int i = 0; i < n; ++i) {
+    BatchCommand* cmd = &cmds[i];
+    if (stopped) {
+      cmd->status = -1;
+      report->nNotRun++;
+      printf("[line %d] not run: %s\n", cmd->line, cmd->text);
+      continue;
+    }
+
+    if (cmd->mergedInto >= 0) {
+      const BatchCommand* into = &cmds[cmd->mergedInto];
+      cmd->status = into->status;
+      report->nMerged++;
+      printf("[line %d] exit %d, merged into line %d: %s\n", cmd->line, cmd->status, into->line, cmd->text);
+    }
+    else if (cmd->skipAfter >= 0 && cmds[cmd->skipAfter].status == 0) {
+      cmd->status = 0;
+      report->nSkipped++;
+      printf("[line %d] exit 0, skipped (buffer %s already holds it): %s\n", cmd->line, cmd->argv[2], cmd->text);
+    }
+    else {
+      fflush(stdout);
+      long long t = getTimeUs();
+      cmd->status = Daemon_Run(handler, cmd->argc + 1, cmd->argv);
+      cmd->timeUs = getTimeUs() - t;
+      report->nRun++;
+      printf("[line %d] exit %d, %.1f ms: %s\n", cmd->line, cmd->status, cmd->timeUs / 1000.0, cmd->text);
+    }
+
+    if (cmd->status != 0) {
+      report->nFailed++;
+      stopped = stopOnError;
+    }
+  }
+
+  report->timeUs = getTimeUs() - start;
+  fflush(stdout);
+  return report->nFailed == 0 && report->nNotRun == 0;
+}
+
+void Batch_PrintReport(const BatchReport* report) {
+  printf("Commands: %d (run %d, merged %d, skipped %d)\n",
+         report->nCommand, report->nRun, report->nMerged, report->nSkipped);
+  printf("Failed:   %d", report->nFailed);
+  if (report->nNotRun > 0)
+    printf(", %d not run", report->nNotRun);
+  printf("\n");
+  printf("Time:     %.1f ms\n", report->timeUs / 1000.0);
+}
@@ -0,0 +1,92 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "./daemon.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/*
+ * 批处理：从文件或 stdin 读取命令，在同一个会话中逐条执行，
+ *   省去每条命令启动进程、打开串口、握手的开销。
+ *
+ * 每行一条命令，格式与 fp 的命令行参数相同(可以省略开头的 "fp")，
+ *   参数可以用双引号包含空格，'#' 开始的行和空行被忽略。
+ * 所有命令都按 -y 执行(不询问确认)。
+ *
+ * 执行前合并可以安全合并的命令(结果与逐条执行相同)：
+ *   1. 相邻且页码连续的 delete 合并为一条
+ *   2. downchar 的文件与缓冲区中已有的模板相同时(中间没有改变缓冲区的命令)，跳过
+ * 模块一次只能处理一条指令，串口上不能流水发送，所以只在主机侧合并。
+ *
+ * 每条命令执行后输出一行结果：
+ *   [line 行号] exit 退出码, 耗时 ms: 命令 (merged/skipped 说明)
+*/
+
+#define BATCH_MAX_LINE  256
+#define BATCH_MAX_ARGS  16
+
+typedef struct Batch_Command {
+  int  line;                  // 行号
+  char text[BATCH_MAX_LINE];  // 原始命令
+  char args[BATCH_MAX_LINE];  // 分割后的参数，argv 指向这里
+  int  argc;
+  char* argv[BATCH_MAX_ARGS + 3];  // "fp" 参数... "-y" NULL
+  int  mergedInto;            // 已合并到该命令(下标)，-1表示没有合并
+  int  skipAfter;             // 该命令(下标)成功时跳过，-1表示需要执行
+  int  status;                // 退出码
+  long long timeUs;           // 耗时
+} BatchCommand;
+
+typedef struct Batch_Report {
+  int  nCommand;     // 命令总数
+  int  nRun;         // 实际执行的命令
+  int  nMerged;      // 合并到其他命令
+  int  nSkipped;     // 跳过
+  int  nFailed;      // 失败
+  int  nNotRun;      // 出错停止后没有执行
+  long long timeUs;  // 总耗时
+} BatchReport;
+
+/*
+ * 读取命令，*pCmds 需要由调用者 free
+ * 返回值：命令数，-1(错误，错误信息已输出)
+*/
+int  Batch_Load(FILE* fp, BatchCommand** pCmds);
+
+// 合并命令，capacity 为指纹库容量(合并后的 delete 不超出)
+void Batch_Optimize(BatchCommand* cmds, int n, int capacity);
+
+/*
+ * 逐条执行，输出每条命令的结果
+ * 参数：stopOnError(某条命令失败后不再执行后面的命令)
+ * 返回值：是否全部成功
+*/
+bool Batch_Run(BatchCommand* cmds, int n, DaemonHandler handler, bool stopOnError, BatchReport* report);
+
+void Batch_PrintReport(const BatchReport* report);
+
+#endif // __BATCH_H__
@@ -0,0 +1,307 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+
+#include "./bus.h"
+#include "./utils.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+
+extern AS608 g_as608;
+extern int g_fd;
+
+// as608.c 中的辅助函数
+int  SendOrder(const uchar* order, int size);
+bool Merge(uint* num, const uchar* startAddr, int count);
+
+// 各指令的最短处理时间(毫秒)，由 Bus_Measure 测量或从文件读取，0 为不交错
+static int s_minBusyMs[256];
+
+void Bus_SetMinBusy(uchar orderCode, int ms) {
+  s_minBusyMs[orderCode] = ms > 0 ? ms : 0;
+}
+
+int Bus_GetMinBusy(uchar orderCode) {
+  return s_minBusyMs[orderCode];
+}
+
+bool Bus_LoadTimings(const char* filename) {
+  FILE* fp = fopen(filename, "r");
+  if (!fp)
+    return false;
+  memset(s_minBusyMs, 0, sizeof(s_minBusyMs));
+  char code[16] = { 0 };
+  int ms = 0;
+  while (fscanf(fp, "%15s %d", code, &ms) == 2)
+    Bus_SetMinBusy(toUInt(code) & 0xff, ms);
+  fclose(fp);
+  return true;
+}
+
+bool Bus_SaveTimings(const char* filename) {
+  FILE* fp = fopen(filename, "w+");
+  if (!fp) {
+    g_error_code = 0xC2;
+    return false;
+  }
+  for (int code = 0; code < 256; ++code) {
+    if (s_minBusyMs[code] > 0)
+      fprintf(fp, "0x%02x %d\n", code, s_minBusyMs[code]);
+  }
+  fclose(fp);
+  return true;
+}
+
+// 在总线上传输 bytes 个字节的时间(1起始位 + 8数据位 + 1停止位)
+static long long wireUs(int bytes) {
+  int baud = g_as608.baud_rate > 0 ? g_as608.baud_rate : 57600;   // 单位已是 bit/s
+  return bytes * 10 * 1000000LL / baud;
+}
+
+void Bus_Encode(BusRequest* req, uint addr, uint tag, uchar orderCode, const uchar* params, int paramSize, int replyParams) {
+  memset(req, 0, sizeof(BusRequest));
+  req->addr = addr;
+  req->tag = tag;
+  req->orderSize = PS_EncodeOrder(req->order, addr, orderCode, params, paramSize);
+  req->replySize = 12 + replyParams;
+}
+
+typedef struct {
+  BusRequest* reqs;
+  int n;
+  bool interleave;
+  bool collided;                      // 出现过冲突，超时的请求重发一次
+  BusStats* stats;
+  int outstanding[BUS_MAX_MODULES];   // 已发出、未应答的请求
+  int nOutstanding;
+  int remaining;
+  uint addr[BUS_MAX_MODULES];         // 出现过的地址，轮流发出
+  int nAddr;
+  int last;
+  bool* done;
+  uchar rx[512];
+  int rxSize;
+} BusState;
+
+static int findOutstanding(BusState* s, uint addr) {
+  for (int i = 0; i < s->nOutstanding; ++i)
+    if (s->reqs[s->outstanding[i]].addr == addr)
+      return i;
+  return -1;
+}
+
+static void complete(BusState* s, int slot, bool ok, uchar code) {
+  BusRequest* req = &s->reqs[s->outstanding[slot]];
+  req->doneUs = getTimeUs();
+  // 应答包损坏、或冲突后没有收到应答时重发一次
+  if (!ok && (code == 0x01 || (code == 0xff && s->collided)) && req->retries == 0) {
+    req->retries++;
+  }
+  else {
+    req->ok = ok;
+    req->code = code;
+    s->done[s->outstanding[slot]] = true;
+    s->remaining--;
+    if (!ok)
+      s->stats->failed++;
+  }
+  s->outstanding[slot] = s->outstanding[--s->nOutstanding];
+}
+
+// 交错时收到损坏或未知地址的数据，说明应答冲突了，之后逐个执行
+static void collide(BusState* s) {
+  if (s->interleave) {
+    s->interleave = false;
+    s->stats->collisions++;
+  }
+  s->collided = true;
+}
+
+// 地址 addr 下一个要执行的请求，没有或已有未完成的请求返回-1
+static int nextOf(BusState* s, uint addr) {
+  if (findOutstanding(s, addr) != -1)
+    return -1;
+  for (int i = 0; i < s->n; ++i)
+    if (!s->done[i] && s->reqs[i].addr == addr)
+      return i;
+  return -1;
+}
+
+// 现在发出请求 r 是否不会与未完成的应答冲突
+static bool canSend(BusState* s, int r, long long now) {
+  if (s->nOutstanding == 0)
+    return true;
+  if (!s->interleave || s->nOutstanding > 1)
+    return false;
+
+  BusRequest* slow = &s->reqs[s->outstanding[0]];
+  BusRequest* req = &s->reqs[r];
+  int busyMs = s_minBusyMs[slow->order[9]];
+  if (busyMs == 0 || s_minBusyMs[req->order[9]] > 0)
+    return false;
+  long long earliestReply = slow->sendUs + wireUs(slow->orderSize) + busyMs * 1000LL;
+  return now + wireUs(req->orderSize + req->replySize) + BUS_GUARD_US < earliestReply;
+}
+
+static void sendRequests(BusState* s) {
+  for (int k = 1; k <= s->nAddr; ++k) {
+    int a = (s->last + k) % s->nAddr;
+    int r = nextOf(s, s->addr[a]);
+    long long now = getTimeUs();
+    if (r == -1 || !canSend(s, r, now))
+      continue;
+
+    BusRequest* req = &s->reqs[r];
+    if (s->nOutstanding > 0)
+      s->stats->overlapped++;
+    req->sendUs = now;
+    SendOrder(req->order, req->orderSize);
+    s->outstanding[s->nOutstanding++] = r;
+    s->stats->sent++;
+    s->last = a;
+  }
+}
+
+// 从接收缓冲区中解析应答包，按地址分发
+static void parseReplies(BusState* s) {
+  int pos = 0;
+  while (s->rxSize - pos >= 9) {
+    uchar* p = s->rx + pos;
+    int length = (p[7] << 8) | p[8];
+    if (p[0] != 0xef || p[1] != 0x01 || p[6] != 0x07 || length < 3 || length > 64 - 9) {
+      // 丢弃到下一个包头
+      s->stats->corrupt++;
+      if (s->nOutstanding > 1)
+        collide(s);
+      pos++;
+      while (pos < s->rxSize && s->rx[pos] != 0xef)
+        pos++;
+      continue;
+    }
+    if (s->rxSize - pos < 9 + length)
+      break;
+
+    uint addr = 0, sum = 0, expected = 0;
+    Merge(&addr, p+2, 4);
+    for (int i = 6; i < 9 + length - 2; ++i)
+      sum += p[i];
+    Merge(&expected, p + 9 + length - 2, 2);
+
+    int slot = findOutstanding(s, addr);
+    if (slot == -1) {
+      s->stats->stray++;
+      collide(s);
+    }
+    else if ((sum & 0xffff) != expected) {
+      s->stats->corrupt++;
+      if (s->nOutstanding > 1)
+        collide(s);
+      complete(s, slot, false, 0x01);
+    }
+    else {
+      BusRequest* req = &s->reqs[s->outstanding[slot]];
+      int size = (9 + length < req->replySize) ? 9 + length : req->replySize;
+      memcpy(req->reply, p, size);
+      complete(s, slot, true, p[9]);
+    }
+    pos += 9 + length;
+  }
+
+  memmove(s->rx, s->rx + pos, s->rxSize - pos);
+  s->rxSize -= pos;
+}
+
+int Bus_Execute(BusRequest* reqs, int n, bool interleave, BusStats* stats) {
+  BusStats localStats;
+  bool done[n > 0 ? n : 1];
+  BusState s;
+  memset(&s, 0, sizeof(s));
+  memset(done, 0, sizeof(done));
+  memset(&localStats, 0, sizeof(localStats));
+  s.reqs = reqs;
+  s.n = n;
+  s.interleave = interleave;
+  s.stats = stats ? stats : &localStats;
+  s.remaining = n;
+  s.done = done;
+  s.last = -1;
+
+  for (int i = 0; i < n; ++i) {
+    reqs[i].ok = false;
+    reqs[i].retries = 0;
+    bool known = false;
+    for (int a = 0; a < s.nAddr && !known; ++a)
+      known = s.addr[a] == reqs[i].addr;
+    if (!known) {
+      if (s.nAddr == BUS_MAX_MODULES) {
+        g_error_code = 0xC6;
+        return 0;
+      }
+      s.addr[s.nAddr++] = reqs[i].addr;
+    }
+  }
+
+  while (s.remaining > 0) {
+    sendRequests(&s);
+
+    // 等待应答，有慢指令时最多等1毫秒，以便及时插入短指令
+    struct pollfd pfd = { g_fd, POLLIN, 0 };
+    if (poll(&pfd, 1, 1) > 0) {
+      int size = read(g_fd, s.rx + s.rxSize, sizeof(s.rx) - s.rxSize);
+      if (size > 0) {
+        s.rxSize += size;
+        parseReplies(&s);
+      }
+      if (s.rxSize == sizeof(s.rx))
+        s.rxSize = 0;
+    }
+
+    long long now = getTimeUs();
+    for (int i = s.nOutstanding - 1; i >= 0; --i)
+      if (now - s.reqs[s.outstanding[i]].sendUs > BUS_TIMEOUT_US)
+        complete(&s, i, false, 0xff);
+  }
+
+  int succeeded = 0;
+  for (int i = 0; i < n; ++i)
+    succeeded += reqs[i].ok;
+  return succeeded;
+}
+
+long long Bus_Measure(uint addr, uchar orderCode, const uchar* params, int paramSize, int replyParams, int rounds) {
+  BusRequest req;
+  long long best = -1;
+  for (int i = 0; i < rounds; ++i) {
+    Bus_Encode(&req, addr, i, orderCode, params, paramSize, replyParams);
+    if (Bus_Execute(&req, 1, false, NULL) != 1)
+      continue;
+    long long busy = req.doneUs - req.sendUs - wireUs(req.orderSize) - wireUs(req.replySize);
+    if (busy < 0)
+      busy = 0;
+    if (best == -1 || busy < best)
+      best = busy;
+  }
+  return best;
+}
@@ -0,0 +1,102 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+
+#ifndef __BUS_H__
+#define __BUS_H__
+
+#include "../as608.h"
+
+/*
+ * 多点总线：RS-485 等总线上多个模块共用一个串口，用芯片地址区分
+ *
+ * 每个指令包都带有芯片地址，模块只应答发给自己的指令，应答包中也带有地址，
+ *   因此可以同时向多个模块发出指令，按应答包的地址分发。
+ * 总线是半双工的，两个模块同时应答会冲突，所以只在不会冲突时交错：
+ *   同一时刻最多一个慢指令(搜索、录入图像等，模块需要处理一段时间才应答)，
+ *   在慢指令最早可能应答之前，可以插入其他模块的短指令(发送 + 应答 + 余量 来得及完成)。
+ * 慢指令最早的应答时刻来自在实际模块上测量的最短处理时间(Bus_Measure)，
+ *   没有测量过的指令不交错，默认所有指令都不交错。
+ *   即使如此仍可能冲突(型号、固件不同)：交错时出现检校和错误或未知地址的应答，
+ *   视为冲突，之后退回为逐个执行，受影响的请求超时后重发一次。
+ * 同一地址的请求按顺序执行，不同地址的请求可以交错。
+ * 只支持 "指令包 → 应答包" 的指令，执行期间其他函数不能使用串口。
+*/
+
+#define BUS_MAX_MODULES 16
+#define BUS_GUARD_US    5000     // 短指令估计的处理时间和余量
+#define BUS_TIMEOUT_US  3000000  // 与 RecvReply 相同，最长等待3秒
+#define BUS_BUSY_MARGIN 2        // 测量到的最短处理时间除以此数作为交错的依据
+
+typedef struct Bus_Request {
+  uint  addr;         // 模块的芯片地址
+  uint  tag;          // 调用者的标识
+  int   orderSize;
+  int   replySize;    // 应答包长度(12 + 返回参数的字节数)
+  uchar order[64];
+  bool  ok;           // 收到检校和正确的应答包
+  uchar code;         // 确认码，ok 为 false 时为错误码(0x01 收包有错，0xff 超时)
+  uchar reply[64];
+  int   retries;
+  long long sendUs;
+  long long doneUs;
+} BusRequest;
+
+typedef struct Bus_Stats {
+  int sent;           // 发出的指令包
+  int overlapped;     // 在其他模块处理慢指令时发出的指令包
+  int corrupt;        // 检校和错误或无法解析的数据
+  int stray;          // 地址不属于任何未完成请求的应答包
+  int collisions;     // 交错时检测到冲突的次数(之后退回为逐个执行)
+  int failed;
+} BusStats;
+
+/*
+ * 编码发给地址 addr 的指令
+ * 参数：params, paramSize(指令参数，大端)  replyParams(应答包中返回参数的字节数)
+*/
+void Bus_Encode(BusRequest* req, uint addr, uint tag, uchar orderCode, const uchar* params, int paramSize, int replyParams);
+
+/*
+ * 执行 n 个请求，interleave 为 false 时一次只执行一个(与直接调用 PS_* 函数相同)
+ *   返回成功的个数，stats 可以为NULL
+*/
+int Bus_Execute(BusRequest* reqs, int n, bool interleave, BusStats* stats);
+
+/*
+ * 慢指令的最短处理时间(毫秒，从模块收完指令包到开始应答)，0 表示不在其处理期间插入其他指令
+ * 读写保存的结果，文件每行为 "指令码 毫秒"，如 "0x1b 120"，可以手工修改
+*/
+void Bus_SetMinBusy(uchar orderCode, int ms);
+int  Bus_GetMinBusy(uchar orderCode);
+bool Bus_LoadTimings(const char* filename);
+bool Bus_SaveTimings(const char* filename);
+
+/*
+ * 在地址 addr 的模块上逐个执行 rounds 次指令，测量处理时间：
+ *   从发出指令包到收完应答包的时间 - 指令包和应答包的传输时间，
+ *   确认码不为0的应答(如 GetImage 没有手指)也计入，这类应答往往最快
+ * 返回值：最短的处理时间(微秒)，没有收到应答返回-1
+*/
+long long Bus_Measure(uint addr, uchar orderCode, const uchar* params, int paramSize, int replyParams, int rounds);
+
+#endif // __BUS_H__
@@ -0,0 +1,127 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+#include "./capture.h"
+#include "./utils.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+extern uchar g_error_code;
+
+static void loadSettle(CaptureCtl* ctl) {
+  FILE* fp = ctl->path[0] ? fopen(ctl->path, "r") : NULL;
+  if (!fp)
+    return;
+  int settleUs = 0, learned = 0;
+  if (fscanf(fp, "%d %d", &settleUs, &learned) == 2 && settleUs >= 0 &&
+      settleUs <= CAPTURE_BUDGET_MS * 1000) {
+    ctl->settleUs = settleUs;
+    ctl->learned = learned;
+  }
+  fclose(fp);
+}
+
+static void saveSettle(const CaptureCtl* ctl) {
+  FILE* fp = ctl->path[0] ? fopen(ctl->path, "w") : NULL;
+  if (!fp)
+    return;
+  fprintf(fp, "%d %d\n", ctl->settleUs, ctl->learned);
+  fclose(fp);
+}
+
+void Capture_Init(CaptureCtl* ctl, GpioLine* line, const char* path) {
+  memset(ctl, 0, sizeof(CaptureCtl));
+  ctl->line = line;
+  ctl->settleUs = CAPTURE_DEFAULT_SETTLE_MS * 1000;
+  if (path)
+    snprintf(ctl->path, sizeof(ctl->path), "%s", path);
+  loadSettle(ctl);
+}
+
+// 按下边沿的时刻，手指在开始等待前早已按下(或后端没有边沿事件)时为0，超时为-1
+static long long waitPress(CaptureCtl* ctl, int timeoutMs, CaptureResult* result) {
+  long long start = getTimeUs();
+  if (!Gpio_WaitLevel(ctl->line, true, timeoutMs, NULL))
+    return -1;
+  long long now = getTimeUs();
+  result->waitUs += now - start;
+  long long edgeUs = ctl->line->level ? ctl->line->lastUs : 0;
+  return (edgeUs > 0 && now - edgeUs < CAPTURE_BUDGET_MS * 1000LL) ? edgeUs : 0;
+}
+
+static void learn(CaptureCtl* ctl, long long edgeUs, int tries, long long readyUs) {
+  ctl->learnedEdgeUs = edgeUs;
+  if (tries == 1)
+    ctl->settleUs -= ctl->settleUs / 8;
+  else
+    ctl->settleUs = (ctl->settleUs * 3 + (int)readyUs) / 4;
+  ctl->learned++;
+  saveSettle(ctl);
+}
+
+bool Capture_Do(CaptureCtl* ctl, int timeoutMs, CaptureOp op, CaptureResult* result) {
+  CaptureResult local;
+  if (!result)
+    result = &local;
+  memset(result, 0, sizeof(CaptureResult));
+
+  while (true) {
+    long long edgeUs = waitPress(ctl, timeoutMs, result);
+    if (edgeUs < 0) {
+      g_error_code = 0x02;
+      return false;
+    }
+    if (edgeUs == ctl->learnedEdgeUs)
+      edgeUs = 0;   // 同一次按压中的后续采集
+
+    // 刚按下时等待稳定，之后手指没有放好(0x02)时在预算内重试
+    if (edgeUs > 0) {
+      long long remain = edgeUs + ctl->settleUs - getTimeUs();
+      if (remain > 0)
+        usleep(remain);
+    }
+    long long startUs = edgeUs > 0 ? edgeUs : getTimeUs();
+    for (int tries = 1; ; ++tries) {
+      long long attemptUs = getTimeUs();
+      result->attempts++;
+      if (op()) {
+        result->readyUs = attemptUs - startUs;
+        if (edgeUs > 0)
+          learn(ctl, edgeUs, tries, result->readyUs);
+        return true;
+      }
+      if (g_error_code != 0x02)
+        return false;
+      if (!Gpio_Read(ctl->line))
+        break;   // 手指离开了，重新等待按下
+      if (getTimeUs() + CAPTURE_RETRY_MS * 1000 - startUs > CAPTURE_BUDGET_MS * 1000LL)
+        return false;
+      usleep(CAPTURE_RETRY_MS * 1000);
+    }
+  }
+}
+
+bool Capture_Image(CaptureCtl* ctl, int timeoutMs, CaptureResult* result) {
+  return Capture_Do(ctl, timeoutMs, PS_GetImage, result);
+}
@@ -0,0 +1,76 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include "../as608.h"
+#include "./gpio.h"
+
+/*
+ * 采集控制：代替检测到手指后固定的等待(原来的 delay(500) 等)
+ *
+ * 检测引脚变为按下后，手指还要一段时间才能压稳，太早采集时模块返回 0x02(传感器上没有手指)。
+ * 控制器在按下边沿之后等待学习到的稳定时间再采集，返回 0x02 且手指还在时
+ *   间隔 CAPTURE_RETRY_MS 重试，从按下起不超过 CAPTURE_BUDGET_MS；手指离开则重新等待按下。
+ * 稳定时间按本站点的采集结果学习，保存在 "~/.fpcapture_[芯片地址]_[串口]"：
+ *   第一次就采集成功时减少 1/8，试探能否更早；
+ *   重试后成功时，向实际可以采集的时刻(相对按下边沿)靠近 1/4。
+ * 开始等待时手指已经按下超过 CAPTURE_BUDGET_MS，或同一次按压已经学习过(如 Enroll_Run 连续采集)，
+ *   不再等待，也不学习；每次按压最多学习一次。
+*/
+
+#define CAPTURE_DEFAULT_SETTLE_MS 300
+#define CAPTURE_RETRY_MS          30
+#define CAPTURE_BUDGET_MS         2000
+
+typedef struct _CaptureCtl {
+  GpioLine* line;
+  char path[256];     // 学习结果的保存路径，空字符串表示不保存
+  int  settleUs;      // 学习到的稳定时间
+  int  learned;       // 学习的次数
+  long long learnedEdgeUs;   // 最近学习过的按下边沿
+} CaptureCtl;
+
+typedef struct _CaptureResult {
+  int  attempts;      // 执行采集的次数
+  long long waitUs;   // 等待手指按下的时间
+  long long readyUs;  // 从按下边沿到成功采集的时间
+} CaptureResult;
+
+// 采集操作，如 PS_GetImage，也可以是自动采集的 PS_Identify、PS_Enroll 等
+typedef bool (*CaptureOp)();
+
+// 初始化，读取 path 中学习到的稳定时间，path 为 NULL 时不保存
+void Capture_Init(CaptureCtl* ctl, GpioLine* line, const char* path);
+
+/*
+ * 等待手指按下并稳定后执行 op，op 返回 0x02 时在预算内重试
+ * 参数：timeoutMs(等待手指按下的最长时间)  result(可以为NULL)
+ * 返回值：op 的结果，没有检测到手指时 g_error_code 为 0x02
+*/
+bool Capture_Do(CaptureCtl* ctl, int timeoutMs, CaptureOp op, CaptureResult* result);
+
+// Capture_Do(ctl, timeoutMs, PS_GetImage, result)
+bool Capture_Image(CaptureCtl* ctl, int timeoutMs, CaptureResult* result);
+
+#endif // __CAPTURE_H__
@@ -0,0 +1,105 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+#include "./charfile.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define MINUTIAE_OFFSET   CHARFILE_HEADER_SIZE
+#define RESERVED_OFFSET   (MINUTIAE_OFFSET + CHARFILE_MAX_MINUTIAE * 4)   // 496
+#define CHECKSUM_OFFSET   510
+#define EXTENSION_OFFSET  512
+
+static unsigned short sum(const uchar* pData, int size) {
+  unsigned int count = 0;
+  for (int i = 0; i < size; ++i)
+    count += pData[i];
+  return count & 0xffff;
+}
+
+bool CharFile_Decode(const uchar* pData, int size, CharFeatures* f) {
+  if (size != CHARFILE_SIZE) {
+    f->valid = false;
+    return false;
+  }
+
+  memcpy(f->header, pData, CHARFILE_HEADER_SIZE);
+  f->n = pData[2];
+
+  const uchar* rec = pData + MINUTIAE_OFFSET;
+  for (int i = 0; i < CHARFILE_MAX_MINUTIAE; ++i, rec += 4) {
+    f->x[i]       = rec[0];
+    f->y[i]       = rec[1] | ((rec[2] & 0x01) << 8);
+    f->type[i]    = (rec[2] >> 1) & 0x01;
+    f->angle[i]   = rec[2] >> 2;
+    f->quality[i] = rec[3];
+  }
+
+  memcpy(f->opaque, pData + RESERVED_OFFSET, CHECKSUM_OFFSET - RESERVED_OFFSET);
+  memcpy(f->opaque + CHECKSUM_OFFSET - RESERVED_OFFSET, pData + EXTENSION_OFFSET,
+         CHARFILE_SIZE - EXTENSION_OFFSET);
+  f->checksum = (pData[CHECKSUM_OFFSET] << 8) | pData[CHECKSUM_OFFSET + 1];
+
+  f->valid = f->n <= CHARFILE_MAX_MINUTIAE &&
+             f->checksum == sum(pData, CHECKSUM_OFFSET);
+  return f->valid;
+}
+
+bool CharFile_Encode(const CharFeatures* f, uchar* pData, int size) {
+  if (size < CHARFILE_SIZE)
+    return false;
+
+  memcpy(pData, f->header, CHARFILE_HEADER_SIZE);
+
+  uchar* rec = pData + MINUTIAE_OFFSET;
+  for (int i = 0; i < CHARFILE_MAX_MINUTIAE; ++i, rec += 4) {
+    rec[0] = f->x[i] & 0xff;
+    rec[1] = f->y[i] & 0xff;
+    rec[2] = ((f->y[i] >> 8) & 0x01) | ((f->type[i] & 0x01) << 1) | (f->angle[i] << 2);
+    rec[3] = f->quality[i];
+  }
+
+  memcpy(pData + RESERVED_OFFSET, f->opaque, CHECKSUM_OFFSET - RESERVED_OFFSET);
+  memcpy(pData + EXTENSION_OFFSET, f->opaque + CHECKSUM_OFFSET - RESERVED_OFFSET,
+         CHARFILE_SIZE - EXTENSION_OFFSET);
+  pData[CHECKSUM_OFFSET]     = f->checksum >> 8;
+  pData[CHECKSUM_OFFSET + 1] = f->checksum & 0xff;
+  return true;
+}
+
+void CharFile_UpdateChecksum(CharFeatures* f) {
+  uchar buf[CHARFILE_SIZE];
+  f->header[2] = f->n;
+  CharFile_Encode(f, buf, CHARFILE_SIZE);
+  f->checksum = sum(buf, CHECKSUM_OFFSET);
+  f->valid = f->n <= CHARFILE_MAX_MINUTIAE;
+}
+
+void CharFile_Print(const CharFeatures* f) {
+  printf("Guessed layout, not verified against real module dumps\n");
+  printf("type=0x%02X quality=%d minutiae=%d checksum=0x%04X %s\n",
+      f->header[0], f->header[1], f->n, f->checksum, f->valid ? "valid" : "INVALID");
+  for (int i = 0; i < f->n && i < CHARFILE_MAX_MINUTIAE; ++i) {
+    printf("%3d: x=%3d y=%3d angle=%3d %-11s quality=%d\n", i, f->x[i], f->y[i],
+        f->angle[i] * 360 / 64, f->type[i] ? "bifurcation" : "ending", f->quality[i]);
+  }
+}
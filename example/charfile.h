@@ -0,0 +1,86 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+#ifndef __CHARFILE_H__
+#define __CHARFILE_H__
+
+#include "../as608.h"
+
+/*
+ * 按猜测的布局查看、生成特征文件(CharBuffer，768字节)，这不是一个可靠的解析器
+ *
+ * 官方手册没有公开特征文件的格式，以下布局是猜测的，没有用模块实际导出的特征文件核对过，
+ *   文件头中的质量、细节点个数和细节点记录都可能与实际含义不符：
+ *
+ *   偏移      长度   内容
+ *   0         16     文件头，[0]文件类型，[1]整体质量，[2]细节点个数
+ *   16        480    细节点记录，最多120个，每个4字节
+ *   496       14     保留
+ *   510       2      检校和，前510字节之和(大端)
+ *   512       256    扩展区
+ *
+ * 细节点记录(4字节)：
+ *   [0] x坐标(0~255)
+ *   [1] y坐标低8位
+ *   [2] bit0: y坐标第9位(0~287)  bit1: 类型(0端点，1分叉点)  bit2~7: 方向(0~63，单位360/64度)
+ *   [3] 质量
+ *
+ * 解析时所有记录(包括细节点个数之后的)和保留区、扩展区都原样保存，
+ *   因此 CharFile_Encode(CharFile_Decode(x)) 一定与 x 逐字节相同，即使猜测的布局有误，
+ *   这个性质不能说明布局正确。布局与数据不符时(检校和不对或细节点个数超出范围)，valid 为 false。
+ * 主机端的处理(matcher.h 的预筛、去重、虚拟指纹库)都不使用这里的字段，只用原始字节；
+ *   这里只用于 chardump 查看文件内容和性能测试中生成模拟的特征文件。
+*/
+
+#define CHARFILE_SIZE           768
+#define CHARFILE_HEADER_SIZE    16
+#define CHARFILE_MAX_MINUTIAE   120
+#define CHARFILE_OPAQUE_SIZE    (14 + 256)
+
+typedef struct _CharFeatures {
+  uchar  header[CHARFILE_HEADER_SIZE];
+  int    n;         // 有效细节点个数，即 header[2]
+  bool   valid;     // 检校和正确 且 细节点个数合法
+
+  // 细节点，按字段分别连续存放，便于向量化处理
+  unsigned short x[CHARFILE_MAX_MINUTIAE];
+  unsigned short y[CHARFILE_MAX_MINUTIAE];
+  uchar  angle[CHARFILE_MAX_MINUTIAE];
+  uchar  type[CHARFILE_MAX_MINUTIAE];
+  uchar  quality[CHARFILE_MAX_MINUTIAE];
+
+  unsigned short checksum;  // 文件中的检校和
+  uchar  opaque[CHARFILE_OPAQUE_SIZE];   // 保留区和扩展区
+} CharFeatures;
+
+// 解析特征文件，size必须为768。返回 f->valid
+bool CharFile_Decode(const uchar* pData, int size, CharFeatures* f);
+
+// 生成特征文件，size>=768
+bool CharFile_Encode(const CharFeatures* f, uchar* pData, int size);
+
+// 修改细节点后重新计算检校和
+void CharFile_UpdateChecksum(CharFeatures* f);
+
+// 按猜测的布局打印特征文件的内容
+void CharFile_Print(const CharFeatures* f);
+
+#endif // __CHARFILE_H__
@@ -0,0 +1,533 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+#include "./classify.h"
+#include "./utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+extern AS608 g_as608;
+extern uchar g_error_code;
+
+#define BW (CLASSIFY_WIDTH / CLASSIFY_BLOCK)     // 每行的块数
+#define BH (CLASSIFY_HEIGHT / CLASSIFY_BLOCK)    // 每列的块数
+
+#define SMOOTH_RADIUS   2      // 方向场平滑的窗口半径(块)
+#define MERGE_DISTANCE  2      // 距离不超过该值(块)的同类奇异点合并为一个
+#define CANCEL_DISTANCE 3      // 距离不超过该值(块)的中心点和三角点视为噪声，相互抵消
+
+// 各纹型占指纹库的比例(%)，比人群中的比例(约 5:65:30)略宽裕
+static const int g_layoutShare[FP_CLASSES] = { 10, 60, 30 };
+
+const char* Classify_Name(int cls) {
+  switch (cls) {
+  case FP_ARCH:  return "arch";
+  case FP_LOOP:  return "loop";
+  case FP_WHORL: return "whorl";
+  default:       return "unknown";
+  }
+}
+
+// 方向差规整到 (-pi/2, pi/2]
+static float wrapAngle(float d) {
+  while (d > M_PI / 2)
+    d -= M_PI;
+  while (d <= -M_PI / 2)
+    d += M_PI;
+  return d;
+}
+
+typedef struct _Cluster {
+  int firstX, firstY;   // 第一个点，后续的点按与它的距离归类
+  int sumX, sumY, n;
+  int charge;           // 指数的绝对值，斗型的中心可能在一个环路内得到2
+} Cluster;
+
+// 把奇异点归入相近的类
+static int addToCluster(Cluster* clusters, int m, int x, int y, int charge) {
+  int j = 0;
+  while (j < m && (abs(x - clusters[j].firstX) > MERGE_DISTANCE || abs(y - clusters[j].firstY) > MERGE_DISTANCE))
+    j++;
+  if (j == m) {
+    memset(&clusters[m], 0, sizeof(Cluster));
+    clusters[m].firstX = x;
+    clusters[m].firstY = y;
+    m++;
+  }
+  clusters[j].sumX += x;
+  clusters[j].sumY += y;
+  clusters[j].n++;
+  if (charge > clusters[j].charge)
+    clusters[j].charge = charge;
+  return m;
+}
+
+// 类转换为奇异点(像素坐标)，返回个数
+static int toPoints(const Cluster* clusters, int m, SingularPoint* points) {
+  int k = 0;
+  for (int j = 0; j < m; ++j) {
+    for (int c = 0; c < clusters[j].charge && k < CLASSIFY_MAX_SP; ++c) {
+      // Poincare环路以块的右下角为中心
+      points[k].x = (clusters[j].sumX + clusters[j].n) * CLASSIFY_BLOCK / clusters[j].n;
+      points[k].y = (clusters[j].sumY + clusters[j].n) * CLASSIFY_BLOCK / clusters[j].n;
+      k++;
+    }
+  }
+  return k;
+}
+
+bool Classify_Image(const uchar* image, ClassifyResult* result) {
+  memset(result, 0, sizeof(ClassifyResult));
+
+  // 1.每块的梯度统计：(gx^2 - gy^2, 2*gx*gy) 的和即方向的二倍角向量
+  float gxx[BH][BW] = { { 0 } }, gxy[BH][BW] = { { 0 } }, energy[BH][BW] = { { 0 } };
+  const int W = CLASSIFY_WIDTH;
+  for (int y = 1; y < CLASSIFY_HEIGHT - 1; ++y) {
+    const uchar* up = image + (y - 1) * W;
+    const uchar* mid = image + y * W;
+    const uchar* down = image + (y + 1) * W;
+    float* rowXX = gxx[y / CLASSIFY_BLOCK];
+    float* rowXY = gxy[y / CLASSIFY_BLOCK];
+    float* rowE = energy[y / CLASSIFY_BLOCK];
+    for (int x = 1; x < W - 1; ++x) {
+      int gx = (up[x+1] + 2 * mid[x+1] + down[x+1]) - (up[x-1] + 2 * mid[x-1] + down[x-1]);
+      int gy = (down[x-1] + 2 * down[x] + down[x+1]) - (up[x-1] + 2 * up[x] + up[x+1]);
+      int b = x / CLASSIFY_BLOCK;
+      rowXX[b] += (float)(gx * gx - gy * gy);
+      rowXY[b] += (float)(2 * gx * gy);
+      rowE[b]  += (float)(gx * gx + gy * gy);
+    }
+  }
+
+  // 2.前景(指纹区域)：梯度能量较大的块，图像边缘的块不使用
+  float mean = 0;
+  for (int i = 0; i < BH; ++i)
+    for (int j = 0; j < BW; ++j)
+      mean += energy[i][j];
+  mean /= BW * BH;
+
+  bool fg[BH][BW] = { { false } };
+  for (int i = 1; i < BH - 1; ++i)
+    for (int j = 1; j < BW - 1; ++j)
+      fg[i][j] = mean > 0 && energy[i][j] > 0.3f * mean;
+
+  // 去掉孤立的前景块，填补前景中的空洞
+  for (int pass = 0; pass < 2; ++pass) {
+    bool next[BH][BW];
+    memcpy(next, fg, sizeof(fg));
+    for (int i = 1; i < BH - 1; ++i) {
+      for (int j = 1; j < BW - 1; ++j) {
+        int count = 0;
+        for (int di = -1; di <= 1; ++di)
+          for (int dj = -1; dj <= 1; ++dj)
+            count += (di || dj) && fg[i+di][j+dj];
+        if (fg[i][j] && count <= 2)
+          next[i][j] = false;
+        else if (!fg[i][j] && count >= 5)
+          next[i][j] = true;
+      }
+    }
+    memcpy(fg, next, sizeof(fg));
+  }
+
+  int nForeground = 0;
+  for (int i = 0; i < BH; ++i)
+    for (int j = 0; j < BW; ++j)
+      nForeground += fg[i][j];
+  result->foreground = (float)nForeground / (BW * BH);
+  if (result->foreground < 0.15f)
+    return false;
+
+  // 3.在前景内平滑二倍角向量，得到纹线方向(梯度方向旋转90度)
+  float theta[BH][BW] = { { 0 } };
+  for (int i = 0; i < BH; ++i) {
+    for (int j = 0; j < BW; ++j) {
+      if (!fg[i][j])
+        continue;
+      float sx = 0, sy = 0;
+      for (int di = -SMOOTH_RADIUS; di <= SMOOTH_RADIUS; ++di) {
+        for (int dj = -SMOOTH_RADIUS; dj <= SMOOTH_RADIUS; ++dj) {
+          int ii = i + di, jj = j + dj;
+          if (ii < 0 || ii >= BH || jj < 0 || jj >= BW || !fg[ii][jj])
+            continue;
+          sx += gxx[ii][jj];
+          sy += gxy[ii][jj];
+        }
+      }
+      theta[i][j] = 0.5f * atan2f(sy, sx) + (float)M_PI / 2;
+    }
+  }
+
+  // 4.Poincare指数：沿 2x2 个块中心组成的环路累加方向差，+pi为中心点，-pi为三角点
+  //   环路及其周围一圈都在前景内才计算，避免指纹边缘的干扰
+  static const int ringI[4] = { 0, 0, 1, 1 };
+  static const int ringJ[4] = { 0, 1, 1, 0 };
+  Cluster cores[BW*BH], deltas[BW*BH];
+  int nCores = 0, nDeltas = 0;
+  for (int i = 1; i < BH - 2; ++i) {
+    for (int j = 1; j < BW - 2; ++j) {
+      bool inside = true;
+      for (int di = -1; di <= 2 && inside; ++di)
+        for (int dj = -1; dj <= 2 && inside; ++dj)
+          inside = fg[i+di][j+dj];
+      if (!inside)
+        continue;
+
+      float sum = 0;
+      for (int k = 0; k < 4; ++k) {
+        float a = theta[i + ringI[k]][j + ringJ[k]];
+        float b = theta[i + ringI[(k+1) % 4]][j + ringJ[(k+1) % 4]];
+        sum += wrapAngle(b - a);
+      }
+      int index = (int)lroundf(sum / (float)M_PI);
+      if (index > 0)
+        nCores = addToCluster(cores, nCores, j, i, index);
+      else if (index < 0)
+        nDeltas = addToCluster(deltas, nDeltas, j, i, -index);
+    }
+  }
+
+  SingularPoint core[CLASSIFY_MAX_SP], delta[CLASSIFY_MAX_SP];
+  int nc = toPoints(cores, nCores, core);
+  int nd = toPoints(deltas, nDeltas, delta);
+
+  // 5.距离很近的中心点和三角点是噪声(如伤疤、褶皱)，成对去掉
+  const int cancel = CANCEL_DISTANCE * CLASSIFY_BLOCK;
+  bool coreRemoved[CLASSIFY_MAX_SP] = { false }, deltaRemoved[CLASSIFY_MAX_SP] = { false };
+  for (int c = 0; c < nc; ++c) {
+    for (int d = 0; d < nd && !coreRemoved[c]; ++d) {
+      if (!deltaRemoved[d] && abs(core[c].x - delta[d].x) <= cancel && abs(core[c].y - delta[d].y) <= cancel)
+        coreRemoved[c] = deltaRemoved[d] = true;
+    }
+  }
+  for (int c = 0; c < nc; ++c) {
+    if (!coreRemoved[c])
+      result->core[result->nCore++] = core[c];
+  }
+  for (int d = 0; d < nd; ++d) {
+    if (!deltaRemoved[d])
+      result->delta[result->nDelta++] = delta[d];
+  }
+
+  // 6.按中心点个数分类(三角点常在采集区域之外，只作参考)
+  if (result->nCore >= 2)
+    result->cls = FP_WHORL;
+  else if (result->nCore == 1)
+    result->cls = FP_LOOP;
+  else
+    result->cls = FP_ARCH;
+  return true;
+}
+
+bool Classify_LoadBmp(const char* filename, uchar* image) {
+  FILE* fp = fopen(filename, "rb");
+  if (!fp) {
+    g_error_code = 0xC2;
+    return false;
+  }
+
+  // 跳过bmp头和调色板，与 PS_UpImage 写入的格式一致
+  uchar header[54];
+  int offset = 0;
+  if (fread(header, 1, 54, fp) == 54 && header[0] == 'B' && header[1] == 'M')
+    offset = header[10] | (header[11] << 8) | (header[12] << 16) | (header[13] << 24);
+  bool ok = offset >= 54 && fseek(fp, offset, SEEK_SET) == 0 &&
+            fread(image, 1, CLASSIFY_WIDTH * CLASSIFY_HEIGHT, fp) == CLASSIFY_WIDTH * CLASSIFY_HEIGHT;
+  fclose(fp);
+
+  if (!ok)
+    g_error_code = 0xC2;
+  return ok;
+}
+
+void Classify_Layout(int capacity, PageRange ranges[FP_CLASSES]) {
+  int start = 0;
+  for (int cls = 0; cls < FP_CLASSES; ++cls) {
+    int count = (cls == FP_CLASSES - 1) ? capacity - start : capacity * g_layoutShare[cls] / 100;
+    ranges[cls].start = start;
+    ranges[cls].count = count;
+    ranges[cls].used  = 0;
+    start += count;
+  }
+}
+
+int Classify_AllocPage(int cls) {
+  PageRange ranges[FP_CLASSES];
+  Classify_Layout(g_as608.capacity, ranges);
+
+  int page = PS_NextFreePage(ranges[cls].start);
+  if (page != -1 && page < ranges[cls].start + ranges[cls].count)
+    return page;
+
+  // 所属的段已满，使用其他段的空页
+  if (!PS_AllocFreePage(&page))
+    return -1;
+  return page;
+}
+
+bool Classify_Search(int cls, bool highSpeed, int* pPageID, int* pScore, bool* pInClass) {
+  PageRange ranges[FP_CLASSES];
+  Classify_Layout(g_as608.capacity, ranges);
+  *pInClass = false;
+
+  // 所属纹型的段在前，其余的段在后
+  int order[FP_CLASSES] = { cls };
+  for (int i = 0, k = 1; i < FP_CLASSES; ++i) {
+    if (i != cls)
+      order[k++] = i;
+  }
+
+  for (int k = 0; k < FP_CLASSES; ++k) {
+    PageRange* r = &ranges[order[k]];
+    int used = PS_CountUsed(r->start, r->count);
+    if (used < 0)
+      return false;
+    if (used == 0)
+      continue;
+
+    bool found = highSpeed ?
+      PS_HighSpeedSearch(1, r->start, r->count, pPageID, pScore) :
+      PS_Search(1, r->start, r->count, pPageID, pScore);
+    if (found) {
+      *pInClass = (k == 0);
+      return true;
+    }
+    if (g_error_code != 0x09)
+      return false;
+  }
+
+  *pPageID = 0;
+  *pScore  = 0;
+  g_error_code = 0x09;
+  return false;
+}
+
+
+/******************************************************************
+ * 合成图像和测试
+******************************************************************/
+
+#define SYN_PERIOD      9.0f   // 纹线间距(像素)，约500dpi
+#define SYN_SIGMA       3.0f
+#define SYN_RADIUS      5
+#define SYN_ORIENTS     16     // Gabor滤波器的方向个数
+#define SYN_ITERATIONS  6
+
+// 方向场模型(Sherlock-Monro)：theta = (sum(arg(z-core)) - sum(arg(z-delta))) / 2
+static float modelOrientation(int cls, float x, float y, const float* cx, const float* cy) {
+  switch (cls) {
+  case FP_LOOP:
+    return 0.5f * (atan2f(y - cy[0], x - cx[0]) - atan2f(y - cy[1], x - cx[1]));
+  case FP_WHORL:
+    return 0.5f * (atan2f(y - cy[0], x - cx[0]) + atan2f(y - cy[1], x - cx[1]) -
+                   atan2f(y - cy[2], x - cx[2]) - atan2f(y - cy[3], x - cx[3]));
+  case FP_ARCH:
+  default:
+    // 没有奇异点，中间拱起的纹线
+    return -0.8f * (x - cx[0]) / (CLASSIFY_WIDTH / 2) * expf(-(y - cy[0]) * (y - cy[0]) / (110.0f * 110.0f));
+  }
+}
+
+void Classify_Synthesize(int cls, unsigned seed, uchar* image) {
+  const int W = CLASSIFY_WIDTH, H = CLASSIFY_HEIGHT;
+  float ox = W / 2 + (int)(rand_r(&seed) % 33) - 16;
+  float oy = H / 2 + (int)(rand_r(&seed) % 33) - 16;
+  int side = (rand_r(&seed) & 1) ? 1 : -1;
+
+  // 奇异点的位置：[0]...为中心点，之后为三角点
+  float cx[4] = { ox, ox, ox, ox }, cy[4] = { oy, oy, oy, oy };
+  if (cls == FP_LOOP) {
+    cy[0] = oy - 30;
+    cx[1] = ox + side * 90;
+    cy[1] = oy + 80;
+  }
+  else if (cls == FP_WHORL) {
+    cx[0] = ox - side * 8;  cy[0] = oy - 28;
+    cx[1] = ox + side * 8;  cy[1] = oy + 20;
+    cx[2] = ox - 100;       cy[2] = oy + 95;
+    cx[3] = ox + 100;       cy[3] = oy + 95;
+  }
+
+  // 方向量化的Gabor滤波器
+  static float kernel[SYN_ORIENTS][2*SYN_RADIUS+1][2*SYN_RADIUS+1];
+  static bool kernelReady = false;
+  if (!kernelReady) {
+    for (int o = 0; o < SYN_ORIENTS; ++o) {
+      float t = (float)M_PI * o / SYN_ORIENTS;
+      float sum = 0;
+      for (int v = -SYN_RADIUS; v <= SYN_RADIUS; ++v) {
+        for (int u = -SYN_RADIUS; u <= SYN_RADIUS; ++u) {
+          float n = -u * sinf(t) + v * cosf(t);   // 到纹线的法向距离
+          float k = expf(-(u*u + v*v) / (2 * SYN_SIGMA * SYN_SIGMA)) * cosf(2 * (float)M_PI * n / SYN_PERIOD);
+          kernel[o][v+SYN_RADIUS][u+SYN_RADIUS] = k;
+          sum += k;
+        }
+      }
+      float avg = sum / ((2*SYN_RADIUS+1) * (2*SYN_RADIUS+1));
+      for (int v = 0; v < 2*SYN_RADIUS+1; ++v)
+        for (int u = 0; u < 2*SYN_RADIUS+1; ++u)
+          kernel[o][v][u] -= avg;
+    }
+    kernelReady = true;
+  }
+
+  uchar* orient = (uchar*)malloc(W * H);
+  float* cur = (float*)malloc(sizeof(float) * W * H);
+  float* next = (float*)malloc(sizeof(float) * W * H);
+  if (!orient || !cur || !next) {
+    free(orient); free(cur); free(next);
+    memset(image, 0xff, W * H);
+    return;
+  }
+
+  // 椭圆形的按压区域内，从随机噪声开始沿方向场反复滤波，得到连续的纹线
+  for (int y = 0; y < H; ++y) {
+    for (int x = 0; x < W; ++x) {
+      float ex = (x - ox) / 110.0f, ey = (y - oy) / 135.0f;
+      bool inside = ex * ex + ey * ey <= 1;
+      float t = modelOrientation(cls, x, y, cx, cy);
+      t -= floorf(t / (float)M_PI) * (float)M_PI;
+      orient[y*W + x] = inside ? (uchar)((int)lroundf(t / (float)M_PI * SYN_ORIENTS) % SYN_ORIENTS) : 0xff;
+      cur[y*W + x] = inside ? ((rand_r(&seed) & 1) ? 1.0f : -1.0f) : 0;
+    }
+  }
+  for (int it = 0; it < SYN_ITERATIONS; ++it) {
+    for (int y = 0; y < H; ++y) {
+      for (int x = 0; x < W; ++x) {
+        int o = orient[y*W + x];
+        if (o == 0xff) {
+          next[y*W + x] = 0;
+          continue;
+        }
+        float sum = 0;
+        for (int v = -SYN_RADIUS; v <= SYN_RADIUS; ++v) {
+          int yy = y + v;
+          if (yy < 0 || yy >= H)
+            continue;
+          for (int u = -SYN_RADIUS; u <= SYN_RADIUS; ++u) {
+            int xx = x + u;
+            if (xx >= 0 && xx < W)
+              sum += kernel[o][v+SYN_RADIUS][u+SYN_RADIUS] * cur[yy*W + xx];
+          }
+        }
+        next[y*W + x] = sum > 0 ? 1.0f : -1.0f;
+      }
+    }
+    float* tmp = cur;
+    cur = next;
+    next = tmp;
+  }
+
+  // 纹线为暗，背景为亮，只保留高4位(与模块的图像一致)
+  for (int i = 0; i < W * H; ++i) {
+    int v = (orient[i] == 0xff) ? 0xf0 : (cur[i] > 0 ? 0x30 : 0xc0);
+    v += (int)(rand_r(&seed) % 32) - 16;
+    image[i] = (uchar)(v < 0 ? 0 : v > 255 ? 255 : v) & 0xf0;
+  }
+
+  free(orient);
+  free(cur);
+  free(next);
+}
+
+static int compareLongLong(const void* a, const void* b) {
+  long long x = *(const long long*)a, y = *(const long long*)b;
+  return x < y ? -1 : (x > y);
+}
+
+/*
+ * 搜索耗时估计(57600波特率)：PS_Search 比对整个页段，
+ *   耗时近似为 固定开销 + 页数 * 每页耗时
+*/
+#define SIM_SEARCH_BASE_MS   40
+#define SIM_SEARCH_PAGE_US   900
+
+void Classify_Benchmark(int n) {
+  if (n <= 0)
+    return;
+
+  uchar* image = (uchar*)malloc(CLASSIFY_WIDTH * CLASSIFY_HEIGHT);
+  long long* elapsed = (long long*)malloc(sizeof(long long) * n);
+  if (!image || !elapsed) {
+    free(image); free(elapsed);
+    return;
+  }
+
+  // 混淆矩阵，最后一列为无法分类
+  int confusion[FP_CLASSES][FP_CLASSES+1] = { { 0 } };
+  long long total = 0;
+  for (int i = 0; i < n; ++i) {
+    int cls = i % FP_CLASSES;
+    Classify_Synthesize(cls, 2019 + i, image);
+
+    ClassifyResult result;
+    long long start = getTimeUs();
+    bool ok = Classify_Image(image, &result);
+    elapsed[i] = getTimeUs() - start;
+    total += elapsed[i];
+    confusion[cls][ok ? result.cls : FP_CLASSES]++;
+  }
+  qsort(elapsed, n, sizeof(long long), compareLongLong);
+
+  int correct = 0;
+  printf("%-8s %8s %8s %8s %8s\n", "actual", "arch", "loop", "whorl", "failed");
+  for (int cls = 0; cls < FP_CLASSES; ++cls) {
+    printf("%-8s %8d %8d %8d %8d\n", Classify_Name(cls),
+        confusion[cls][0], confusion[cls][1], confusion[cls][2], confusion[cls][3]);
+    correct += confusion[cls][cls];
+  }
+  printf("Accuracy: %.1f%% on %d synthetic images\n", 100.0 * correct / n, n);
+  printf("Classify: mean %.2f ms, p99 %.2f ms per image\n",
+      total / 1000.0 / n, elapsed[n * 99 / 100] / 1000.0);
+
+  // 指纹库已满(300页)时，按人群比例(5:65:30)估计 PS_Search 的耗时
+  static const double population[FP_CLASSES] = { 0.05, 0.65, 0.30 };
+  const int capacity = 300;
+  PageRange ranges[FP_CLASSES];
+  Classify_Layout(capacity, ranges);
+
+  double fullMs = SIM_SEARCH_BASE_MS + capacity * SIM_SEARCH_PAGE_US / 1000.0;
+  double classMs = 0;
+  for (int cls = 0; cls < FP_CLASSES; ++cls) {
+    int rowTotal = 0;
+    for (int j = 0; j <= FP_CLASSES; ++j)
+      rowTotal += confusion[cls][j];
+    double miss = rowTotal ? 1 - (double)confusion[cls][cls] / rowTotal : 0;
+    double inClass = SIM_SEARCH_BASE_MS + ranges[cls].count * SIM_SEARCH_PAGE_US / 1000.0;
+    // 分类错误时，其余的页(最多两段)还要再搜索
+    double rest = 2 * SIM_SEARCH_BASE_MS + (capacity - ranges[cls].count) * SIM_SEARCH_PAGE_US / 1000.0;
+    classMs += population[cls] * (inClass + miss * rest);
+  }
+  printf("Search (estimated, %d pages): full %.0f ms, class-first %.0f ms (%.0f%% less)\n",
+      capacity, fullMs, classMs, 100 * (1 - classMs / fullMs));
+
+  // 待搜索的指纹也要上传图像才能分类：36864字节数据 + 每包11字节的包头和检校和
+  int bytes = 36864 + 36864 / 128 * 11;
+  printf("Probe image upload (packet size 128): %.0f ms at 57600, %.0f ms at 115200 baud\n",
+      bytes * 10 * 1000.0 / 57600, bytes * 10 * 1000.0 / 115200);
+
+  free(image);
+  free(elapsed);
+}
@@ -0,0 +1,96 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+#ifndef __CLASSIFY_H__
+#define __CLASSIFY_H__
+
+#include "../as608.h"
+
+/*
+ * 指纹纹型分类：弓型(arch)、箕型(loop)、斗型(whorl)
+ *
+ * 由 PS_UpImageToBuf 得到的图像计算块方向场，用 Poincare 指数检测奇异点：
+ *   没有中心点(core)为弓型，一个中心点为箕型，两个中心点为斗型。
+ * 指纹库按纹型划分为连续的页段(Classify_Layout)，录入时放到所属纹型的段中，
+ *   搜索时先搜索所属纹型的段，未找到再搜索其余的页。
+*/
+
+#define CLASSIFY_WIDTH   256
+#define CLASSIFY_HEIGHT  288
+#define CLASSIFY_BLOCK   8     // 方向场的块大小(像素)
+#define CLASSIFY_MAX_SP  8     // 每种奇异点最多记录的个数
+
+enum {
+  FP_ARCH    = 0,
+  FP_LOOP    = 1,
+  FP_WHORL   = 2,
+  FP_CLASSES = 3
+};
+
+typedef struct _SingularPoint {
+  int x;
+  int y;
+} SingularPoint;
+
+typedef struct _ClassifyResult {
+  int cls;
+  int nCore;
+  int nDelta;
+  SingularPoint core[CLASSIFY_MAX_SP];    // 中心点(像素坐标)
+  SingularPoint delta[CLASSIFY_MAX_SP];   // 三角点
+  float foreground;                       // 指纹区域占整幅图像的比例
+} ClassifyResult;
+
+const char* Classify_Name(int cls);
+
+/*
+ * 对一幅 256*288 的灰度图像分类
+ * 返回值：true(成功)，false(指纹区域太小，无法分类)
+*/
+bool Classify_Image(const uchar* image, ClassifyResult* result);
+
+// 读取 PS_UpImage 保存的bmp文件，得到与 PS_UpImageToBuf 相同的像素数据
+bool Classify_LoadBmp(const char* filename, uchar* image);
+
+// 各纹型在指纹库中的页段，按纹型的常见比例划分
+void Classify_Layout(int capacity, PageRange ranges[FP_CLASSES]);
+
+/*
+ * 为纹型分配一个空页：优先所属纹型的段，已满时使用其他段的空页
+ * 返回值：页码，指纹库已满返回-1
+*/
+int  Classify_AllocPage(int cls);
+
+/*
+ * 以 CharBuffer1 中的特征搜索：先搜索所属纹型的段，再搜索其余的页
+ * 参数：pInClass(是否在所属纹型的段中找到)
+ * 返回值 ：true(搜索到)，false(没搜索到或出现错误)，确认码赋值给g_error_code
+*/
+bool Classify_Search(int cls, bool highSpeed, int* pPageID, int* pScore, bool* pInClass);
+
+// 按纹型生成一幅合成的指纹图像(方向场模型 + Gabor滤波)
+void Classify_Synthesize(int cls, unsigned seed, uchar* image);
+
+// 用合成图像测试分类的耗时和准确率，并估计按纹型搜索的延时
+void Classify_Benchmark(int n);
+
+#endif // __CLASSIFY_H__
@@ -0,0 +1,321 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+#include "./daemon.h"
+#include "./fpclient.h"
+
+#include <stdio.h>
+#include <stdio_ext.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define DAEMON_MAX_CONNECTIONS 16
+
+static jmp_buf g_session;
+static volatile bool g_inSession = false;
+static bool g_serving = false;
+
+// 登记的资源，按登记顺序保存
+typedef struct {
+  DaemonCleanup cleanup;
+  void* arg;
+} Deferred;
+
+static Deferred* g_deferred = NULL;
+static int g_nDeferred = 0, g_deferredSize = 0;
+
+void Daemon_Defer(DaemonCleanup cleanup, void* arg) {
+  if (g_nDeferred == g_deferredSize) {
+    int size = g_deferredSize ? g_deferredSize * 2 : 16;
+    Deferred* p = (Deferred*)realloc(g_deferred, sizeof(Deferred) * size);
+    if (!p) {
+      cleanup(arg);   // 无法登记时立即释放，不泄漏
+      return;
+    }
+    g_deferred = p;
+    g_deferredSize = size;
+  }
+  g_deferred[g_nDeferred].cleanup = cleanup;
+  g_deferred[g_nDeferred].arg = arg;
+  g_nDeferred++;
+}
+
+void Daemon_Release(void* arg) {
+  for (int i = g_nDeferred - 1; i >= 0; --i) {
+    if (g_deferred[i].arg == arg) {
+      Deferred d = g_deferred[i];
+      memmove(g_deferred + i, g_deferred + i + 1, sizeof(Deferred) * (g_nDeferred - i - 1));
+      g_nDeferred--;
+      d.cleanup(d.arg);
+      return;
+    }
+  }
+}
+
+// 释放 base 之后登记的资源
+static void releaseFrom(int base) {
+  while (g_nDeferred > base) {
+    Deferred d = g_deferred[--g_nDeferred];
+    d.cleanup(d.arg);
+  }
+}
+
+bool Daemon_InSession() {
+  return g_inSession;
+}
+
+bool Daemon_Serving() {
+  return g_serving;
+}
+
+void Daemon_EndSession(int status) {
+  // 退出码加1，与 setjmp 的首次返回值0区分
+  longjmp(g_session, status + 1);
+}
+
+// 逐字节读取一个请求，之后的字节留给命令作为输入
+static int readRequest(int fd, char* buf, int size) {
+  int len = 0;
+  char c;
+  while (read(fd, &c, 1) == 1) {
+    if (c == '\n') {
+      buf[len] = 0;
+      if (strncmp(buf, FPCLIENT_MAGIC "\x1f", strlen(FPCLIENT_MAGIC) + 1) == 0)
+        return len;
+      len = 0;    // 不是请求，忽略
+      continue;
+    }
+    if (len < size - 1)
+      buf[len++] = c;
+  }
+  return -1;
+}
+
+int Daemon_Run(DaemonHandler handler, int argc, char* argv[]) {
+  // 保存外层会话(如守护进程中执行批处理)
+  jmp_buf outer;
+  bool outerInSession = g_inSession;
+  memcpy(outer, g_session, sizeof(jmp_buf));
+
+  volatile int status = 0;
+  int base = g_nDeferred;
+  int code = setjmp(g_session);
+  if (code == 0) {
+    g_inSession = true;
+    handler(argc, argv);
+  }
+  else {
+    status = code - 1;
+  }
+
+  releaseFrom(base);
+  memcpy(g_session, outer, sizeof(jmp_buf));
+  g_inSession = outerInSession;
+  return status;
+}
+
+// 把命令的输出转发到连接，输出中的 0x1d、0x1e 转义，以免与结束标记混淆
+typedef struct {
+  int in;     // 管道的读端
+  int conn;
+} Relay;
+
+static void* relayThread(void* arg) {
+  Relay* relay = (Relay*)arg;
+  char buf[4096], esc[sizeof(buf) * 2];
+  int n;
+  while ((n = read(relay->in, buf, sizeof(buf))) > 0) {
+    int len = 0;
+    for (int i = 0; i < n; ++i) {
+      if (buf[i] == FPCLIENT_ESCAPE || buf[i] == FPCLIENT_END) {
+        esc[len++] = FPCLIENT_ESCAPE;
+        esc[len++] = buf[i] ^ 0x20;
+      }
+      else {
+        esc[len++] = buf[i];
+      }
+    }
+    // 客户端已断开时继续读取，命令不会因管道写满而阻塞
+    for (int off = 0; off < len; ) {
+      int w = write(relay->conn, esc + off, len - off);
+      if (w <= 0)
+        break;
+      off += w;
+    }
+  }
+  close(relay->in);
+  return NULL;
+}
+
+static int runSession(int conn, DaemonHandler handler, int argc, char* argv[]) {
+  // stdin 重定向到连接，stdout 经过转义后转发到连接
+  int pipeFd[2];
+  if (pipe(pipeFd) < 0)
+    return 1;
+  Relay relay = { pipeFd[0], conn };
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, relayThread, &relay) != 0) {
+    close(pipeFd[0]);
+    close(pipeFd[1]);
+    return 1;
+  }
+
+  fflush(stdout);
+  int savedIn = dup(STDIN_FILENO);
+  int savedOut = dup(STDOUT_FILENO);
+  dup2(conn, STDIN_FILENO);
+  dup2(pipeFd[1], STDOUT_FILENO);
+  close(pipeFd[1]);
+  clearerr(stdin);
+
+  int status = Daemon_Run(handler, argc, argv);
+
+  // 恢复，丢弃命令没有读取的输入
+  fflush(stdout);
+  __fpurge(stdin);
+  clearerr(stdin);
+  if (savedIn >= 0) {
+    dup2(savedIn, STDIN_FILENO);
+    close(savedIn);
+  }
+  else {
+    close(STDIN_FILENO);
+  }
+  if (savedOut >= 0) {
+    dup2(savedOut, STDOUT_FILENO);
+    close(savedOut);
+  }
+  else {
+    close(STDOUT_FILENO);
+  }
+
+  // 管道的写端全部关闭后，转发完剩余的输出
+  pthread_join(thread, NULL);
+  return status;
+}
+
+// 处理连接上的一个请求，连接已关闭时返回false
+static bool serveRequest(int conn, DaemonHandler handler, int homeFd) {
+  char request[FPCLIENT_MAX_REQUEST];
+  if (readRequest(conn, request, sizeof(request)) < 0)
+    return false;
+
+  // 拆分为 工作目录 和 argv
+  char* fields[FPCLIENT_MAX_ARGS + 3];
+  int n = 0;
+  for (char* p = request; p && n < FPCLIENT_MAX_ARGS + 2; ) {
+    fields[n++] = p;
+    p = strchr(p, '\x1f');
+    if (p)
+      *p++ = 0;
+  }
+
+  int status = 1;
+  if (n >= 3) {
+    if (chdir(fields[1]) != 0)
+      chdir("/");
+    fields[n] = NULL;
+    status = runSession(conn, handler, n - 2, fields + 2);
+    fchdir(homeFd);
+  }
+
+  char trailer[16];
+  int len = snprintf(trailer, sizeof(trailer), "%c%d\n", FPCLIENT_END, status);
+  return write(conn, trailer, len) == len;
+}
+
+bool Daemon_Serve(const char* path, DaemonHandler handler) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    printf("Socket path is too long: %s\n", path);
+    return false;
+  }
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("socket");
+    return false;
+  }
+
+  // 只允许当前用户连接
+  unlink(path);
+  mode_t mask = umask(0077);
+  int ret = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+  umask(mask);
+  if (ret < 0 || listen(fd, 8) < 0) {
+    perror("bind");
+    close(fd);
+    return false;
+  }
+
+  // 客户端提前断开时，写入不应终止进程
+  signal(SIGPIPE, SIG_IGN);
+  int homeFd = open(".", O_RDONLY);
+  g_serving = true;
+  printf("Listening on %s\n", path);
+  fflush(stdout);
+
+  // 可同时保持多个连接(如客户端库的长连接)，请求按到达顺序逐个执行
+  struct pollfd fds[DAEMON_MAX_CONNECTIONS + 1];
+  int nfds = 1;
+  fds[0].fd = fd;
+  fds[0].events = POLLIN;
+  while (true) {
+    if (poll(fds, nfds, -1) < 0)
+      continue;
+
+    for (int i = nfds - 1; i >= 1; --i) {
+      if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+        continue;
+      if (!serveRequest(fds[i].fd, handler, homeFd)) {
+        close(fds[i].fd);
+        fds[i] = fds[--nfds];
+      }
+    }
+
+    if (fds[0].revents & POLLIN) {
+      int conn = accept(fd, NULL, NULL);
+      if (conn >= 0 && nfds <= DAEMON_MAX_CONNECTIONS) {
+        fds[nfds].fd = conn;
+        fds[nfds].events = POLLIN;
+        fds[nfds].revents = 0;
+        nfds++;
+      }
+      else if (conn >= 0) {
+        close(conn);
+      }
+    }
+  }
+  return true;
+}
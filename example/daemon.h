@@ -0,0 +1,74 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+#ifndef __DAEMON_H__
+#define __DAEMON_H__
+
+#include <stdbool.h>
+
+/*
+ * 指纹守护进程的服务端，协议见 fpclient.h
+ *
+ * 串口只能由一个进程使用，所以可以同时保持多个连接，但请求按顺序逐个执行，
+ *   执行中的命令会阻塞其它连接的请求，没有超时。长时间运行的命令(如 watch、各种 bench)
+ *   由处理函数用 Daemon_Serving 判断后拒绝，需要停止守护进程后在命令行执行。
+ * 执行命令时 stdin/stdout 重定向到连接，命令处理函数与 fp 命令行相同，
+ *   命令中的 quit() 通过 Daemon_EndSession 返回到请求循环，而不是退出进程。
+ * longjmp 不会释放命令持有的资源(内存、文件、线程等)，守护进程长期运行，
+ *   所以命令获得资源后用 Daemon_Defer 登记，命令结束时(正常返回或 quit())由 Daemon_Run 释放。
+*/
+
+typedef void (*DaemonHandler)(int argc, char* argv[]);
+
+/*
+ * 在 path 上监听并处理请求，正常情况下不返回
+ * 返回值：false(无法监听，错误信息已输出)
+*/
+bool Daemon_Serve(const char* path, DaemonHandler handler);
+
+/*
+ * 执行一个命令，命令中的 quit() 返回到这里(可以嵌套，如守护进程中执行批处理)
+ * 返回值：命令的退出码
+*/
+int  Daemon_Run(DaemonHandler handler, int argc, char* argv[]);
+
+typedef void (*DaemonCleanup)(void* arg);
+
+/*
+ * 登记当前命令持有的资源，命令结束时按登记的相反顺序调用 cleanup(arg)
+ *   不在 Daemon_Run 中时(命令行直接执行)，quit() 退出进程，资源随进程释放
+*/
+void Daemon_Defer(DaemonCleanup cleanup, void* arg);
+
+// 立即释放一个已登记的资源并注销登记(命令正常执行完时使用)
+void Daemon_Release(void* arg);
+
+// 当前是否在执行某个命令
+bool Daemon_InSession();
+
+// 当前进程是否为守护进程(在 Daemon_Serve 中)
+bool Daemon_Serving();
+
+// 结束当前命令，status 为退出码
+void Daemon_EndSession(int status) __attribute__((noreturn));
+
+#endif // __DAEMON_H__
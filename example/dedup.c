@@ -0,0 +1,375 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+#include "./dedup.h"
+#include "./utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern AS608 g_as608;
+extern uchar g_error_code;
+
+// 并查集，根为组内页码最小的页
+static int findGroup(int* group, int page) {
+  while (group[page] != page) {
+    group[page] = group[group[page]];
+    page = group[page];
+  }
+  return page;
+}
+
+static void addPair(DedupReport* report, int a, int b, int score, bool identical) {
+  if (a > b) {
+    int t = a; a = b; b = t;
+  }
+  if (report->nPairs < DEDUP_MAX_PAIRS) {
+    report->pairs[report->nPairs].a = a;
+    report->pairs[report->nPairs].b = b;
+    report->pairs[report->nPairs].score = score;
+    report->pairs[report->nPairs].identical = identical;
+    report->nPairs++;
+  }
+
+  int ra = findGroup(report->group, a);
+  int rb = findGroup(report->group, b);
+  if (ra < rb)
+    report->group[rb] = ra;
+  else if (rb < ra)
+    report->group[ra] = rb;
+}
+
+// 初始化报告：已占用的页各自为一组
+static bool initReport(DedupReport* report) {
+  memset(report, 0, sizeof(DedupReport));
+  uchar bitmap[64] = { 0 };
+  if (!PS_ReadIndexBitmap(bitmap, 64))
+    return false;
+  report->nCommand++;
+
+  for (int page = 0; page < DEDUP_MAX_PAGES; ++page)
+    report->group[page] = -1;
+  for (int page = PS_NextUsedPage(0); page != -1 && page < DEDUP_MAX_PAGES; page = PS_NextUsedPage(page + 1)) {
+    report->group[page] = page;
+    report->nTemplates++;
+  }
+  return true;
+}
+
+// 结束时把每页的组号压缩为根
+static void finishReport(DedupReport* report, long long start) {
+  for (int page = 0; page < DEDUP_MAX_PAGES; ++page) {
+    if (report->group[page] != -1)
+      report->group[page] = findGroup(report->group, page);
+  }
+  report->timeUs = getTimeUs() - start;
+}
+
+bool Dedup_ScanModule(DedupReport* report) {
+  long long start = getTimeUs();
+  if (!initReport(report))
+    return false;
+
+  for (int page = PS_NextUsedPage(0); page != -1; page = PS_NextUsedPage(page + 1)) {
+    // 已是其他页的重复，它的重复页也会从组内页码最小的页找到
+    if (findGroup(report->group, page) != page)
+      continue;
+
+    if (!PS_LoadChar(1, page))
+      return false;
+    report->nCommand++;
+
+    // 只搜索其后的页，模块按页码顺序返回第一个达到阈值的页，找到后从下一页继续
+    int from = PS_NextUsedPage(page + 1);
+    while (from != -1) {
+      int pageID = 0, score = 0;
+      bool found = PS_Search(1, from, g_as608.capacity - from, &pageID, &score);
+      report->nCommand++;
+      report->nCompared++;
+      if (!found) {
+        if (g_error_code != 0x09)
+          return false;
+        break;
+      }
+      addPair(report, page, pageID, score, false);
+      from = PS_NextUsedPage(pageID + 1);
+    }
+  }
+
+  finishReport(report, start);
+  return true;
+}
+
+static bool readCharFile(const char* dir, int page, uchar* buf) {
+  char filename[256] = { 0 };
+  snprintf(filename, sizeof(filename), "%s/%d.char", dir, page);
+  FILE* fp = fopen(filename, "rb");
+  if (!fp)
+    return false;
+  int size = fread(buf, 1, 768, fp);
+  fclose(fp);
+  return size == 768;
+}
+
+bool Dedup_ScanHost(const char* dir, Matcher* matcher, DedupReport* report) {
+  long long start = getTimeUs();
+  if (!initReport(report))
+    return false;
+
+  unsigned char* checked = (unsigned char*)calloc(DEDUP_MAX_PAGES * DEDUP_MAX_PAGES / 8, 1);
+  if (!checked) {
+    g_error_code = 0xC1;
+    return false;
+  }
+
+  // 1.备份中内容相同的页，在模块上确认后判为重复
+  static SyncHash hashes[DEDUP_MAX_PAGES];
+  Sync_LoadStore(dir, hashes, DEDUP_MAX_PAGES);
+  for (int a = 0; a < DEDUP_MAX_PAGES; ++a) {
+    if (report->group[a] == -1 || hashes[a] == 0)
+      continue;
+    for (int b = a + 1; b < DEDUP_MAX_PAGES; ++b) {
+      if (report->group[b] == -1 || hashes[b] != hashes[a] || findGroup(report->group, b) != b)
+        continue;
+      int bit = a * DEDUP_MAX_PAGES + b;
+      checked[bit / 8] |= 1 << (bit % 8);
+
+      int score = 0;
+      bool matched = PS_LoadChar(1, a) && PS_LoadChar(2, b) && PS_Match(&score);
+      report->nCommand += 3;
+      report->nCompared++;
+      if (matched) {
+        addPair(report, a, b, score, true);
+        break;   // 同组的其余页由b继续找
+      }
+      if (g_error_code != 0x08) {
+        free(checked);
+        return false;
+      }
+    }
+  }
+
+  // 2.主机比对选出候选，在模块上确认；已确认过的页对不再比对
+  uchar tpl[768];
+  MatchResult results[DEDUP_CANDIDATES + 1];
+  for (int a = PS_NextUsedPage(0); a != -1 && a < DEDUP_MAX_PAGES; a = PS_NextUsedPage(a + 1)) {
+    if (hashes[a] == 0 || !readCharFile(dir, a, tpl))
+      continue;
+
+    int n = Matcher_Search(matcher, tpl, DEDUP_CANDIDATES + 1, 0, results);
+    int self = 0;
+    for (int i = 0; i < n; ++i) {
+      if (results[i].id == a)
+        self = results[i].score;
+    }
+
+    bool loaded = false;
+    for (int i = 0; i < n; ++i) {
+      int b = results[i].id;
+      if (b == a || b < 0 || b >= DEDUP_MAX_PAGES || report->group[b] == -1)
+        continue;
+      if (results[i].score * 100 < self * DEDUP_MIN_SHARE)
+        continue;
+      if (findGroup(report->group, a) == findGroup(report->group, b))
+        continue;
+      int lo = a < b ? a : b, hi = a < b ? b : a;
+      int bit = lo * DEDUP_MAX_PAGES + hi;
+      if (checked[bit / 8] & (1 << (bit % 8)))
+        continue;
+      checked[bit / 8] |= 1 << (bit % 8);
+
+      // 模块上精确比对
+      if (!loaded) {
+        if (!PS_LoadChar(1, a)) {
+          free(checked);
+          return false;
+        }
+        report->nCommand++;
+        loaded = true;
+      }
+      int score = 0;
+      bool matched = PS_LoadChar(2, b) && PS_Match(&score);
+      report->nCommand += 2;
+      report->nCompared++;
+      if (matched) {
+        addPair(report, a, b, score, false);
+      }
+      else if (g_error_code != 0x08) {
+        free(checked);
+        return false;
+      }
+    }
+  }
+
+  free(checked);
+  finishReport(report, start);
+  return true;
+}
+
+void Dedup_Print(const DedupReport* report) {
+  int nGroups = 0, nDuplicates = 0;
+  for (int root = 0; root < DEDUP_MAX_PAGES; ++root) {
+    int members = 0;
+    for (int page = root + 1; page < DEDUP_MAX_PAGES; ++page)
+      members += (report->group[page] == root);
+    if (report->group[root] != root || members == 0)
+      continue;
+
+    nGroups++;
+    nDuplicates += members;
+    printf("Group %d: keep %d, duplicates", nGroups, root);
+    for (int page = root + 1; page < DEDUP_MAX_PAGES; ++page) {
+      if (report->group[page] == root)
+        printf(" %d", page);
+    }
+    printf("\n");
+  }
+
+  for (int i = 0; i < report->nPairs; ++i) {
+    if (report->pairs[i].identical)
+      printf("  %d = %d (identical, score=%d)\n", report->pairs[i].a, report->pairs[i].b, report->pairs[i].score);
+    else
+      printf("  %d = %d (score=%d)\n", report->pairs[i].a, report->pairs[i].b, report->pairs[i].score);
+  }
+
+  long long allPairs = (long long)report->nTemplates * (report->nTemplates - 1) / 2;
+  printf("Templates: %d, duplicate groups: %d, duplicate pages: %d\n",
+      report->nTemplates, nGroups, nDuplicates);
+  printf("Compared on module: %d (all pairs: %lld), commands: %d, time: %lld ms\n",
+      report->nCompared, allPairs, report->nCommand, report->timeUs / 1000);
+}
+
+// 当前索引表的哈希
+static bool indexHash(SyncHash* hash) {
+  uchar bitmap[64] = { 0 };
+  if (!PS_ReadIndexBitmap(bitmap, 64))
+    return false;
+  *hash = Sync_Hash(bitmap, 64);
+  return true;
+}
+
+bool Dedup_Plan(const DedupReport* report, bool compact, DedupPlan* plan) {
+  memset(plan, 0, sizeof(DedupPlan));
+  if (!indexHash(&plan->index))
+    return false;
+
+  bool used[DEDUP_MAX_PAGES] = { false };
+  for (int page = 0; page < DEDUP_MAX_PAGES; ++page) {
+    if (report->group[page] == -1)
+      continue;
+    if (report->group[page] != page)
+      plan->deletePage[plan->nDelete++] = page;
+    else
+      used[page] = true;
+  }
+
+  if (!compact)
+    return true;
+
+  // 页码最大的模板移动到页码最小的空页
+  int lo = 0, hi = g_as608.capacity - 1;
+  if (hi >= DEDUP_MAX_PAGES)
+    hi = DEDUP_MAX_PAGES - 1;
+  while (true) {
+    while (lo < hi && used[lo])
+      lo++;
+    while (hi > lo && !used[hi])
+      hi--;
+    if (lo >= hi)
+      break;
+    plan->moveFrom[plan->nMove] = hi;
+    plan->moveTo[plan->nMove] = lo;
+    plan->nMove++;
+    used[lo] = true;
+    used[hi] = false;
+  }
+  return true;
+}
+
+bool Dedup_SavePlan(const char* filename, const DedupPlan* plan) {
+  FILE* fp = fopen(filename, "w+");
+  if (!fp) {
+    g_error_code = 0xC2;
+    return false;
+  }
+
+  fprintf(fp, "index %016llx\n", plan->index);
+  for (int i = 0; i < plan->nDelete; ++i)
+    fprintf(fp, "delete %d\n", plan->deletePage[i]);
+  for (int i = 0; i < plan->nMove; ++i)
+    fprintf(fp, "move %d %d\n", plan->moveFrom[i], plan->moveTo[i]);
+
+  fclose(fp);
+  return true;
+}
+
+bool Dedup_LoadPlan(const char* filename, DedupPlan* plan) {
+  memset(plan, 0, sizeof(DedupPlan));
+  FILE* fp = fopen(filename, "r");
+  if (!fp) {
+    g_error_code = 0xC2;
+    return false;
+  }
+
+  char line[64];
+  int a = 0, b = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    if (sscanf(line, "index %llx", &plan->index) == 1)
+      continue;
+    if (sscanf(line, "delete %d", &a) == 1 && plan->nDelete < DEDUP_MAX_PAGES)
+      plan->deletePage[plan->nDelete++] = a;
+    else if (sscanf(line, "move %d %d", &a, &b) == 2 && plan->nMove < DEDUP_MAX_PAGES) {
+      plan->moveFrom[plan->nMove] = a;
+      plan->moveTo[plan->nMove] = b;
+      plan->nMove++;
+    }
+  }
+
+  fclose(fp);
+  return true;
+}
+
+bool Dedup_Apply(const DedupPlan* plan) {
+  SyncHash hash = 0;
+  if (!indexHash(&hash))
+    return false;
+  if (hash != plan->index) {
+    g_error_code = 0xCD;
+    return false;
+  }
+
+  for (int i = 0; i < plan->nDelete; ++i) {
+    if (!PS_DeleteChar(plan->deletePage[i], 1))
+      return false;
+  }
+
+  // 先写入新位置，再删除旧位置
+  for (int i = 0; i < plan->nMove; ++i) {
+    if (!(PS_LoadChar(1, plan->moveFrom[i]) &&
+          PS_StoreChar(1, plan->moveTo[i]) &&
+          PS_DeleteChar(plan->moveFrom[i], 1)))
+      return false;
+    printf("Moved %d -> %d\n", plan->moveFrom[i], plan->moveTo[i]);
+  }
+  return true;
+}
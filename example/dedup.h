@@ -0,0 +1,99 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+#ifndef __DEDUP_H__
+#define __DEDUP_H__
+
+#include "../as608.h"
+#include "./matcher.h"
+#include "./sync.h"
+
+/*
+ * 指纹库查重：同一个手指被录入到多个页
+ *
+ * 逐对 PS_LoadChar + PS_Match 需要 O(n^2) 次指令往返，这里用两种方法剪枝：
+ *   Dedup_ScanModule：每页载入一次，用 PS_Search 在其后的页中搜索，
+ *     找到后从下一页继续搜索，指令往返次数约为 模板数 + 重复数。
+ *   Dedup_ScanHost：用主机上备份的特征文件("dir/[页码].char"，同 sync.h)，
+ *     内容相同的页和主机比对器(多线程)选出的少量候选，都在模块上 PS_Match 确认，
+ *     备份可能已过期(如页在备份之后重新录入)，不能只按备份判定重复。
+ * 查重结果可生成整理计划(删除重复页，可选地把模板移动到空页使页码连续)，
+ *   保存到文件，确认后再执行。
+*/
+
+#define DEDUP_MAX_PAGES   512
+#define DEDUP_MAX_PAIRS   1024
+#define DEDUP_CANDIDATES  4     // 主机预筛时每个模板最多确认的候选个数
+#define DEDUP_MIN_SHARE   20    // 候选的主机得分至少为自身得分的百分之几
+
+typedef struct _DedupPair {
+  int a;         // 页码较小的一页
+  int b;
+  int score;     // 模块比对得分
+  bool identical;   // 备份中的内容相同
+} DedupPair;
+
+typedef struct _DedupReport {
+  int nTemplates;                    // 参与查重的模板数
+  int nPairs;                        // 确认重复的对数
+  DedupPair pairs[DEDUP_MAX_PAIRS];
+  int group[DEDUP_MAX_PAGES];        // 每页所属重复组中页码最小的页，空页为-1
+  int nCompared;                     // 模块上的比对次数(PS_Match 或 每次搜索)
+  int nCommand;                      // 指令往返次数
+  long long timeUs;
+} DedupReport;
+
+typedef struct _DedupPlan {
+  SyncHash index;                    // 生成计划时索引表的哈希，执行前核对
+  int nDelete;
+  int deletePage[DEDUP_MAX_PAGES];
+  int nMove;
+  int moveFrom[DEDUP_MAX_PAGES];
+  int moveTo[DEDUP_MAX_PAGES];
+} DedupPlan;
+
+// 只用模块查重
+bool Dedup_ScanModule(DedupReport* report);
+
+// 用主机备份的特征文件剪枝，matcher为加载了dir的比对器
+bool Dedup_ScanHost(const char* dir, Matcher* matcher, DedupReport* report);
+
+// 输出重复组
+void Dedup_Print(const DedupReport* report);
+
+/*
+ * 生成整理计划：每个重复组保留页码最小的一页，其余删除
+ *   compact为true时，再把页码最大的模板依次移动到页码最小的空页，直到页码连续
+ *   (会改变模板的页码，使用纹型分段或热区时不要整理)
+*/
+bool Dedup_Plan(const DedupReport* report, bool compact, DedupPlan* plan);
+
+bool Dedup_SavePlan(const char* filename, const DedupPlan* plan);
+bool Dedup_LoadPlan(const char* filename, DedupPlan* plan);
+
+/*
+ * 执行整理计划，索引表与生成计划时不同则不执行(错误码0xCD)
+ * 返回值：true(成功)，false(出现错误，错误码见g_error_code)
+*/
+bool Dedup_Apply(const DedupPlan* plan);
+
+#endif // __DEDUP_H__
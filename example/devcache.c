@@ -0,0 +1,166 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+
+#include "./devcache.h"
+#include "./utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+extern AS608 g_as608;
+
+bool DevCache_Path(char* path, int size, const char* serial, uint chipAddr) {
+  // 串口路径中的 '/' 换为 '_'，如 /dev/ttyAMA0 为 dev_ttyAMA0
+  char name[64] = { 0 };
+  while (*serial == '/')
+    ++serial;
+  for (int i = 0; serial[i] && i < (int)sizeof(name) - 1; ++i)
+    name[i] = (serial[i] == '/') ? '_' : serial[i];
+  int len = snprintf(path, size, "%s/.fpdev_%08x_%s", getenv("HOME"), chipAddr, name);
+  return len >= 0 && len < size;
+}
+
+// 复制缓存中的字符串，超出长度时缓存无效
+static bool copyField(char* dst, int size, const char* value) {
+  int len = strlen(value);
+  if (len >= size)
+    return false;
+  memcpy(dst, value, len + 1);
+  return true;
+}
+
+// 串口设备文件的代数：设备号和 ctime
+static bool deviceGeneration(const char* serial, char* gen, int size) {
+  struct stat st;
+  if (stat(serial, &st) != 0)
+    return false;
+  snprintf(gen, size, "%llx:%lld.%09ld", (unsigned long long)st.st_rdev,
+           (long long)st.st_ctim.tv_sec, (long)st.st_ctim.tv_nsec);
+  return true;
+}
+
+bool DevCache_Load(const char* serial, uint chipAddr, DevCache* cache) {
+  char gen[64] = { 0 };
+  if (!deviceGeneration(serial, gen, sizeof(gen)))
+    return false;
+
+  char filename[PATH_MAX] = { 0 };
+  if (!DevCache_Path(filename, sizeof(filename), serial, chipAddr))
+    return false;
+  FILE* fp = fopen(filename, "r");
+  if (!fp)
+    return false;
+
+  memset(cache, 0, sizeof(DevCache));
+  bool sameSerial = false, sameGen = false, hasParams = false, fieldsOk = true;
+  char line[128] = { 0 };
+  char value[128] = { 0 };
+  while (fgets(line, sizeof(line), fp)) {
+    char* eq = strchr(line, '=');
+    if (!eq)
+      continue;
+    *eq = '\0';
+    trim(eq + 1, value);
+
+    if (strcmp(line, "serial") == 0)
+      sameSerial = (strcmp(value, serial) == 0);
+    else if (strcmp(line, "generation") == 0)
+      sameGen = (strcmp(value, gen) == 0);
+    else if (strcmp(line, "params") == 0)
+      hasParams = (sscanf(value, "%u %u %u %u %u %u", &cache->status, &cache->model,
+                          &cache->capacity, &cache->secure_level,
+                          &cache->packet_size, &cache->baud_rate) == 6);
+    else if (strcmp(line, "product_sn") == 0)
+      fieldsOk = copyField(cache->product_sn, sizeof(cache->product_sn), value) && fieldsOk;
+    else if (strcmp(line, "software_version") == 0)
+      fieldsOk = copyField(cache->software_version, sizeof(cache->software_version), value) && fieldsOk;
+    else if (strcmp(line, "manufacture") == 0)
+      fieldsOk = copyField(cache->manufacture, sizeof(cache->manufacture), value) && fieldsOk;
+    else if (strcmp(line, "sensor_name") == 0) {
+      fieldsOk = copyField(cache->sensor_name, sizeof(cache->sensor_name), value) && fieldsOk;
+      cache->has_info = true;
+    }
+  }
+  fclose(fp);
+
+  return sameSerial && sameGen && hasParams && fieldsOk && cache->packet_size > 0;
+}
+
+bool DevCache_Save(const char* serial, uint chipAddr, bool withInfo) {
+  char gen[64] = { 0 };
+  if (!deviceGeneration(serial, gen, sizeof(gen)))
+    return false;
+
+  char filename[PATH_MAX] = { 0 };
+  if (!DevCache_Path(filename, sizeof(filename), serial, chipAddr))
+    return false;
+  FILE* fp = fopen(filename, "w+");
+  if (!fp)
+    return false;
+
+  fprintf(fp, "serial=%s\n", serial);
+  fprintf(fp, "generation=%s\n", gen);
+  fprintf(fp, "params=%u %u %u %u %u %u\n", g_as608.status, g_as608.model,
+          g_as608.capacity, g_as608.secure_level, g_as608.packet_size, g_as608.baud_rate);
+  if (withInfo) {
+    fprintf(fp, "product_sn=%.8s\n", g_as608.product_sn);
+    fprintf(fp, "software_version=%.8s\n", g_as608.software_version);
+    fprintf(fp, "manufacture=%.8s\n", g_as608.manufacture);
+    fprintf(fp, "sensor_name=%.8s\n", g_as608.sensor_name);
+  }
+  fclose(fp);
+  return true;
+}
+
+void DevCache_Apply(const DevCache* cache) {
+  g_as608.status       = cache->status;
+  g_as608.model        = cache->model;
+  g_as608.capacity     = cache->capacity;
+  g_as608.secure_level = cache->secure_level;
+  g_as608.packet_size  = cache->packet_size;
+  g_as608.baud_rate    = cache->baud_rate;
+  if (cache->has_info) {
+    memcpy(g_as608.product_sn,       cache->product_sn,       sizeof(g_as608.product_sn));
+    memcpy(g_as608.software_version, cache->software_version, sizeof(g_as608.software_version));
+    memcpy(g_as608.manufacture,      cache->manufacture,      sizeof(g_as608.manufacture));
+    memcpy(g_as608.sensor_name,      cache->sensor_name,      sizeof(g_as608.sensor_name));
+  }
+}
+
+bool DevCache_Same(const DevCache* cache) {
+  return g_as608.model        == cache->model &&
+         g_as608.capacity     == cache->capacity &&
+         g_as608.secure_level == cache->secure_level &&
+         g_as608.packet_size  == cache->packet_size &&
+         g_as608.baud_rate    == cache->baud_rate;
+}
+
+void DevCache_Invalidate(const char* serial, uint chipAddr) {
+  char filename[PATH_MAX] = { 0 };
+  if (DevCache_Path(filename, sizeof(filename), serial, chipAddr))
+    unlink(filename);
+}
@@ -0,0 +1,70 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+
+#ifndef __DEVCACHE_H__
+#define __DEVCACHE_H__
+
+#include "../as608.h"
+
+/*
+ * 设备参数缓存：保存 PS_ReadSysPara 读取的参数和 INF 页中的字符串，
+ *   启动时从缓存恢复，省去读取系统参数(和 info 读取 512 字节 INF 页)的往返。
+ *
+ * 文件为 "~/.fpdev_[芯片地址]_[串口路径]"(如 .fpdev_ffffffff_dev_ttyAMA0)，按串口和芯片地址区分。
+ * 串口设备文件的设备号和 ctime 作为代数(重启、重新插拔后改变)，不一致时缓存失效。
+ * 模块单独重新上电不会改变代数，由调用者在第一次出错时重新读取参数(见 main.c 的 PS_Exit)。
+ * 修改参数的命令(波特率、安全等级、数据包大小、地址、密码)执行后应使缓存失效。
+*/
+
+typedef struct Dev_Cache {
+  uint status;
+  uint model;
+  uint capacity;
+  uint secure_level;
+  uint packet_size;
+  uint baud_rate;
+  bool has_info;              // 是否有 INF 页中的字符串
+  char product_sn[12];
+  char software_version[12];
+  char manufacture[12];
+  char sensor_name[12];
+} DevCache;
+
+// 缓存文件的路径，路径超出 size 时返回false
+bool DevCache_Path(char* path, int size, const char* serial, uint chipAddr);
+
+// 读取缓存，不存在或已失效返回false
+bool DevCache_Load(const char* serial, uint chipAddr, DevCache* cache);
+
+// 保存 g_as608 中的参数，withInfo 为 true 时同时保存 INF 页中的字符串
+bool DevCache_Save(const char* serial, uint chipAddr, bool withInfo);
+
+// 把缓存的参数写入 g_as608
+void DevCache_Apply(const DevCache* cache);
+
+// 比较缓存与 g_as608 中的参数(不包括状态寄存器)
+bool DevCache_Same(const DevCache* cache);
+
+void DevCache_Invalidate(const char* serial, uint chipAddr);
+
+#endif // __DEVCACHE_H__
@@ -0,0 +1,179 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+#include "./enroll.h"
+#include "./utils.h"
+
+#include <stdio.h>
+#include <string.h>
+
+extern int   g_verbose;
+extern uchar g_error_code;
+
+#define PAIR_UNKNOWN      -1
+#define PAIR_MERGE_FAILED -2
+
+static uchar g_samples[ENROLL_MAX_SAMPLES][768];
+
+// 两个样本的比对得分，PAIR_UNKNOWN 表示不可用或还没有比对
+static int g_pair[ENROLL_MAX_SAMPLES][ENROLL_MAX_SAMPLES];
+
+// CharBuffer1、CharBuffer2 中是哪个样本，-1表示未知
+static int g_inBuffer[3];
+
+static int* pair(int a, int b) {
+  return a < b ? &g_pair[a][b] : &g_pair[b][a];
+}
+
+// 把样本 i 下载到 CharBuffer[bufferID]，已在其中时不重复下载
+static bool loadSample(uchar bufferID, int i) {
+  if (g_inBuffer[bufferID] == i)
+    return true;
+  g_inBuffer[bufferID] = -1;
+  if (!PS_DownCharFromBuf(bufferID, g_samples[i], 768))
+    return false;
+  g_inBuffer[bufferID] = i;
+  return true;
+}
+
+/*
+ * 采集第i个样本，并与之前可用的样本逐个比对
+ *   生成特征失败(图像太乱、特征点太少)的样本不可用，不算出错
+*/
+static bool captureSample(int i, EnrollCapture capture, EnrollReport* report) {
+  report->best[i] = -1;
+  if (!capture(5000))
+    return false;
+
+  report->nSample++;
+  g_inBuffer[1] = -1;
+  if (!PS_GenChar(1)) {
+    if (g_error_code != 0x06 && g_error_code != 0x07 && g_error_code != 0x15)
+      return false;
+    report->nUnusable++;
+    return true;
+  }
+  if (!PS_UpCharToBuf(1, g_samples[i], 768))
+    return false;
+  g_inBuffer[1] = i;
+  report->best[i] = 0;
+
+  for (int j = 0; j < i; ++j) {
+    if (report->best[j] < 0)
+      continue;
+    if (!loadSample(2, j))
+      return false;
+    int score = 0;
+    report->nMatch++;
+    if (!PS_Match(&score)) {
+      if (g_error_code != 0x08)
+        return false;
+      score = 0;
+    }
+    *pair(i, j) = score;
+    if (score > report->best[i])
+      report->best[i] = score;
+    if (score > report->best[j])
+      report->best[j] = score;
+  }
+  return true;
+}
+
+/*
+ * 在前n个样本中按比对得分从高到低找一对能合并的样本
+ * 返回值：1(已合并)，0(没有)，-1(出错)
+*/
+static int selectPair(int n, EnrollReport* report) {
+  while (true) {
+    int a = -1, b = -1, best = ENROLL_MIN_SCORE - 1;
+    for (int i = 0; i < n; ++i) {
+      for (int j = i + 1; j < n; ++j) {
+        if (*pair(i, j) > best) {
+          best = *pair(i, j);
+          a = i;
+          b = j;
+        }
+      }
+    }
+    if (a == -1)
+      return 0;
+
+    if (!loadSample(1, a) || !loadSample(2, b))
+      return -1;
+    bool merged = PS_RegModel();
+    g_inBuffer[1] = g_inBuffer[2] = -1;
+    if (merged) {
+      report->first = a;
+      report->second = b;
+      report->score = best;
+      return 1;
+    }
+    if (g_error_code != 0x0a)
+      return -1;
+    *pair(a, b) = PAIR_MERGE_FAILED;
+  }
+}
+
+bool Enroll_Run(int nSamples, EnrollCapture capture, EnrollReport* report) {
+  memset(report, 0, sizeof(EnrollReport));
+  report->first = report->second = -1;
+  memset(g_pair, 0xff, sizeof(g_pair));   // PAIR_UNKNOWN
+  g_inBuffer[1] = g_inBuffer[2] = -1;
+  if (nSamples < 2)
+    nSamples = 2;
+  if (nSamples > ENROLL_MAX_SAMPLES)
+    nSamples = ENROLL_MAX_SAMPLES;
+
+  int verbose = g_verbose;
+  g_verbose = -1;   // 不显示上传、下载特征文件的进度条
+  long long start = getTimeUs();
+  int n = 0;
+  int ret = 0;
+  while (true) {
+    for (; n < nSamples; ++n) {
+      if (!captureSample(n, capture, report)) {
+        ret = -1;
+        break;
+      }
+    }
+    if (ret < 0)
+      break;
+    ret = selectPair(n, report);
+    if (ret != 0 || n == ENROLL_MAX_SAMPLES)
+      break;
+    nSamples = n + ENROLL_EXTRA_SAMPLES > ENROLL_MAX_SAMPLES ? ENROLL_MAX_SAMPLES : n + ENROLL_EXTRA_SAMPLES;
+  }
+  g_verbose = verbose;
+  report->timeUs = getTimeUs() - start;
+
+  // 可用但与合并的样本不一致的样本
+  if (ret == 1) {
+    for (int i = 0; i < n; ++i) {
+      if (i != report->first && i != report->second && report->best[i] >= 0 &&
+          *pair(report->first, i) >= 0 && *pair(report->first, i) < ENROLL_MIN_SCORE)
+        report->nRejected++;
+    }
+  }
+  if (ret == 0)
+    g_error_code = 0x0a;
+  return ret == 1;
+}
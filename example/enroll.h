@@ -0,0 +1,63 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+#ifndef __ENROLL_H__
+#define __ENROLL_H__
+
+#include "../as608.h"
+
+/*
+ * 多次采集录入：一次按压连续采集 N 个样本，选最好的两个合并为模板
+ *
+ * 每个样本由调用者的采集函数采集图像(如 capture.h 的 Capture_Image)，PS_GenChar(1) 后上传特征文件(768字节)，
+ *   生成特征失败的样本不可用。新样本还在 CharBuffer1 中时，与之前的样本逐个在模块上 PS_Match，
+ *   样本的好坏只按模块的比对得分判断(特征文件的布局未经核对，见 charfile.h，不用文件头中的字段)。
+ * 按比对得分从高到低尝试样本对，得分低于 ENROLL_MIN_SCORE 的两个样本不一致(如按偏、按压不完整)；
+ *   PS_RegModel 成功后结束，模板在 CharBuffer1 和 CharBuffer2 中，由调用者存储。
+ * 没有可合并的两个样本时再采集 ENROLL_EXTRA_SAMPLES 个，总数不超过 ENROLL_MAX_SAMPLES。
+*/
+
+#define ENROLL_DEFAULT_SAMPLES 4
+#define ENROLL_EXTRA_SAMPLES   2
+#define ENROLL_MAX_SAMPLES     8
+#define ENROLL_MIN_SCORE       50     // PS_Match 得分低于此值的两个样本认为不一致
+
+typedef struct _EnrollReport {
+  int  nSample;                       // 采集的样本个数
+  int  nUnusable;                     // 生成特征失败的样本
+  int  nRejected;                     // 与合并的第一个样本不一致而剔除的样本
+  int  nMatch;                        // PS_Match 的次数
+  int  best[ENROLL_MAX_SAMPLES];      // 每个样本与其他样本的最高比对得分，不可用为-1
+  int  first;                         // 合并的两个样本，失败时为-1
+  int  second;
+  int  score;                         // 合并的两个样本的比对得分
+  long long timeUs;
+} EnrollReport;
+
+// 等待手指按下(最长 timeoutMs 毫秒)并采集图像到 ImageBuffer，没有手指时 g_error_code 为 0x02
+typedef bool (*EnrollCapture)(int timeoutMs);
+
+// 采集 nSamples 个样本并合并，成功时模板在 CharBuffer1 和 CharBuffer2 中
+//   失败时 g_error_code 为最后一次出错的确认码，没有可合并的样本时为 0x0a
+bool Enroll_Run(int nSamples, EnrollCapture capture, EnrollReport* report);
+
+#endif // __ENROLL_H__
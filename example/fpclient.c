@@ -0,0 +1,198 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+#include "./fpclient.h"
+#include "./utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+bool FpClient_DefaultPath(char* path, int size, const char* serial, unsigned int chipAddr) {
+  const char* env = getenv("FP_SOCKET");
+  if (!env || !env[0])
+    return deviceFilePath(path, size, getenv("HOME"), ".fpsock_", chipAddr, serial);
+  int len = snprintf(path, size, "%s", env);
+  return len >= 0 && len < size;
+}
+
+int FpClient_Connect(const char* path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path))
+    return -1;
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+void FpClient_Close(int fd) {
+  if (fd >= 0)
+    close(fd);
+}
+
+static bool writeAll(int fd, const char* buf, int size) {
+  while (size > 0) {
+    int n = write(fd, buf, size);
+    if (n <= 0)
+      return false;
+    buf += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool sendRequest(int fd, int argc, char* const argv[]) {
+  char request[FPCLIENT_MAX_REQUEST];
+  char cwd[512] = "/";
+  getcwd(cwd, sizeof(cwd));
+
+  int len = snprintf(request, sizeof(request), "%s\x1f%s", FPCLIENT_MAGIC, cwd);
+  for (int i = 0; i < argc && len < (int)sizeof(request); ++i)
+    len += snprintf(request + len, sizeof(request) - len, "\x1f%s", argv[i]);
+  if (len + 1 >= (int)sizeof(request))
+    return false;
+  request[len++] = '\n';
+  return writeAll(fd, request, len);
+}
+
+/*
+ * 解析应答：0x1e 之前为命令的输出(去掉转义后保留在 buf 中)，之后为退出码
+ * 返回值：已找到退出码时返回true
+*/
+typedef struct _Reply {
+  bool inStatus;
+  bool escaped;   // 上一个字节是 FPCLIENT_ESCAPE
+  int  status;
+} Reply;
+
+static bool parseReply(Reply* reply, char* buf, int size, int* pOutput) {
+  int output = 0;
+  bool done = false;
+  for (int i = 0; i < size && !done; ++i) {
+    if (!reply->inStatus) {
+      if (reply->escaped) {
+        buf[output++] = buf[i] ^ 0x20;
+        reply->escaped = false;
+      }
+      else if (buf[i] == FPCLIENT_ESCAPE)
+        reply->escaped = true;
+      else if (buf[i] == FPCLIENT_END)
+        reply->inStatus = true;
+      else
+        buf[output++] = buf[i];
+    }
+    else if (buf[i] >= '0' && buf[i] <= '9') {
+      reply->status = reply->status * 10 + (buf[i] - '0');
+    }
+    else if (buf[i] == '\n') {
+      done = true;
+    }
+  }
+  *pOutput = output;
+  return done;
+}
+
+int FpClient_Call(int fd, int argc, char* const argv[], const char* input, char* out, int outSize) {
+  if (!sendRequest(fd, argc, argv))
+    return -1;
+  if (input && !writeAll(fd, input, strlen(input)))
+    return -1;
+
+  Reply reply = { false, false, 0 };
+  int outLen = 0;
+  char buf[4096];
+  while (true) {
+    int n = read(fd, buf, sizeof(buf));
+    if (n <= 0)
+      return -1;
+    int output = 0;
+    bool done = parseReply(&reply, buf, n, &output);
+    if (out && outSize > 0) {
+      int copy = output < outSize - 1 - outLen ? output : outSize - 1 - outLen;
+      memcpy(out + outLen, buf, copy);
+      outLen += copy;
+      out[outLen] = 0;
+    }
+    if (done)
+      return reply.status;
+  }
+}
+
+int FpClient_Run(const char* path, int argc, char* const argv[]) {
+  int fd = FpClient_Connect(path);
+  if (fd < 0)
+    return -1;
+  if (!sendRequest(fd, argc, argv)) {
+    close(fd);
+    return -1;
+  }
+
+  // 转发 stdin 到守护进程，守护进程的输出写到 stdout
+  struct pollfd fds[2] = { { fd, POLLIN, 0 }, { STDIN_FILENO, POLLIN, 0 } };
+  bool stdinOpen = true;
+  Reply reply = { false, false, 0 };
+  char buf[4096];
+  while (true) {
+    if (poll(fds, stdinOpen ? 2 : 1, -1) < 0)
+      break;
+
+    if (stdinOpen && (fds[1].revents & (POLLIN | POLLHUP))) {
+      int n = read(STDIN_FILENO, buf, sizeof(buf));
+      if (n <= 0 || !writeAll(fd, buf, n)) {
+        stdinOpen = false;
+        shutdown(fd, SHUT_WR);
+      }
+    }
+
+    if (fds[0].revents & (POLLIN | POLLHUP)) {
+      int n = read(fd, buf, sizeof(buf));
+      if (n <= 0)
+        break;
+      int output = 0;
+      bool done = parseReply(&reply, buf, n, &output);
+      fwrite(buf, 1, output, stdout);
+      fflush(stdout);
+      if (done) {
+        close(fd);
+        return reply.status;
+      }
+    }
+  }
+
+  // 守护进程在命令结束前断开(如崩溃)
+  close(fd);
+  fprintf(stderr, "Lost connection to the daemon\n");
+  return 2;
+}
@@ -0,0 +1,73 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+#ifndef __FPCLIENT_H__
+#define __FPCLIENT_H__
+
+#include <stdbool.h>
+
+/*
+ * 指纹守护进程(fp daemon)的客户端库
+ *
+ * 守护进程打开串口、初始化模块后常驻，通过 Unix 域套接字接收命令，
+ *   命令与 fp 的命令行参数相同，省去每次启动时读取配置、打开串口、握手的开销。
+ *
+ * 协议(每个连接可依次发送多个请求)：
+ *   请求：FPCLIENT_MAGIC 0x1f 工作目录 0x1f argv[0] 0x1f argv[1] ... '\n'
+ *     参数中不能含有 0x1f 和 '\n'；请求之后可以发送命令需要的输入(如确认 y/n)
+ *   应答：命令的输出，之后是 0x1e 退出码 '\n'
+ *     输出中的 0x1d、0x1e 转义为 0x1d (字节^0x20)，二进制输出(如记事本内容)不会被截断
+ *   不以 FPCLIENT_MAGIC 开头的行被忽略(如命令没有读取的多余输入)
+ * 文件名参数在守护进程中按请求的工作目录解析。
+*/
+
+#define FPCLIENT_MAGIC        "FP1"
+#define FPCLIENT_MAX_REQUEST  1024
+#define FPCLIENT_MAX_ARGS     32
+#define FPCLIENT_ESCAPE       '\x1d'
+#define FPCLIENT_END          '\x1e'
+
+// 默认的套接字路径：环境变量 FP_SOCKET，否则为 "~/.fpsock_[芯片地址]_[串口]"
+//   返回值：false(路径超出size)
+bool FpClient_DefaultPath(char* path, int size, const char* serial, unsigned int chipAddr);
+
+// 连接守护进程，返回套接字，失败返回-1
+int  FpClient_Connect(const char* path);
+void FpClient_Close(int fd);
+
+/*
+ * 执行一个命令
+ * 参数：argv(同 fp 的命令行参数，argv[0]为程序名)
+ *      input(命令需要的输入，可以为NULL)
+ *      out, outSize(保存命令的输出，超出部分被丢弃，可以为NULL)
+ * 返回值：命令的退出码，通信失败返回-1
+*/
+int  FpClient_Call(int fd, int argc, char* const argv[], const char* input, char* out, int outSize);
+
+/*
+ * 执行一个命令，输入输出与当前进程的 stdin/stdout 相连(fp 前端使用)
+ *   守护进程逐个执行请求，其它请求正在执行时等待它结束；watch 和 bench 命令被守护进程拒绝
+ * 返回值：命令的退出码，守护进程没有运行返回-1
+*/
+int  FpClient_Run(const char* path, int argc, char* const argv[]);
+
+#endif // __FPCLIENT_H__
@@ -0,0 +1,253 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+
+#include "./gpio.h"
+#include "./utils.h"
+
+#include <wiringPi.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+static GpioLine* s_isrLine = NULL;   // wiringPi 的中断函数没有参数，只支持一个引脚
+
+// 在 wiringPi 的中断线程中执行
+static void onEdge() {
+  GpioEvent event;
+  event.timeUs = getTimeUs();
+  event.level = (digitalRead(s_isrLine->pin) == HIGH);
+  write(s_isrLine->writeFd, &event, sizeof(event));   // 非阻塞，管道满时丢弃
+}
+
+static bool openPipe(GpioLine* line) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    perror("pipe");
+    return false;
+  }
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  fcntl(fds[1], F_SETFL, O_NONBLOCK);
+  line->fd = fds[0];
+  line->writeFd = fds[1];
+  return true;
+}
+
+static bool openWiringPi(GpioLine* line) {
+  if (s_isrLine) {
+    printf("Only one wiringPi input is supported\n");
+    return false;
+  }
+  pinMode(line->pin, INPUT);
+  if (!openPipe(line))
+    return false;
+
+  s_isrLine = line;
+  if (wiringPiISR(line->pin, INT_EDGE_BOTH, onEdge) < 0) {
+    fprintf(stderr, "Can not set up the interrupt on pin %d, polling instead\n", line->pin);
+    s_isrLine = NULL;
+    close(line->fd);
+    close(line->writeFd);
+    line->fd = line->writeFd = -1;
+    line->polling = true;
+  }
+  return true;
+}
+
+static bool openCdev(GpioLine* line, const char* chip) {
+  int chipFd = open(chip, O_RDONLY | O_CLOEXEC);
+  if (chipFd < 0) {
+    printf("Can not open %s: %s\n", chip, strerror(errno));
+    return false;
+  }
+
+  struct gpio_v2_line_request req;
+  memset(&req, 0, sizeof(req));
+  req.offsets[0] = line->pin;
+  req.num_lines = 1;
+  strcpy(req.consumer, "fp");
+  req.config.flags = GPIO_V2_LINE_FLAG_INPUT |
+                     GPIO_V2_LINE_FLAG_EDGE_RISING |
+                     GPIO_V2_LINE_FLAG_EDGE_FALLING;
+  req.config.num_attrs = 1;
+  req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+  req.config.attrs[0].attr.debounce_period_us = line->debounceUs;
+  req.config.attrs[0].mask = 1;
+
+  int ret = ioctl(chipFd, GPIO_V2_GET_LINE_IOCTL, &req);
+  if (ret < 0 && line->debounceUs > 0) {
+    // 不支持内核去抖，只在读取事件时去抖
+    req.config.num_attrs = 0;
+    ret = ioctl(chipFd, GPIO_V2_GET_LINE_IOCTL, &req);
+  }
+  if (ret < 0) {
+    // 不支持边沿事件，只请求输入，轮询电平
+    req.config.flags = GPIO_V2_LINE_FLAG_INPUT;
+    req.config.num_attrs = 0;
+    ret = ioctl(chipFd, GPIO_V2_GET_LINE_IOCTL, &req);
+    if (ret >= 0) {
+      fprintf(stderr, "No edge events on line %d of %s, polling instead\n", line->pin, chip);
+      line->polling = true;
+    }
+  }
+  close(chipFd);
+  if (ret < 0) {
+    printf("Can not request line %d of %s: %s\n", line->pin, chip, strerror(errno));
+    return false;
+  }
+
+  line->fd = req.fd;
+  fcntl(line->fd, F_SETFL, O_NONBLOCK);
+  return true;
+}
+
+bool Gpio_Open(GpioLine* line, const char* chip, int pin, int debounceUs) {
+  memset(line, 0, sizeof(GpioLine));
+  line->pin = pin;
+  line->fd = -1;
+  line->writeFd = -1;
+  line->debounceUs = debounceUs;
+
+  bool ok = false;
+  if (chip == NULL || chip[0] == '\0') {
+    line->backend = GPIO_WIRINGPI;
+    ok = openWiringPi(line);
+  }
+  else if (strcmp(chip, "fake") == 0) {
+    line->backend = GPIO_FAKE;
+    ok = openPipe(line);
+  }
+  else {
+    line->backend = GPIO_CDEV;
+    ok = openCdev(line, chip);
+  }
+  if (!ok) {
+    Gpio_Close(line);
+    return false;
+  }
+
+  line->level = Gpio_Read(line);
+  return true;
+}
+
+void Gpio_Close(GpioLine* line) {
+  if (line->backend == GPIO_WIRINGPI && s_isrLine == line)
+    return;   // wiringPi 不能注销中断，保留管道
+  if (line->fd >= 0)
+    close(line->fd);
+  if (line->writeFd >= 0)
+    close(line->writeFd);
+  line->fd = line->writeFd = -1;
+}
+
+bool Gpio_Read(GpioLine* line) {
+  switch (line->backend) {
+  case GPIO_WIRINGPI:
+    return digitalRead(line->pin) == HIGH;
+  case GPIO_FAKE:
+    return line->fakeLevel;
+  case GPIO_CDEV: {
+    struct gpio_v2_line_values values = { 0, 1 };
+    if (ioctl(line->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0)
+      return line->level;
+    return values.bits & 1;
+  }
+  }
+  return false;
+}
+
+// 读取一个原始边沿
+static bool readEvent(GpioLine* line, GpioEvent* event) {
+  if (line->backend != GPIO_CDEV)
+    return read(line->fd, event, sizeof(GpioEvent)) == sizeof(GpioEvent);
+
+  struct gpio_v2_line_event raw;
+  if (read(line->fd, &raw, sizeof(raw)) != sizeof(raw))
+    return false;
+  event->level = (raw.id == GPIO_V2_LINE_EVENT_RISING_EDGE);
+  event->timeUs = raw.timestamp_ns / 1000;   // 默认为 CLOCK_MONOTONIC
+  return true;
+}
+
+bool Gpio_NextEvent(GpioLine* line, GpioEvent* event) {
+  if (line->polling)
+    return false;
+  GpioEvent raw;
+  while (readEvent(line, &raw)) {
+    if (raw.level == line->level)
+      continue;
+    if (line->lastUs != 0 && raw.timeUs - line->lastUs < line->debounceUs)
+      continue;
+    line->level = raw.level;
+    line->lastUs = raw.timeUs;
+    *event = raw;
+    return true;
+  }
+  return false;
+}
+
+bool Gpio_WaitLevel(GpioLine* line, bool level, int timeoutMs, long long* pTimeUs) {
+  long long deadline = (timeoutMs < 0) ? -1 : getTimeUs() + timeoutMs * 1000LL;
+
+  while (true) {
+    // 先取出已经发生的边沿，再读取电平，之后的边沿一定可以 poll 到
+    long long edgeUs = 0;
+    GpioEvent event;
+    while (Gpio_NextEvent(line, &event)) {
+      if (event.level == level)
+        edgeUs = event.timeUs;
+    }
+
+    if (Gpio_Read(line) == level) {
+      if (pTimeUs)
+        *pTimeUs = edgeUs ? edgeUs : getTimeUs();
+      return true;
+    }
+
+    int wait = -1;
+    if (deadline >= 0) {
+      long long left = deadline - getTimeUs();
+      if (left <= 0)
+        return false;
+      wait = (int)((left + 999) / 1000);
+    }
+    if (line->polling) {
+      delay(wait >= 0 && wait < 100 ? wait : 100);
+      continue;
+    }
+    struct pollfd pfd = { line->fd, POLLIN, 0 };
+    poll(&pfd, 1, wait);
+  }
+}
+
+void Gpio_FakeSet(GpioLine* line, bool level) {
+  if (line->fakeLevel == level)
+    return;
+  line->fakeLevel = level;
+  GpioEvent event = { level, getTimeUs() };
+  write(line->writeFd, &event, sizeof(event));
+}
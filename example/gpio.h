@@ -0,0 +1,94 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+
+#ifndef __GPIO_H__
+#define __GPIO_H__
+
+#include <stdbool.h>
+
+/*
+ * 检测手指的 GPIO 输入(AS608 的 WAK 引脚)，按边沿事件等待，不轮询
+ *
+ * 后端：
+ *   wiringPi  wiringPiISR 注册中断，中断线程把边沿写入管道(默认，pin 为 wiringPi 引脚号)
+ *   cdev      Linux GPIO 字符设备(/dev/gpiochipN，v2 接口)，pin 为芯片的 line 偏移，
+ *               边沿时刻由内核记录，内核支持时由内核去抖
+ *   fake      进程内模拟，由 Gpio_FakeSet 产生边沿，用于测试和性能测试
+ *
+ * line.fd 在有边沿事件时可读，可以加入 poll/epoll。
+ * 无法注册中断或请求边沿事件时(没有权限、引脚被占用等)退回为轮询电平：
+ *   line.polling 为true，不能 poll line.fd，Gpio_WaitLevel 每100ms读取一次电平。
+ * 去抖：接受一个边沿后，debounceUs 内的边沿被忽略(不增加按下时的延时)，
+ *   需要准确的当前电平时使用 Gpio_Read。
+*/
+
+#define GPIO_DEBOUNCE_US 5000
+
+typedef enum {
+  GPIO_WIRINGPI,
+  GPIO_CDEV,
+  GPIO_FAKE
+} GpioBackend;
+
+typedef struct Gpio_Event {
+  bool level;         // 边沿之后的电平，true 为上升沿(手指按下)
+  long long timeUs;   // 边沿时刻，与 getTimeUs() 相同的时钟
+} GpioEvent;
+
+typedef struct Gpio_Line {
+  GpioBackend backend;
+  int  pin;
+  int  fd;            // 有边沿事件时可读
+  int  writeFd;       // wiringPi、fake：管道的写端
+  int  debounceUs;
+  bool polling;       // 没有边沿事件，轮询电平
+  bool level;         // 最近接受的边沿之后的电平
+  long long lastUs;   // 最近接受的边沿时刻
+  volatile bool fakeLevel;   // fake：当前电平(可能在其他线程中设置)
+} GpioLine;
+
+/*
+ * 打开输入引脚
+ * 参数：chip(NULL 或 "" 为 wiringPi，"fake" 为模拟，否则为字符设备路径)
+ * 返回值：false(无法读取该引脚，错误信息已输出)
+*/
+bool Gpio_Open(GpioLine* line, const char* chip, int pin, int debounceUs);
+void Gpio_Close(GpioLine* line);
+
+// 读取当前电平
+bool Gpio_Read(GpioLine* line);
+
+// 读取一个去抖之后的边沿(不阻塞)，没有返回false
+bool Gpio_NextEvent(GpioLine* line, GpioEvent* event);
+
+/*
+ * 等待电平变为 level
+ * 参数：timeoutMs(<0 表示一直等待)  pTimeUs(变化的时刻，已是该电平时为当前时刻，可以为NULL)
+ * 返回值：false(超时)
+*/
+bool Gpio_WaitLevel(GpioLine* line, bool level, int timeoutMs, long long* pTimeUs);
+
+// fake：设置电平，电平变化时产生一个边沿(可以在其他线程中调用)
+void Gpio_FakeSet(GpioLine* line, bool level);
+
+#endif // __GPIO_H__
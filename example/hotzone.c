@@ -0,0 +1,364 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+#include "./hotzone.h"
+#include "./utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern AS608 g_as608;
+extern uchar g_error_code;
+
+/*
+ * 模拟时使用的耗时估计，57600波特率
+ *   高速搜索找到后立即返回，耗时近似为 固定开销 + 已比对的页数 * 每页耗时
+*/
+#define SIM_SEARCH_BASE_MS   40    // 搜索指令的固定开销(收发、比对前的准备)
+#define SIM_SEARCH_PAGE_US   900   // 每比对一页
+#define SIM_MOVE_MS          200   // 交换两个模板(2次PS_LoadChar + 2次PS_StoreChar)
+
+void HotZone_Init(HotZone* hz, int capacity, int zoneSize) {
+  memset(hz, 0, sizeof(HotZone));
+  if (capacity <= 0 || capacity > HOTZONE_MAX_PAGES)
+    capacity = HOTZONE_MAX_PAGES;
+  if (zoneSize <= 0 || zoneSize > capacity)
+    zoneSize = capacity / 10;
+  hz->capacity = capacity;
+  hz->zoneSize = zoneSize;
+  for (int page = 0; page < HOTZONE_MAX_PAGES; ++page)
+    hz->user[page] = -1;
+}
+
+int HotZone_Find(const HotZone* hz, int user) {
+  for (int page = 0; page < hz->capacity; ++page) {
+    if (hz->user[page] == user)
+      return page;
+  }
+  return -1;
+}
+
+bool HotZone_Load(const char* filename, HotZone* hz) {
+  int zoneSize = hz->zoneSize;
+  HotZone_Init(hz, g_as608.capacity, zoneSize);
+
+  uchar bitmap[64] = { 0 };
+  if (!PS_ReadIndexBitmap(bitmap, 64))
+    return false;
+
+  FILE* fp = fopen(filename, "r");
+  if (fp) {
+    int page = 0, user = 0;
+    unsigned hits = 0;
+    int savedZoneSize = 0;
+    fscanf(fp, "%u %d", &hz->pending, &savedZoneSize);
+    // 未指定热区大小时使用上次的
+    if (zoneSize <= 0 && savedZoneSize > 0 && savedZoneSize <= hz->capacity)
+      hz->zoneSize = savedZoneSize;
+    while (fscanf(fp, "%d %d %u", &page, &user, &hits) == 3) {
+      // 以索引表为准，模块中已删除的页不再记录
+      if (page < 0 || page >= hz->capacity || !PS_IsPageUsed(page))
+        continue;
+      hz->user[page] = user;
+      hz->hits[page] = hits;
+    }
+    fclose(fp);
+  }
+
+  // 新录入的页，用户ID为页码；页码已被移动过的用户占用时，分配新的用户ID
+  int nextUser = hz->capacity;
+  for (int page = 0; page < hz->capacity; ++page) {
+    if (hz->user[page] >= nextUser)
+      nextUser = hz->user[page] + 1;
+  }
+  for (int page = PS_NextUsedPage(0); page != -1 && page < hz->capacity; page = PS_NextUsedPage(page + 1)) {
+    if (hz->user[page] != -1)
+      continue;
+    hz->user[page] = (HotZone_Find(hz, page) == -1) ? page : nextUser++;
+  }
+
+  return true;
+}
+
+bool HotZone_Save(const char* filename, const HotZone* hz) {
+  FILE* fp = fopen(filename, "w+");
+  if (!fp) {
+    g_error_code = 0xC2;
+    return false;
+  }
+
+  fprintf(fp, "%u %d\n", hz->pending, hz->zoneSize);
+  for (int page = 0; page < hz->capacity; ++page) {
+    if (hz->user[page] >= 0)
+      fprintf(fp, "%d %d %u\n", page, hz->user[page], hz->hits[page]);
+  }
+
+  fclose(fp);
+  return true;
+}
+
+bool HotZone_Identify(HotZone* hz, int* pUser, int* pPageID, int* pScore, bool* pHot) {
+  *pUser = -1;
+  *pPageID = 0;
+  *pScore = 0;
+  *pHot = false;
+
+  // 1.搜索热区
+  int page = -1;
+  int zoneUsed = PS_CountUsed(0, hz->zoneSize);
+  if (zoneUsed < 0)
+    return false;
+  if (zoneUsed > 0) {
+    if (PS_HighSpeedSearch(1, 0, hz->zoneSize, pPageID, pScore)) {
+      page = *pPageID;
+      *pHot = true;
+    }
+    else if (g_error_code != 0x09) {
+      return false;
+    }
+  }
+
+  // 2.按命中次数搜索其余的页
+  if (page == -1) {
+    PageRange ranges[8];
+    int n = PS_PlanSearch(ranges, 8, hz->hits);
+    if (n < 0)
+      return false;
+    for (int i = 0; i < n && page == -1; ++i) {
+      int start = ranges[i].start;
+      int end = ranges[i].start + ranges[i].count;
+      if (start < hz->zoneSize)
+        start = hz->zoneSize;
+      if (start >= end)
+        continue;
+      if (PS_HighSpeedSearch(1, start, end - start, pPageID, pScore))
+        page = *pPageID;
+      else if (g_error_code != 0x09)
+        return false;
+    }
+  }
+
+  if (page == -1) {
+    g_error_code = 0x09;
+    return false;
+  }
+
+  hz->pending++;
+  if (page < hz->capacity) {
+    hz->hits[page]++;
+    *pUser = hz->user[page];
+  }
+  return true;
+}
+
+bool HotZone_Due(const HotZone* hz) {
+  return hz->pending >= HOTZONE_COMPACT_EVERY;
+}
+
+// 交换两页的记录
+static void swapPage(HotZone* hz, int a, int b) {
+  int user = hz->user[a];
+  hz->user[a] = hz->user[b];
+  hz->user[b] = user;
+  unsigned hits = hz->hits[a];
+  hz->hits[a] = hz->hits[b];
+  hz->hits[b] = hits;
+}
+
+/*
+ * 整理热区
+ *   device为false时只更新记录，不操作模块(用于模拟)
+*/
+static int compact(HotZone* hz, int maxMoves, bool device) {
+  // 1.命中次数最多的zoneSize个页为热门页
+  int order[HOTZONE_MAX_PAGES];
+  int n = 0;
+  for (int page = 0; page < hz->capacity; ++page) {
+    if (hz->user[page] >= 0 && hz->hits[page] > 0)
+      order[n++] = page;
+  }
+  for (int i = 1; i < n; ++i) {
+    int page = order[i];
+    int j = i - 1;
+    while (j >= 0 && hz->hits[order[j]] < hz->hits[page]) {
+      order[j+1] = order[j];
+      j--;
+    }
+    order[j+1] = page;
+  }
+  if (n > hz->zoneSize)
+    n = hz->zoneSize;
+
+  bool hot[HOTZONE_MAX_PAGES] = { false };
+  for (int i = 0; i < n; ++i)
+    hot[order[i]] = true;
+
+  // 2.热区外的热门页，与热区中的空页或最冷的页交换
+  int moves = 0;
+  for (int i = 0; i < n && (maxMoves <= 0 || moves < maxMoves); ++i) {
+    int from = order[i];
+    if (from < hz->zoneSize)
+      continue;
+
+    int to = -1;
+    for (int page = 0; page < hz->zoneSize; ++page) {
+      if (hot[page])
+        continue;
+      if (to == -1 || hz->user[page] == -1 ||
+          (hz->user[to] != -1 && hz->hits[page] < hz->hits[to]))
+        to = page;
+      if (hz->user[to] == -1)
+        break;
+    }
+    if (to == -1)
+      break;
+
+    if (device) {
+      // 先写入新位置，再覆盖或删除旧位置
+      if (!PS_LoadChar(1, from))
+        return -1;
+      if (hz->user[to] != -1 && !PS_LoadChar(2, to))
+        return -1;
+      if (!PS_StoreChar(1, to))
+        return -1;
+      if (hz->user[to] != -1 ? !PS_StoreChar(2, from) : !PS_DeleteChar(from, 1))
+        return -1;
+    }
+    swapPage(hz, from, to);
+    hot[to] = true;
+    hot[from] = false;
+    moves++;
+  }
+
+  // 3.命中次数减半，使热区跟随访问规律的变化
+  for (int page = 0; page < hz->capacity; ++page)
+    hz->hits[page] >>= 1;
+  hz->pending = 0;
+  return moves;
+}
+
+int HotZone_Compact(HotZone* hz, int maxMoves) {
+  return compact(hz, maxMoves, true);
+}
+
+
+/******************************************************************
+ * 模拟
+******************************************************************/
+
+static int compareInt(const void* a, const void* b) {
+  return *(const int*)a - *(const int*)b;
+}
+
+// 按 Zipf 分布(指数为1)抽样，cdf为累积分布
+static int sampleZipf(const double* cdf, int n, unsigned* seed) {
+  double u = (double)rand_r(seed) / RAND_MAX;
+  int lo = 0, hi = n - 1;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (cdf[mid] < u)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// 在 [start, start+count) 中高速搜索page的耗时(微秒)
+static int searchUs(int start, int count, int page) {
+  int scanned = (page >= start && page < start + count) ? page - start + 1 : count;
+  return SIM_SEARCH_BASE_MS * 1000 + scanned * SIM_SEARCH_PAGE_US;
+}
+
+static void printLatency(const char* name, int* latencyUs, int n) {
+  long long sum = 0;
+  for (int i = 0; i < n; ++i)
+    sum += latencyUs[i];
+  qsort(latencyUs, n, sizeof(int), compareInt);
+  printf("%8s %9.1f %9.1f %9.1f %9.1f\n", name, (double)sum / n / 1000, latencyUs[n / 2] / 1000.0,
+      latencyUs[n * 9 / 10] / 1000.0, latencyUs[n * 99 / 100] / 1000.0);
+}
+
+void HotZone_Simulate(int users, int zoneSize, int accesses) {
+  if (users <= 0 || users > HOTZONE_MAX_PAGES || accesses <= 0 || zoneSize <= 0 || zoneSize > users)
+    return;
+
+  double* cdf = (double*)malloc(sizeof(double) * users);
+  int* full = (int*)malloc(sizeof(int) * accesses);
+  int* twoStage = (int*)malloc(sizeof(int) * accesses);
+  if (!cdf || !full || !twoStage) {
+    free(cdf); free(full); free(twoStage);
+    return;
+  }
+
+  double total = 0;
+  for (int i = 0; i < users; ++i)
+    total += 1.0 / (i + 1);
+  double acc = 0;
+  for (int i = 0; i < users; ++i) {
+    acc += 1.0 / (i + 1) / total;
+    cdf[i] = acc;
+  }
+
+  // 用户按录入顺序占满 [0, users)，热门程度与页码无关
+  static HotZone hz;
+  HotZone_Init(&hz, users, zoneSize);
+  for (int page = 0; page < users; ++page)
+    hz.user[page] = page;
+
+  unsigned seed = 2019;
+  int hotHits = 0, moves = 0, compactions = 0;
+  for (int i = 0; i < accesses; ++i) {
+    int user = (sampleZipf(cdf, users, &seed) * 7919) % users;
+
+    // 整个指纹库搜索，页码即用户ID
+    full[i] = searchUs(0, users, user);
+
+    // 先搜索热区，未命中再搜索其余的页
+    int page = HotZone_Find(&hz, user);
+    if (page < zoneSize) {
+      twoStage[i] = searchUs(0, zoneSize, page);
+      hotHits++;
+    }
+    else {
+      twoStage[i] = searchUs(0, zoneSize, page) + searchUs(zoneSize, users - zoneSize, page);
+    }
+    hz.hits[page]++;
+    if (++hz.pending >= HOTZONE_COMPACT_EVERY) {
+      moves += compact(&hz, 0, false);
+      compactions++;
+    }
+  }
+
+  printf("users=%d zone=%d accesses=%d (Zipf s=1), compact every %d identifications\n",
+      users, zoneSize, accesses, HOTZONE_COMPACT_EVERY);
+  printf("hot zone hit rate: %.1f%%, %d compactions moved %d templates (~%d ms idle time each)\n",
+      100.0 * hotHits / accesses, compactions, moves, compactions ? moves * SIM_MOVE_MS / compactions : 0);
+  printf("%8s %9s %9s %9s %9s\n", "search", "mean(ms)", "p50(ms)", "p90(ms)", "p99(ms)");
+  printLatency("full", full, accesses);
+  printLatency("hotzone", twoStage, accesses);
+
+  free(cdf);
+  free(full);
+  free(twoStage);
+}
@@ -0,0 +1,77 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+#ifndef __HOTZONE_H__
+#define __HOTZONE_H__
+
+#include "../as608.h"
+
+/*
+ * 热区识别：按命中次数把常用用户的模板集中到页码最小的 "热区"
+ *
+ * 主机记录每一页的命中次数和该页存放的用户ID(初始时用户ID即页码)，
+ *   保存在 "~/.fphot_[芯片地址]_[串口]"。
+ * 识别时先搜索热区 [0, zoneSize)，未命中再按命中次数搜索其余的页。
+ * 整理(HotZone_Compact)应在空闲时执行，用 PS_LoadChar/PS_StoreChar
+ *   把热门用户移入热区，把热区中不再热门的用户换出。
+*/
+
+#define HOTZONE_MAX_PAGES     512
+#define HOTZONE_COMPACT_EVERY 200   // 识别多少次后需要整理
+
+typedef struct _HotZone {
+  int capacity;
+  int zoneSize;
+  unsigned pending;                    // 上次整理后的识别次数
+  int      user[HOTZONE_MAX_PAGES];    // 页存放的用户ID，空页为-1
+  unsigned hits[HOTZONE_MAX_PAGES];    // 页的命中次数(每次整理后减半)
+} HotZone;
+
+void HotZone_Init(HotZone* hz, int capacity, int zoneSize);
+
+// 读写统计信息，并与模块的索引表核对；hz->zoneSize<=0 时使用上次的热区大小
+bool HotZone_Load(const char* filename, HotZone* hz);
+bool HotZone_Save(const char* filename, const HotZone* hz);
+
+// 查找用户所在的页，不存在返回-1
+int  HotZone_Find(const HotZone* hz, int user);
+
+/*
+ * 以 CharBuffer1 中的特征识别用户：先搜索热区，再搜索其余的页
+ * 参数：pUser, pPageID, pScore(识别结果)  pHot(是否在热区中命中)
+ * 返回值：true(识别成功)，false(未识别或出现错误，错误码见g_error_code)
+*/
+bool HotZone_Identify(HotZone* hz, int* pUser, int* pPageID, int* pScore, bool* pHot);
+
+// 是否需要整理
+bool HotZone_Due(const HotZone* hz);
+
+/*
+ * 整理热区，最多移动maxMoves个模板(<=0不限制)
+ * 返回值：移动的模板个数，出现错误返回-1(错误码见g_error_code)
+*/
+int  HotZone_Compact(HotZone* hz, int maxMoves);
+
+// 用合成的访问序列(Zipf分布)模拟整个指纹库搜索 与 热区优先搜索 的延时分布
+void HotZone_Simulate(int users, int zoneSize, int accesses);
+
+#endif // __HOTZONE_H__
@@ -0,0 +1,250 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+
+#include "./ioqueue.h"
+#include "./utils.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+
+extern AS608 g_as608;
+extern uchar g_error_code;
+
+// as608.c 中收发数据包的函数
+bool RecvPacket(uchar* pData, int validDataSize);
+bool SendPacket(uchar* pData, int validDataSize);
+
+// 执行一个指令，应答写入完成环
+static void execute(const IoRequest* req, IoCompletion* comp) {
+  comp->tag = req->tag;
+  comp->submitUs = req->submitUs;
+  comp->replySize = req->replySize;
+  comp->startUs = getTimeUs();
+  comp->ok = PS_Transact(req->order, req->orderSize, comp->reply, req->replySize);
+  comp->code = g_error_code;
+
+  // 确认码为0时才有后续的数据包
+  if (comp->ok && comp->code == 0x00 && req->dataDir != IO_DATA_NONE) {
+    if (req->dataDir == IO_DATA_IN)
+      comp->ok = RecvPacket(req->data, req->dataSize);
+    else
+      comp->ok = SendPacket(req->data, req->dataSize);
+    if (!comp->ok)
+      comp->code = g_error_code;
+  }
+  comp->doneUs = getTimeUs();
+}
+
+// 通道有待执行的指令，且完成环有空位
+static bool ready(IoChannel* c) {
+  unsigned head = atomic_load_explicit(&c->sqHead, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&c->sqTail, memory_order_acquire);
+  if (head == tail)
+    return false;
+  // 完成环已满时，等应用线程取走再处理
+  unsigned cqTail = atomic_load_explicit(&c->cqTail, memory_order_relaxed);
+  unsigned cqHead = atomic_load_explicit(&c->cqHead, memory_order_acquire);
+  return cqTail - cqHead < IOQUEUE_RING_SIZE;
+}
+
+// 按调度策略选择下一个执行的通道，没有返回-1
+static int pick(IoQueue* q, int n) {
+  int best = -1;
+  for (int k = 1; k <= n; ++k) {
+    int i = (q->last + k) % n;   // 从上次执行的下一个开始，同一优先级轮流执行
+    IoChannel* c = &q->channel[i];
+    if (!ready(c))
+      continue;
+    if (best == -1) {
+      best = i;
+      continue;
+    }
+
+    IoChannel* b = &q->channel[best];
+    if (q->policy == IOQUEUE_FIFO) {
+      unsigned head = atomic_load_explicit(&c->sqHead, memory_order_relaxed);
+      unsigned bestHead = atomic_load_explicit(&b->sqHead, memory_order_relaxed);
+      if (c->sq[head % IOQUEUE_RING_SIZE].submitUs < b->sq[bestHead % IOQUEUE_RING_SIZE].submitUs)
+        best = i;
+    }
+    else {
+      // 饿了太久的通道最先执行，其次是优先级高的
+      bool starving = c->skipped >= IOQUEUE_STARVE_LIMIT;
+      bool bestStarving = b->skipped >= IOQUEUE_STARVE_LIMIT;
+      if (starving != bestStarving ? starving : c->priority < b->priority)
+        best = i;
+    }
+  }
+
+  if (best != -1 && q->policy == IOQUEUE_PRIORITY) {
+    // 比选中的通道优先级低的通道记一次跳过
+    for (int i = 0; i < n; ++i) {
+      IoChannel* c = &q->channel[i];
+      if (i == best)
+        c->skipped = 0;
+      else if (c->priority > q->channel[best].priority && ready(c))
+        c->skipped++;
+    }
+  }
+  return best;
+}
+
+// 执行一个指令，没有可执行的指令返回false
+static bool serveOnce(IoQueue* q) {
+  int n = atomic_load_explicit(&q->nChannel, memory_order_acquire);
+  if (n > IOQUEUE_MAX_CHANNELS)
+    n = IOQUEUE_MAX_CHANNELS;
+  int i = (n > 0) ? pick(q, n) : -1;
+  if (i == -1)
+    return false;
+
+  IoChannel* c = &q->channel[i];
+  unsigned head = atomic_load_explicit(&c->sqHead, memory_order_relaxed);
+  unsigned cqTail = atomic_load_explicit(&c->cqTail, memory_order_relaxed);
+  execute(&c->sq[head % IOQUEUE_RING_SIZE], &c->cq[cqTail % IOQUEUE_RING_SIZE]);
+  atomic_store_explicit(&c->sqHead, head + 1, memory_order_release);
+  atomic_store_explicit(&c->cqTail, cqTail + 1, memory_order_release);
+  q->last = i;
+  return true;
+}
+
+static bool hasRequest(IoQueue* q) {
+  int n = atomic_load(&q->nChannel);
+  for (int i = 0; i < n && i < IOQUEUE_MAX_CHANNELS; ++i) {
+    if (ready(&q->channel[i]))
+      return true;
+  }
+  return false;
+}
+
+static void* ioThread(void* arg) {
+  IoQueue* q = (IoQueue*)arg;
+  while (atomic_load(&q->running)) {
+    if (serveOnce(q))
+      continue;
+
+    // 先声明睡眠再检查一次，提交方在入队后检查该标志，不会漏掉唤醒
+    atomic_store(&q->sleeping, true);
+    if (!hasRequest(q) && atomic_load(&q->running)) {
+      struct pollfd pfd = { q->wakeFd, POLLIN, 0 };
+      poll(&pfd, 1, 100);
+      eventfd_t value;
+      eventfd_read(q->wakeFd, &value);
+    }
+    atomic_store(&q->sleeping, false);
+  }
+  return NULL;
+}
+
+bool IoQueue_Start(IoQueue* q, int policy) {
+  memset(q, 0, sizeof(IoQueue));
+  q->policy = policy;
+  q->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (q->wakeFd < 0) {
+    perror("eventfd");
+    return false;
+  }
+  atomic_store(&q->running, true);
+  if (pthread_create(&q->thread, NULL, ioThread, q) != 0) {
+    printf("Can not create the I/O thread\n");
+    close(q->wakeFd);
+    return false;
+  }
+  return true;
+}
+
+void IoQueue_Stop(IoQueue* q) {
+  atomic_store(&q->running, false);
+  eventfd_write(q->wakeFd, 1);
+  pthread_join(q->thread, NULL);
+  close(q->wakeFd);
+}
+
+int IoQueue_Attach(IoQueue* q, int priority) {
+  int ch = atomic_fetch_add(&q->nChannel, 1);
+  if (ch >= IOQUEUE_MAX_CHANNELS) {
+    atomic_fetch_sub(&q->nChannel, 1);
+    return -1;
+  }
+  q->channel[ch].priority = priority;
+  return ch;
+}
+
+void IoQueue_Encode(IoRequest* req, uint tag, uchar orderCode, const uchar* params, int paramSize, int replyParams) {
+  req->tag = tag;
+  req->orderSize = PS_EncodeOrder(req->order, g_as608.chip_addr, orderCode, params, paramSize);
+  req->replySize = 12 + replyParams;
+  req->dataDir = IO_DATA_NONE;
+  req->data = NULL;
+  req->dataSize = 0;
+}
+
+void IoQueue_SetData(IoRequest* req, int dir, uchar* data, int size) {
+  req->dataDir = dir;
+  req->data = data;
+  req->dataSize = size;
+}
+
+bool IoQueue_Submit(IoQueue* q, int ch, IoRequest* req) {
+  IoChannel* c = &q->channel[ch];
+  unsigned tail = atomic_load_explicit(&c->sqTail, memory_order_relaxed);
+  unsigned head = atomic_load_explicit(&c->sqHead, memory_order_acquire);
+  if (tail - head == IOQUEUE_RING_SIZE)
+    return false;
+
+  req->submitUs = getTimeUs();
+  c->sq[tail % IOQUEUE_RING_SIZE] = *req;
+  atomic_store_explicit(&c->sqTail, tail + 1, memory_order_release);
+
+  // 与 I/O 线程声明睡眠的顺序一致(seq_cst)，I/O 线程睡眠时才唤醒
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load(&q->sleeping))
+    eventfd_write(q->wakeFd, 1);
+  return true;
+}
+
+bool IoQueue_Poll(IoQueue* q, int ch, IoCompletion* comp) {
+  IoChannel* c = &q->channel[ch];
+  unsigned head = atomic_load_explicit(&c->cqHead, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&c->cqTail, memory_order_acquire);
+  if (head == tail)
+    return false;
+
+  *comp = c->cq[head % IOQUEUE_RING_SIZE];
+  atomic_store_explicit(&c->cqHead, head + 1, memory_order_release);
+
+  // 完成环满时 I/O 线程会跳过该通道，腾出空位后可能需要唤醒它
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load(&q->sleeping))
+    eventfd_write(q->wakeFd, 1);
+  return true;
+}
+
+void IoQueue_Wait(IoQueue* q, int ch, IoCompletion* comp) {
+  while (!IoQueue_Poll(q, ch, comp))
+    sched_yield();
+}
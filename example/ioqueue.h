@@ -0,0 +1,139 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+
+#ifndef __IOQUEUE_H__
+#define __IOQUEUE_H__
+
+#include "../as608.h"
+
+#include <stdatomic.h>
+#include <pthread.h>
+
+/*
+ * I/O 线程模式：一个线程独占串口，应用线程通过无锁队列提交指令
+ *
+ * 每个应用(生产者)线程用 IoQueue_Attach 取得一个通道，通道有两个单生产者单消费者环：
+ *   提交环(应用线程 → I/O 线程)  完成环(I/O 线程 → 应用线程)
+ * 提交和取完成都只有原子读写，没有锁。I/O 线程空闲时在 eventfd 上睡眠，
+ *   提交时只有 I/O 线程正在睡眠才需要写 eventfd 唤醒。
+ *
+ * 指令由应用线程预先编码(IoQueue_Encode)，I/O 线程只负责收发(PS_Transact)。
+ *   应答后有数据包的指令(UpChar、DownChar 等)用 IoQueue_SetData 指定数据缓冲区。
+ * I/O 线程运行期间，其他线程不能调用 PS_* 函数。
+ *
+ * 调度：
+ *   IOQUEUE_FIFO      按提交的先后执行
+ *   IOQUEUE_PRIORITY  先执行优先级高的通道，同一优先级的通道轮流执行；
+ *                     低优先级的通道连续被跳过 IOQUEUE_STARVE_LIMIT 次后执行它一次
+ * 批量任务应拆成单个指令提交，高优先级的请求最多等待一个正在执行的指令。
+ *   同时执行的任务不能使用同一个特征缓冲区(如识别用 CharBuffer1，备份用 CharBuffer2)。
+*/
+
+#define IOQUEUE_RING_SIZE    64   // 2的幂
+#define IOQUEUE_MAX_CHANNELS 16
+#define IOQUEUE_STARVE_LIMIT 4
+
+// 调度策略
+#define IOQUEUE_FIFO     0
+#define IOQUEUE_PRIORITY 1
+
+// 优先级，数值小的优先
+#define IO_PRIO_LIVE  0   // 实时识别
+#define IO_PRIO_ADMIN 1   // 管理命令
+#define IO_PRIO_BULK  2   // 批量同步、备份
+
+// 数据包的方向
+#define IO_DATA_NONE 0
+#define IO_DATA_IN   1    // 应答后接收数据包(UpChar、UpImage)
+#define IO_DATA_OUT  2    // 应答后发送数据包(DownChar)
+
+typedef struct Io_Request {
+  uint  tag;          // 调用者的标识，原样返回
+  int   orderSize;
+  int   replySize;    // 应答包长度(12 + 返回参数的字节数)
+  uchar order[64];
+  int   dataDir;
+  uchar* data;        // 数据包的有效数据，执行完成前调用者不能释放
+  int   dataSize;
+  long long submitUs;
+} IoRequest;
+
+typedef struct Io_Completion {
+  uint  tag;
+  bool  ok;           // 收到检校和正确的应答包(及数据包)
+  uchar code;         // 确认码，ok 为 false 时为错误码
+  int   replySize;
+  uchar reply[64];
+  long long submitUs;
+  long long startUs;  // I/O 线程开始执行的时刻
+  long long doneUs;   // I/O 线程执行完成的时刻
+} IoCompletion;
+
+typedef struct Io_Channel {
+  _Alignas(64) atomic_uint sqHead;   // I/O 线程读取
+  _Alignas(64) atomic_uint sqTail;   // 应用线程写入
+  _Alignas(64) atomic_uint cqHead;   // 应用线程读取
+  _Alignas(64) atomic_uint cqTail;   // I/O 线程写入
+  int          priority;
+  int          skipped;              // 连续被跳过的次数(只由 I/O 线程访问)
+  IoRequest    sq[IOQUEUE_RING_SIZE];
+  IoCompletion cq[IOQUEUE_RING_SIZE];
+} IoChannel;
+
+typedef struct Io_Queue {
+  IoChannel   channel[IOQUEUE_MAX_CHANNELS];
+  atomic_int  nChannel;
+  atomic_bool running;
+  atomic_bool sleeping;   // I/O 线程是否在 eventfd 上睡眠
+  int         policy;
+  int         last;       // 上次执行的通道，同一优先级从它的下一个开始
+  int         wakeFd;
+  pthread_t   thread;
+} IoQueue;
+
+// 启动 I/O 线程，此后只有该线程使用串口，policy 为调度策略
+bool IoQueue_Start(IoQueue* q, int policy);
+void IoQueue_Stop(IoQueue* q);
+
+// 为一个应用线程分配优先级为 priority 的通道，返回通道号，已满返回-1
+int  IoQueue_Attach(IoQueue* q, int priority);
+
+/*
+ * 编码指令
+ * 参数：params, paramSize(指令参数，大端)  replyParams(应答包中返回参数的字节数)
+*/
+void IoQueue_Encode(IoRequest* req, uint tag, uchar orderCode, const uchar* params, int paramSize, int replyParams);
+
+// 指定应答后的数据包，dir 为 IO_DATA_IN 或 IO_DATA_OUT
+void IoQueue_SetData(IoRequest* req, int dir, uchar* data, int size);
+
+// 提交指令，提交环已满返回false
+bool IoQueue_Submit(IoQueue* q, int ch, IoRequest* req);
+
+// 取一个完成的指令，没有返回false
+bool IoQueue_Poll(IoQueue* q, int ch, IoCompletion* comp);
+
+// 等待一个完成的指令(自旋，让出 CPU)
+void IoQueue_Wait(IoQueue* q, int ch, IoCompletion* comp);
+
+#endif // __IOQUEUE_H__
@@ -0,0 +1,233 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+#include "./kvstore.h"
+
+#include <stdio.h>
+#include <string.h>
+
+extern uchar g_error_code;
+
+#define KV_HEADER_SIZE 4
+#define KV_VERSION     1
+
+static uchar checksum(const KVStore* kv) {
+  uchar count = 0;
+  for (int i = KV_HEADER_SIZE; i < KV_HEADER_SIZE + kv->used; ++i)
+    count += kv->data[i];
+  return count;
+}
+
+// 查找键，返回记录的偏移量，不存在返回-1
+static int find(const KVStore* kv, const char* key) {
+  int keyLen = strlen(key);
+  int offset = KV_HEADER_SIZE;
+  while (offset < KV_HEADER_SIZE + kv->used) {
+    int klen = kv->data[offset];
+    int vlen = kv->data[offset + 1];
+    if (klen == keyLen && memcmp(kv->data + offset + 2, key, klen) == 0)
+      return offset;
+    offset += 2 + klen + vlen;
+  }
+  return -1;
+}
+
+static void clear(KVStore* kv) {
+  memset(kv->data, 0, KV_SIZE);
+  kv->data[0] = 'K';
+  kv->data[1] = 'V';
+  kv->data[2] = KV_VERSION;
+  kv->used = 0;
+}
+
+bool KV_Open(KVStore* kv) {
+  memset(kv, 0, sizeof(KVStore));
+
+  // 逐页读取，直到遇到结束标记
+  int offset = KV_HEADER_SIZE;
+  bool formatted = true;
+  for (int page = 0; page < KV_PAGES; ++page) {
+    if (!PS_ReadNotepad(KV_FIRST_PAGE + page, kv->image + page * 32, 32))
+      return false;
+    kv->loaded[page] = true;
+
+    if (page == 0 && !(kv->image[0] == 'K' && kv->image[1] == 'V' && kv->image[2] == KV_VERSION)) {
+      formatted = false;
+      break;
+    }
+
+    // 跳过本页内完整的记录
+    int end = (page + 1) * 32;
+    while (offset < end && kv->image[offset] != 0) {
+      if (offset + 1 >= end)
+        break;    // 记录头跨页，读下一页
+      int next = offset + 2 + kv->image[offset] + kv->image[offset + 1];
+      if (next > KV_SIZE) {
+        g_error_code = 0xCB;
+        return false;
+      }
+      if (next > end)
+        break;    // 记录跨页，读下一页
+      offset = next;
+    }
+    if (offset < end && kv->image[offset] == 0)
+      break;
+  }
+
+  if (!formatted) {
+    clear(kv);
+    return true;
+  }
+
+  memcpy(kv->data, kv->image, KV_SIZE);
+  kv->used = offset - KV_HEADER_SIZE;
+  // 未读取的页不属于记录区，视为0
+  for (int i = offset; i < KV_SIZE; ++i)
+    kv->data[i] = 0;
+
+  if (checksum(kv) != kv->data[3]) {
+    g_error_code = 0xCB;
+    return false;
+  }
+  return true;
+}
+
+const uchar* KV_Get(const KVStore* kv, const char* key, int* pLen) {
+  int offset = find(kv, key);
+  if (offset < 0)
+    return NULL;
+  *pLen = kv->data[offset + 1];
+  return kv->data + offset + 2 + kv->data[offset];
+}
+
+bool KV_GetStr(const KVStore* kv, const char* key, char* value, int size) {
+  int len = 0;
+  const uchar* p = KV_Get(kv, key, &len);
+  if (!p || size <= 0)
+    return false;
+  if (len > size - 1)
+    len = size - 1;
+  memcpy(value, p, len);
+  value[len] = 0;
+  return true;
+}
+
+bool KV_Delete(KVStore* kv, const char* key) {
+  int offset = find(kv, key);
+  if (offset < 0)
+    return false;
+  int size = 2 + kv->data[offset] + kv->data[offset + 1];
+  int end = KV_HEADER_SIZE + kv->used;
+  memmove(kv->data + offset, kv->data + offset + size, end - offset - size);
+  memset(kv->data + end - size, 0, size);
+  kv->used -= size;
+  kv->data[3] = checksum(kv);
+  return true;
+}
+
+bool KV_Set(KVStore* kv, const char* key, const uchar* value, int len) {
+  int keyLen = strlen(key);
+  if (keyLen == 0 || keyLen > KV_MAX_KEY || len < 0 || len > 255) {
+    g_error_code = 0xC6;
+    return false;
+  }
+
+  // 值不变，不修改
+  int oldLen = 0;
+  const uchar* old = KV_Get(kv, key, &oldLen);
+  if (old && oldLen == len && memcmp(old, value, len) == 0)
+    return true;
+
+  // 需要保留结束标记的位置
+  int oldSize = old ? 2 + keyLen + oldLen : 0;
+  if (KV_HEADER_SIZE + kv->used - oldSize + 2 + keyLen + len + 1 > KV_SIZE) {
+    g_error_code = 0xCC;
+    return false;
+  }
+
+  KV_Delete(kv, key);
+  uchar* p = kv->data + KV_HEADER_SIZE + kv->used;
+  p[0] = keyLen;
+  p[1] = len;
+  memcpy(p + 2, key, keyLen);
+  memcpy(p + 2 + keyLen, value, len);
+  kv->used += 2 + keyLen + len;
+  kv->data[3] = checksum(kv);
+  return true;
+}
+
+bool KV_SetStr(KVStore* kv, const char* key, const char* value) {
+  return KV_Set(kv, key, (const uchar*)value, strlen(value));
+}
+
+bool KV_At(const KVStore* kv, int index, char* key, const uchar** pValue, int* pLen) {
+  int offset = KV_HEADER_SIZE;
+  for (int i = 0; offset < KV_HEADER_SIZE + kv->used; ++i) {
+    int klen = kv->data[offset];
+    int vlen = kv->data[offset + 1];
+    if (i == index) {
+      memcpy(key, kv->data + offset + 2, klen);
+      key[klen] = 0;
+      *pValue = kv->data + offset + 2 + klen;
+      *pLen = vlen;
+      return true;
+    }
+    offset += 2 + klen + vlen;
+  }
+  return false;
+}
+
+// 该页是否需要写回
+static bool pageDirty(const KVStore* kv, int page) {
+  const uchar* data = kv->data + page * 32;
+  if (kv->loaded[page])
+    return memcmp(data, kv->image + page * 32, 32) != 0;
+
+  // 未读取过的页，只有写入了新记录才需要写回
+  for (int i = 0; i < 32; ++i) {
+    if (data[i])
+      return true;
+  }
+  return false;
+}
+
+bool KV_Dirty(const KVStore* kv) {
+  for (int page = 0; page < KV_PAGES; ++page) {
+    if (pageDirty(kv, page))
+      return true;
+  }
+  return false;
+}
+
+int KV_Flush(KVStore* kv) {
+  int written = 0;
+  // 从后往前写，第0页(包含检校和)最后写入
+  for (int page = KV_PAGES - 1; page >= 0; --page) {
+    if (!pageDirty(kv, page))
+      continue;
+    if (!PS_WriteNotepad(KV_FIRST_PAGE + page, kv->data + page * 32, 32))
+      return -1;
+    memcpy(kv->image + page * 32, kv->data + page * 32, 32);
+    kv->loaded[page] = true;
+    written++;
+  }
+  return written;
+}
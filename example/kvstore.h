@@ -0,0 +1,75 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+#ifndef __KVSTORE_H__
+#define __KVSTORE_H__
+
+#include "../as608.h"
+
+/*
+ * 基于用户记事本的键值存储，用于在模块上保存少量元数据(如指纹库版本号、站点ID、同步进度)
+ *
+ * 使用记事本的第 KV_FIRST_PAGE~15 页，共 KV_SIZE 字节，按顺序紧凑存放：
+ *   [0~1] 魔数 'K' 'V'   [2] 格式版本   [3] 记录区的检校和(各字节之和的低8位)
+ *   [4~ ] 记录：[键长度 1字节][值长度 1字节][键][值]，键长度为0表示结束
+ *
+ * 打开时读取记事本直到结束标记所在的页(通常只需1页)，之后读取都在主机内存中完成；
+ * 修改只更新主机缓存，KV_Flush 时只重写内容发生变化的页。
+*/
+
+#define KV_FIRST_PAGE   8
+#define KV_PAGES        (16 - KV_FIRST_PAGE)
+#define KV_SIZE         (KV_PAGES * 32)
+#define KV_MAX_KEY      15
+
+typedef struct _KVStore {
+  uchar data[KV_SIZE];      // 当前内容(编码后)
+  uchar image[KV_SIZE];     // 模块中的内容
+  bool  loaded[KV_PAGES];   // image 中该页是否已从模块读取
+  int   used;               // data 中已使用的字节数(不含结束标记)
+} KVStore;
+
+// 从模块读取，记事本未格式化时得到空的存储
+bool KV_Open(KVStore* kv);
+
+// 读取，返回值的指针(在kv内部)和长度，不存在返回NULL
+const uchar* KV_Get(const KVStore* kv, const char* key, int* pLen);
+
+// 读取字符串，不存在返回false
+bool KV_GetStr(const KVStore* kv, const char* key, char* value, int size);
+
+// 写入(只修改主机缓存)
+bool KV_Set(KVStore* kv, const char* key, const uchar* value, int len);
+bool KV_SetStr(KVStore* kv, const char* key, const char* value);
+
+// 删除(只修改主机缓存)
+bool KV_Delete(KVStore* kv, const char* key);
+
+// 遍历，index从0开始，返回false表示结束
+bool KV_At(const KVStore* kv, int index, char* key, const uchar** pValue, int* pLen);
+
+// 是否有未写回的修改
+bool KV_Dirty(const KVStore* kv);
+
+// 写回内容发生变化的页，返回写入的页数，出错返回-1
+int  KV_Flush(KVStore* kv);
+
+#endif // __KVSTORE_H__
@@ -21,6 +21,28 @@
 
 #include "../as608.h"
 #include "./utils.h"
+#include "./sync.h"
+#include "./matcher.h"
+#include "./charfile.h"
+#include "./alloccount.h"
+#include "./vdb.h"
+#include "./kvstore.h"
+#include "./hotzone.h"
+#include "./classify.h"
+#include "./dedup.h"
+#include "./daemon.h"
+#include "./fpclient.h"
+#include "./batch.h"
+#include "./watch.h"
+#include "./gpio.h"
+#include "./devcache.h"
+#include "./ioqueue.h"
+#include "./bus.h"
+#include "./shard.h"
+#include "./replicate.h"
+#include "./site.h"
+#include "./enroll.h"
+#include "./capture.h"
 
 #include <wiringPi.h>
 #include <wiringSerial.h>
@@ -29,6 +51,13 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
 
 extern AS608 g_as608;
 extern int g_fd;
@@ -38,8 +67,13 @@ extern uchar g_error_code;
 
 int  g_argc = 0;   // 参数个数，g_argc = argc - g_option_count
 int  g_option_count = 0; // 选项个数-v、-h等
+bool g_assume_yes = false; // -y 选项，不询问确认
 char g_command[16] = { 0 };     // 即argv[1]
 Config g_config;   // 配置文件 结构体，定义在"./utils.h"头文件中
+GpioLine g_detect; // 检测手指的引脚，第一次需要时由 fingerCapture() 打开
+CaptureCtl g_capture;  // 按学习到的稳定时间采集图像
+bool g_detect_open = false;
+bool g_cached_setup = false;  // 以缓存的设备参数初始化，且还没有重新读取过
 
 void printConfig();
 void printUsage();
@@ -48,18 +82,110 @@ bool writeConfig(); // 将 g_config 写入文件
 void asyncConfig();
 void priorAnalyseArgv(int argc, char* argv[]);
 void analyseArgv(int argc, char* argv[]);
-
+void runCommand(int argc, char* argv[]);
+void printLatency(const char* name, long long* latencyUs, int n);
+void daemonBenchmark(int n, int cmdArgc, char* cmdArgv[]);
+void gpioBenchmark(int n);
+void ioBenchmark(int nThread, int n);
+void schedBenchmark(int n);
+void busBenchmark(uint* addrs, int nAddr, int n);
+void busProbe(uint* addrs, int nAddr, int rounds);
+void shardBenchmark(ShardSet* set, int n);
+void configDevices(const char* name, int argc, char* argv[]);
+void openDevices(const char* name, ShardSet* set);  // 读取模块列表(~/name)并打开所有模块，失败时退出
+void repBenchmark(ShardSet* doors, int n);
+void templateCacheBenchmark(int n);
+void printTemplateCache();
+void enrollBenchmark(int n);
+void captureBenchmark(int n);
+bool allocBenchmark(int rounds);
+
+bool confirm();     // 询问是否继续，默认为是
 bool waitUntilDetectFinger(int wait_time);   // 阻塞至检测到手指，最长阻塞wait_time毫秒
 bool waitUntilNotDetectFinger(int wait_time);
+bool captureImage(int wait_time);   // 等待手指按下并稳定后采集图像，最长等待wait_time毫秒
+void quit(int status) __attribute__((noreturn));
+static void homeStatePath(char* filename, int size, const char* prefix);  // 本模块的状态文件
+
+
+// 打开检测手指的引脚(注册中断有开销，也可能失败，只在需要等待手指的命令中打开)
+static CaptureCtl* fingerCapture() {
+  if (g_detect_open)
+    return &g_capture;
+  if (!Gpio_Open(&g_detect, g_config.detect_chip, g_config.detect_pin, GPIO_DEBOUNCE_US))
+    quit(1);
+  g_detect_open = true;
+  char capturePath[256] = { 0 };
+  homeStatePath(capturePath, sizeof(capturePath), ".fpcapture_");
+  Capture_Init(&g_capture, &g_detect, capturePath);
+  return &g_capture;
+}
+
+// PS_DetectFinger 使用的检测函数
+static bool detectFinger() {
+  return Gpio_Read(fingerCapture()->line);
+}
 
+// 以缓存的参数初始化后第一次出错时，重新读取设备参数，更新缓存
+static void refreshDevCache() {
+  if (!g_cached_setup)
+    return;
+  g_cached_setup = false;
+
+  // 丢弃出错时还没有接收完的数据
+  do {
+    serialFlush(g_fd);
+    delay(50);
+  } while (serialDataAvail(g_fd) > 0);
+
+  DevCache cached;
+  if (!DevCache_Load(g_config.serial, g_config.address, &cached) ||
+      !PS_Setup(g_config.address, g_config.password)) {
+    DevCache_Invalidate(g_config.serial, g_config.address);
+    return;
+  }
+  if (!DevCache_Same(&cached)) {
+    DevCache_Save(g_config.serial, g_config.address, false);
+    printf("Cached device parameters were stale and have been refreshed, please retry\n");
+  }
+}
 
 // 因为as608.h内的函数执行失败而退出程序
 bool PS_Exit() {
   printf("ERROR! code=%02X, desc=%s\n", g_error_code, PS_GetErrorDesc());
-  exit(2);
+  refreshDevCache();
+  quit(2);
   return true;
 }
 
+// 主目录下本模块的状态文件 "~/[prefix][芯片地址]_[串口]"，路径过长时退出
+static void homeStatePath(char* filename, int size, const char* prefix) {
+  if (!deviceFilePath(filename, size, getenv("HOME"), prefix, g_config.address, g_config.serial)) {
+    g_error_code = 0xC2;
+    PS_Exit();
+  }
+}
+
+// 结束当前命令：在会话中(守护进程、批处理)返回到会话，否则退出程序
+void quit(int status) {
+  if (Daemon_InSession())
+    Daemon_EndSession(status);
+  exit(status);
+}
+
+// 守护进程中命令提前结束(quit)时释放资源，见 Daemon_Defer
+static void closeShards(void* set) {
+  Shard_Close((ShardSet*)set);
+}
+
+static void destroyMatcher(void* matcher) {
+  Matcher_Destroy((Matcher*)matcher);
+}
+
+static void closeGpio(void* line) {
+  Gpio_Close((GpioLine*)line);
+}
+
 // 程序退出时执行的工作，关闭串口等
 void atExitFunc() {
   if (g_verbose == 1)
@@ -87,29 +213,48 @@ int main(int argc, char *argv[]) //int serialOpen (const char *device, const int
   if (g_verbose == 1)
     printConfig();
   
-  // 3.初始化wiringPi库
+  // 3.守护进程在运行时，把命令转发给它
+  if (strcmp(g_command, "daemon") != 0 && !getenv("FP_NO_DAEMON")) {
+    char path[108] = { 0 };
+    if (FpClient_DefaultPath(path, sizeof(path), g_config.serial, g_config.address)) {
+      int status = FpClient_Run(path, argc, argv);
+      if (status >= 0)
+        return status;
+    }
+  }
+
+  // 4.初始化wiringPi库
   if (-1 == wiringPiSetup()) {
     printf("wiringPi setup failed!\n");
     return 1;
   }
 
-  // 4.检测是否有手指放上的GPIO端口，设为输入模式
-  pinMode(g_config.detect_pin, INPUT);
+  // 5.检测是否有手指放上的GPIO端口，按边沿事件维护电平(第一次检测时才打开)
+  g_detect_finger = detectFinger;
 
-  // 5.打开串口
+  // 6.打开串口
 	if((g_fd = serialOpen(g_config.serial, g_config.baudrate)) < 0)	{
 		fprintf(stderr,"Unable to open serial device: %s\n", strerror(errno));
 		return 1;
 	}
 
-  // 6.注册退出函数(打印一些信息、关闭串口等)
+  // 7.注册退出函数(打印一些信息、关闭串口等)
   atexit(atExitFunc);
 
-  // 7.初始化 AS608 模块
-  // 地址 密码
-  PS_Setup(g_config.address, g_config.password) ||  PS_Exit();
+  // 8.初始化 AS608 模块
+  // 地址 密码，优先使用缓存的设备参数(不读取系统参数)
+  DevCache cache;
+  if (DevCache_Load(g_config.serial, g_config.address, &cache)) {
+    DevCache_Apply(&cache);
+    g_cached_setup = true;
+    PS_SetupCached(g_config.address, g_config.password) || PS_Exit();
+  }
+  else {
+    PS_Setup(g_config.address, g_config.password) ||  PS_Exit();
+    DevCache_Save(g_config.serial, g_config.address, false);
+  }
 
-  // 8.主处理函数，解析普通命令(argv[1])，
+  // 9.主处理函数，解析普通命令(argv[1])，
   analyseArgv(argc, argv);
 
 	return 0;
@@ -134,7 +279,7 @@ bool checkArgc(int argcNum) {
   else if (argcNum > 3)
     printf("ERROR! \"%s\" accept %d parameters\n", g_command, argcNum);
 
-  exit(1);
+  quit(1);
 }
 
 // 匹配argv[1], 即g_command
@@ -147,20 +292,24 @@ bool match(const char* str) {
 void priorAnalyseArgv(int argc, char* argv[]) {
   if (argc < 2) {
     printUsage();
-    exit(1);
+    quit(1);
   }
 
-  // 检查选项  -v -h
+  // 检查选项  -v -h -y
   for (int i = 0; i < argc; ++i) {
     if (strcmp(argv[i], "-h") == 0) {
       printUsage();
       g_option_count++;
-      exit(0);
+      quit(0);
     }
     else if (strcmp(argv[i], "-v") == 0) {
       g_verbose = 1;
       g_option_count++;
     }
+    else if (strcmp(argv[i], "-y") == 0) {
+      g_assume_yes = true;
+      g_option_count++;
+    }
   }
   
   g_argc = argc - g_option_count;
@@ -168,7 +317,7 @@ void priorAnalyseArgv(int argc, char* argv[]) {
 
   if (match("cfg")) {
     printConfig();
-    exit(0);
+    quit(0);
   }
 
   // 配置通信地址
@@ -176,7 +325,7 @@ void priorAnalyseArgv(int argc, char* argv[]) {
     checkArgc(3);
     g_config.address = toUInt(argv[2]);
     writeConfig();
-    exit(0);
+    quit(0);
   }
 
   // 配置通信密码
@@ -185,7 +334,7 @@ void priorAnalyseArgv(int argc, char* argv[]) {
     g_config.password = toUInt(argv[2]);
     g_config.has_password = 1;
     writeConfig();
-    exit(0);
+    quit(0);
   }
 
   // 配置串口号
@@ -193,134 +342,1247 @@ void priorAnalyseArgv(int argc, char* argv[]) {
     checkArgc(3);
     strcpy(g_config.serial, argv[2]);
     writeConfig();
-    exit(0);
+    quit(0);
   }
 
   else if (match("cfgbaud")) {
     checkArgc(3);
     g_config.baudrate = toInt(argv[2]);
     writeConfig();
-    exit(0);
+    quit(0);
+  }
+
+  // 配置分片列表、门禁模块列表，无参数时显示
+  else if (match("cfgshard") || match("cfgdoor")) {
+    configDevices(match("cfgshard") ? ".fpshards" : ".fpdoors", argc, argv);
+    quit(0);
   }
 
   else if (match("cfgpin")) {
-    checkArgc(3);
+    if (g_argc != 3 && g_argc != 4) {
+      printf("Command \"cfgpin\" accept 1 or 2 parameters\n");
+      printf("  Usage: fp cfgpin GPIO_pin [/dev/gpiochipN|fake|wiringpi]\n");
+      quit(1);
+    }
     g_config.detect_pin = toInt(argv[2]);
+    if (g_argc == 4) {
+      if (strcmp(argv[3], "wiringpi") == 0)
+        g_config.detect_chip[0] = '\0';
+      else if (strlen(argv[3]) < sizeof(g_config.detect_chip))
+        strcpy(g_config.detect_chip, argv[3]);
+      else {
+        printf("Chip path is too long\n");
+        quit(1);
+      }
+    }
     writeConfig();
-    exit(0);
+    quit(0);
+  }
+
+  // 主机端比对的性能测试，不需要与模块通信
+  else if (match("matchbench")) {
+    Matcher_Benchmark(g_argc == 3 ? toInt(argv[2]) : 0);
+    quit(0);
+  }
+
+  // 解析本地的特征文件
+  else if (match("chardump")) {
+    checkArgc(3);
+    uchar buf[CHARFILE_SIZE] = { 0 };
+    FILE* fp = fopen(argv[2], "rb");
+    if (!fp || fread(buf, 1, CHARFILE_SIZE, fp) != CHARFILE_SIZE) {
+      printf("Read char file error\n");
+      if (fp)
+        fclose(fp);
+      quit(1);
+    }
+    fclose(fp);
+
+    CharFeatures features;
+    CharFile_Decode(buf, CHARFILE_SIZE, &features);
+    CharFile_Print(&features);
+    quit(0);
+  }
+
+  // 模拟虚拟指纹库的命中率和识别延时
+  else if (match("vdbsim")) {
+    int users    = (g_argc >= 3) ? toInt(argv[2]) : 5000;
+    int capacity = (g_argc >= 4) ? toInt(argv[3]) : 300;
+    int accesses = (g_argc >= 5) ? toInt(argv[4]) : 100000;
+    Vdb_Simulate(users, capacity, accesses);
+    quit(0);
+  }
+  else if (match("classify")) {
+    checkArgc(3);
+    static uchar image[CLASSIFY_WIDTH * CLASSIFY_HEIGHT];
+    Classify_LoadBmp(argv[2], image) || PS_Exit();
+    ClassifyResult result;
+    if (!Classify_Image(image, &result)) {
+      printf("Error: Fingerprint area is too small to classify!\n");
+      quit(1);
+    }
+    printf("Pattern: %s (foreground %.0f%%)\n", Classify_Name(result.cls), result.foreground * 100);
+    for (int i = 0; i < result.nCore; ++i)
+      printf("  core  (%d, %d)\n", result.core[i].x, result.core[i].y);
+    for (int i = 0; i < result.nDelta; ++i)
+      printf("  delta (%d, %d)\n", result.delta[i].x, result.delta[i].y);
+    quit(0);
+  }
+  else if (match("daemonbench")) {
+    int n = (g_argc >= 3) ? toInt(argv[2]) : 20;
+    daemonBenchmark(n > 0 ? n : 20, g_argc - 3, argv + 3);
+    quit(0);
+  }
+  else if (match("gpiobench")) {
+    int n = (g_argc == 3) ? toInt(argv[2]) : 20;
+    gpioBenchmark(n > 0 ? n : 20);
+    quit(0);
+  }
+  else if (match("classbench")) {
+    Classify_Benchmark((g_argc == 3) ? toInt(argv[2]) : 300);
+    quit(0);
+  }
+  else if (match("hotsim")) {
+    int users    = (g_argc >= 3) ? toInt(argv[2]) : 300;
+    int zoneSize = (g_argc >= 4) ? toInt(argv[3]) : 30;
+    int accesses = (g_argc >= 5) ? toInt(argv[4]) : 100000;
+    HotZone_Simulate(users, zoneSize, accesses);
+    quit(0);
+  }
+
+  // 站点间同步的服务端和性能测试，不需要与模块通信
+  else if (match("siteserve")) {
+    if (g_argc != 3 && g_argc != 4) {
+      printf("Command \"siteserve\" accept 1 or 2 parameter\n");
+      printf("  Usage: fp siteserve dir [port]\n");
+      quit(1);
+    }
+    int port = (g_argc == 4) ? toInt(argv[3]) : SITE_PORT;
+    Site_Serve(argv[2], port, -1);
+    quit(1);
+  }
+  else if (match("sitebench")) {
+    Site_Benchmark((g_argc == 3) ? toInt(argv[2]) : 300);
+    quit(0);
+  }
+}
+
+// 询问是否继续，默认为是，-y 时不询问
+bool confirm() {
+  if (g_assume_yes) {
+    printf("y\n");
+    return true;
   }
+  fflush(stdout);
+  int c = getchar();
+  return c != 'n' && c != 'N';
 }
 
-// 阻塞至检测到手指，最长阻塞wait_time毫秒
+// 阻塞至检测到手指，最长阻塞wait_time毫秒(等待边沿事件，不轮询)
 bool waitUntilDetectFinger(int wait_time) {
-  while (true) {
-    if (PS_DetectFinger()) {
-      return true;
+  return Gpio_WaitLevel(fingerCapture()->line, true, wait_time, NULL);
+}
+
+bool waitUntilNotDetectFinger(int wait_time) {
+  return Gpio_WaitLevel(fingerCapture()->line, false, wait_time, NULL);
+}
+
+bool captureImage(int wait_time) {
+  return Capture_Image(fingerCapture(), wait_time, NULL);
+}
+
+// PS_Enroll、PS_Identify 由模块自动采集，同样按学习到的稳定时间开始，0x02 时重试
+static int g_auto_page = 0, g_auto_score = 0;
+static bool enrollOp() {
+  return PS_Enroll(&g_auto_page);
+}
+static bool identifyOp() {
+  return PS_Identify(&g_auto_page, &g_auto_score);
+}
+
+
+static int compareLongLong(const void* a, const void* b) {
+  long long x = *(const long long*)a, y = *(const long long*)b;
+  return x < y ? -1 : (x > y);
+}
+
+// 输出延时的平均值和p99，单位为毫秒
+void printLatency(const char* name, long long* latencyUs, int n) {
+  long long sum = 0;
+  for (int i = 0; i < n; ++i)
+    sum += latencyUs[i];
+  qsort(latencyUs, n, sizeof(long long), compareLongLong);
+  printf("%-8s %10.1f %10.1f\n", name, (double)sum / n / 1000, latencyUs[n * 99 / 100] / 1000.0);
+}
+
+// 运行 n 次 fp 命令，nodaemon 为 true 时不使用守护进程
+static void runProcess(char* args[], bool nodaemon, long long* latencyUs, int n) {
+  for (int i = 0; i < n; ++i) {
+    long long start = getTimeUs();
+    pid_t pid = fork();
+    if (pid == 0) {
+      if (nodaemon)
+        setenv("FP_NO_DAEMON", "1", 1);
+      else
+        unsetenv("FP_NO_DAEMON");
+      int null = open("/dev/null", O_RDWR);
+      dup2(null, STDIN_FILENO);
+      dup2(null, STDOUT_FILENO);
+      execv("/proc/self/exe", args);
+      _exit(127);
     }
-    else {
-      delay(100);
-      wait_time -= 100;
-      if (wait_time < 0) {
-        return false;
+    int status = 0;
+    waitpid(pid, &status, 0);
+    latencyUs[i] = getTimeUs() - start;
+  }
+}
+
+/*
+ * 比较 每次启动fp(冷启动)、fp前端转发给守护进程、客户端库直接请求 的延时
+ *   串口同一时刻只能由一个进程使用，所以守护进程已运行时跳过冷启动的测试，
+ *   否则先测试冷启动，再启动一个临时的守护进程
+*/
+void daemonBenchmark(int n, int cmdArgc, char* cmdArgv[]) {
+  char* args[FPCLIENT_MAX_ARGS + 2] = { "fp", "count" };
+  int argc = 2;
+  if (cmdArgc > 0) {
+    argc = 1;
+    for (int i = 0; i < cmdArgc && argc < FPCLIENT_MAX_ARGS; ++i)
+      args[argc++] = cmdArgv[i];
+  }
+  args[argc] = NULL;
+
+  long long* latency = (long long*)malloc(sizeof(long long) * n);
+  printf("Command: fp");
+  for (int i = 1; i < argc; ++i)
+    printf(" %s", args[i]);
+  printf(", %d times\n", n);
+  printf("%-8s %10s %10s\n", "", "mean(ms)", "p99(ms)");
+
+  char path[108] = { 0 };
+  if (!FpClient_DefaultPath(path, sizeof(path), g_config.serial, g_config.address)) {
+    printf("The socket path is too long\n");
+    free(latency);
+    return;
+  }
+  int fd = FpClient_Connect(path);
+  pid_t daemon = 0;
+  if (fd < 0) {
+    runProcess(args, true, latency, n);
+    printLatency("cold", latency, n);
+
+    // 临时的守护进程，等待其完成初始化
+    snprintf(path, sizeof(path), "/tmp/.fpsock_bench_%d", (int)getpid());
+    setenv("FP_SOCKET", path, 1);
+    daemon = fork();
+    if (daemon == 0) {
+      int null = open("/dev/null", O_RDWR);
+      dup2(null, STDOUT_FILENO);
+      execl("/proc/self/exe", "fp", "daemon", path, (char*)NULL);
+      _exit(127);
+    }
+    for (int i = 0; i < 500 && fd < 0; ++i) {
+      delay(10);
+      fd = FpClient_Connect(path);
+    }
+    if (fd < 0) {
+      printf("Failed to start the daemon\n");
+      kill(daemon, SIGTERM);
+      free(latency);
+      return;
+    }
+  }
+  else {
+    printf("%-8s (skipped, the daemon is using the serial port)\n", "cold");
+  }
+
+  runProcess(args, false, latency, n);
+  printLatency("fp", latency, n);
+
+  for (int i = 0; i < n; ++i) {
+    long long start = getTimeUs();
+    if (FpClient_Call(fd, argc, args, NULL, NULL, 0) < 0) {
+      printf("Lost connection to the daemon\n");
+      break;
+    }
+    latency[i] = getTimeUs() - start;
+  }
+  printLatency("library", latency, n);
+
+  FpClient_Close(fd);
+  if (daemon > 0) {
+    kill(daemon, SIGTERM);
+    waitpid(daemon, NULL, 0);
+    unlink(path);
+  }
+  free(latency);
+}
+
+// gpiobench 模拟按压的线程
+typedef struct {
+  GpioLine* line;
+  int n;
+  long long* pressUs;   // 每次按下的时刻
+} PressScript;
+
+static void* pressThread(void* arg) {
+  PressScript* script = (PressScript*)arg;
+  for (int i = 0; i < script->n; ++i) {
+    delay(120 + rand() % 200);   // 空闲
+    script->pressUs[i] = getTimeUs();
+    Gpio_FakeSet(script->line, true);
+    delay(150);                  // 按住
+    Gpio_FakeSet(script->line, false);
+  }
+  return NULL;
+}
+
+/*
+ * 用模拟的 GPIO 比较从手指按下到可以发送 GetImage 的延时：
+ *   poll  原来的 waitUntilDetectFinger，每100ms读取一次电平
+ *   edge  等待边沿事件
+*/
+void gpioBenchmark(int n) {
+  long long* pressUs = (long long*)malloc(sizeof(long long) * n);
+  long long* latency = (long long*)malloc(sizeof(long long) * n);
+  printf("%d presses\n", n);
+  printf("%-8s %10s %10s\n", "", "mean(ms)", "p99(ms)");
+
+  for (int mode = 0; mode < 2; ++mode) {
+    GpioLine line;
+    if (!Gpio_Open(&line, "fake", 0, GPIO_DEBOUNCE_US))
+      break;
+    PressScript script = { &line, n, pressUs };
+    pthread_t thread;
+    pthread_create(&thread, NULL, pressThread, &script);
+
+    for (int i = 0; i < n; ++i) {
+      if (mode == 0) {
+        while (!Gpio_Read(&line))
+          delay(100);
+      }
+      else {
+        Gpio_WaitLevel(&line, true, -1, NULL);
+      }
+      latency[i] = getTimeUs() - pressUs[i];
+
+      if (mode == 0) {
+        while (Gpio_Read(&line))
+          delay(100);
+      }
+      else {
+        Gpio_WaitLevel(&line, false, -1, NULL);
       }
     }
+
+    pthread_join(thread, NULL);
+    Gpio_Close(&line);
+    printLatency(mode == 0 ? "poll" : "edge", latency, n);
   }
+
+  free(pressUs);
+  free(latency);
 }
 
-bool waitUntilNotDetectFinger(int wait_time) {
-  while (true) {
-    if (!PS_DetectFinger()) {
-      return true;
+// iobench 的生产者线程
+typedef struct {
+  IoQueue* queue;         // 为NULL时使用全局锁
+  pthread_mutex_t* lock;
+  int n;
+  long long* submitUs;    // 提交(取得锁)的耗时
+  long long* latencyUs;   // 从提交到收到应答
+  int failed;
+} IoProducer;
+
+static void* ioProducerThread(void* arg) {
+  IoProducer* p = (IoProducer*)arg;
+  if (p->queue == NULL) {
+    for (int i = 0; i < p->n; ++i) {
+      int count = 0;
+      long long start = getTimeUs();
+      pthread_mutex_lock(p->lock);
+      p->submitUs[i] = getTimeUs() - start;
+      if (!PS_ValidTempleteNum(&count))
+        p->failed++;
+      pthread_mutex_unlock(p->lock);
+      p->latencyUs[i] = getTimeUs() - start;
     }
-    else {
-      delay(100);
-      wait_time -= 100;
-      if (wait_time < 0) {
-        return false;
+    return NULL;
+  }
+
+  int ch = IoQueue_Attach(p->queue, IO_PRIO_LIVE);
+  IoRequest req;
+  IoCompletion comp;
+  IoQueue_Encode(&req, 0, 0x1d, NULL, 0, 2);   // ValidTempleteNum
+  for (int i = 0; i < p->n; ++i) {
+    req.tag = i;
+    long long start = getTimeUs();
+    while (!IoQueue_Submit(p->queue, ch, &req))
+      sched_yield();
+    p->submitUs[i] = getTimeUs() - start;
+    IoQueue_Wait(p->queue, ch, &comp);
+    if (!comp.ok || comp.code != 0x00 || comp.tag != (uint)i)
+      p->failed++;
+    p->latencyUs[i] = getTimeUs() - comp.submitUs;
+  }
+  return NULL;
+}
+
+/*
+ * 多个线程同时读取有效模板个数，比较两种共享串口的方式：
+ *   mutex  每个线程持全局锁调用 PS_ValidTempleteNum
+ *   ring   I/O 线程独占串口，各线程通过无锁队列提交
+*/
+void ioBenchmark(int nThread, int n) {
+  int total = nThread * n;
+  long long* submit  = (long long*)malloc(sizeof(long long) * total);
+  long long* latency = (long long*)malloc(sizeof(long long) * total);
+  IoProducer producer[IOQUEUE_MAX_CHANNELS];
+  pthread_t thread[IOQUEUE_MAX_CHANNELS];
+  pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  static IoQueue queue;
+
+  printf("%d threads x %d requests\n", nThread, n);
+  printf("%-8s %12s %12s %10s %10s\n", "", "submit(us)", "p99(us)", "mean(ms)", "p99(ms)");
+  for (int mode = 0; mode < 2; ++mode) {
+    if (mode == 1 && !IoQueue_Start(&queue, IOQUEUE_PRIORITY))
+      break;
+    for (int i = 0; i < nThread; ++i) {
+      IoProducer p = { mode == 1 ? &queue : NULL, &lock, n, submit + i * n, latency + i * n, 0 };
+      producer[i] = p;
+      pthread_create(&thread[i], NULL, ioProducerThread, &producer[i]);
+    }
+    int failed = 0;
+    for (int i = 0; i < nThread; ++i) {
+      pthread_join(thread[i], NULL);
+      failed += producer[i].failed;
+    }
+    if (mode == 1)
+      IoQueue_Stop(&queue);
+
+    long long sumSubmit = 0, sumLatency = 0;
+    for (int i = 0; i < total; ++i) {
+      sumSubmit += submit[i];
+      sumLatency += latency[i];
+    }
+    qsort(submit, total, sizeof(long long), compareLongLong);
+    qsort(latency, total, sizeof(long long), compareLongLong);
+    printf("%-8s %12.2f %12.2f %10.1f %10.1f\n", mode == 0 ? "mutex" : "ring",
+      (double)sumSubmit / total, (double)submit[total * 99 / 100],
+      (double)sumLatency / total / 1000, latency[total * 99 / 100] / 1000.0);
+    if (failed > 0)
+      printf("  %d requests failed\n", failed);
+  }
+
+  free(submit);
+  free(latency);
+}
+
+// schedbench 的备份任务：反复把所有模板上传到内存，直到 stop 被置位
+typedef struct {
+  IoQueue* queue;         // 为NULL时整个备份持有全局锁
+  pthread_mutex_t* lock;
+  int* pages;
+  int nPage;
+  uchar (*backup)[768];
+  atomic_bool stop;
+  int uploaded;           // 完成上传的模板个数
+  int failed;
+} BackupJob;
+
+static void* backupThread(void* arg) {
+  BackupJob* job = (BackupJob*)arg;
+  if (job->queue == NULL) {
+    while (!atomic_load(&job->stop)) {
+      pthread_mutex_lock(job->lock);
+      for (int i = 0; i < job->nPage; ++i) {
+        if (PS_LoadChar(2, job->pages[i]) && PS_UpCharToBuf(2, job->backup[i], 768))
+          job->uploaded++;
+        else
+          job->failed++;
       }
+      pthread_mutex_unlock(job->lock);
+      delay(1);
     }
+    return NULL;
   }
+
+  // 每个模板拆成 LoadChar、UpChar 两个指令，最多8个指令在队列中
+  int ch = IoQueue_Attach(job->queue, IO_PRIO_BULK);
+  int inFlight = 0, next = 0;
+  IoRequest req;
+  IoCompletion comp;
+  while (!atomic_load(&job->stop) || inFlight > 0) {
+    while (inFlight < 8 && !atomic_load(&job->stop)) {
+      int i = next++ % job->nPage;
+      uchar params[3] = { 2, job->pages[i] >> 8, job->pages[i] & 0xff };
+      IoQueue_Encode(&req, 0, 0x07, params, 3, 0);          // LoadChar(2, page)
+      IoQueue_Submit(job->queue, ch, &req);
+      IoQueue_Encode(&req, 1, 0x08, params, 1, 0);          // UpChar(2)
+      IoQueue_SetData(&req, IO_DATA_IN, job->backup[i], 768);
+      IoQueue_Submit(job->queue, ch, &req);
+      inFlight += 2;
+    }
+    IoQueue_Wait(job->queue, ch, &comp);
+    inFlight--;
+    if (!comp.ok || comp.code != 0x00)
+      job->failed++;
+    else if (comp.tag == 1)
+      job->uploaded++;
+  }
+  return NULL;
 }
 
+// 通过队列执行一个指令并等待完成
+static bool ioCall(IoQueue* q, int ch, IoRequest* req) {
+  IoCompletion comp;
+  IoQueue_Submit(q, ch, req);
+  IoQueue_Wait(q, ch, &comp);
+  g_error_code = comp.code;
+  return comp.ok && comp.code == 0x00;
+}
 
-// 主处理函数，解析命令
-void analyseArgv(int argc, char* argv[]) {
+/*
+ * 在备份整个指纹库的同时执行 n 次识别(GetImage、GenChar、HighSpeedSearch)，比较识别的延时：
+ *   exclusive  备份任务持有串口直到备份完成(原来的方式)
+ *   fifo       备份拆成单个指令，与识别的指令按提交顺序执行
+ *   priority   识别的优先级高于备份
+*/
+void schedBenchmark(int n) {
+  int* pages = (int*)malloc(sizeof(int) * g_as608.capacity);
+  int nPage = 0;
+  for (int page = PS_NextUsedPage(0); page != -1; page = PS_NextUsedPage(page + 1))
+    pages[nPage++] = page;
+  if (nPage == 0) {
+    printf("The database is empty!\n");
+    free(pages);
+    quit(1);
+  }
 
-  if (match("add")) {
-    checkArgc(3);
-    printf("Please put your finger on the module.\n");
-    if (waitUntilDetectFinger(5000)) {
-      delay(500);
-      PS_GetImage() || PS_Exit();
-      PS_GenChar(1) || PS_Exit();
+  uchar (*backup)[768] = malloc(768 * nPage);
+  long long* latency = (long long*)malloc(sizeof(long long) * n);
+  pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  static IoQueue queue;
+  const char* name[3] = { "exclusive", "fifo", "priority" };
+
+  int verbose = g_verbose;
+  g_verbose = -1;   // 备份时不显示进度条
+  printf("%d identifications during backups of %d templates\n", n, nPage);
+  printf("%-10s %10s %10s %10s\n", "", "mean(ms)", "p99(ms)", "backup/s");
+  for (int mode = 0; mode < 3; ++mode) {
+    if (mode > 0 && !IoQueue_Start(&queue, mode == 1 ? IOQUEUE_FIFO : IOQUEUE_PRIORITY))
+      break;
+    BackupJob job = { mode > 0 ? &queue : NULL, &lock, pages, nPage, backup };
+    atomic_store(&job.stop, false);
+    pthread_t thread;
+    pthread_create(&thread, NULL, backupThread, &job);
+
+    int ch = (mode > 0) ? IoQueue_Attach(&queue, IO_PRIO_LIVE) : -1;
+    int failed = 0;
+    long long begin = getTimeUs();
+    for (int i = 0; i < n; ++i) {
+      delay(50 + rand() % 100);
+      long long start = getTimeUs();
+      bool ok = true;
+      if (mode == 0) {
+        int pageID = 0, score = 0;
+        pthread_mutex_lock(&lock);
+        ok = PS_GetImage() && PS_GenChar(1) &&
+          (PS_HighSpeedSearch(1, 0, g_as608.capacity, &pageID, &score) || g_error_code == 0x09);
+        pthread_mutex_unlock(&lock);
+      }
+      else {
+        IoRequest req;
+        uchar params[5] = { 1, 0, 0, g_as608.capacity >> 8, g_as608.capacity & 0xff };
+        IoQueue_Encode(&req, 0, 0x01, NULL, 0, 0);          // GetImage
+        ok = ioCall(&queue, ch, &req);
+        IoQueue_Encode(&req, 0, 0x02, params, 1, 0);        // GenChar(1)
+        ok = ok && ioCall(&queue, ch, &req);
+        IoQueue_Encode(&req, 0, 0x1b, params, 5, 4);        // HighSpeedSearch(1, 0, capacity)
+        ok = ok && (ioCall(&queue, ch, &req) || g_error_code == 0x09);
+      }
+      latency[i] = getTimeUs() - start;
+      if (!ok)
+        failed++;
     }
-    else {
-      printf("Error: Didn't detect finger!\n");
-      exit(1);
+    long long elapsed = getTimeUs() - begin;
+
+    atomic_store(&job.stop, true);
+    pthread_join(thread, NULL);
+    if (mode > 0)
+      IoQueue_Stop(&queue);
+    double rate = job.uploaded * 1e6 / elapsed;
+
+    long long sum = 0;
+    for (int i = 0; i < n; ++i)
+      sum += latency[i];
+    qsort(latency, n, sizeof(long long), compareLongLong);
+    printf("%-10s %10.1f %10.1f %10.1f\n", name[mode], (double)sum / n / 1000, latency[n * 99 / 100] / 1000.0, rate);
+    if (failed + job.failed > 0)
+      printf("  %d identifications and %d backup commands failed\n", failed, job.failed);
+  }
+
+  g_verbose = verbose;
+  free(pages);
+  free(backup);
+  free(latency);
+}
+
+/*
+ * 同一总线上的多个模块各执行 n 轮 (HighSpeedSearch、ValidTempleteNum、ReadIndexTable、ReadNotepad)，
+ *   比较一次执行一个指令与交错执行的吞吐量
+*/
+void busBenchmark(uint* addrs, int nAddr, int n) {
+  char filename[256] = { 0 };
+  homeStatePath(filename, sizeof(filename), ".fpbus_");
+  if (!Bus_LoadTimings(filename))
+    printf("No measured timings, interleaving is disabled (run \"fp busprobe\" first)\n");
+
+  int total = nAddr * n * 4;
+  BusRequest* reqs = (BusRequest*)malloc(sizeof(BusRequest) * total);
+  int k = 0;
+  for (int round = 0; round < n; ++round) {
+    for (int a = 0; a < nAddr; ++a) {
+      uchar search[5] = { 1, 0, 0, g_as608.capacity >> 8, g_as608.capacity & 0xff };
+      uchar zero[1] = { 0 };
+      Bus_Encode(&reqs[k++], addrs[a], 0, 0x1b, search, 5, 4);  // HighSpeedSearch
+      Bus_Encode(&reqs[k++], addrs[a], 1, 0x1d, NULL, 0, 2);     // ValidTempleteNum
+      Bus_Encode(&reqs[k++], addrs[a], 2, 0x1f, zero, 1, 32);    // ReadIndexTable
+      Bus_Encode(&reqs[k++], addrs[a], 3, 0x19, zero, 1, 32);    // ReadNotepad
+    }
+  }
+
+  printf("%d modules x %d rounds, %d orders\n", nAddr, n, total);
+  printf("%-12s %10s %10s %10s %8s %10s %8s\n", "", "time(ms)", "orders/s", "overlap", "corrupt", "collisions", "failed");
+  for (int mode = 0; mode < 2; ++mode) {
+    BusStats stats;
+    memset(&stats, 0, sizeof(stats));
+    long long start = getTimeUs();
+    Bus_Execute(reqs, total, mode == 1, &stats);
+    long long elapsed = getTimeUs() - start;
+
+    // 确认码不为0(如搜索不到)也算完成，只统计没有收到应答的
+    printf("%-12s %10.1f %10.1f %10d %8d %10d %8d\n", mode == 0 ? "sequential" : "interleaved",
+      elapsed / 1000.0, total * 1e6 / elapsed, stats.overlapped, stats.corrupt, stats.collisions, stats.failed);
+    if (stats.stray > 0)
+      printf("  %d stray replies\n", stats.stray);
+  }
+  free(reqs);
+}
+
+/*
+ * 在总线上的各模块测量慢指令的处理时间，取所有模块中最短的，
+ *   除以 BUS_BUSY_MARGIN 作为交错的依据，保存在 "~/.fpbus_[芯片地址]_[串口]"
+*/
+void busProbe(uint* addrs, int nAddr, int rounds) {
+  uchar one[1] = { 1 };
+  uchar search[5] = { 1, 0, 0, g_as608.capacity >> 8, g_as608.capacity & 0xff };
+  struct {
+    uchar code;
+    const char* name;
+    const uchar* params;
+    int paramSize;
+    int replyParams;
+  } orders[5] = {
+    { 0x01, "GetImage",        NULL,   0, 0 },
+    { 0x02, "GenChar",         one,    1, 0 },
+    { 0x04, "Search",          search, 5, 4 },
+    { 0x05, "RegModel",        NULL,   0, 0 },
+    { 0x1b, "HighSpeedSearch", search, 5, 4 },
+  };
+
+  printf("%d modules x %d rounds\n", nAddr, rounds);
+  printf("%-16s %10s %10s\n", "", "min(ms)", "used(ms)");
+  for (int i = 0; i < 5; ++i) {
+    long long best = -1;
+    for (int a = 0; a < nAddr; ++a) {
+      long long us = Bus_Measure(addrs[a], orders[i].code, orders[i].params, orders[i].paramSize,
+                                 orders[i].replyParams, rounds);
+      if (us < 0) {
+        best = -1;   // 有模块没有应答，不交错
+        break;
+      }
+      if (best == -1 || us < best)
+        best = us;
     }
+    int ms = (best < 0) ? 0 : (int)(best / 1000 / BUS_BUSY_MARGIN);
+    Bus_SetMinBusy(orders[i].code, ms);
+    if (best < 0)
+      printf("%-16s %10s %10d\n", orders[i].name, "-", ms);
+    else
+      printf("%-16s %10.1f %10d\n", orders[i].name, best / 1000.0, ms);
+  }
+
+  char filename[256] = { 0 };
+  homeStatePath(filename, sizeof(filename), ".fpbus_");
+  Bus_SaveTimings(filename) || PS_Exit();
+  printf("Saved to %s\n", filename);
+}
 
-    // 判断用户是否抬起了手指，
-    printf("Ok.\nPlease raise your finger!\n");
-    if (waitUntilNotDetectFinger(5000)) {
+// 显示或设置模块列表(分片、门禁)
+void configDevices(const char* name, int argc, char* argv[]) {
+  char filename[256] = { 0 };
+  sprintf(filename, "%s/%s", getenv("HOME"), name);
+  static ShardSet set;
+  if (g_argc == 2) {
+    if (!Shard_LoadConfig(filename, &set)) {
+      printf("No devices configured\n");
+      quit(1);
+    }
+    for (int i = 0; i < set.count; ++i)
+      printf("%d  %s 0x%08x\n", i, set.shard[i].serial, set.shard[i].addr);
+    return;
+  }
+  if ((g_argc - 2) % 2 != 0 || (g_argc - 2) / 2 > SHARD_MAX) {
+    printf("Command \"%s\" accept serial-address pairs, %d devices at most\n", g_command, SHARD_MAX);
+    printf("  Usage: fp %s /dev/ttyAMA0 0xffffffff /dev/ttyUSB0 0xffffffff ...\n", g_command);
+    quit(1);
+  }
+  memset(&set, 0, sizeof(set));
+  for (int i = 2; i + 1 < g_argc; i += 2) {
+    Shard* shard = &set.shard[set.count++];
+    strncpy(shard->serial, argv[i], sizeof(shard->serial) - 1);
+    shard->addr = toUInt(argv[i + 1]);
+  }
+  Shard_SaveConfig(filename, &set) || PS_Exit();
+}
+
+void openDevices(const char* name, ShardSet* set) {
+  char filename[256] = { 0 };
+  sprintf(filename, "%s/%s", getenv("HOME"), name);
+  if (!Shard_LoadConfig(filename, set)) {
+    printf("No devices configured in ~/%s\n", name);
+    quit(1);
+  }
+  Shard_Open(set, g_config.serial, g_config.baudrate, g_config.password) || PS_Exit();
+  Daemon_Defer(closeShards, set);
+}
+
+/*
+ * 分别用前 k(1~分片数) 个分片，搜索 n 个随机选取的已录入模板，输出容量和延时
+ *   探针从所在的分片复制到第一个分片的 CharBuffer1(不计时)
+*/
+void shardBenchmark(ShardSet* set, int n) {
+  long long* latency = (long long*)malloc(sizeof(long long) * n);
+  Daemon_Defer(free, latency);
+  int verbose = g_verbose;
+  g_verbose = -1;
+  printf("%d searches of enrolled templates\n", n);
+  printf("%-6s %10s %10s %10s %10s %10s\n", "shards", "capacity", "templates", "mean(ms)", "p99(ms)", "cancelled");
+
+  for (int k = 1; k <= set->count; ++k) {
+    int capacity = 0, templates = 0;
+    for (int i = 0; i < k; ++i) {
+      capacity += set->shard[i].info.capacity;
+      templates += set->shard[i].used;
+    }
+    if (templates == 0) {
+      printf("%-6d %10d %10d (no templates)\n", k, capacity, templates);
+      continue;
+    }
+
+    int cancelled = 0, missed = 0;
+    for (int t = 0; t < n; ++t) {
+      // 随机选一个有模板的分片和其中的一个模板作为探针
+      int from = rand() % k;
+      while (set->shard[from].used == 0)
+        from = (from + 1) % k;
+      Shard_Use(set, from);
+      int page = PS_NextUsedPage(rand() % set->shard[from].info.capacity);
+      if (page == -1)
+        page = PS_NextUsedPage(0);
+      bool ok = PS_LoadChar(1, page);
+      if (ok && from != 0) {
+        uchar probe[768];
+        ok = PS_UpCharToBuf(1, probe, sizeof(probe));
+        Shard_Use(set, 0);
+        ok = ok && PS_DownCharFromBuf(1, probe, sizeof(probe));
+      }
+      Shard_Use(set, 0);
+      if (!ok) {
+        Shard_Close(set);
+        PS_Exit();
+      }
+
+      int shard = 0, pageID = 0, score = 0, c = 0;
+      long long start = getTimeUs();
+      if (!Shard_Search(set, k, 1, &shard, &pageID, &score, &c))
+        missed++;
+      latency[t] = getTimeUs() - start;
+      cancelled += c;
+    }
+
+    long long sum = 0;
+    for (int t = 0; t < n; ++t)
+      sum += latency[t];
+    qsort(latency, n, sizeof(long long), compareLongLong);
+    printf("%-6d %10d %10d %10.1f %10.1f %10.2f\n", k, capacity, templates,
+      (double)sum / n / 1000, latency[n * 99 / 100] / 1000.0, (double)cancelled / n);
+    if (missed > 0)
+      printf("  %d searches missed\n", missed);
+  }
+  g_verbose = verbose;
+  Daemon_Release(latency);
+}
+
+/*
+ * 把当前模块的前 n 个模板推送到所有门禁模块，比较：
+ *   serial      逐个模块推送(原来的 downchar + storechar 循环)
+ *   concurrent  所有模块同时推送
+ *   again       再次执行，模块已是最新，整批跳过
+ *   传播延时为模板读取完成到最后一个模块存储完成
+*/
+void repBenchmark(ShardSet* doors, int n) {
+  static RepTemplate templates[REPLICATE_MAX];
+  long long* latency = (long long*)malloc(sizeof(long long) * REPLICATE_MAX);
+  printf("%-10s %10s %10s %10s %10s %8s %8s\n", "", "time(ms)", "tmpl/s", "mean(ms)", "p99(ms)", "pushed", "retried");
+  for (int mode = 0; mode < 3; ++mode) {
+    Shard_Use(doors, doors->self);
+    int count = Replicate_LoadPages(templates, n < REPLICATE_MAX ? n : REPLICATE_MAX, 0, g_as608.capacity);
+    if (count <= 0) {
+      printf("No templates to replicate\n");
+      break;
+    }
+
+    RepReport report;
+    long long start = getTimeUs();
+    Replicate_Run(doors, templates, count, mode > 0, mode < 2, &report);
+    long long elapsed = getTimeUs() - start;
+
+    long long sum = 0;
+    for (int i = 0; i < count; ++i) {
+      latency[i] = templates[i].doneUs - templates[i].readyUs;
+      sum += latency[i];
+    }
+    qsort(latency, count, sizeof(long long), compareLongLong);
+    const char* name[3] = { "serial", "concurrent", "again" };
+    printf("%-10s %10.1f %10.1f %10.1f %10.1f %8d %8d\n", name[mode], elapsed / 1000.0, count * 1e6 / elapsed,
+      (double)sum / count / 1000, latency[count * 99 / 100] / 1000.0, report.nPushed, report.nRetried);
+    if (report.nFailed > 0)
+      printf("  %d failed\n", report.nFailed);
+  }
+  free(latency);
+}
+
+// LoadChar + UpChar 读取一个模板在串口上传输的字节数
+static long long templateWireBytes() {
+  int packetSize = g_as608.packet_size > 0 ? g_as608.packet_size : 128;
+  return (12 + 12) * 2 + 768 / packetSize * (packetSize + 11);
+}
+
+void printTemplateCache() {
+  TemplateCacheStats stats;
+  PS_GetTemplateCacheStats(&stats);
+  long long total = stats.hits + stats.misses;
+  printf("Template cache: %d/%d templates, %lld hits, %lld misses (hit rate %.1f%%)\n",
+    stats.count, stats.size, stats.hits, stats.misses, total > 0 ? 100.0 * stats.hits / total : 0.0);
+  printf("  %lld evicted, %lld invalidated, saved %lld bytes on the serial port\n",
+    stats.evictions, stats.invalidations, stats.hits * templateWireBytes());
+}
+
+/*
+ * 导出、复制检查、校验等流程先后读取同样的 n 个模板(3轮)，比较：
+ *   uncached  每次 PS_LoadChar + PS_UpCharToBuf
+ *   cached    PS_LoadCharToBuf，第一轮之后都是内存复制
+ * 然后在一个空页上检查 PS_StoreChar、PS_DeleteChar 后缓存是否失效，测试后删除该页
+*/
+void templateCacheBenchmark(int n) {
+  const int rounds = 3;
+  int pages[512];
+  int count = 0;
+  for (int page = PS_NextUsedPage(0); page != -1 && count < n; page = PS_NextUsedPage(page + 1))
+    pages[count++] = page;
+  if (count == 0) {
+    printf("The database is empty!\n");
+    return;
+  }
+
+  int verbose = g_verbose;
+  g_verbose = -1;   // 不显示进度条
+  uchar data[768];
+  uchar first[768], second[768];
+
+  long long start = getTimeUs();
+  for (int r = 0; r < rounds; ++r) {
+    for (int i = 0; i < count; ++i)
+      (PS_LoadChar(1, pages[i]) && PS_UpCharToBuf(1, data, 768)) || (g_verbose = verbose, PS_Exit());
+  }
+  long long uncached = getTimeUs() - start;
+
+  TemplateCacheStats stats;
+  PS_GetTemplateCacheStats(&stats);
+  PS_SetTemplateCacheSize(stats.size);   // 从空缓存开始
+  TemplateCacheStats before;
+  PS_GetTemplateCacheStats(&before);
+  start = getTimeUs();
+  for (int r = 0; r < rounds; ++r) {
+    for (int i = 0; i < count; ++i)
+      PS_LoadCharToBuf(1, pages[i], data, 768) || (g_verbose = verbose, PS_Exit());
+  }
+  long long cached = getTimeUs() - start;
+  PS_GetTemplateCacheStats(&stats);
+  long long hits = stats.hits - before.hits;
+  long long misses = stats.misses - before.misses;
+
+  printf("%d rounds x %d templates\n", rounds, count);
+  printf("%-10s %10s %10s %10s\n", "", "time(ms)", "hit rate", "bytes");
+  printf("%-10s %10.1f %10s %10lld\n", "uncached", uncached / 1000.0, "-",
+    rounds * count * templateWireBytes());
+  printf("%-10s %10.1f %9.1f%% %10lld\n", "cached", cached / 1000.0,
+    100.0 * hits / (hits + misses), misses * templateWireBytes());
+
+  // 失效检查：空页先存入第一个模板并缓存，再用第二个模板覆盖，最后删除
+  int freePage = -1;
+  bool ok = count >= 2 && PS_AllocFreePage(&freePage);
+  if (ok) {
+    ok = PS_LoadCharToBuf(1, pages[0], first, 768) &&
+         PS_LoadCharToBuf(1, pages[1], second, 768) &&
+         PS_LoadChar(1, pages[0]) && PS_StoreChar(1, freePage) &&
+         PS_LoadCharToBuf(2, freePage, data, 768) && memcmp(data, first, 768) == 0 &&
+         PS_LoadChar(1, pages[1]) && PS_StoreChar(1, freePage) &&
+         PS_LoadCharToBuf(2, freePage, data, 768) && memcmp(data, second, 768) == 0 &&
+         PS_DeleteChar(freePage, 1) &&
+         !PS_LoadCharToBuf(2, freePage, data, 768);
+    PS_DeleteChar(freePage, 1);
+    printf("Invalidation by StoreChar and DeleteChar (page %d): %s\n", freePage, ok ? "ok" : "FAILED");
+  }
+  g_verbose = verbose;
+  printTemplateCache();
+}
+
+// 操作员重新执行命令并重新按压手指的时间(估计值)，用于比较录入失败的代价
+#define ENROLL_RETRY_MS     3000
+#define ENROLL_MAX_ATTEMPTS 5
+
+/*
+ * 原来的 add：检测到手指后等待500ms采集，抬起(等待100ms)再按下，等待500ms采集第二次
+ *   测试时手指一直在传感器上，省略等待抬起
+ *   采集、比对或合并失败时返回false，由操作员重新执行命令
+*/
+static bool twoShotEnroll(int* pScore) {
+  *pScore = 0;
+  for (int i = 0; i < 2; ++i) {
+    if (i == 1)
       delay(100);
-      printf("Ok.\nPlease put your finger again!\n");
-      // 第二次录入指纹
-      if (waitUntilDetectFinger(5000)) {
-        delay(500);
-        PS_GetImage() || PS_Exit();
-        PS_GenChar(2) || PS_Exit();
+    if (!waitUntilDetectFinger(5000))
+      return false;
+    delay(500);
+    if (!PS_GetImage() || !PS_GenChar(i + 1))
+      return false;
+  }
+  return PS_Match(pScore) && PS_RegModel();
+}
+
+/*
+ * 比较两次采集(原来的 add)与多次采集选优的录入，每种方式录入 n 个用户(不存储)：
+ *   失败后由操作员重新执行，每次重试计入 ENROLL_RETRY_MS，最多 ENROLL_MAX_ATTEMPTS 次
+ * 在模拟器上运行时，样本质量的分布由模拟器决定
+*/
+void enrollBenchmark(int n) {
+  printf("%d users, retry by the operator costs %d ms\n", n, ENROLL_RETRY_MS);
+  printf("%-10s %10s %8s %8s %12s %14s %8s\n", "", "1st fail", "failed", "samples",
+      "device(ms)", "operator(ms)", "score");
+  for (int mode = 0; mode < 2; ++mode) {
+    int firstFailed = 0, failed = 0, samples = 0;
+    long long deviceUs = 0, operatorUs = 0, scoreSum = 0;
+    for (int u = 0; u < n; ++u) {
+      bool ok = false;
+      int attempt = 0;
+      for (; attempt < ENROLL_MAX_ATTEMPTS && !ok; ++attempt) {
+        int score = 0;
+        long long start = getTimeUs();
+        if (mode == 0) {
+          ok = twoShotEnroll(&score);
+          samples += 2;
+        }
+        else {
+          EnrollReport report;
+          ok = Enroll_Run(ENROLL_DEFAULT_SAMPLES, captureImage, &report);
+          score = report.score;
+          samples += report.nSample;
+        }
+        long long elapsed = getTimeUs() - start;
+        deviceUs += elapsed;
+        operatorUs += elapsed + (ok ? 0 : ENROLL_RETRY_MS * 1000LL);
+        if (ok)
+          scoreSum += score;
+        else if (g_error_code != 0x06 && g_error_code != 0x07 && g_error_code != 0x08 && g_error_code != 0x0a)
+          PS_Exit();
+      }
+      if (attempt > 1 || !ok)
+        firstFailed++;
+      if (!ok)
+        failed++;
+    }
+    char name[16];
+    snprintf(name, sizeof(name), mode == 0 ? "two-shot" : "best-of-%d", ENROLL_DEFAULT_SAMPLES);
+    printf("%-10s %9.1f%% %8d %8.1f %12.1f %14.1f %8.1f\n", name, 100.0 * firstFailed / n, failed,
+        (double)samples / n, deviceUs / 1000.0 / n, operatorUs / 1000.0 / n,
+        n > failed ? (double)scoreSum / (n - failed) : 0.0);
+  }
+}
+
+/*
+ * capturebench 模拟的按压：按下后经过 g_sim_settle_us 手指才放稳，之前采集返回 0x02
+ *   多数按压 150~350ms 放稳，少数(5%) 600~900ms
+*/
+static long long g_sim_press_us = 0, g_sim_settle_us = 0;
+static bool simulatedGetImage() {
+  if (!PS_GetImage())
+    return false;
+  if (getTimeUs() - g_sim_press_us < g_sim_settle_us) {
+    g_error_code = 0x02;
+    return false;
+  }
+  return true;
+}
+
+/*
+ * 比较从手指按下到采集成功的时间，每种方式 n 次按压(放稳时间的序列相同)：
+ *   fixed     原来的 add，按下后等待500ms采集
+ *   immediate 原来的 identify、search，按下后立即采集
+ *   adaptive  按学习到的稳定时间采集，没放好时在预算内重试
+ * 采集失败时由操作员重新按压，计入 ENROLL_RETRY_MS
+*/
+/*
+ * 检查指令和传输路径不分配堆内存：
+ *   每种指令先执行一次(模板缓存等只在第一次使用时分配)，再执行 rounds 次，
+ *   统计期间 malloc/calloc/realloc 的调用次数，都为0时返回true
+*/
+bool allocBenchmark(int rounds) {
+  static uchar image[73728];
+  uchar charFile[768];
+  uchar info[512];
+  int count = 0;
+  const char* names[5] = { "ValidTempleteNum", "ReadINFpage", "DownChar", "UpChar", "UpImage" };
+
+  int verbose = g_verbose;
+  g_verbose = -1;   // 不显示进度条
+  printf("%d rounds\n", rounds);
+  printf("%-18s %10s %12s %10s\n", "", "calls", "allocations", "time(ms)");
+
+  long long total = 0;
+  for (int op = 0; op < 5; ++op) {
+    long long allocs = 0, timeUs = 0;
+    int calls = (op == 4 && rounds > 3) ? 3 : rounds;   // 上传图像在57600波特率下约需13秒
+    for (int r = 0; r <= calls; ++r) {
+      long long before = AllocCount_Get();
+      long long start = getTimeUs();
+      bool ok = false;
+      switch (op) {
+      case 0: ok = PS_ValidTempleteNum(&count); break;
+      case 1: ok = PS_ReadINFpage(info, sizeof(info)); break;
+      case 2: ok = (r > 0 || PS_UpCharToBuf(1, charFile, 768)) && PS_DownCharFromBuf(1, charFile, 768); break;
+      case 3: ok = PS_UpCharToBuf(1, charFile, 768); break;
+      case 4: ok = PS_UpImageToBuf(image, sizeof(image)); break;
+      }
+      if (!ok) {
+        g_verbose = verbose;
+        PS_Exit();
+      }
+      if (r > 0) {
+        timeUs += getTimeUs() - start;
+        allocs += AllocCount_Get() - before;
+      }
+    }
+    total += allocs;
+    printf("%-18s %10d %12lld %10.1f\n", names[op], calls, allocs, timeUs / 1000.0);
+  }
+  g_verbose = verbose;
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  printf("Max RSS: %ld KB\n", usage.ru_maxrss);
+  printf("Heap allocations on the command path: %lld (%s)\n", total, total == 0 ? "OK" : "FAILED");
+  return total == 0;
+}
+
+void captureBenchmark(int n) {
+  long long* settleUs = (long long*)malloc(sizeof(long long) * n);
+  long long* latency = (long long*)malloc(sizeof(long long) * n);
+  Daemon_Defer(free, settleUs);
+  Daemon_Defer(free, latency);
+  srand(1);
+  for (int i = 0; i < n; ++i) {
+    if (rand() % 100 < 95)
+      settleUs[i] = (150 + rand() % 200) * 1000LL;
+    else
+      settleUs[i] = (600 + rand() % 300) * 1000LL;
+  }
+
+  printf("%d presses, retry by the operator costs %d ms\n", n, ENROLL_RETRY_MS);
+  printf("%-10s %10s %10s %8s %10s\n", "", "mean(ms)", "p99(ms)", "failed", "attempts");
+  for (int mode = 0; mode < 3; ++mode) {
+    GpioLine line;
+    if (!Gpio_Open(&line, "fake", 0, GPIO_DEBOUNCE_US))
+      break;
+    Daemon_Defer(closeGpio, &line);
+    CaptureCtl ctl;
+    Capture_Init(&ctl, &line, NULL);
+    int failed = 0, attempts = 0;
+    double early = 0, late = 0;
+
+    for (int i = 0; i < n; ++i) {
+      g_sim_settle_us = settleUs[i];
+      g_sim_press_us = getTimeUs();
+      Gpio_FakeSet(&line, true);
+
+      bool ok;
+      if (mode == 2) {
+        CaptureResult result;
+        ok = Capture_Do(&ctl, 5000, simulatedGetImage, &result);
+        attempts += result.attempts;
       }
       else {
-        printf("Error: Didn't detect finger!\n");
-        exit(1);
+        if (mode == 0)
+          delay(500);
+        ok = simulatedGetImage();
+        attempts++;
+      }
+      latency[i] = getTimeUs() - g_sim_press_us;
+      if (!ok) {
+        if (g_error_code != 0x02)
+          PS_Exit();
+        failed++;
+        latency[i] += ENROLL_RETRY_MS * 1000LL;
       }
+      if (i < n / 2)
+        early += latency[i];
+      else
+        late += latency[i];
+
+      Gpio_FakeSet(&line, false);
+      delay(GPIO_DEBOUNCE_US / 1000 * 2);
     }
-    else {
-      printf("Error! Didn't raise your finger\n");
-      exit(1);
+
+    const char* name[] = { "fixed", "immediate", "adaptive" };
+    qsort(latency, n, sizeof(long long), compareLongLong);
+    long long sum = 0;
+    for (int i = 0; i < n; ++i)
+      sum += latency[i];
+    printf("%-10s %10.1f %10.1f %8d %10.2f\n", name[mode], sum / 1000.0 / n,
+        latency[(n * 99 - 1) / 100] / 1000.0, failed, (double)attempts / n);
+    if (mode == 2 && n >= 2)
+      printf("adaptive: learned settle %.1f ms, first half %.1f ms, second half %.1f ms\n",
+          ctl.settleUs / 1000.0, early / 1000.0 / (n / 2), late / 1000.0 / (n - n / 2));
+    Daemon_Release(&line);
+  }
+
+  Daemon_Release(settleUs);
+  Daemon_Release(latency);
+}
+
+// 长时间运行的命令，在守护进程中执行会阻塞其它客户端
+static bool longRunning(const char* command) {
+  int len = strlen(command);
+  if (len > 5 && strcmp(command + len - 5, "bench") == 0)
+    return true;
+  return strcmp(command, "watch") == 0;
+}
+
+// 守护进程中执行一个请求，与命令行的处理相同
+void runCommand(int argc, char* argv[]) {
+  g_option_count = 0;
+  g_verbose = 0;
+  g_assume_yes = false;
+  priorAnalyseArgv(argc, argv);
+  if (Daemon_Serving() && longRunning(g_command)) {
+    printf("\"%s\" would block other clients of the daemon, stop the daemon and run it again\n", g_command);
+    quit(1);
+  }
+  analyseArgv(argc, argv);
+}
+
+// 主处理函数，解析命令
+void analyseArgv(int argc, char* argv[]) {
+
+  if (match("add")) {
+    // 不指定pageID时，自动分配页码最小的空页
+    // 指定为class时，按纹型分配所属页段中的空页
+    int pageID = 0;
+    bool byClass = (g_argc == 3 && strcmp(argv[2], "class") == 0);
+    if (g_argc == 3 && !byClass) {
+      pageID = toInt(argv[2]);
+    }
+    else if (g_argc == 2) {
+      PS_AllocFreePage(&pageID) || PS_Exit();
+    }
+    else if (!byClass) {
+      printf("Command \"add\" accept 1 parameter at most\n");
+      quit(1);
     }
 
-    int score = 0;
-    if (PS_Match(&score)) {
-      printf("Matched! score=%d\n", score);
+    // 一次按压连续采集多个样本，选比对得分最高的两个合并
+    printf("Please put your finger on the module and hold it.\n");
+    EnrollReport enroll;
+    bool enrolled = Enroll_Run(ENROLL_DEFAULT_SAMPLES, captureImage, &enroll);
+    printf("Captured %d samples, best match score:", enroll.nSample);
+    for (int i = 0; i < enroll.nSample; ++i)
+      printf(" %d", enroll.best[i]);
+    printf("\n");
+    if (!enrolled && g_error_code == 0x02) {
+      printf("Error: Didn't detect finger!\n");
+      quit(1);
     }
-    else {
-      printf("Not matched, raise your finger and put it on again.\n");
-      exit(1);
+    if (!enrolled && g_error_code == 0x0a)
+      printf("No two consistent samples, raise your finger and put it on again.\n");
+    enrolled || PS_Exit();
+    printf("Merged samples #%d and #%d (score=%d), %d rejected, %lld ms\n",
+        enroll.first + 1, enroll.second + 1, enroll.score, enroll.nRejected, enroll.timeUs / 1000);
+
+    // 按最后一次采集的图像分类
+    if (byClass) {
+      static uchar image[CLASSIFY_WIDTH * CLASSIFY_HEIGHT];
+      PS_UpImageToBuf(image, sizeof(image)) || PS_Exit();
+      ClassifyResult result;
+      if (!Classify_Image(image, &result)) {
+        printf("Error: Fingerprint area is too small to classify!\n");
+        quit(1);
+      }
+      pageID = Classify_AllocPage(result.cls);
+      (pageID != -1) || PS_Exit();
+      printf("Pattern: %s, pageID=%d\n", Classify_Name(result.cls), pageID);
     }
-    
-    if (g_error_code != 0x00)
+
+    // 存储前先搜索，同一个手指不重复录入(重新录入到原来的页除外)
+    int dupPageID = 0, dupScore = 0;
+    if (PS_SearchPlanned(1, false, NULL, &dupPageID, &dupScore) && dupPageID != pageID) {
+      printf("This finger is already enrolled at pageID=%d (score=%d)\n", dupPageID, dupScore);
+      g_error_code = 0xCE;
+      PS_Exit();
+    }
+    if (g_error_code != 0x00 && g_error_code != 0x09)
       PS_Exit();
 
-    // 合并特征文件
-    PS_RegModel() || PS_Exit();
-    PS_StoreChar(2, toInt(argv[2])) || PS_Exit();
+    PS_StoreChar(2, pageID) || PS_Exit();
 
-    printf("OK! New fingerprint saved to pageID=%d\n", toInt(argv[2]));
+    printf("OK! New fingerprint saved to pageID=%d\n", pageID);
   }
 
   else if (match("enroll")) {
     checkArgc(2);
 
-    int count = 0;
     printf("Please put your finger on the moudle\n");
-    while (digitalRead(g_as608.detect_pin) == LOW) {
-      delay(1);
-      if ((count++) > 5000) {
+    if (!Capture_Do(fingerCapture(), 5000, enrollOp, NULL)) {
+      if (g_error_code == 0x02) {
         printf("Not detected the finger!\n");
-        exit(2);
+        quit(2);
       }
+      PS_Exit();
     }
-        
-    int pageID = 0;
-    PS_Enroll(&pageID) || PS_Exit();
 
-    printf("OK! New fingerprint saved to pageID=%d\n", pageID);
+    printf("OK! New fingerprint saved to pageID=%d\n", g_auto_page);
   }
   
   else if (match("info")) {
     checkArgc(2);
-    PS_GetAllInfo() || PS_Exit();
+    // 状态寄存器每次读取，INF 页中的字符串使用缓存
+    PS_ReadSysPara() || PS_Exit();
+    if (g_as608.sensor_name[0] == '\0') {
+      uchar buf[512] = { 0 };
+      PS_ReadINFpage(buf, 512) || PS_Exit();
+      DevCache_Save(g_config.serial, g_config.address, true);
+    }
 
     printf("Product SN:        %s\n", g_as608.product_sn);
     printf("Software version:  %s\n", g_as608.software_version);
@@ -338,12 +1600,9 @@ void analyseArgv(int argc, char* argv[]) {
   else if (match("empty")) {
     checkArgc(2);
     printf("Confirm to empty database: (Y/n)? ");
-    fflush(stdout);
-    char cmd;
-    scanf("%c", &cmd);
-    if (cmd == 'n' || cmd ==  'N') {
+    if (!confirm()) {
       printf("Canceled!\n");
-      exit(3);
+      quit(3);
     }
 
     PS_Empty() || PS_Exit();
@@ -360,7 +1619,7 @@ void analyseArgv(int argc, char* argv[]) {
       count = 1;
       printf("Confirm to delete fingerprint %d: (Y/n)? ", startPageID);
     }
-    else if (argc == 4) {
+    else if (g_argc == 4) {
       startPageID = toInt(argv[2]);
       count = toInt(argv[3]);
       printf("Confirm to delete fingerprint %d-%d: (Y/n)? ", startPageID, startPageID+count-1);
@@ -368,15 +1627,13 @@ void analyseArgv(int argc, char* argv[]) {
     else {
       printf("Command \"delete\" accept 1 or 2 parameter\n");
       printf("  Usage: fp delete startPageID [count]\n");
-      exit(1);
+      quit(1);
     }
 
     // 询问是否继续
-    fflush(stdout);
-    char cmd = getchar();
-    if (cmd == 'n' || cmd ==  'N') {
+    if (!confirm()) {
       printf("Canceled!\n");
-      exit(0);
+      quit(0);
     }
 
     PS_DeleteChar(startPageID, count) || PS_Exit();
@@ -394,63 +1651,315 @@ void analyseArgv(int argc, char* argv[]) {
     checkArgc(2);
 
     printf("Please put your finger on the module.\n");
-    PS_GetImage() || PS_Exit();
+    captureImage(5000) || PS_Exit();
     PS_GenChar(1) || PS_Exit();
 
     int pageID = 0, score = 0;
-    if (!PS_Search(1, 0, 300, &pageID, &score))
+    if (!PS_SearchPlanned(1, false, NULL, &pageID, &score))
       PS_Exit();
     else
       printf("Matched! pageID=%d score=%d\n", pageID, score);
   }
 
+  // 先在所属纹型的页段中搜索
+  else if (match("csearch")) {
+    checkArgc(2);
+
+    printf("Please put your finger on the module.\n");
+    captureImage(5000) || PS_Exit();
+    PS_GenChar(1) || PS_Exit();
+
+    static uchar image[CLASSIFY_WIDTH * CLASSIFY_HEIGHT];
+    long long start = getTimeUs();
+    PS_UpImageToBuf(image, sizeof(image)) || PS_Exit();
+    long long uploadUs = getTimeUs() - start;
+
+    start = getTimeUs();
+    ClassifyResult result;
+    if (!Classify_Image(image, &result)) {
+      printf("Error: Fingerprint area is too small to classify!\n");
+      quit(1);
+    }
+    long long classifyUs = getTimeUs() - start;
+
+    int pageID = 0, score = 0;
+    bool inClass = false;
+    start = getTimeUs();
+    Classify_Search(result.cls, false, &pageID, &score, &inClass) || PS_Exit();
+    long long searchUs = getTimeUs() - start;
+
+    printf("Matched! pageID=%d score=%d pattern=%s (%s)\n", pageID, score,
+        Classify_Name(result.cls), inClass ? "in class" : "out of class");
+    printf("Time: upload %lld ms, classify %lld ms, search %lld ms\n",
+        uploadUs / 1000, classifyUs / 1000, searchUs / 1000);
+  }
+
   else if (match("hsearch")) {  // high speed search
     checkArgc(2);
 
     printf("Please put your finger on the module.\n");
-    PS_GetImage() || PS_Exit();
+    captureImage(5000) || PS_Exit();
     PS_GenChar(1) || PS_Exit();
 
     int pageID = 0, score = 0;
-    if (!PS_HighSpeedSearch(1, 0, 300, &pageID, &score))
+    if (!PS_SearchPlanned(1, true, NULL, &pageID, &score))
       PS_Exit();
     else
       printf("Matched! pageID=%d score=%d\n", pageID, score);
   }
 
+  // 模板缓存的统计数据，或设置容量(守护进程、batch 中多次读取模板时有效)
+  else if (match("tcache")) {
+    if (g_argc == 3)
+      PS_SetTemplateCacheSize(toInt(argv[2])) || PS_Exit();
+    else
+      checkArgc(2);
+    printTemplateCache();
+  }
+  else if (match("enrollbench")) {
+    int n = (g_argc == 3) ? toInt(argv[2]) : 50;
+    enrollBenchmark(n > 0 ? n : 50);
+  }
+  else if (match("capturebench")) {
+    int n = (g_argc == 3) ? toInt(argv[2]) : 100;
+    captureBenchmark(n > 0 ? n : 100);
+  }
+  else if (match("allocbench")) {
+    int n = (g_argc == 3) ? toInt(argv[2]) : 50;
+    if (!allocBenchmark(n > 0 ? n : 50))
+      quit(1);
+  }
+  else if (match("tcachebench")) {
+    int n = (g_argc == 3) ? toInt(argv[2]) : 20;
+    templateCacheBenchmark(n > 0 ? n : 20);
+  }
+
+  // 比较整个指纹库搜索 与 按搜索计划搜索 的延时
+  else if (match("searchbench")) {
+    int n = (g_argc == 3) ? toInt(argv[2]) : 50;
+    if (n <= 0)
+      n = 50;
+    int used = PS_CountUsed(0, g_as608.capacity);
+    (used >= 0) || PS_Exit();
+    if (used == 0) {
+      printf("The database is empty!\n");
+      quit(1);
+    }
+
+    PageRange ranges[8];
+    int nRanges = PS_PlanSearch(ranges, 8, NULL);
+    printf("Fill level: %d/%d, planned %d ranges:", used, g_as608.capacity, nRanges);
+    for (int i = 0; i < nRanges; ++i)
+      printf(" [%d,%d)", ranges[i].start, ranges[i].start + ranges[i].count);
+    printf("\n");
+
+    long long* full    = (long long*)malloc(sizeof(long long) * n);
+    long long* planned = (long long*)malloc(sizeof(long long) * n);
+    Daemon_Defer(free, full);
+    Daemon_Defer(free, planned);
+    for (int i = 0; i < n; ++i) {
+      // 随机选一个已录入的模板作为待搜索的指纹
+      int page = PS_NextUsedPage(rand() % g_as608.capacity);
+      if (page == -1)
+        page = PS_NextUsedPage(0);
+      PS_LoadChar(1, page) || PS_Exit();
+
+      int pageID = 0, score = 0;
+      long long start = getTimeUs();
+      PS_HighSpeedSearch(1, 0, g_as608.capacity, &pageID, &score) || PS_Exit();
+      full[i] = getTimeUs() - start;
+
+      start = getTimeUs();
+      PS_SearchPlanned(1, true, NULL, &pageID, &score) || PS_Exit();
+      planned[i] = getTimeUs() - start;
+    }
+
+    printf("%-8s %10s %10s\n", "", "mean(ms)", "p99(ms)");
+    printLatency("full", full, n);
+    printLatency("planned", planned, n);
+    Daemon_Release(full);
+    Daemon_Release(planned);
+  }
+  // 录入到分片，模板放到已用比例最小的分片
+  else if (match("sadd")) {
+    checkArgc(2);
+    static ShardSet set;
+    openDevices(".fpshards", &set);
+
+    for (int i = 1; i <= 2; ++i) {
+      printf(i == 1 ? "Please put your finger on the module.\n" : "Ok.\nPlease put your finger again!\n");
+      bool captured = captureImage(5000);
+      if (!captured && g_error_code == 0x02) {
+        printf("Error: Didn't detect finger!\n");
+        Shard_Close(&set);
+        quit(1);
+      }
+      (captured && PS_GenChar(i)) || (Shard_Close(&set), PS_Exit());
+      if (i == 1) {
+        printf("Ok.\nPlease raise your finger!\n");
+        if (!waitUntilNotDetectFinger(5000)) {
+          printf("Error! Didn't raise your finger\n");
+          Shard_Close(&set);
+          quit(1);
+        }
+      }
+    }
+    PS_RegModel() || (Shard_Close(&set), PS_Exit());
+
+    // 所有分片中都没有才存储
+    int shard = 0, pageID = 0, score = 0;
+    if (Shard_Search(&set, 0, 1, &shard, &pageID, &score, NULL)) {
+      printf("This finger is already enrolled at shard %d pageID=%d (score=%d)\n", shard, pageID, score);
+      Shard_Close(&set);
+      g_error_code = 0xCE;
+      PS_Exit();
+    }
+    (g_error_code == 0x09) || (Shard_Close(&set), PS_Exit());
+
+    Shard_Store(&set, 2, &shard, &pageID) || (Shard_Close(&set), PS_Exit());
+    Daemon_Release(&set);
+    printf("OK! New fingerprint saved to shard %d pageID=%d\n", shard, pageID);
+  }
+
+  // 在所有分片中并行搜索
+  else if (match("sidentify")) {
+    checkArgc(2);
+    static ShardSet set;
+    openDevices(".fpshards", &set);
+
+    printf("Please put your finger on the module.\n");
+    bool captured = captureImage(5000);
+    if (!captured && g_error_code == 0x02) {
+      printf("Error: Didn't detect finger!\n");
+      Shard_Close(&set);
+      quit(1);
+    }
+    (captured && PS_GenChar(1)) || (Shard_Close(&set), PS_Exit());
+
+    int shard = 0, pageID = 0, score = 0;
+    long long start = getTimeUs();
+    bool ok = Shard_Search(&set, 0, 1, &shard, &pageID, &score, NULL);
+    long long elapsed = getTimeUs() - start;
+    Daemon_Release(&set);
+    ok || PS_Exit();
+    printf("Matched! shard=%d pageID=%d score=%d (%d shards, %lld ms)\n", shard, pageID, score, set.count, elapsed / 1000);
+  }
+
+  // 把当前模块 [start, start+count) 中的模板或目录中的模板推送到所有门禁模块
+  else if (match("replicate")) {
+    static RepTemplate templates[REPLICATE_MAX];
+    static ShardSet doors;
+    struct stat st;
+    int n = 0;
+    bool fromDir = (g_argc == 3 && stat(argv[2], &st) == 0 && S_ISDIR(st.st_mode));
+    if (fromDir) {
+      n = Replicate_LoadDir(templates, REPLICATE_MAX, argv[2]);
+    }
+    else {
+      int start = (g_argc >= 3) ? toInt(argv[2]) : 0;
+      int count = (g_argc >= 4) ? toInt(argv[3]) : g_as608.capacity;
+      n = Replicate_LoadPages(templates, REPLICATE_MAX, start, count);
+      (n >= 0) || PS_Exit();
+    }
+    if (n == 0) {
+      printf("No templates to replicate\n");
+      quit(1);
+    }
+
+    openDevices(".fpdoors", &doors);
+    RepReport report;
+    bool ok = Replicate_Run(&doors, templates, n, true, false, &report);
+    Daemon_Release(&doors);
+    printf("%d templates to %d devices in %.1f ms: %d pushed, %d skipped, %d devices up to date, %d retried, %d failed\n",
+      report.nTemplate, report.nDevice, report.timeUs / 1000.0, report.nPushed, report.nSkipped,
+      report.nSkippedDevice, report.nRetried, report.nFailed);
+    if (!ok)
+      quit(1);
+  }
+
+  else if (match("repbench")) {
+    int n = (g_argc == 3) ? toInt(argv[2]) : 20;
+    static ShardSet doors;
+    openDevices(".fpdoors", &doors);
+    repBenchmark(&doors, n > 0 ? n : 20);
+    Daemon_Release(&doors);
+  }
+
+  else if (match("shardbench")) {
+    int n = (g_argc == 3) ? toInt(argv[2]) : 20;
+    static ShardSet set;
+    openDevices(".fpshards", &set);
+    shardBenchmark(&set, n > 0 ? n : 20);
+    Daemon_Release(&set);
+  }
+  else if (match("busbench") || match("busprobe")) {
+    if (g_argc < 3) {
+      printf("ERROR! Please specify the chip addresses, e.g. 0x1,0x2,0x3\n");
+      quit(1);
+    }
+    uint addrs[BUS_MAX_MODULES];
+    int nAddr = 0;
+    char list[256] = { 0 };
+    strncpy(list, argv[2], sizeof(list) - 1);
+    for (char* tok = strtok(list, ","); tok && nAddr < BUS_MAX_MODULES; tok = strtok(NULL, ","))
+      addrs[nAddr++] = toUInt(tok);
+    int n = (g_argc == 4) ? toInt(argv[3]) : 10;
+    if (match("busprobe"))
+      busProbe(addrs, nAddr, n > 0 ? n : 10);
+    else
+      busBenchmark(addrs, nAddr, n > 0 ? n : 10);
+  }
+  else if (match("schedbench")) {
+    int n = (g_argc == 3) ? toInt(argv[2]) : 20;
+    schedBenchmark(n > 0 ? n : 20);
+  }
+  else if (match("iobench")) {
+    int nThread = (g_argc >= 3) ? toInt(argv[2]) : 4;
+    int n = (g_argc >= 4) ? toInt(argv[3]) : 50;
+    if (nThread <= 0 || nThread > IOQUEUE_MAX_CHANNELS) {
+      printf("ERROR! threads must be 1~%d\n", IOQUEUE_MAX_CHANNELS);
+      quit(1);
+    }
+    ioBenchmark(nThread, n > 0 ? n : 50);
+  }
+
   else if (match("identify")) {
     checkArgc(2);
     int pageID = 0;
     int score = 0;
     
-    // 检测手指是否存在
-    int count = 0;
+    // 等待手指按下，最长5秒
     printf("Please put your finger on the moudle\n");
-    while (digitalRead(g_as608.detect_pin) == LOW) {
-      delay(1);
-      if ((count++) > 5000) {
+    if (!Capture_Do(fingerCapture(), 5000, identifyOp, NULL)) {
+      if (g_error_code == 0x02) {
         printf("Not detected the finger!\n");
-        exit(2);
+        quit(2);
       }
+      PS_Exit();
     }
-
-    PS_Identify(&pageID, &score) || PS_Exit();
+    pageID = g_auto_page;
+    score = g_auto_score;
     printf("Matched! pageID=%d score=%d\n", pageID, score);
   }
 
+  // 连续识别，每次输出一行 JSON
+  else if (match("watch")) {
+    int count = (g_argc == 3) ? toInt(argv[2]) : 0;
+    Watch_Run(fingerCapture(), count);
+  }
+
   // 列出指纹列表
   else if (match("list")) {
     checkArgc(2);
-    int indexList[512] = { 0 };
-    PS_ReadIndexTable(indexList, 512) ||  PS_Exit();
+    uchar bitmap[64] = { 0 };
+    PS_ReadIndexBitmap(bitmap, 64) ||  PS_Exit();
 
-    int i = 0;
-    for (i = 0; i < 300; ++i) {
-      if (indexList[i] == -1)
-        break;
-      printf("%d\n", indexList[i]);
+    int count = 0;
+    for (int page = PS_NextUsedPage(0); page != -1; page = PS_NextUsedPage(page + 1)) {
+      printf("%d\n", page);
+      count++;
     }
-    if (i == 0) {
+    if (count == 0) {
       printf("The database is empty!\n");
     }
   }
@@ -458,7 +1967,7 @@ void analyseArgv(int argc, char* argv[]) {
   else if (match("getimage")) {
     checkArgc(2);
     printf("Please put your finger on the module.\n");
-    PS_GetImage() || PS_Exit();
+    captureImage(5000) || PS_Exit();
     printf("OK!\n");
   }
 
@@ -539,14 +2048,15 @@ void analyseArgv(int argc, char* argv[]) {
   else if (match("baudrate")) {
     if (g_argc == 2) {
       printf("%d\n", g_as608.baud_rate);
-      exit(0);
+      quit(0);
     }
     else if (g_argc == 3) {
       PS_SetBaudRate(toInt(argv[2])) ||  PS_Exit();
+      DevCache_Invalidate(g_config.serial, g_config.address);
     }
     else {
       printf("Command \"baudrate\" accept 1 parameter at most\n");
-      exit(1);
+      quit(1);
     }
 
     printf("OK!\n");
@@ -555,14 +2065,15 @@ void analyseArgv(int argc, char* argv[]) {
   else if (match("level")) {
     if (g_argc == 2) {
       printf("%d\n", g_as608.secure_level);
-      exit(0);
+      quit(0);
     }
     else if (g_argc == 3) {
       PS_SetSecureLevel(toInt(argv[2])) ||  PS_Exit();
+      DevCache_Invalidate(g_config.serial, g_config.address);
     }
     else {
       printf("Command \"level\" accept 1 parameter at most\n");
-      exit(1);
+      quit(1);
     }
 
     printf("OK!\n");
@@ -571,14 +2082,15 @@ void analyseArgv(int argc, char* argv[]) {
   else if (match("packetsize")) {
     if (g_argc == 2) {
       printf("%d\n", g_as608.packet_size);
-      exit(0);
+      quit(0);
     }
     else if (g_argc == 3) {
       PS_SetPacketSize(toInt(argv[2])) ||  PS_Exit();
+      DevCache_Invalidate(g_config.serial, g_config.address);
     }
     else {
       printf("Command \"packetsize\" accept 1 parameter at most\n");
-      exit(1);
+      quit(1);
     }
 
     printf("OK!\n");
@@ -587,17 +2099,18 @@ void analyseArgv(int argc, char* argv[]) {
   else if (match("address")) {
     if (g_argc == 2) {
       printf("0x%08x\n", g_as608.chip_addr);
-      exit(0);
+      quit(0);
     }
     else if (g_argc == 3) {
       PS_SetChipAddr(toUInt(argv[2])) || PS_Exit();
+      DevCache_Invalidate(g_config.serial, g_config.address);
       g_config.address = toUInt(argv[2]);
       if (writeConfig())
         printf("New chip address is 0x%08x\n", g_as608.chip_addr);
     }
     else {
       printf("Command \"address\" accept 1 parameter at most\n");
-      exit(1);
+      quit(1);
     }
 
     printf("OK!\n");
@@ -627,7 +2140,7 @@ void analyseArgv(int argc, char* argv[]) {
     FILE* fp = fopen(argv[2], "w+");
     if (!fp) {
       printf("Open file error\n");
-      exit(1);
+      quit(1);
     }
     fwrite(buf, 1, 512, fp);
     fclose(fp);
@@ -646,7 +2159,7 @@ void analyseArgv(int argc, char* argv[]) {
     }
     else {
       printf("Command \"writenote\" accept 1 or 2 parameter\n");
-      exit(1);
+      quit(1);
     }
 
     if (strlen(buf) > 31) {   // 如果输入的字符多于31个
@@ -655,10 +2168,11 @@ void analyseArgv(int argc, char* argv[]) {
       scanf("%c", &c);
       if (c != 'y' && c != 'Y') {
         printf("Canceled!\n");
-        exit(0);
+        quit(0);
       }
     }
 
+    buf[31] = 0;  // 最多保存31个字符和结束符
     PS_WriteNotepad(toInt(argv[2]), buf, 32) ||  PS_Exit();
 
     printf("OK\n");
@@ -671,9 +2185,364 @@ void analyseArgv(int argc, char* argv[]) {
     printf("%s\n", buf);
   }
 
+  // 记事本中的键值存储
+  else if (match("kv")) {
+    static KVStore kv;
+    KV_Open(&kv) || PS_Exit();
+
+    if (g_argc == 2) {
+      char key[KV_MAX_KEY + 1];
+      const uchar* value;
+      int len = 0;
+      for (int i = 0; KV_At(&kv, i, key, &value, &len); ++i)
+        printf("%s=%.*s\n", key, len, value);
+    }
+    else if (g_argc == 3) {
+      char value[256] = { 0 };
+      if (!KV_GetStr(&kv, argv[2], value, sizeof(value))) {
+        printf("Key \"%s\" not found\n", argv[2]);
+        quit(1);
+      }
+      printf("%s\n", value);
+    }
+    else if (g_argc == 4) {
+      KV_SetStr(&kv, argv[2], argv[3]) || PS_Exit();
+      int written = KV_Flush(&kv);
+      (written >= 0) || PS_Exit();
+      printf("OK! %d notepad pages written\n", written);
+    }
+    else {
+      printf("Command \"kv\" accept 2 parameters at most\n");
+      quit(1);
+    }
+  }
+
+  else if (match("kvdel")) {
+    checkArgc(3);
+    static KVStore kv;
+    KV_Open(&kv) || PS_Exit();
+    if (!KV_Delete(&kv, argv[2])) {
+      printf("Key \"%s\" not found\n", argv[2]);
+      quit(1);
+    }
+    (KV_Flush(&kv) >= 0) || PS_Exit();
+    printf("OK!\n");
+  }
+
+  // 虚拟指纹库识别，模块作为主机指纹库的缓存
+  else if (match("videntify")) {
+    if (g_argc < 3 || g_argc > 5) {
+      printf("Command \"videntify\" accept 1 to 3 parameters\n");
+      printf("  Usage: fp videntify dir [lru|lfu|lrfu] [evict]\n");
+      printf("  evict: allow replacing templates enrolled outside the virtual database\n");
+      quit(1);
+    }
+
+    static VdbCache cache;
+    cache.policy = VDB_LRFU;
+    cache.evictUnmanaged = false;
+    for (int i = 3; i < g_argc; ++i) {
+      if (strcmp(argv[i], "lru") == 0)
+        cache.policy = VDB_LRU;
+      else if (strcmp(argv[i], "lfu") == 0)
+        cache.policy = VDB_LFU;
+      else if (strcmp(argv[i], "evict") == 0)
+        cache.evictUnmanaged = true;
+    }
+    Vdb_Load(argv[2], g_config.serial, &cache) || PS_Exit();
+
+    Matcher* matcher = Matcher_Create(0);
+    if (matcher)
+      Daemon_Defer(destroyMatcher, matcher);
+    if (!matcher || Matcher_LoadDir(matcher, argv[2]) == 0) {
+      printf("No templates found in %s\n", argv[2]);
+      quit(1);
+    }
+
+    printf("Please put your finger on the module.\n");
+    bool captured = captureImage(5000);
+    if (!captured && g_error_code == 0x02) {
+      printf("Error: Didn't detect finger!\n");
+      quit(1);
+    }
+    captured || PS_Exit();
+    PS_GenChar(1) || PS_Exit();
+
+    int uid = 0, score = 0;
+    bool hit = false;
+    long long start = getTimeUs();
+    bool ok = Vdb_Identify(argv[2], &cache, matcher, &uid, &score, &hit);
+    long long elapsed = getTimeUs() - start;
+    Vdb_Save(argv[2], g_config.serial, &cache);
+    Daemon_Release(matcher);
+    ok || PS_Exit();
+
+    printf("Matched! uid=%d score=%d (%s, %lld ms)\n", uid, score, hit ? "hit" : "miss", elapsed / 1000);
+  }
+
+  // 先搜索热区，再搜索其余的页
+  else if (match("hidentify")) {
+    static HotZone hz;
+    hz.zoneSize = (g_argc == 3) ? toInt(argv[2]) : 0;
+    char filename[256] = { 0 };
+    homeStatePath(filename, sizeof(filename), ".fphot_");
+    HotZone_Load(filename, &hz) || PS_Exit();
+
+    printf("Please put your finger on the module.\n");
+    bool captured = captureImage(5000);
+    if (!captured && g_error_code == 0x02) {
+      printf("Error: Didn't detect finger!\n");
+      quit(1);
+    }
+    captured || PS_Exit();
+    PS_GenChar(1) || PS_Exit();
+
+    int user = 0, pageID = 0, score = 0;
+    bool hot = false;
+    long long start = getTimeUs();
+    bool ok = HotZone_Identify(&hz, &user, &pageID, &score, &hot);
+    long long elapsed = getTimeUs() - start;
+    HotZone_Save(filename, &hz);
+    ok || PS_Exit();
+
+    printf("Matched! user=%d pageID=%d score=%d (%s, %lld ms)\n",
+        user, pageID, score, hot ? "hot zone" : "remainder", elapsed / 1000);
+    if (HotZone_Due(&hz))
+      printf("Hot zone is due for compaction, run \"fp hotcompact\" when idle\n");
+  }
+
+  // 整理热区，应在空闲时执行
+  else if (match("hotcompact")) {
+    static HotZone hz;
+    char filename[256] = { 0 };
+    homeStatePath(filename, sizeof(filename), ".fphot_");
+    HotZone_Load(filename, &hz) || PS_Exit();
+
+    int maxMoves = (g_argc == 3) ? toInt(argv[2]) : 0;
+    int moves = HotZone_Compact(&hz, maxMoves);
+    // 出错时已完成的移动也要记录
+    HotZone_Save(filename, &hz);
+    (moves >= 0) || PS_Exit();
+    printf("Moved %d templates into the hot zone [0,%d)\n", moves, hz.zoneSize);
+  }
+
+  // 指纹库查重，生成整理计划；apply 执行上次生成的计划
+  else if (match("dedup")) {
+    const char* dir = NULL;
+    bool compact = false, apply = false;
+    for (int i = 2; i < g_argc; ++i) {
+      if (strcmp(argv[i], "compact") == 0)
+        compact = true;
+      else if (strcmp(argv[i], "apply") == 0)
+        apply = true;
+      else
+        dir = argv[i];
+    }
+
+    char filename[256] = { 0 };
+    homeStatePath(filename, sizeof(filename), ".fpdedup_");
+    static DedupPlan plan;
+    if (apply) {
+      Dedup_LoadPlan(filename, &plan) || PS_Exit();
+      Dedup_Apply(&plan) || PS_Exit();
+      remove(filename);
+      printf("OK! Deleted %d duplicates, moved %d templates\n", plan.nDelete, plan.nMove);
+      quit(0);
+    }
+
+    static DedupReport report;
+    if (dir) {
+      Matcher* matcher = Matcher_Create(0);
+      if (matcher)
+        Daemon_Defer(destroyMatcher, matcher);
+      if (!matcher || Matcher_LoadDir(matcher, dir) == 0) {
+        printf("No templates found in %s\n", dir);
+        quit(1);
+      }
+      bool ok = Dedup_ScanHost(dir, matcher, &report);
+      Daemon_Release(matcher);
+      ok || PS_Exit();
+    }
+    else {
+      Dedup_ScanModule(&report) || PS_Exit();
+    }
+    Dedup_Print(&report);
+
+    Dedup_Plan(&report, compact, &plan) || PS_Exit();
+    if (plan.nDelete == 0 && plan.nMove == 0) {
+      printf("No duplicates found\n");
+      quit(0);
+    }
+    Dedup_SavePlan(filename, &plan) || PS_Exit();
+    printf("Plan: delete %d pages, move %d templates. Saved to %s\n", plan.nDelete, plan.nMove, filename);
+    printf("Run \"fp dedup apply\" to execute it\n");
+  }
+
+  // 常驻，通过 Unix 域套接字接收命令
+  else if (match("daemon")) {
+    if (Daemon_InSession()) {
+      printf("The daemon is already running\n");
+      quit(1);
+    }
+    char path[108] = { 0 };
+    if (g_argc == 3)
+      strncpy(path, argv[2], sizeof(path) - 1);
+    else if (!FpClient_DefaultPath(path, sizeof(path), g_config.serial, g_config.address)) {
+      printf("The socket path is too long\n");
+      quit(1);
+    }
+
+    int fd = FpClient_Connect(path);
+    if (fd >= 0) {
+      FpClient_Close(fd);
+      printf("The daemon is already running on %s\n", path);
+      quit(1);
+    }
+    Daemon_Serve(path, runCommand);
+    quit(1);
+  }
+
+  // 批处理，在同一个会话中执行文件或 stdin 中的命令
+  else if (match("batch")) {
+    const char* filename = "-";
+    bool stopOnError = false;
+    if (g_argc > 4) {
+      printf("Command \"batch\" accept at most 2 parameters\n");
+      printf("  Usage: fp batch [file|-] [stop]\n");
+      quit(1);
+    }
+    for (int i = 2; i < g_argc; ++i) {
+      if (strcmp(argv[i], "stop") == 0)
+        stopOnError = true;
+      else
+        filename = argv[i];
+    }
+
+    FILE* fp = stdin;
+    if (strcmp(filename, "-") != 0) {
+      fp = fopen(filename, "r");
+      if (!fp) {
+        printf("Can not open %s\n", filename);
+        quit(1);
+      }
+    }
+    BatchCommand* cmds = NULL;
+    int n = Batch_Load(fp, &cmds);
+    if (fp != stdin)
+      fclose(fp);
+    if (n < 0)
+      quit(1);
+
+    Batch_Optimize(cmds, n, g_as608.capacity);
+    BatchReport report;
+    bool ok = Batch_Run(cmds, n, runCommand, stopOnError, &report);
+    free(cmds);
+    Batch_PrintReport(&report);
+    if (!ok)
+      quit(1);
+  }
+
+  // 主机指纹库 与 模块指纹库 差量同步
+  else if (match("sync")) {
+    if (g_argc != 3 && g_argc != 4) {
+      printf("Command \"sync\" accept 1 or 2 parameter\n");
+      printf("  Usage: fp sync dir [verify]\n");
+      quit(1);
+    }
+    bool verify = (g_argc == 4 && strcmp(argv[3], "verify") == 0);
+
+    static SyncPlan plan;
+    Sync_Plan(argv[2], g_config.serial, verify, &plan) || PS_Exit();
+    printf("Store: %d templates. Missing: %d, stale: %d, extra: %d\n",
+        plan.nStore, plan.nMissing, plan.nStale, plan.nExtra);
+    if (plan.useEmpty)
+      printf("Plan: empty database, write %d pages\n", plan.nWrite);
+    else
+      printf("Plan: delete %d ranges, write %d pages\n", plan.nDelete, plan.nWrite);
+
+    SyncReport report;
+    Sync_Execute(argv[2], &plan, &report) || PS_Exit();
+
+    printf("OK! %d commands, %d char files downloaded\n", report.nCommand, report.nDownChar);
+    printf("Transferred: %lld bytes (full rewrite: %lld bytes, saved %lld)\n",
+        report.bytes, report.fullBytes, report.fullBytes - report.bytes);
+    printf("Time: %lld ms (full rewrite: ~%lld ms, saved ~%lld ms)\n",
+        report.timeUs / 1000, report.fullTimeUs / 1000, (report.fullTimeUs - report.timeUs) / 1000);
+  }
+
+  // 从其他站点拉取主机指纹库的修改，再差量同步到模块
+  else if (match("sitepull")) {
+    if (g_argc != 4) {
+      printf("Command \"sitepull\" accept 2 parameter\n");
+      printf("  Usage: fp sitepull host[:port] dir\n");
+      quit(1);
+    }
+    char host[128] = { 0 };
+    strncpy(host, argv[2], sizeof(host) - 1);
+    int port = SITE_PORT;
+    char* colon = strrchr(host, ':');
+    if (colon) {
+      *colon = 0;
+      port = toInt(colon + 1);
+    }
+
+    SiteReport site;
+    if (!Site_Pull(argv[3], host, port, true, &site))
+      quit(1);
+    printf("Pulled %d entries (%d applied, %d older than local) in %lld ms, %lld bytes (%lld uncompressed)\n",
+        site.nEntry, site.nApplied, site.nIgnored, site.timeUs / 1000, site.wireBytes, site.rawBytes);
+
+    static SyncPlan plan;
+    Sync_Plan(argv[3], g_config.serial, false, &plan) || PS_Exit();
+    SyncReport report;
+    Sync_Execute(argv[3], &plan, &report) || PS_Exit();
+    printf("Synced to the module: %d commands, %d char files downloaded, %lld ms\n",
+        report.nCommand, report.nDownChar, report.timeUs / 1000);
+  }
+
+  // 在主机端指纹库中搜索，不受模块300个模板的限制
+  else if (match("hostsearch")) {
+    if (g_argc != 3 && g_argc != 4) {
+      printf("Command \"hostsearch\" accept 1 or 2 parameter\n");
+      printf("  Usage: fp hostsearch dir [k]\n");
+      quit(1);
+    }
+    int k = (g_argc == 4) ? toInt(argv[3]) : 1;
+
+    Matcher* matcher = Matcher_Create(0);
+    if (matcher)
+      Daemon_Defer(destroyMatcher, matcher);
+    if (!matcher || Matcher_LoadDir(matcher, argv[2]) == 0) {
+      printf("No templates found in %s\n", argv[2]);
+      quit(1);
+    }
+
+    printf("Please put your finger on the module.\n");
+    bool captured = captureImage(5000);
+    if (!captured && g_error_code == 0x02) {
+      printf("Error: Didn't detect finger!\n");
+      quit(1);
+    }
+    captured || PS_Exit();
+    PS_GenChar(1) || PS_Exit();
+
+    uchar probe[768] = { 0 };
+    PS_UpCharToBuf(1, probe, 768) || PS_Exit();
+
+    MatchResult results[MATCHER_MAX_K];
+    long long start = getTimeUs();
+    int n = Matcher_Search(matcher, probe, k, 0, results);
+    long long elapsed = getTimeUs() - start;
+
+    for (int i = 0; i < n; ++i)
+      printf("id=%d score=%d\n", results[i].id, results[i].score);
+    printf("Searched %d templates in %lld us\n", Matcher_Count(matcher), elapsed);
+    Daemon_Release(matcher);
+  }
+
   else {
     printf("Unknown parameter \"%s\"\n", argv[1]);
-    exit(1);
+    quit(1);
   }
 } // end analyseArgv
 
@@ -688,6 +2557,7 @@ void printConfig() {
   printf("serial_file=%s\n",   g_config.serial);
   printf("baudrate=%d\n",   g_config.baudrate);
   printf("detect_pin=%d\n",   g_config.detect_pin);
+  printf("detect_chip=%s\n",  g_config.detect_chip[0] ? g_config.detect_chip : "wiringpi");
 }
 
 // 同步g_config变量内容和其他变量内容
@@ -707,9 +2577,8 @@ bool readConfig() {
   char filename[256] = { 0 };
   sprintf(filename, "%s/.fpconfig", getenv("HOME"));
   
-  // 主目录下的配置文件
+  // 主目录下的配置文件(只读取，空白字符在解析时去除)
   if (access(filename, F_OK) == 0) { 
-    trimSpaceInFile(filename);
     fp = fopen(filename, "r");
   }
   else {
@@ -729,7 +2598,7 @@ bool readConfig() {
     printf("  fp cfgpwd    0x[password]\n");
     printf("  fp cfgserial [serialFile]\n");
     printf("  fp cfgbaud   [rate]\n");
-    printf("  fp cfgpin    [GPIO_pin]\n");
+    printf("  fp cfgpin    [GPIO_pin] {chip}\n");
     return false;
   }
 
@@ -782,6 +2651,9 @@ bool readConfig() {
     else if (strcmp(key, "detect_pin") == 0) {
       g_config.detect_pin = toInt(value);
     }
+    else if (strcmp(key, "detect_chip") == 0) {
+      strcpy(g_config.detect_chip, value);
+    }
     else {
       printf("Unknown key:%s\n", key);
       fclose(fp);
@@ -807,7 +2679,7 @@ bool writeConfig() {
   FILE* fp = fp = fopen(filename, "w+");
   if (!fp) {
     printf("Write config file error!\n");
-    exit(0);
+    quit(0);
   }
 
   fprintf(fp, "address=0x%08x\n", g_config.address);
@@ -817,6 +2689,8 @@ bool writeConfig() {
     fprintf(fp, "password=none\n");
   fprintf(fp, "baudrate=%d\n", g_config.baudrate);
   fprintf(fp, "detect_pin=%d\n", g_config.detect_pin);
+  if (g_config.detect_chip[0])
+    fprintf(fp, "detect_chip=%s\n", g_config.detect_chip);
   fprintf(fp, "serial=%s\n", g_config.serial);
 
   fclose(fp);
@@ -836,13 +2710,20 @@ void printUsage() {
   printf("  cfgpwd    [pwd]      Config password in local config file\n");
   printf("  cfgserial [serialFile] Config serial port in local config file. Default:/dev/ttyAMA0\n");
   printf("  cfgbaud   [rate]     Config baud rate in local config file\n");
-  printf("  cfgpin    [GPIO_pin] Config GPIO pin to detect finger in local confilg file\n\n");
-
-  printf("  add       [pID]      Add a new fingerprint to database. (Read twice) \n");
+  printf("  cfgpin    [GPIO_pin] {chip} Config GPIO pin to detect finger in local confilg file,\n");
+  printf("                         chip: /dev/gpiochipN (pin is the line offset), fake or wiringpi\n");
+  printf("  cfgshard  [{serial addr}...] Show or config the shards, the first one has the sensor\n");
+  printf("  cfgdoor   [{serial addr}...] Show or config the door modules for replication\n\n");
+
+  printf("  add       [{pID}]    Add a new fingerprint to database. (Hold the finger, best 2 of\n");
+  printf("                         %d samples are merged)\n", ENROLL_DEFAULT_SAMPLES);
+  printf("                         Saved to the first free page if pID is omitted,\n");
+  printf("                         or to the page range of its pattern if pID is \"class\"\n");
   printf("  enroll    []         Add a new fingerprint to database. (Read only once)\n");
   printf("  delete    [pID {count}]  Delete one or contiguous fingerprints.\n");
   printf("  empty     []         Empty the database.\n");
   printf("  search    []         Collect fingerprint and search in database.\n");
+  printf("  csearch   []         Search the page range of its pattern first\n");
   printf("  identify  []         Search\n");
   printf("  count     []         Get the count of registered fingerprints.\n");
   printf("  list      []         Show the registered fingerprints list.\n");
@@ -874,10 +2755,60 @@ void printUsage() {
   printf("  baudrate      [{rate}]        Show or Set baud rate\n");
   printf("  level         [{level}]       Show or Set secure level(1~5)\n");
   printf("  address       [{addr}]        Show or Set secure level(1~5)\n");
+  printf("  searchbench   [{n}]           Compare latency of full-range and occupancy-planned search\n");
+  printf("  enrollbench   [{n}]           Compare two-shot and best-of-N enrollment of n users (not stored)\n");
+  printf("  capturebench  [{n}]           Compare fixed-delay and adaptive image capture over n presses\n");
+  printf("  tcache        [{size}]        Show hit rate of the template cache, or set its size (0~1024)\n");
+  printf("  tcachebench   [{n}]           Compare reading n templates 3 times with and without the cache\n");
+  printf("  allocbench    [{n}]           Run transfer commands n times and check they allocate no heap memory\n");
+  printf("  hostsearch    [dir {k}]       Collect fingerprint and search in templates in dir\n");
+  printf("                                  on the host (dir/[id].char, no 300 limit)\n");
+  printf("  matchbench    [{threads}]     Benchmark the host matcher with 1k/10k/100k templates\n");
+  printf("  gpiobench     [{n}]           Compare finger-down detection delay of polling and edge events\n");
+  printf("  sadd          []              Add a fingerprint to the least loaded shard\n");
+  printf("  sidentify     []              Identify by searching all shards in parallel\n");
+  printf("  shardbench    [{n}]           Show capacity and search latency with 1..K shards\n");
+  printf("  replicate     [{start count}] Push templates in the page range to all doors concurrently\n");
+  printf("  replicate     [dir]           Push templates in dir (dir/[page].char) to all doors\n");
+  printf("  repbench      [{n}]           Compare serial and concurrent replication of n templates\n");
+  printf("  busprobe      [addrs {n}]     Measure the processing time of slow commands on the bus modules\n");
+  printf("  busbench      [addrs {n}]     Compare one-at-a-time and interleaved commands to modules\n");
+  printf("                                  sharing the bus (addrs: 0x1,0x2,...)\n");
+  printf("  schedbench    [{n}]           Compare identification latency during a backup with and\n");
+  printf("                                  without priority scheduling\n");
+  printf("  iobench       [{threads n}]   Compare sharing the port by a mutex and by an I/O thread with\n");
+  printf("                                  lock-free queues, n requests from each thread\n");
+  printf("  videntify     [dir {policy}]  Identify with the module as a cache of templates in dir\n");
+  printf("                                  (policy: lru, lfu or lrfu; add \"evict\" to allow replacing\n");
+  printf("                                  templates enrolled outside the cache)\n");
+  printf("  vdbsim        [{users cap n}] Simulate hit rate and latency of the module cache\n");
+  printf("  dedup         [{dir compact}] Find duplicate enrollments and make a cleanup plan,\n");
+  printf("                                  pruned with backed-up templates in dir if given\n");
+  printf("  dedup         [apply]         Execute the plan made by the last dedup\n");
+  printf("  daemon        [{path}]        Keep the device open and serve commands on a Unix socket\n");
+  printf("                                  (fp forwards commands to it when it is running)\n");
+  printf("  daemonbench   [{n cmd...}]    Compare latency of cold start and requests to the daemon\n");
+  printf("  watch         [{n}]           Identify continuously on finger-down, one JSON line per decision\n");
+  printf("  batch         [{file} {stop}] Run commands in file or stdin (one per line) in one session,\n");
+  printf("                                  stop at the first failure if \"stop\" is given\n");
+  printf("  hidentify     [{zone}]        Identify by searching the hot zone of frequent users first\n");
+  printf("  hotcompact    [{max}]         Move frequent users into the hot zone (run when idle)\n");
+  printf("  hotsim        [{u zone n}]    Simulate latency of hot zone search on a skewed trace\n");
+  printf("  classify      [filename]      Classify a bmp image (arch/loop/whorl)\n");
+  printf("  classbench    [{n}]           Benchmark classification on synthetic images\n");
+  printf("  chardump      [filename]      Show a char file with the guessed (unverified) layout\n");
+  printf("  kv            [{key {value}}] List, get or set metadata stored in notepad pages %d~15\n", KV_FIRST_PAGE);
+  printf("  kvdel         [key]           Delete metadata stored in notepad\n");
+  printf("  sync          [dir {verify}]  Sync database with templates in dir (dir/[pID].char),\n");
+  printf("                                  only missing, stale or extra pages are transferred\n");
+  printf("  siteserve     [dir {port}]    Serve changes of templates in dir to other sites over TCP\n");
+  printf("  sitepull      [host[:port] dir] Pull changes from another site into dir, then sync the module\n");
+  printf("  sitebench     [{n}]           Benchmark site sync of n templates between two local processes\n");
   
   printf("\nAvaiable options:\n");
   printf("  -h    Show help\n");
   printf("  -v    Shwo details while excute the order\n");
+  printf("  -y    Do not ask for confirmation\n");
 
   printf("\nUsage:\n  ./fp [command] [param] [option]\n\n");
 }
@@ -0,0 +1,487 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+#include "./matcher.h"
+#include "./utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define CHUNK_BLOCKS 8   // 每个工作单元包含的块数
+
+typedef uchar          v16u8  __attribute__((vector_size(16)));
+typedef unsigned short v16u16 __attribute__((vector_size(32)));
+
+typedef struct _Worker {
+  pthread_t thread;
+  Matcher*  owner;
+  int       index;
+  _Atomic unsigned long long range;   // 高32位为区间起点，低32位为区间终点 [lo, hi)
+  int nResult;
+  MatchResult heap[MATCHER_MAX_K];    // 得分最高的k个结果(小顶堆)
+} Worker;
+
+struct _Matcher {
+  int    nThreads;
+  Worker* workers;
+  MatchResult* merged;  // 合并各线程结果的缓冲区，nThreads*MATCHER_MAX_K 个
+
+  int    count;       // 模板个数
+  int    nBlocks;     // 已分配的块数
+  uchar* data;        // 特征数据，data[块][维度][通道]
+  int*   ids;         // 模板编号，ids[块*MATCHER_LANES+通道]
+
+  // 当前任务
+  const uchar* probe;
+  int    nz[MATCHER_DIM];   // probe 中非零维度的下标
+  int    nNz;
+  int    k;
+  int    threshold;
+  atomic_int stop;          // 提前终止
+
+  // 线程同步(仅在任务开始和结束时使用)
+  pthread_mutex_t lock;
+  pthread_cond_t  start;
+  pthread_cond_t  done;
+  int    generation;
+  int    nFinished;
+  bool   quit;
+};
+
+static inline unsigned long long packRange(unsigned lo, unsigned hi) {
+  return ((unsigned long long)lo << 32) | hi;
+}
+
+// 把结果放入小顶堆
+static void heapPush(Worker* w, int k, int id, int score) {
+  MatchResult* h = w->heap;
+  if (w->nResult == k) {
+    if (score <= h[0].score)
+      return;
+    // 替换堆顶，下沉
+    int i = 0;
+    while (true) {
+      int l = 2*i + 1, r = l + 1, m = i;
+      if (l < k && h[l].score < (m == i ? score : h[m].score)) m = l;
+      if (r < k && h[r].score < (m == i ? score : h[m].score)) m = r;
+      if (m == i)
+        break;
+      h[i] = h[m];
+      i = m;
+    }
+    h[i].id = id;
+    h[i].score = score;
+    return;
+  }
+  // 上浮
+  int i = w->nResult++;
+  while (i > 0 && h[(i-1)/2].score > score) {
+    h[i] = h[(i-1)/2];
+    i = (i-1) / 2;
+  }
+  h[i].id = id;
+  h[i].score = score;
+}
+
+/*
+ * 比对一个块内的 MATCHER_LANES 个模板
+ * 得分为 probe 与模板特征值相等且非零的维度个数
+*/
+static void scoreBlock(const Matcher* m, const uchar* block, int* scores) {
+  v16u8  acc8  = { 0 };
+  v16u16 acc16 = { 0 };
+  int pending = 0;
+
+  for (int i = 0; i < m->nNz; ++i) {
+    int j = m->nz[i];
+    v16u8 col  = *(const v16u8*)(block + j * MATCHER_LANES);
+    v16u8 eq   = (v16u8)(col == m->probe[j]);  // 相等的通道为0xff
+    acc8 -= eq;
+    // 8位累加器最多累加255次，之后合并到16位累加器
+    if (++pending == 255) {
+      acc16 += __builtin_convertvector(acc8, v16u16);
+      acc8 = (v16u8){ 0 };
+      pending = 0;
+    }
+  }
+  acc16 += __builtin_convertvector(acc8, v16u16);
+
+  for (int lane = 0; lane < MATCHER_LANES; ++lane)
+    scores[lane] = acc16[lane];
+}
+
+static void processChunk(Matcher* m, Worker* w, unsigned chunk) {
+  int scores[MATCHER_LANES];
+  int firstBlock = chunk * CHUNK_BLOCKS;
+  for (int b = firstBlock; b < firstBlock + CHUNK_BLOCKS && b * MATCHER_LANES < m->count; ++b) {
+    scoreBlock(m, m->data + (size_t)b * MATCHER_DIM * MATCHER_LANES, scores);
+    for (int lane = 0; lane < MATCHER_LANES; ++lane) {
+      int id = m->ids[b * MATCHER_LANES + lane];
+      if (id < 0)
+        continue;
+      heapPush(w, m->k, id, scores[lane]);
+      if (m->threshold > 0 && scores[lane] >= m->threshold)
+        atomic_store(&m->stop, 1);
+    }
+  }
+}
+
+// 从自己的区间头部取一个工作单元
+static bool takeOwn(Worker* w, unsigned* chunk) {
+  unsigned long long r = atomic_load(&w->range);
+  while (true) {
+    unsigned lo = r >> 32, hi = (unsigned)r;
+    if (lo >= hi)
+      return false;
+    if (atomic_compare_exchange_weak(&w->range, &r, packRange(lo + 1, hi))) {
+      *chunk = lo;
+      return true;
+    }
+  }
+}
+
+// 从其他线程的区间尾部窃取一半
+static bool steal(Matcher* m, int self) {
+  for (int i = 1; i < m->nThreads; ++i) {
+    Worker* v = &m->workers[(self + i) % m->nThreads];
+    unsigned long long r = atomic_load(&v->range);
+    while (true) {
+      unsigned lo = r >> 32, hi = (unsigned)r;
+      if (lo >= hi)
+        break;
+      unsigned mid = lo + (hi - lo) / 2;
+      if (atomic_compare_exchange_weak(&v->range, &r, packRange(lo, mid))) {
+        atomic_store(&m->workers[self].range, packRange(mid, hi));
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static void runJob(Matcher* m, int self) {
+  Worker* w = &m->workers[self];
+  unsigned chunk;
+  while (!atomic_load(&m->stop)) {
+    if (takeOwn(w, &chunk))
+      processChunk(m, w, chunk);
+    else if (!steal(m, self))
+      break;
+  }
+}
+
+static void* workerMain(void* arg) {
+  Worker* w = (Worker*)arg;
+  Matcher* m = w->owner;
+  int self = w->index;
+
+  int generation = 0;
+  while (true) {
+    pthread_mutex_lock(&m->lock);
+    while (m->generation == generation && !m->quit)
+      pthread_cond_wait(&m->start, &m->lock);
+    if (m->quit) {
+      pthread_mutex_unlock(&m->lock);
+      break;
+    }
+    generation = m->generation;
+    pthread_mutex_unlock(&m->lock);
+
+    runJob(m, self);
+
+    pthread_mutex_lock(&m->lock);
+    if (++m->nFinished == m->nThreads - 1)
+      pthread_cond_signal(&m->done);
+    pthread_mutex_unlock(&m->lock);
+  }
+  return NULL;
+}
+
+/*
+ * 特征向量
+ *   特征文件的布局没有核对过(见 charfile.h)，不解析，直接以每个字节作为一个维度。
+*/
+void Matcher_Extract(const uchar* charFile, uchar* feature) {
+  memcpy(feature, charFile, MATCHER_DIM);
+}
+
+Matcher* Matcher_Create(int nThreads) {
+  if (nThreads <= 0)
+    nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nThreads <= 0)
+    nThreads = 1;
+
+  Matcher* m = (Matcher*)calloc(1, sizeof(Matcher));
+  if (!m)
+    return NULL;
+  m->nThreads = nThreads;
+  m->workers = (Worker*)calloc(nThreads, sizeof(Worker));
+  m->merged = (MatchResult*)malloc(sizeof(MatchResult) * MATCHER_MAX_K * nThreads);
+  if (!m->workers || !m->merged) {
+    free(m->workers);
+    free(m->merged);
+    free(m);
+    return NULL;
+  }
+  pthread_mutex_init(&m->lock, NULL);
+  pthread_cond_init(&m->start, NULL);
+  pthread_cond_init(&m->done, NULL);
+
+  // 0号工作线程即调用 Matcher_Search 的线程
+  for (int i = 0; i < nThreads; ++i) {
+    m->workers[i].owner = m;
+    m->workers[i].index = i;
+    if (i > 0)
+      pthread_create(&m->workers[i].thread, NULL, workerMain, &m->workers[i]);
+  }
+  return m;
+}
+
+void Matcher_Destroy(Matcher* m) {
+  if (!m)
+    return;
+  pthread_mutex_lock(&m->lock);
+  m->quit = true;
+  pthread_cond_broadcast(&m->start);
+  pthread_mutex_unlock(&m->lock);
+  for (int i = 1; i < m->nThreads; ++i)
+    pthread_join(m->workers[i].thread, NULL);
+
+  pthread_mutex_destroy(&m->lock);
+  pthread_cond_destroy(&m->start);
+  pthread_cond_destroy(&m->done);
+  free(m->workers);
+  free(m->merged);
+  free(m->data);
+  free(m->ids);
+  free(m);
+}
+
+bool Matcher_Add(Matcher* m, int id, const uchar* charFile) {
+  int block = m->count / MATCHER_LANES;
+  int lane  = m->count % MATCHER_LANES;
+
+  // 扩容，每次翻倍
+  if (block >= m->nBlocks) {
+    int nBlocks = m->nBlocks ? m->nBlocks * 2 : 64;
+    size_t blockSize = (size_t)MATCHER_DIM * MATCHER_LANES;
+    // 按缓存行(64字节)对齐
+    uchar* data = NULL;
+    if (posix_memalign((void**)&data, 64, nBlocks * blockSize) != 0)
+      data = NULL;
+    int*   ids  = (int*)realloc(m->ids, sizeof(int) * nBlocks * MATCHER_LANES);
+    if (!data || !ids) {
+      free(data);
+      if (ids)
+        m->ids = ids;
+      return false;
+    }
+    memset(data, 0, nBlocks * blockSize);
+    if (m->data)
+      memcpy(data, m->data, m->nBlocks * blockSize);
+    free(m->data);
+    for (int i = m->nBlocks * MATCHER_LANES; i < nBlocks * MATCHER_LANES; ++i)
+      ids[i] = -1;
+    m->data = data;
+    m->ids  = ids;
+    m->nBlocks = nBlocks;
+  }
+
+  uchar feature[MATCHER_DIM];
+  Matcher_Extract(charFile, feature);
+
+  uchar* base = m->data + (size_t)block * MATCHER_DIM * MATCHER_LANES + lane;
+  for (int j = 0; j < MATCHER_DIM; ++j)
+    base[j * MATCHER_LANES] = feature[j];
+  m->ids[m->count] = id;
+  m->count++;
+  return true;
+}
+
+int Matcher_LoadDir(Matcher* m, const char* dir) {
+  DIR* d = opendir(dir);
+  if (!d)
+    return 0;
+
+  int loaded = 0;
+  struct dirent* entry;
+  while ((entry = readdir(d)) != NULL) {
+    int id = 0;
+    char suffix[8] = { 0 };
+    if (sscanf(entry->d_name, "%d.%7s", &id, suffix) != 2 || strcmp(suffix, "char") != 0)
+      continue;
+
+    char filename[512] = { 0 };
+    snprintf(filename, sizeof(filename), "%s/%s", dir, entry->d_name);
+    FILE* fp = fopen(filename, "rb");
+    if (!fp)
+      continue;
+    uchar buf[768];
+    if (fread(buf, 1, 768, fp) == 768 && Matcher_Add(m, id, buf))
+      loaded++;
+    fclose(fp);
+  }
+
+  closedir(d);
+  return loaded;
+}
+
+int Matcher_Count(const Matcher* m) {
+  return m->count;
+}
+
+static int compareResult(const void* a, const void* b) {
+  const MatchResult* x = (const MatchResult*)a;
+  const MatchResult* y = (const MatchResult*)b;
+  if (x->score != y->score)
+    return y->score - x->score;
+  return x->id - y->id;
+}
+
+int Matcher_Search(Matcher* m, const uchar* probe, int k, int threshold, MatchResult* results) {
+  if (k <= 0 || m->count == 0)
+    return 0;
+  if (k > MATCHER_MAX_K)
+    k = MATCHER_MAX_K;
+
+  static __thread uchar feature[MATCHER_DIM];
+  Matcher_Extract(probe, feature);
+
+  m->probe = feature;
+  m->nNz = 0;
+  for (int j = 0; j < MATCHER_DIM; ++j) {
+    if (feature[j])
+      m->nz[m->nNz++] = j;
+  }
+  m->k = k;
+  m->threshold = threshold;
+  atomic_store(&m->stop, 0);
+
+  // 把所有工作单元平均分给各线程
+  unsigned nChunks = (m->count + MATCHER_LANES * CHUNK_BLOCKS - 1) / (MATCHER_LANES * CHUNK_BLOCKS);
+  for (int i = 0; i < m->nThreads; ++i) {
+    unsigned lo = nChunks * i / m->nThreads;
+    unsigned hi = nChunks * (i + 1) / m->nThreads;
+    atomic_store(&m->workers[i].range, packRange(lo, hi));
+    m->workers[i].nResult = 0;
+  }
+
+  // 唤醒其他线程，当前线程作为0号线程参与
+  pthread_mutex_lock(&m->lock);
+  m->nFinished = 0;
+  m->generation++;
+  pthread_cond_broadcast(&m->start);
+  pthread_mutex_unlock(&m->lock);
+
+  runJob(m, 0);
+
+  pthread_mutex_lock(&m->lock);
+  while (m->nFinished < m->nThreads - 1)
+    pthread_cond_wait(&m->done, &m->lock);
+  pthread_mutex_unlock(&m->lock);
+
+  // 合并各线程的结果
+  MatchResult* all = m->merged;
+  int n = 0;
+  for (int i = 0; i < m->nThreads; ++i) {
+    memcpy(all + n, m->workers[i].heap, sizeof(MatchResult) * m->workers[i].nResult);
+    n += m->workers[i].nResult;
+  }
+  qsort(all, n, sizeof(MatchResult), compareResult);
+  if (n > k)
+    n = k;
+  memcpy(results, all, sizeof(MatchResult) * n);
+  return n;
+}
+
+
+/******************************************************************
+ * 性能测试
+******************************************************************/
+
+// 随机生成一个稀疏的特征文件
+static void randomCharFile(uchar* buf, unsigned* seed) {
+  for (int i = 0; i < 768; ++i)
+    buf[i] = (rand_r(seed) % 4 == 0) ? (rand_r(seed) & 0xff) : 0;
+}
+
+static int compareLong(const void* a, const void* b) {
+  long long x = *(const long long*)a, y = *(const long long*)b;
+  return x < y ? -1 : (x > y);
+}
+
+void Matcher_Benchmark(int nThreads) {
+  const int sizes[3] = { 1000, 10000, 100000 };
+  const int nQuery = 50;
+  unsigned seed = 2019;
+
+  Matcher* m = Matcher_Create(nThreads);
+  if (!m)
+    return;
+  printf("threads=%d, dim=%d, lanes=%d\n", m->nThreads, MATCHER_DIM, MATCHER_LANES);
+  printf("%8s %14s %12s %12s %12s\n", "gallery", "matches/s", "mean(us)", "p99(us)", "early(us)");
+
+  // 第 i 个模板的特征文件由种子 2019 + i 生成，probe 可以重新生成原文件
+  uchar buf[768];
+  for (int s = 0; s < 3; ++s) {
+    while (m->count < sizes[s]) {
+      unsigned fileSeed = 2019 + m->count;
+      randomCharFile(buf, &fileSeed);
+      Matcher_Add(m, m->count, buf);
+    }
+
+    long long latency[64];
+    long long total = 0, early = 0;
+    MatchResult results[10];
+    for (int q = 0; q < nQuery; ++q) {
+      // probe 为库中某个模板的特征文件，修改其中一部分字节
+      int target = rand_r(&seed) % m->count;
+      unsigned fileSeed = 2019 + target;
+      randomCharFile(buf, &fileSeed);
+      for (int j = 0; j < 768; ++j) {
+        if (rand_r(&seed) % 10 == 0)
+          buf[j] = 0;
+      }
+
+      long long t = getTimeUs();
+      Matcher_Search(m, buf, 10, 0, results);
+      latency[q] = getTimeUs() - t;
+      total += latency[q];
+
+      // 提前终止：得分达到目标模板的一半即停止
+      t = getTimeUs();
+      Matcher_Search(m, buf, 1, results[0].score / 2, results);
+      early += getTimeUs() - t;
+    }
+    qsort(latency, nQuery, sizeof(long long), compareLong);
+
+    printf("%8d %14.0f %12.1f %12lld %12.1f\n", m->count,
+        (double)m->count * nQuery / (total > 0 ? total : 1) * 1e6,
+        (double)total / nQuery, latency[nQuery * 99 / 100], (double)early / nQuery);
+  }
+
+  Matcher_Destroy(m);
+}
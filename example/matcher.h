@@ -0,0 +1,78 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+#ifndef __MATCHER_H__
+#define __MATCHER_H__
+
+#include "../as608.h"
+
+/*
+ * 主机端 1:N 指纹比对
+ *
+ * 模块的指纹库最多300个模板，且每个模块同一时刻只能执行一次搜索。
+ * 本模块把大量特征文件保存在主机内存中，用多线程在主机上比对。
+ *
+ * 内存布局(结构数组，SoA)：每 MATCHER_LANES 个模板为一块，
+ *   块内按特征维度连续存放，即 data[块][维度][通道]，
+ *   比对时一次读取同一维度上 MATCHER_LANES 个模板的特征，用 SIMD 指令并行比较。
+ * 线程池采用工作窃取：每个线程先处理自己的区间，处理完后从其他线程的区间尾部窃取一半。
+*/
+
+#define MATCHER_DIM    768   // 特征维度
+#define MATCHER_LANES  16    // 每块的模板数，即 SIMD 通道数
+#define MATCHER_MAX_K  64    // 最多返回的结果数
+
+typedef struct _MatchResult {
+  int id;       // 模板编号
+  int score;    // 得分
+} MatchResult;
+
+typedef struct _Matcher Matcher;
+
+// 创建比对器，nThreads<=0 时使用CPU核心数
+Matcher* Matcher_Create(int nThreads);
+void     Matcher_Destroy(Matcher* matcher);
+
+// 把特征文件转为特征向量(即特征文件的原始字节，不依赖 charfile.h 中猜测的布局)
+void Matcher_Extract(const uchar* charFile, uchar* feature);
+
+// 添加一个模板(768字节特征文件)
+bool Matcher_Add(Matcher* matcher, int id, const uchar* charFile);
+
+// 加载目录中所有的 [id].char 文件，返回加载的个数
+int  Matcher_LoadDir(Matcher* matcher, const char* dir);
+
+// 模板个数
+int  Matcher_Count(const Matcher* matcher);
+
+/*
+ * 以 probe 搜索所有模板
+ * 参数：k(返回得分最高的k个结果，<=MATCHER_MAX_K)
+ *      threshold(>0时，某个模板得分达到threshold后立即停止搜索)
+ *      results(存放结果，按得分降序)
+ * 返回值：结果个数
+*/
+int  Matcher_Search(Matcher* matcher, const uchar* probe, int k, int threshold, MatchResult* results);
+
+// 性能测试：随机生成 1k/10k/100k 个模板，输出每秒比对次数和搜索延时
+void Matcher_Benchmark(int nThreads);
+
+#endif // __MATCHER_H__
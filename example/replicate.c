@@ -0,0 +1,348 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+
+#include "./replicate.h"
+#include "./kvstore.h"
+#include "./utils.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <wiringSerial.h>
+
+extern AS608 g_as608;
+extern int   g_fd;
+extern int   g_verbose;
+extern uchar g_error_code;
+
+// as608.c 中发送数据包的函数
+bool SendPacket(uchar* pData, int validDataSize);
+
+int Replicate_LoadPages(RepTemplate* t, int size, int start, int count) {
+  int n = 0;
+  int verbose = g_verbose;
+  g_verbose = -1;   // 不显示进度条
+  for (int page = PS_NextUsedPage(start); page != -1 && page < start + count && n < size;
+       page = PS_NextUsedPage(page + 1)) {
+    t[n].page = page;
+    if (!PS_LoadCharToBuf(2, page, t[n].data, 768)) {
+      g_verbose = verbose;
+      return -1;
+    }
+    t[n].hash = Sync_Hash(t[n].data, 768);
+    t[n].readyUs = getTimeUs();
+    n++;
+  }
+  g_verbose = verbose;
+  return n;
+}
+
+int Replicate_LoadDir(RepTemplate* t, int size, const char* dir) {
+  int n = 0;
+  for (int page = 0; page < REPLICATE_MAX && n < size; ++page) {
+    char filename[256] = { 0 };
+    snprintf(filename, sizeof(filename), "%s/%d.char", dir, page);
+    FILE* fp = fopen(filename, "rb");
+    if (!fp)
+      continue;
+    if (fread(t[n].data, 1, 768, fp) == 768) {
+      t[n].page = page;
+      t[n].hash = Sync_Hash(t[n].data, 768);
+      t[n].readyUs = getTimeUs();
+      n++;
+    }
+    fclose(fp);
+  }
+  return n;
+}
+
+// 一批模板的代数：页码和内容哈希的哈希
+static SyncHash generation(const RepTemplate* t, int n) {
+  SyncHash gen = 14695981039346656037ULL;
+  for (int i = 0; i < n; ++i) {
+    gen = (gen ^ (SyncHash)t[i].page) * 1099511628211ULL;
+    gen = (gen ^ t[i].hash) * 1099511628211ULL;
+  }
+  return gen;
+}
+
+/*
+ * 检查当前模块中已有哪些模板，todo[i] 为 true 表示需要推送
+ * 返回值：需要推送的个数，出错返回-1
+*/
+static int planDevice(const RepTemplate* t, int n, SyncHash gen, bool* todo, RepReport* report) {
+  for (int i = 0; i < n; ++i)
+    todo[i] = true;
+
+  // 代数和模板个数都相同只说明推送后没有增删，模板可能在个数不变时被替换，
+  //   所以总是逐页核对哈希(经模板缓存读取，重复检查同一模块时不再传输)
+  KVStore kv;
+  int len = 0, used = 0;
+  const uchar* value = KV_Open(&kv) ? KV_Get(&kv, REPLICATE_GEN_KEY, &len) : NULL;
+  bool sameGen = value && len == sizeof(SyncHash) + 2 && memcmp(value, &gen, sizeof(SyncHash)) == 0 &&
+      PS_ValidTempleteNum(&used) && used == ((value[8] << 8) | value[9]);
+
+  int count = 0;
+  for (int i = 0; i < n; ++i) {
+    if (PS_IsPageUsed(t[i].page)) {
+      uchar data[768];
+      if (!PS_LoadCharToBuf(2, t[i].page, data, 768))
+        return -1;
+      if (Sync_Hash(data, 768) == t[i].hash) {
+        todo[i] = false;
+        report->nSkipped++;
+        continue;
+      }
+    }
+    count++;
+  }
+  if (sameGen && count == 0)
+    report->nSkippedDevice++;
+  return count;
+}
+
+// 推送完成后记录代数和模板个数
+static bool saveGeneration(SyncHash gen) {
+  KVStore kv;
+  int used = 0;
+  uchar value[sizeof(SyncHash) + 2];
+  if (!PS_ValidTempleteNum(&used) || !KV_Open(&kv))
+    return false;
+  memcpy(value, &gen, sizeof(SyncHash));
+  value[8] = used >> 8;
+  value[9] = used & 0xff;
+  return KV_Set(&kv, REPLICATE_GEN_KEY, value, sizeof(value)) && KV_Flush(&kv) >= 0;
+}
+
+// 单个模块的推送状态
+typedef struct {
+  int   device;
+  bool  todo[REPLICATE_MAX];
+  int   next;        // 正在推送的模板
+  int   state;       // 0 空闲  1 等待 DownChar 的应答  2 等待 StoreChar 的应答  3 完成
+  int   retries;
+  bool  failed;
+  uchar rx[12];
+  int   rxSize;
+  long long sentUs;
+} DoorState;
+
+static void sendOrder(int fd, uint addr, uchar orderCode, const uchar* params, int paramSize) {
+  uchar order[32];
+  int size = PS_EncodeOrder(order, addr, orderCode, params, paramSize);
+  write(fd, order, size);
+}
+
+// 开始推送下一个模板，没有了返回false
+static bool startNext(ShardSet* doors, DoorState* d, int n) {
+  while (d->next < n && !d->todo[d->next])
+    d->next++;
+  if (d->next >= n) {
+    d->state = 3;
+    return false;
+  }
+  Shard* s = &doors->shard[d->device];
+  uchar buffer = 1;
+  sendOrder(s->fd, s->addr, 0x09, &buffer, 1);   // DownChar(1)
+  d->state = 1;
+  d->rxSize = 0;
+  d->sentUs = getTimeUs();
+  return true;
+}
+
+// 当前模板失败，重试或放弃
+static void retryOrSkip(ShardSet* doors, DoorState* d, int n, RepReport* report) {
+  serialFlush(doors->shard[d->device].fd);
+  if (++d->retries <= REPLICATE_RETRIES) {
+    report->nRetried++;
+  }
+  else {
+    report->nFailed++;
+    d->failed = true;
+    d->todo[d->next++] = false;
+    d->retries = 0;
+  }
+  startNext(doors, d, n);
+}
+
+// 处理收到的应答包
+static void onReply(ShardSet* doors, DoorState* d, RepTemplate* t, int n, RepReport* report) {
+  uint sum = 0;
+  for (int i = 6; i < 10; ++i)
+    sum += d->rx[i];
+  uint check = ((uint)d->rx[10] << 8) | d->rx[11];
+  bool ok = d->rx[0] == 0xef && d->rx[1] == 0x01 && check == (sum & 0xffff) && d->rx[9] == 0x00;
+  if (!ok) {
+    retryOrSkip(doors, d, n, report);
+    return;
+  }
+
+  Shard* s = &doors->shard[d->device];
+  if (d->state == 1) {
+    // 发送数据包后紧接着发送 StoreChar，数据写入串口缓冲区后即返回
+    Shard_Use(doors, d->device);
+    SendPacket(t[d->next].data, 768);
+    uchar params[3] = { 1, t[d->next].page >> 8, t[d->next].page & 0xff };
+    sendOrder(s->fd, s->addr, 0x06, params, 3);    // StoreChar(1, page)
+    PS_InvalidateTemplates(t[d->next].page, 1);
+    d->state = 2;
+    d->rxSize = 0;
+    d->sentUs = getTimeUs();
+  }
+  else {
+    report->nPushed++;
+    t[d->next].doneUs = getTimeUs();
+    d->todo[d->next] = false;
+    d->next++;
+    d->retries = 0;
+    startNext(doors, d, n);
+  }
+}
+
+// 所有模块同时推送
+static void pushConcurrent(ShardSet* doors, DoorState* states, int nState, RepTemplate* t, int n, RepReport* report) {
+  for (int k = 0; k < nState; ++k)
+    startNext(doors, &states[k], n);
+
+  while (true) {
+    struct pollfd pfd[SHARD_MAX];
+    int active = 0;
+    for (int k = 0; k < nState; ++k) {
+      pfd[k].fd = states[k].state == 3 ? -1 : doors->shard[states[k].device].fd;
+      pfd[k].events = POLLIN;
+      pfd[k].revents = 0;
+      active += states[k].state != 3;
+    }
+    if (active == 0)
+      break;
+    poll(pfd, nState, 10);
+
+    long long now = getTimeUs();
+    for (int k = 0; k < nState; ++k) {
+      DoorState* d = &states[k];
+      if (d->state == 3)
+        continue;
+      if (pfd[k].revents & POLLIN) {
+        int size = read(pfd[k].fd, d->rx + d->rxSize, 12 - d->rxSize);
+        if (size > 0 && (d->rxSize += size) == 12)
+          onReply(doors, d, t, n, report);
+      }
+      else if (now - d->sentUs > 3000000) {   // 与 RecvReply 相同，最长等待3秒
+        retryOrSkip(doors, d, n, report);
+      }
+    }
+  }
+}
+
+// 逐个模块、逐个模板推送(原来的方式)
+static void pushSerial(ShardSet* doors, DoorState* states, int nState, RepTemplate* t, int n, RepReport* report) {
+  for (int i = 0; i < n; ++i) {
+    for (int k = 0; k < nState; ++k) {
+      DoorState* d = &states[k];
+      if (!d->todo[i])
+        continue;
+      Shard_Use(doors, d->device);
+      int tries = 0;
+      while (!(PS_DownCharFromBuf(1, t[i].data, 768) && PS_StoreChar(1, t[i].page))) {
+        serialFlush(g_fd);
+        if (++tries > REPLICATE_RETRIES)
+          break;
+        report->nRetried++;
+      }
+      if (tries > REPLICATE_RETRIES) {
+        report->nFailed++;
+        d->failed = true;
+      }
+      else {
+        report->nPushed++;
+        t[i].doneUs = getTimeUs();
+      }
+      d->todo[i] = false;
+    }
+  }
+}
+
+bool Replicate_Run(ShardSet* doors, RepTemplate* t, int n, bool concurrent, bool force, RepReport* report) {
+  static DoorState states[SHARD_MAX];
+  int nState = 0;
+  memset(report, 0, sizeof(RepReport));
+  report->nTemplate = n;
+  long long start = getTimeUs();
+  int verbose = g_verbose;
+  g_verbose = -1;   // 不显示进度条
+
+  // 检查各模块已有的模板
+  SyncHash gen = generation(t, n);
+  bool ok = true;
+  for (int i = 0; i < doors->count; ++i) {
+    if (i == doors->self)
+      continue;
+    DoorState* d = &states[nState];
+    memset(d, 0, sizeof(DoorState));
+    d->device = i;
+    Shard_Use(doors, i);
+    report->nDevice++;
+    int count = n;
+    if (force) {
+      for (int j = 0; j < n; ++j)
+        d->todo[j] = true;
+    }
+    else {
+      count = planDevice(t, n, gen, d->todo, report);
+    }
+    if (count < 0) {
+      report->nFailed++;
+      ok = false;
+      continue;
+    }
+    nState++;   // 没有要推送的模板也记录代数，下次整批跳过
+  }
+
+  // 所有模块都已有的模板，在检查完成时就已到达
+  long long planned = getTimeUs();
+  for (int i = 0; i < n; ++i)
+    t[i].doneUs = planned;
+
+  if (concurrent)
+    pushConcurrent(doors, states, nState, t, n, report);
+  else
+    pushSerial(doors, states, nState, t, n, report);
+  long long end = getTimeUs();
+
+  // 全部成功的模块记录代数
+  for (int k = 0; k < nState; ++k) {
+    if (states[k].failed) {
+      ok = false;
+      continue;
+    }
+    Shard_Use(doors, states[k].device);
+    ok = saveGeneration(gen) && ok;
+  }
+  Shard_Use(doors, doors->self);
+  PS_InvalidateIndex();
+  g_verbose = verbose;
+
+  report->timeUs = end - start;
+  return ok && report->nFailed == 0;
+}
@@ -0,0 +1,81 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+
+#ifndef __REPLICATE_H__
+#define __REPLICATE_H__
+
+#include "../as608.h"
+#include "./shard.h"
+#include "./sync.h"
+
+/*
+ * 复制：把模板推送到站点的所有门禁模块，每个模块保存完整的指纹库(同一页码)
+ *
+ * 门禁模块的列表保存在 "~/.fpdoors"，格式与分片列表相同，用 Shard_Open/Shard_Use 切换。
+ * 模板只读取一次(从当前模块上传或从目录读取)，然后同时推送到其他模块：
+ *   各模块一个状态机 DownChar → 数据包 → StoreChar，各串口并行收发，
+ *   失败(超时、应答错误)的模板最多重试 REPLICATE_RETRIES 次。
+ * 幂等：
+ *   模块中已占用的页，经模板缓存(PS_LoadCharToBuf)读出比较哈希，相同则跳过该页；
+ *   一批模板的内容哈希作为代数，推送完成后与模板个数一起写入模块记事本的键 "repgen"，
+ *     代数和模板个数都相同、且所有页都已相同的模块计为整批跳过。
+ *     代数不能代替逐页核对：模板在个数不变时被替换，代数不会改变。
+*/
+
+#define REPLICATE_MAX     SYNC_MAX_PAGES
+#define REPLICATE_RETRIES 3
+#define REPLICATE_GEN_KEY "repgen"
+
+typedef struct _RepTemplate {
+  int       page;
+  SyncHash  hash;
+  uchar     data[768];
+  long long readyUs;   // 读取完成的时刻
+  long long doneUs;    // 最后一个模块存储完成的时刻
+} RepTemplate;
+
+typedef struct _RepReport {
+  int  nTemplate;
+  int  nDevice;         // 推送的目标模块(不含来源)
+  int  nPushed;         // 实际推送的 (模块, 模板)
+  int  nSkipped;        // 模块中已有相同内容而跳过的
+  int  nSkippedDevice;  // 代数相同且所有页都已相同的模块
+  int  nRetried;
+  int  nFailed;
+  long long timeUs;
+} RepReport;
+
+// 从当前模块读取 [start, start+count) 中已录入的模板，返回个数，出错返回-1
+int  Replicate_LoadPages(RepTemplate* t, int size, int start, int count);
+
+// 从目录读取模板(dir/[page].char)，返回个数
+int  Replicate_LoadDir(RepTemplate* t, int size, const char* dir);
+
+/*
+ * 把 n 个模板推送到 doors 中除当前模块外的所有模块
+ * 参数：concurrent(false 时逐个模块、逐个模板推送)  force(不检查模块中是否已有，总是推送)
+ * 返回值：true(全部成功)，false(有失败的，见report)
+*/
+bool Replicate_Run(ShardSet* doors, RepTemplate* t, int n, bool concurrent, bool force, RepReport* report);
+
+#endif // __REPLICATE_H__
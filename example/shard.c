@@ -0,0 +1,299 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+
+#include "./shard.h"
+#include "./utils.h"
+
+#include <wiringSerial.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+
+extern AS608 g_as608;
+extern int   g_fd;
+extern int   g_verbose;
+extern uchar g_error_code;
+
+bool Shard_LoadConfig(const char* filename, ShardSet* set) {
+  memset(set, 0, sizeof(ShardSet));
+  FILE* fp = fopen(filename, "r");
+  if (!fp)
+    return false;
+
+  char line[128];
+  while (set->count < SHARD_MAX && fgets(line, sizeof(line), fp)) {
+    char serial[32] = { 0 }, addr[32] = { 0 };
+    if (sscanf(line, "%31s %31s", serial, addr) < 1 || serial[0] == '#')
+      continue;
+    Shard* s = &set->shard[set->count++];
+    strcpy(s->serial, serial);
+    s->addr = addr[0] ? toUInt(addr) : 0xffffffff;
+    s->fd = -1;
+  }
+  fclose(fp);
+  return set->count > 0;
+}
+
+bool Shard_SaveConfig(const char* filename, const ShardSet* set) {
+  FILE* fp = fopen(filename, "w+");
+  if (!fp)
+    return false;
+  for (int i = 0; i < set->count; ++i)
+    fprintf(fp, "%s 0x%08x\n", set->shard[i].serial, set->shard[i].addr);
+  fclose(fp);
+  return true;
+}
+
+// 丢弃被取消的搜索迟到的应答包
+static void drain(Shard* s) {
+  uchar buf[64];
+  long long start = getTimeUs();
+  while (s->pending > 0 && getTimeUs() - start < 3000000) {
+    struct pollfd pfd = { s->fd, POLLIN, 0 };
+    if (poll(&pfd, 1, 10) > 0) {
+      int size = read(s->fd, buf, s->pending < (int)sizeof(buf) ? s->pending : (int)sizeof(buf));
+      if (size > 0)
+        s->pending -= size;
+    }
+  }
+  s->pending = 0;
+}
+
+void Shard_Use(ShardSet* set, int i) {
+  if (set->current == i)
+    return;
+  set->shard[set->current].info = g_as608;
+  set->current = i;
+  g_fd = set->shard[i].fd;
+  g_as608 = set->shard[i].info;
+  PS_InvalidateIndex();
+  drain(&set->shard[i]);
+}
+
+bool Shard_Open(ShardSet* set, const char* serial, int baudrate, uint password) {
+  // 当前设备是哪一个分片
+  int self = -1;
+  for (int i = 0; i < set->count && self == -1; ++i)
+    if (strcmp(set->shard[i].serial, serial) == 0 && set->shard[i].addr == g_as608.chip_addr)
+      self = i;
+  if (self == -1) {
+    printf("The current device (%s 0x%08x) is not in the shard list\n", serial, g_as608.chip_addr);
+    g_error_code = 0xC7;
+    return false;
+  }
+  set->shard[self].fd = g_fd;
+  set->self = self;
+  set->current = self;
+  set->shard[self].info = g_as608;
+
+  for (int i = 0; i < set->count; ++i) {
+    Shard* s = &set->shard[i];
+    if (i != self) {
+      if ((s->fd = serialOpen(s->serial, baudrate)) < 0) {
+        printf("Can not open %s\n", s->serial);
+        Shard_Close(set);
+        g_error_code = 0xC7;
+        return false;
+      }
+      serialFlush(s->fd);   // 丢弃上次未读完的数据
+      s->owned = true;
+      s->info = g_as608;
+      Shard_Use(set, i);
+      if (!PS_Setup(s->addr, password)) {
+        Shard_Close(set);
+        return false;
+      }
+    }
+    else {
+      Shard_Use(set, i);
+    }
+    if (!PS_ValidTempleteNum(&s->used)) {
+      Shard_Close(set);
+      return false;
+    }
+  }
+  Shard_Use(set, 0);
+  return true;
+}
+
+void Shard_Close(ShardSet* set) {
+  Shard_Use(set, set->self);
+  for (int i = 0; i < set->count; ++i) {
+    if (set->shard[i].owned && set->shard[i].fd >= 0)
+      serialClose(set->shard[i].fd);
+    set->shard[i].owned = false;
+  }
+}
+
+int Shard_Place(const ShardSet* set) {
+  // 已用比例最小的分片，比例相同时取序号小的
+  int best = -1;
+  for (int i = 0; i < set->count; ++i) {
+    const Shard* s = &set->shard[i];
+    if (s->used >= (int)s->info.capacity)
+      continue;
+    if (best == -1 || (long long)s->used * set->shard[best].info.capacity <
+                      (long long)set->shard[best].used * s->info.capacity)
+      best = i;
+  }
+  return best;
+}
+
+// 向分片发送 HighSpeedSearch 指令，不等待应答
+static void sendSearch(Shard* s, uchar bufferID) {
+  uchar order[32];
+  uchar params[5] = { bufferID, 0, 0, s->info.capacity >> 8, s->info.capacity & 0xff };
+  int size = PS_EncodeOrder(order, s->addr, 0x1b, params, 5);
+  write(s->fd, order, size);
+}
+
+bool Shard_Search(ShardSet* set, int k, uchar bufferID, int* pShard, int* pPageID, int* pScore, int* pCancelled) {
+  if (k <= 0 || k > set->count)
+    k = set->count;
+  int verbose = g_verbose;
+  g_verbose = -1;   // 不显示传输特征的进度条
+  for (int i = 0; i < k; ++i)
+    drain(&set->shard[i]);
+
+  // 第一个分片已有特征，先开始搜索；上传特征后下载到其他分片
+  uchar probe[768];
+  Shard_Use(set, 0);
+  bool ok = (k == 1) || PS_UpCharToBuf(bufferID, probe, sizeof(probe));
+  if (ok)
+    sendSearch(&set->shard[0], bufferID);
+  int sent = ok ? 1 : 0;
+  for (int i = 1; i < k && ok; ++i) {
+    Shard_Use(set, i);
+    ok = PS_DownCharFromBuf(bufferID, probe, sizeof(probe));
+    if (ok) {
+      sendSearch(&set->shard[i], bufferID);
+      sent++;
+    }
+  }
+  Shard_Use(set, 0);
+  g_verbose = verbose;
+  if (!ok) {
+    // 已发出的搜索指令，应答在下次使用前丢弃
+    for (int i = 0; i < sent; ++i)
+      set->shard[i].pending = 16;
+    return false;
+  }
+
+  // 同时等待所有分片的应答包(12字节 + 页码2字节 + 得分2字节)
+  uchar reply[SHARD_MAX][16];
+  int received[SHARD_MAX] = { 0 };
+  int waiting = k, best = -1, bestPage = 0, bestScore = 0;
+  uchar error = 0x09;
+  long long start = getTimeUs();
+  while (waiting > 0 && getTimeUs() - start < 3000000) {
+    struct pollfd pfd[SHARD_MAX];
+    for (int i = 0; i < k; ++i) {
+      pfd[i].fd = received[i] < 16 ? set->shard[i].fd : -1;
+      pfd[i].events = POLLIN;
+      pfd[i].revents = 0;
+    }
+    if (poll(pfd, k, 10) <= 0)
+      continue;
+
+    for (int i = 0; i < k; ++i) {
+      if (!(pfd[i].revents & POLLIN))
+        continue;
+      int size = read(set->shard[i].fd, reply[i] + received[i], 16 - received[i]);
+      if (size <= 0 || (received[i] += size) < 16)
+        continue;
+      waiting--;
+
+      uint sum = 0;
+      for (int j = 6; j < 14; ++j)
+        sum += reply[i][j];
+      uint check = ((uint)reply[i][14] << 8) | reply[i][15];
+      uchar code = (reply[i][0] != 0xef || check != (sum & 0xffff)) ? 0x01 : reply[i][9];
+      if (code != 0x00) {
+        if (code != 0x09)
+          error = code;
+        continue;
+      }
+      int score = (reply[i][12] << 8) | reply[i][13];
+      if (best == -1 || score > bestScore) {
+        best = i;
+        bestPage = (reply[i][10] << 8) | reply[i][11];
+        bestScore = score;
+      }
+    }
+
+    if (best != -1 && bestScore >= SHARD_CONFIDENT_SCORE)
+      break;
+  }
+
+  // 不再等待的分片，记下还没收到的字节数
+  int cancelled = 0;
+  for (int i = 0; i < k; ++i) {
+    if (received[i] < 16) {
+      set->shard[i].pending = 16 - received[i];
+      cancelled++;
+    }
+  }
+  if (pCancelled)
+    *pCancelled = cancelled;
+
+  if (best == -1) {
+    g_error_code = (cancelled > 0) ? 0xff : error;   // 有分片超时未应答
+    return false;
+  }
+  *pShard = best;
+  *pPageID = bestPage;
+  *pScore = bestScore;
+  g_error_code = 0x00;
+  return true;
+}
+
+bool Shard_Store(ShardSet* set, uchar bufferID, int* pShard, int* pPageID) {
+  int target = Shard_Place(set);
+  if (target == -1) {
+    g_error_code = 0x0b;   // 地址序号超出指纹库范围
+    return false;
+  }
+
+  int verbose = g_verbose;
+  g_verbose = -1;
+  bool ok = true;
+  if (target != 0) {
+    uchar data[768];
+    Shard_Use(set, 0);
+    ok = PS_UpCharToBuf(bufferID, data, sizeof(data));
+    Shard_Use(set, target);
+    ok = ok && PS_DownCharFromBuf(bufferID, data, sizeof(data));
+  }
+  int pageID = 0;
+  ok = ok && PS_AllocFreePage(&pageID) && PS_StoreChar(bufferID, pageID);
+  Shard_Use(set, 0);
+  g_verbose = verbose;
+  if (!ok)
+    return false;
+
+  set->shard[target].used++;
+  *pShard = target;
+  *pPageID = pageID;
+  return true;
+}
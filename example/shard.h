@@ -0,0 +1,91 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+
+#ifndef __SHARD_H__
+#define __SHARD_H__
+
+#include "../as608.h"
+
+/*
+ * 分片：用户分布在多个模块(分片)上，每个模块接一个串口，容量随模块数增加
+ *
+ * 分片列表保存在 "~/.fpshards"，每行 "串口 芯片地址"，第一个分片是接了传感器的模块。
+ * 录入时模板放到已用比例最小的分片(Shard_Store)。
+ * 识别时在第一个分片上采集并生成特征，上传特征后下载到其他分片，
+ *   然后所有分片同时 HighSpeedSearch(各串口并行收发)，返回得分最高的结果。
+ *   某个分片的得分达到 SHARD_CONFIDENT_SCORE 时不再等待其他分片，
+ *   模块没有取消指令，其他分片迟到的应答在下次使用(Shard_Use)该分片时丢弃。
+ * 切换分片会替换 g_fd、g_as608，并清除索引表缓存，Shard_Close 切换回原来的设备。
+*/
+
+#define SHARD_MAX             8
+#define SHARD_CONFIDENT_SCORE 100
+
+typedef struct _Shard {
+  char  serial[32];
+  uint  addr;
+  int   fd;
+  bool  owned;         // 由 Shard_Open 打开的串口
+  AS608 info;
+  int   used;          // 已录入的模板个数
+  int   pending;       // 被取消的搜索还没有收到的应答包字节数
+} Shard;
+
+typedef struct _ShardSet {
+  int   count;
+  int   current;       // g_fd、g_as608 当前对应的分片
+  int   self;          // 打开前的设备对应的分片，Shard_Close 时切换回去
+  Shard shard[SHARD_MAX];
+} ShardSet;
+
+// 读写分片列表
+bool Shard_LoadConfig(const char* filename, ShardSet* set);
+bool Shard_SaveConfig(const char* filename, const ShardSet* set);
+
+/*
+ * 打开并初始化所有分片，与当前设备(串口serial、g_fd)相同的分片直接使用当前设备
+ * 返回值：true(成功)，false(出现错误，错误码见g_error_code)
+*/
+bool Shard_Open(ShardSet* set, const char* serial, int baudrate, uint password);
+void Shard_Close(ShardSet* set);
+
+// 切换 g_fd、g_as608 到分片 i
+void Shard_Use(ShardSet* set, int i);
+
+// 按均衡策略选择存放新模板的分片，都已满返回-1
+int  Shard_Place(const ShardSet* set);
+
+/*
+ * 在前 k 个分片中搜索第一个分片 CharBuffer[bufferID] 中的特征
+ * 参数：pShard, pPageID, pScore(得分最高的结果)  pCancelled(不再等待的分片数，可为NULL)
+ * 返回值：true(找到)，false(未找到(0x09)或出现错误)
+*/
+bool Shard_Search(ShardSet* set, int k, uchar bufferID, int* pShard, int* pPageID, int* pScore, int* pCancelled);
+
+/*
+ * 把第一个分片 CharBuffer[bufferID] 中的模板存到 Shard_Place 选择的分片
+ * 参数：pShard, pPageID(存放的位置)
+*/
+bool Shard_Store(ShardSet* set, uchar bufferID, int* pShard, int* pPageID);
+
+#endif // __SHARD_H__
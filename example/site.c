@@ -0,0 +1,787 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+#include "./site.h"
+#include "./charfile.h"
+#include "./utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <dirent.h>
+#include <netdb.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define SITE_HELLO 1
+#define SITE_ENTRY 2
+#define SITE_END   3
+
+#define SITE_RAW      0
+#define SITE_ZERORUN  1
+#define SITE_DELETE   2
+
+#define SITE_FRAME_HEAD   5
+#define SITE_ENTRY_HEAD   15
+#define SITE_MAX_PAYLOAD  (SITE_ENTRY_HEAD + 768 + 768 / 128 + 1)
+#define SITE_BUF_SIZE     (32 * 1024)
+#define SITE_TIMEOUT_MS   5000
+
+// 一个TCP连接，收发都经过缓冲区，多个条目合并成一次 write
+typedef struct _SiteConn {
+  int   fd;
+  uchar out[SITE_BUF_SIZE];
+  int   nOut;
+  uchar in[SITE_BUF_SIZE];
+  int   inPos;
+  int   inLen;
+  long long bytes;
+} SiteConn;
+
+// 拉取时收到的条目，先全部收下，断开连接后再加锁应用
+typedef struct _SiteRemote {
+  uint  clock;
+  uint  site;
+  int   page;
+  bool  deleted;
+  uchar data[768];
+} SiteRemote;
+
+
+static void put32(uchar* p, uint v) {
+  p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static uint get32(const uchar* p) {
+  return ((uint)p[0] << 24) | ((uint)p[1] << 16) | ((uint)p[2] << 8) | p[3];
+}
+
+static void fileName(const char* dir, const char* name, char* filename, int size) {
+  snprintf(filename, size, "%s/%s", dir, name);
+}
+
+static bool readCharFile(const char* dir, int page, uchar* buf) {
+  char filename[256] = { 0 };
+  snprintf(filename, sizeof(filename), "%s/%d.char", dir, page);
+  FILE* fp = fopen(filename, "rb");
+  if (!fp)
+    return false;
+  int size = fread(buf, 1, 768, fp);
+  bool more = fgetc(fp) != EOF;
+  fclose(fp);
+  return size == 768 && !more;
+}
+
+// 先写临时文件再改名，同一目录的另一个进程不会读到写了一半的文件
+static bool writeCharFile(const char* dir, int page, const uchar* buf) {
+  char filename[256] = { 0 };
+  char tmpname[256] = { 0 };
+  snprintf(filename, sizeof(filename), "%s/%d.char", dir, page);
+  snprintf(tmpname, sizeof(tmpname), "%s/.%d.char.tmp", dir, page);
+  FILE* fp = fopen(tmpname, "wb");
+  if (!fp)
+    return false;
+  bool ok = fwrite(buf, 1, 768, fp) == 768;
+  ok = (fclose(fp) == 0) && ok;
+  if (ok && rename(tmpname, filename) == 0)
+    return true;
+  unlink(tmpname);
+  return false;
+}
+
+static void deleteCharFile(const char* dir, int page) {
+  char filename[256] = { 0 };
+  snprintf(filename, sizeof(filename), "%s/%d.char", dir, page);
+  unlink(filename);
+}
+
+// 读取站点ID，不存在时随机生成一个
+static uint loadSiteId(const char* dir) {
+  char filename[256] = { 0 };
+  fileName(dir, ".siteid", filename, sizeof(filename));
+  uint site = 0;
+  FILE* fp = fopen(filename, "r");
+  if (fp) {
+    fscanf(fp, "%x", &site);
+    fclose(fp);
+  }
+  if (site != 0)
+    return site;
+
+  int fd = open("/dev/urandom", O_RDONLY);
+  if (fd >= 0) {
+    read(fd, &site, sizeof(site));
+    close(fd);
+  }
+  if (site == 0)
+    site = (uint)getpid() ^ (uint)getTimeUs();
+  fp = fopen(filename, "w");
+  if (!fp)
+    return 0;
+  fprintf(fp, "%08x\n", site);
+  fclose(fp);
+  return site;
+}
+
+static void appendEntry(FILE* fp, SiteLog* log, int page, uint clock, uint site, SyncHash hash) {
+  SiteEntry* e = &log->page[page];
+  e->gen   = ++log->gen;
+  e->clock = clock;
+  e->site  = site;
+  e->hash  = hash;
+  if (clock > log->clock)
+    log->clock = clock;
+  fprintf(fp, "%u %u %08x %d %016llx\n", e->gen, e->clock, e->site, page, e->hash);
+}
+
+/*
+ * 打开并锁定日志，读取每页的最新条目，再把目录中的本地修改追加到日志
+ *   返回的文件在 fclose 时解锁。同一目录可能同时被 siteserve 和 sitepull 使用
+*/
+static FILE* openLog(const char* dir, SiteLog* log, int* nAppended) {
+  struct stat st;
+  if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+    printf("No such directory: %s\n", dir);
+    return NULL;
+  }
+
+  memset(log, 0, sizeof(SiteLog));
+  log->site = loadSiteId(dir);
+  char filename[256] = { 0 };
+  fileName(dir, ".sitelog", filename, sizeof(filename));
+  FILE* fp = fopen(filename, "a+");
+  if (log->site == 0 || !fp) {
+    printf("Cannot open %s\n", filename);
+    if (fp)
+      fclose(fp);
+    return NULL;
+  }
+  flock(fileno(fp), LOCK_EX);
+
+  rewind(fp);
+  SiteEntry e;
+  int page = 0;
+  while (fscanf(fp, "%u %u %x %d %llx", &e.gen, &e.clock, &e.site, &page, &e.hash) == 5) {
+    if (page < 0 || page >= SITE_MAX_PAGES)
+      continue;
+    log->page[page] = e;
+    if (e.gen > log->gen)
+      log->gen = e.gen;
+    if (e.clock > log->clock)
+      log->clock = e.clock;
+  }
+  fseek(fp, 0, SEEK_END);
+
+  static SyncHash hashes[SITE_MAX_PAGES];
+  Sync_LoadStore(dir, hashes, SITE_MAX_PAGES);
+  int n = 0;
+  for (int page = 0; page < SITE_MAX_PAGES; ++page) {
+    if (hashes[page] != log->page[page].hash) {
+      appendEntry(fp, log, page, log->clock + 1, log->site, hashes[page]);
+      n++;
+    }
+  }
+  fflush(fp);
+  if (nAppended)
+    *nAppended = n;
+  return fp;
+}
+
+int Site_Open(const char* dir, SiteLog* log) {
+  int n = 0;
+  FILE* fp = openLog(dir, log, &n);
+  if (!fp)
+    return -1;
+  fclose(fp);
+  return n;
+}
+
+/******************************************************************************
+ *
+ * 零游程压缩
+ *   控制字节 c < 0x80 时后跟 c+1 个原样字节，c >= 0x80 时表示 (c & 0x7f)+1 个0
+ *
+******************************************************************************/
+
+int Site_Compress(const uchar* in, int size, uchar* out) {
+  int n = 0;
+  int i = 0;
+  while (i < size) {
+    int zeros = 0;
+    while (i + zeros < size && in[i + zeros] == 0 && zeros < 128)
+      zeros++;
+    if (zeros >= 2 || (zeros == 1 && i + 1 == size)) {
+      out[n++] = 0x80 | (zeros - 1);
+      i += zeros;
+      continue;
+    }
+
+    // 单个0不值得单独编码，并入原样字节
+    int start = i;
+    while (i < size && i - start < 128) {
+      if (in[i] == 0 && i + 1 < size && in[i + 1] == 0)
+        break;
+      i++;
+    }
+    out[n++] = i - start - 1;
+    memcpy(out + n, in + start, i - start);
+    n += i - start;
+  }
+  return n;
+}
+
+int Site_Decompress(const uchar* in, int size, uchar* out, int outSize) {
+  int n = 0;
+  int i = 0;
+  while (i < size) {
+    uchar c = in[i++];
+    int len = (c & 0x7f) + 1;
+    if (n + len > outSize)
+      return -1;
+    if (c & 0x80) {
+      memset(out + n, 0, len);
+    }
+    else {
+      if (i + len > size)
+        return -1;
+      memcpy(out + n, in + i, len);
+      i += len;
+    }
+    n += len;
+  }
+  return n;
+}
+
+/******************************************************************************
+ *
+ * 帧的收发
+ *
+******************************************************************************/
+
+static bool waitFd(int fd, short events) {
+  struct pollfd pfd = { fd, events, 0 };
+  return poll(&pfd, 1, SITE_TIMEOUT_MS) > 0;
+}
+
+static bool flushConn(SiteConn* conn) {
+  int sent = 0;
+  while (sent < conn->nOut) {
+    if (!waitFd(conn->fd, POLLOUT))
+      return false;
+    int ret = write(conn->fd, conn->out + sent, conn->nOut - sent);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0)
+      return false;
+    sent += ret;
+  }
+  conn->bytes += conn->nOut;
+  conn->nOut = 0;
+  return true;
+}
+
+static bool sendFrame(SiteConn* conn, uchar type, const uchar* payload, int len) {
+  if (conn->nOut + SITE_FRAME_HEAD + len > SITE_BUF_SIZE && !flushConn(conn))
+    return false;
+  uchar* p = conn->out + conn->nOut;
+  p[0] = type;
+  put32(p + 1, len);
+  memcpy(p + SITE_FRAME_HEAD, payload, len);
+  conn->nOut += SITE_FRAME_HEAD + len;
+  return true;
+}
+
+static bool recvBytes(SiteConn* conn, uchar* dst, int n) {
+  while (n > 0) {
+    if (conn->inPos == conn->inLen) {
+      if (!waitFd(conn->fd, POLLIN))
+        return false;
+      int ret = read(conn->fd, conn->in, SITE_BUF_SIZE);
+      if (ret < 0 && errno == EINTR)
+        continue;
+      if (ret <= 0)
+        return false;
+      conn->inPos = 0;
+      conn->inLen = ret;
+      conn->bytes += ret;
+    }
+    int len = conn->inLen - conn->inPos;
+    if (len > n)
+      len = n;
+    memcpy(dst, conn->in + conn->inPos, len);
+    conn->inPos += len;
+    dst += len;
+    n -= len;
+  }
+  return true;
+}
+
+static bool recvFrame(SiteConn* conn, uchar* type, uchar* payload, int* len) {
+  uchar head[SITE_FRAME_HEAD];
+  if (!recvBytes(conn, head, SITE_FRAME_HEAD))
+    return false;
+  *type = head[0];
+  *len = get32(head + 1);
+  if (*len > SITE_MAX_PAYLOAD)
+    return false;
+  return recvBytes(conn, payload, *len);
+}
+
+static void initConn(SiteConn* conn, int fd) {
+  memset(conn, 0, sizeof(SiteConn));
+  conn->fd = fd;
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+static int connectTo(const char* host, int port) {
+  char service[16] = { 0 };
+  snprintf(service, sizeof(service), "%d", port);
+  struct addrinfo hints, *res = NULL;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host, service, &hints, &res) != 0)
+    return -1;
+
+  int fd = -1;
+  for (struct addrinfo* ai = res; ai; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0)
+      continue;
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+      break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  return fd;
+}
+
+/******************************************************************************
+ *
+ * 服务端
+ *
+******************************************************************************/
+
+static bool serveConnection(const char* dir, int fd) {
+  static SiteConn conn;
+  initConn(&conn, fd);
+
+  uchar payload[SITE_MAX_PAYLOAD];
+  uchar type = 0;
+  int len = 0;
+  if (!recvFrame(&conn, &type, payload, &len) || type != SITE_HELLO || len != 9)
+    return false;
+  uint since    = get32(payload);
+  bool compress = payload[4] & 0x01;
+  uint peer     = get32(payload + 5);
+
+  static SiteLog log;
+  FILE* fp = openLog(dir, &log, NULL);
+  if (!fp)
+    return false;
+
+  // 对方记录的代数比日志还新，说明本站点的日志被重建了，全部重新发送
+  if (since > log.gen)
+    since = 0;
+
+  bool ok = true;
+  uchar data[768];
+  for (int page = 0; page < SITE_MAX_PAGES && ok; ++page) {
+    SiteEntry* e = &log.page[page];
+    // 对方自己产生的条目不必发回去，对方该页的 (时钟, 站点) 一定不小于它
+    if (e->gen == 0 || e->gen <= since || e->site == peer)
+      continue;
+
+    uchar* p = payload;
+    put32(p, e->gen);
+    put32(p + 4, e->clock);
+    put32(p + 8, e->site);
+    p[12] = page >> 8;
+    p[13] = page;
+    len = SITE_ENTRY_HEAD;
+    if (e->hash == 0) {
+      p[14] = SITE_DELETE;
+    }
+    else {
+      // 扫描之后文件又被修改了，下次连接时会作为新条目发送
+      if (!readCharFile(dir, page, data) || Sync_Hash(data, 768) != e->hash)
+        continue;
+      int size = compress ? Site_Compress(data, 768, p + SITE_ENTRY_HEAD) : 768;
+      if (size < 768) {
+        p[14] = SITE_ZERORUN;
+      }
+      else {
+        p[14] = SITE_RAW;
+        memcpy(p + SITE_ENTRY_HEAD, data, 768);
+        size = 768;
+      }
+      len += size;
+    }
+    ok = sendFrame(&conn, SITE_ENTRY, payload, len);
+  }
+  fclose(fp);
+
+  put32(payload, log.gen);
+  return ok && sendFrame(&conn, SITE_END, payload, 4) && flushConn(&conn);
+}
+
+bool Site_Serve(const char* dir, int port, int maxConnections) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("socket");
+    return false;
+  }
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+    perror("bind");
+    close(fd);
+    return false;
+  }
+
+  // 对方提前断开时，写入不应终止进程
+  signal(SIGPIPE, SIG_IGN);
+  printf("Serving %s on port %d\n", dir, port);
+  fflush(stdout);
+
+  // 请求逐个处理，每个连接只有一次拉取，持续时间很短
+  for (int n = 0; maxConnections < 0 || n < maxConnections; ++n) {
+    int conn = accept(fd, NULL, NULL);
+    if (conn < 0) {
+      --n;
+      continue;
+    }
+    serveConnection(dir, conn);
+    close(conn);
+  }
+  close(fd);
+  return true;
+}
+
+/******************************************************************************
+ *
+ * 拉取
+ *
+******************************************************************************/
+
+static void peerFileName(const char* dir, const char* host, int port, char* filename, int size) {
+  snprintf(filename, size, "%s/.peer_%s_%d", dir, host, port);
+}
+
+static bool receiveEntries(int fd, uint since, bool compress, uint self,
+                           SiteRemote* remote, int* nRemote, SiteReport* report)
+{
+  static SiteConn conn;
+  initConn(&conn, fd);
+
+  uchar payload[SITE_MAX_PAYLOAD];
+  put32(payload, since);
+  payload[4] = compress ? 0x01 : 0x00;
+  put32(payload + 5, self);
+  if (!sendFrame(&conn, SITE_HELLO, payload, 9) || !flushConn(&conn))
+    return false;
+
+  uchar type = 0;
+  int len = 0;
+  *nRemote = 0;
+  while (recvFrame(&conn, &type, payload, &len)) {
+    if (type == SITE_END && len == 4) {
+      report->gen = get32(payload);
+      report->wireBytes = conn.bytes;
+      return true;
+    }
+    if (type != SITE_ENTRY || len < SITE_ENTRY_HEAD || *nRemote >= SITE_MAX_PAGES)
+      break;
+
+    SiteRemote* r = &remote[*nRemote];
+    r->clock   = get32(payload + 4);
+    r->site    = get32(payload + 8);
+    r->page    = (payload[12] << 8) | payload[13];
+    r->deleted = (payload[14] == SITE_DELETE);
+    const uchar* data = payload + SITE_ENTRY_HEAD;
+    int size = len - SITE_ENTRY_HEAD;
+    if (r->page >= SITE_MAX_PAGES)
+      break;
+    if (payload[14] == SITE_RAW && size == 768)
+      memcpy(r->data, data, 768);
+    else if (payload[14] == SITE_ZERORUN && Site_Decompress(data, size, r->data, 768) == 768)
+      ;
+    else if (!r->deleted || size != 0)
+      break;
+    if (!r->deleted)
+      report->rawBytes += 768;
+    report->nEntry++;
+    (*nRemote)++;
+  }
+  printf("Protocol error or connection lost\n");
+  return false;
+}
+
+bool Site_Pull(const char* dir, const char* host, int port, bool compress, SiteReport* report) {
+  memset(report, 0, sizeof(SiteReport));
+  long long start = getTimeUs();
+
+  uint self = loadSiteId(dir);
+  if (self == 0) {
+    printf("No such directory: %s\n", dir);
+    return false;
+  }
+  char peerFile[256] = { 0 };
+  peerFileName(dir, host, port, peerFile, sizeof(peerFile));
+  FILE* fp = fopen(peerFile, "r");
+  if (fp) {
+    fscanf(fp, "%u", &report->since);
+    fclose(fp);
+  }
+
+  int fd = connectTo(host, port);
+  if (fd < 0) {
+    printf("Cannot connect to %s:%d\n", host, port);
+    return false;
+  }
+  SiteRemote* remote = (SiteRemote*)malloc(sizeof(SiteRemote) * SITE_MAX_PAGES);
+  int nRemote = 0;
+  bool ok = remote && receiveEntries(fd, report->since, compress, self, remote, &nRemote, report);
+  close(fd);
+  if (!ok) {
+    free(remote);
+    return false;
+  }
+
+  // 收完再加锁应用，两个站点互相拉取时不会因为各自持有日志锁而等待对方
+  static SiteLog log;
+  fp = openLog(dir, &log, NULL);
+  if (!fp) {
+    free(remote);
+    return false;
+  }
+  for (int i = 0; i < nRemote; ++i) {
+    SiteRemote* r = &remote[i];
+    SiteEntry* e = &log.page[r->page];
+    bool newer = r->clock > e->clock || (r->clock == e->clock && r->site > e->site);
+    if (!newer) {
+      report->nIgnored++;
+      continue;
+    }
+    SyncHash hash = 0;
+    if (r->deleted) {
+      deleteCharFile(dir, r->page);
+    }
+    else {
+      hash = Sync_Hash(r->data, 768);
+      if (!writeCharFile(dir, r->page, r->data)) {
+        printf("Write %s/%d.char error\n", dir, r->page);
+        ok = false;
+        break;
+      }
+    }
+    appendEntry(fp, &log, r->page, r->clock, r->site, hash);
+    report->nApplied++;
+  }
+  fclose(fp);
+  free(remote);
+
+  // 中途失败时不记录拉取位置，下次从原位置重新拉取，已应用的条目会被忽略
+  if (ok) {
+    fp = fopen(peerFile, "w");
+    if (fp) {
+      fprintf(fp, "%u\n", report->gen);
+      fclose(fp);
+    }
+  }
+  report->timeUs = getTimeUs() - start;
+  return ok;
+}
+
+/******************************************************************************
+ *
+ * 性能测试
+ *
+******************************************************************************/
+
+// 与模块导出的特征文件一样，细节点之后和扩展区都是0
+static void randomTemplate(uchar* pData, unsigned* seed) {
+  CharFeatures f;
+  memset(&f, 0, sizeof(f));
+  f.header[0] = 0x03;
+  f.header[1] = rand_r(seed) % 100;
+  f.n = 20 + rand_r(seed) % 40;
+  f.header[2] = f.n;
+  for (int i = 0; i < f.n; ++i) {
+    f.x[i]       = rand_r(seed) % 256;
+    f.y[i]       = rand_r(seed) % 288;
+    f.angle[i]   = rand_r(seed) % 64;
+    f.type[i]    = rand_r(seed) % 2;
+    f.quality[i] = rand_r(seed) % 100;
+  }
+  CharFile_UpdateChecksum(&f);
+  CharFile_Encode(&f, pData, CHARFILE_SIZE);
+}
+
+static void clearDir(const char* dir) {
+  DIR* d = opendir(dir);
+  if (!d)
+    return;
+  struct dirent* ent;
+  char filename[512] = { 0 };
+  while ((ent = readdir(d)) != NULL) {
+    if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+      continue;
+    snprintf(filename, sizeof(filename), "%s/%s", dir, ent->d_name);
+    unlink(filename);
+  }
+  closedir(d);
+}
+
+static bool sameStore(const char* dirA, const char* dirB) {
+  static SyncHash a[SITE_MAX_PAGES], b[SITE_MAX_PAGES];
+  Sync_LoadStore(dirA, a, SITE_MAX_PAGES);
+  Sync_LoadStore(dirB, b, SITE_MAX_PAGES);
+  return memcmp(a, b, sizeof(a)) == 0;
+}
+
+static pid_t startServer(const char* dir, int port) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    freopen("/dev/null", "w", stdout);
+    Site_Serve(dir, port, -1);
+    _exit(1);
+  }
+  // 等待开始监听
+  for (int i = 0; i < 200 && pid > 0; ++i) {
+    int fd = connectTo("127.0.0.1", port);
+    if (fd >= 0) {
+      close(fd);
+      break;
+    }
+    usleep(10000);
+  }
+  return pid;
+}
+
+static void printPull(const char* name, const SiteReport* r) {
+  printf("  %-10s %4d entries  %4d applied  %8lld bytes  %7.2f ms  %8.0f templates/s  %6.2f MB/s\n",
+    name, r->nEntry, r->nApplied, r->wireBytes, r->timeUs / 1000.0,
+    r->nEntry * 1e6 / (r->timeUs > 0 ? r->timeUs : 1),
+    r->wireBytes / (r->timeUs > 0 ? (double)r->timeUs : 1.0));
+}
+
+void Site_Benchmark(int n) {
+  if (n <= 0 || n > SITE_MAX_PAGES)
+    n = 300;
+  char dirA[64], dirB[64];
+  snprintf(dirA, sizeof(dirA), "/tmp/fpsite_%d_a", getpid());
+  snprintf(dirB, sizeof(dirB), "/tmp/fpsite_%d_b", getpid());
+  mkdir(dirA, 0700);
+  mkdir(dirB, 0700);
+  clearDir(dirA);
+  clearDir(dirB);
+
+  unsigned seed = 2019;
+  uchar data[768];
+  for (int page = 0; page < n; ++page) {
+    randomTemplate(data, &seed);
+    writeCharFile(dirA, page, data);
+  }
+
+  int portA = SITE_PORT + 1 + getpid() % 1000;
+  int portB = portA + 1000;
+  pid_t serverA = startServer(dirA, portA);
+  pid_t serverB = startServer(dirB, portB);
+  if (serverA < 0 || serverB < 0) {
+    printf("fork error\n");
+    return;
+  }
+
+  SiteReport raw, packed, delta, idle, ab, ba;
+  memset(&raw, 0, sizeof(raw));
+  memset(&packed, 0, sizeof(packed));
+  printf("Full pull of %d templates over loopback:\n", n);
+  if (Site_Pull(dirB, "127.0.0.1", portA, false, &raw))
+    printPull("raw", &raw);
+
+  clearDir(dirB);
+  if (Site_Pull(dirB, "127.0.0.1", portA, true, &packed))
+    printPull("zero-run", &packed);
+  if (packed.rawBytes > 0)
+    printf("  Compressed to %.1f%% of %lld bytes of char files\n",
+      100.0 * packed.wireBytes / packed.rawBytes, packed.rawBytes);
+
+  // 修改一部分模板，测量修改到对方一致的时间
+  int k = n < 10 ? n : 10;
+  long long start = getTimeUs();
+  for (int i = 0; i < k; ++i) {
+    randomTemplate(data, &seed);
+    writeCharFile(dirA, (i * 7) % n, data);
+  }
+  deleteCharFile(dirA, n - 1);
+  if (Site_Pull(dirB, "127.0.0.1", portA, true, &delta)) {
+    printf("\nDelta after %d edits and 1 delete:\n", k);
+    printPull("delta", &delta);
+    printf("  Converged in %.2f ms: %s\n", (getTimeUs() - start) / 1000.0,
+      sameStore(dirA, dirB) ? "yes" : "NO");
+  }
+  if (Site_Pull(dirB, "127.0.0.1", portA, true, &idle))
+    printPull("no change", &idle);
+
+  // 两个站点同时修改同一页，互相拉取一次后应一致
+  randomTemplate(data, &seed);
+  writeCharFile(dirA, 0, data);
+  randomTemplate(data, &seed);
+  writeCharFile(dirB, 0, data);
+  start = getTimeUs();
+  bool ok = Site_Pull(dirB, "127.0.0.1", portA, true, &ab)
+         && Site_Pull(dirA, "127.0.0.1", portB, true, &ba);
+  if (ok) {
+    printf("\nConflict on page 0 (both sites edited it):\n");
+    printPull("B <- A", &ab);
+    printPull("A <- B", &ba);
+    printf("  Converged in %.2f ms: %s\n", (getTimeUs() - start) / 1000.0,
+      sameStore(dirA, dirB) ? "yes" : "NO");
+  }
+
+  kill(serverA, SIGTERM);
+  kill(serverB, SIGTERM);
+  waitpid(serverA, NULL, 0);
+  waitpid(serverB, NULL, 0);
+  clearDir(dirA);
+  clearDir(dirB);
+  rmdir(dirA);
+  rmdir(dirB);
+}
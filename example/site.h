@@ -0,0 +1,92 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+#ifndef __SITE_H__
+#define __SITE_H__
+
+#include "./sync.h"
+
+/*
+ * 站点间主机指纹库的差量同步(TCP)
+ *
+ * 每个站点(网关)有一个主机指纹库目录，格式与 sync 相同("dir/[页码].char")。
+ * 目录中的修改记录在代数日志 "dir/.sitelog" 中，每行 "代数 时钟 站点 页码 哈希"，
+ *   代数在本站点内递增，哈希为0表示删除。Site_Open 比较目录与日志，把本地的修改追加到日志。
+ * 拉取时只传输对方日志中 代数 大于上次拉取位置("dir/.peer_[主机]_[端口]") 的页，每页只传最新一条。
+ * 同一页在两个站点都被修改时，(时钟, 站点) 较大的一方胜出(Lamport 时钟)，
+ *   应用远端条目时把本地时钟推进到不小于远端时钟，因此后发生的修改总是胜出，各站点最终一致。
+ *
+ * 帧格式：[类型 1字节][长度 4字节，大端][内容]
+ *   HELLO  起始代数(4) 标志(1，bit0 接受压缩) 请求方站点(4)
+ *   ENTRY  代数(4) 时钟(4) 站点(4) 页码(2) 编码(1) 数据
+ *          编码 0: 768字节原样  1: 零游程压缩  2: 删除(无数据)
+ *   END    对方当前代数(4)
+ * 特征文件的扩展区和细节点之后大多是0，零游程压缩不依赖第三方库，通常能减少一半以上。
+*/
+
+#define SITE_PORT      6608
+#define SITE_MAX_PAGES SYNC_MAX_PAGES
+
+typedef struct _SiteEntry {
+  uint gen;        // 0 表示日志中没有该页
+  uint clock;
+  uint site;
+  SyncHash hash;   // 0 表示已删除
+} SiteEntry;
+
+typedef struct _SiteLog {
+  uint site;       // 本站点ID，保存在 "dir/.siteid"
+  uint gen;        // 日志的最新代数
+  uint clock;      // Lamport 时钟
+  SiteEntry page[SITE_MAX_PAGES];   // 每页的最新一条
+} SiteLog;
+
+typedef struct _SiteReport {
+  int  nEntry;          // 收到的条目
+  int  nApplied;        // 写入(或删除)本地文件的条目
+  int  nIgnored;        // 本地更新而忽略的条目
+  uint since;           // 本次拉取的起始代数
+  uint gen;             // 对方当前代数
+  long long wireBytes;  // 收发的字节数(包括帧头)
+  long long rawBytes;   // 不压缩时特征文件的字节数
+  long long timeUs;
+} SiteReport;
+
+// 读取日志，并把目录中的本地修改追加到日志，返回新追加的条数，失败返回-1
+int  Site_Open(const char* dir, SiteLog* log);
+
+// 在 port 上提供 dir 的日志，每个连接重新扫描目录。maxConnections < 0 时一直运行
+bool Site_Serve(const char* dir, int port, int maxConnections);
+
+// 从 host:port 拉取修改，应用到 dir。compress 为 true 时请求对方压缩
+bool Site_Pull(const char* dir, const char* host, int port, bool compress, SiteReport* report);
+
+// 零游程压缩，out 至少 size + size/128 + 1 字节，返回压缩后的字节数
+int  Site_Compress(const uchar* in, int size, uchar* out);
+
+// 解压，返回解压后的字节数，数据不合法或超过 outSize 时返回-1
+int  Site_Decompress(const uchar* in, int size, uchar* out, int outSize);
+
+// 性能测试：本机回环上两个进程同步 n 个模板，统计吞吐量、压缩率和收敛时间
+void Site_Benchmark(int n);
+
+#endif // __SITE_H__
@@ -0,0 +1,324 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+#include "./sync.h"
+#include "./utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern AS608 g_as608;
+extern uchar g_error_code;
+
+// 各指令包的大小(包括应答包12字节)，用于统计传输量
+#define SYNC_EMPTY_BYTES    (12 + 12)
+#define SYNC_DELETE_BYTES   (16 + 12)
+#define SYNC_STORE_BYTES    (15 + 12)
+#define SYNC_DOWNCHAR_BYTES (13 + 12)
+
+
+// 768字节特征文件分包传输时的实际字节数
+static long long charFileWireBytes() {
+  int packetSize = g_as608.packet_size > 0 ? g_as608.packet_size : 128;
+  return 768 / packetSize * (packetSize + 11);
+}
+
+// 指纹库容量
+static int capacity() {
+  if (g_as608.capacity == 0 || g_as608.capacity > SYNC_MAX_PAGES)
+    return SYNC_MAX_PAGES;
+  return g_as608.capacity;
+}
+
+static bool readCharFile(const char* dir, int page, uchar* buf) {
+  char filename[256] = { 0 };
+  snprintf(filename, sizeof(filename), "%s/%d.char", dir, page);
+  FILE* fp = fopen(filename, "rb");
+  if (!fp)
+    return false;
+  int size = fread(buf, 1, 768, fp);
+  bool more = fgetc(fp) != EOF;
+  fclose(fp);
+  return size == 768 && !more;
+}
+
+// 记录文件名：dir/.sync_[芯片地址]_[串口]，串口中的'/'替换为'_'
+static bool stateFileName(const char* dir, const char* serial, uint chipAddr, char* filename, int size) {
+  while (*serial == '/')
+    serial++;
+  int len = snprintf(filename, size, "%s/.sync_%08x_%s", dir, chipAddr, serial);
+  if (len < 0 || len >= size)
+    return false;
+  for (char* p = filename + len - strlen(serial); *p; ++p) {
+    if (*p == '/')
+      *p = '_';
+  }
+  return true;
+}
+
+SyncHash Sync_Hash(const uchar* pData, int size) {
+  SyncHash hash = 0xcbf29ce484222325ULL;
+  for (int i = 0; i < size; ++i) {
+    hash ^= pData[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash ? hash : 1;  // 0 保留为"不存在"
+}
+
+int Sync_LoadStore(const char* dir, SyncHash* hashes, int size) {
+  uchar buf[768];
+  int count = 0;
+  for (int page = 0; page < size; ++page) {
+    hashes[page] = 0;
+    if (readCharFile(dir, page, buf)) {
+      hashes[page] = Sync_Hash(buf, 768);
+      count++;
+    }
+  }
+  return count;
+}
+
+bool Sync_LoadState(const char* dir, const char* serial, uint chipAddr, SyncHash* hashes, int size) {
+  memset(hashes, 0, sizeof(SyncHash) * size);
+
+  char filename[256] = { 0 };
+  if (!stateFileName(dir, serial, chipAddr, filename, sizeof(filename)))
+    return false;
+  FILE* fp = fopen(filename, "r");
+  if (!fp)
+    return false;
+
+  int page = 0;
+  SyncHash hash = 0;
+  while (fscanf(fp, "%d %llx", &page, &hash) == 2) {
+    if (page >= 0 && page < size)
+      hashes[page] = hash;
+  }
+
+  fclose(fp);
+  return true;
+}
+
+bool Sync_SaveState(const char* dir, const char* serial, uint chipAddr, const SyncHash* hashes, int size) {
+  char filename[256] = { 0 };
+  FILE* fp = NULL;
+  if (stateFileName(dir, serial, chipAddr, filename, sizeof(filename)))
+    fp = fopen(filename, "w+");
+  if (!fp) {
+    g_error_code = 0xC2;
+    return false;
+  }
+
+  for (int page = 0; page < size; ++page) {
+    if (hashes[page])
+      fprintf(fp, "%d %016llx\n", page, hashes[page]);
+  }
+
+  fclose(fp);
+  return true;
+}
+
+// 写入顺序：按哈希分组，同组按页码升序
+static int compareWrite(const void* a, const void* b) {
+  const SyncHash* x = (const SyncHash*)a;
+  const SyncHash* y = (const SyncHash*)b;
+  if (x[0] != y[0])
+    return x[0] < y[0] ? -1 : 1;
+  return (int)(x[1] - y[1]);
+}
+
+bool Sync_Plan(const char* dir, const char* serial, bool verify, SyncPlan* plan) {
+  memset(plan, 0, sizeof(SyncPlan));
+  if (strlen(serial) >= sizeof(plan->serial)) {
+    g_error_code = 0xC2;
+    return false;
+  }
+  strcpy(plan->serial, serial);
+  int size = capacity();
+
+  plan->nStore = Sync_LoadStore(dir, plan->storeHash, size);
+
+  // 模块索引表
+  uchar bitmap[64] = { 0 };
+  if (!PS_ReadIndexBitmap(bitmap, 64))
+    return false;
+  bool occupied[SYNC_MAX_PAGES] = { false };
+  for (int page = 0; page < size; ++page)
+    occupied[page] = (bitmap[page / 8] >> (page % 8)) & 1;
+
+  // 模块内容哈希，以索引表为准
+  Sync_LoadState(dir, plan->serial, g_as608.chip_addr, plan->moduleHash, size);
+  for (int page = 0; page < size; ++page) {
+    if (!occupied[page])
+      plan->moduleHash[page] = 0;
+  }
+
+  // 重新读取所有需要比较的已占用页：记录的哈希在 fp add、delete、replicate
+  //   或其他主机修改模块之后就不再可信，模板缓存同样可能过期，直接从模块读取
+  if (verify) {
+    uchar buf[768];
+    for (int page = 0; page < size; ++page) {
+      if (occupied[page] && plan->storeHash[page]) {
+        if (!PS_LoadChar(1, page) || !PS_UpCharToBuf(1, buf, 768))
+          return false;
+        plan->moduleHash[page] = Sync_Hash(buf, 768);
+      }
+    }
+  }
+
+  // 分类
+  bool extra[SYNC_MAX_PAGES] = { false };
+  bool write[SYNC_MAX_PAGES] = { false };
+  int nOccupied = 0;
+  for (int page = 0; page < size; ++page) {
+    if (occupied[page])
+      nOccupied++;
+    if (plan->storeHash[page] && !occupied[page]) {
+      write[page] = true;
+      plan->nMissing++;
+    }
+    else if (plan->storeHash[page] && plan->moduleHash[page] != plan->storeHash[page]) {
+      write[page] = true;
+      plan->nStale++;
+    }
+    else if (!plan->storeHash[page] && occupied[page]) {
+      extra[page] = true;
+      plan->nExtra++;
+    }
+  }
+
+  // 所有已占用页都需要删除或重写，一条 PS_Empty 代替所有删除
+  if (nOccupied > 0 && plan->nExtra + plan->nStale == nOccupied && plan->nExtra > 0) {
+    plan->useEmpty = true;
+  }
+  else {
+    // 合并删除区间：空页和即将重写的页不影响结果，可以并入区间
+    int start = -1, last = -1;
+    for (int page = 0; page <= size; ++page) {
+      bool keep = page < size && occupied[page] && !extra[page] && !write[page];
+      if (page < size && extra[page]) {
+        if (start == -1)
+          start = page;
+        last = page;
+      }
+      else if (start != -1 && (keep || page == size)) {
+        plan->deleteStart[plan->nDelete] = start;
+        plan->deleteCount[plan->nDelete] = last - start + 1;
+        plan->nDelete++;
+        start = -1;
+      }
+    }
+  }
+
+  // 写入列表，内容相同的页相邻，只需下载一次特征文件
+  SyncHash order[SYNC_MAX_PAGES][2];
+  for (int page = 0; page < size; ++page) {
+    if (write[page]) {
+      order[plan->nWrite][0] = plan->storeHash[page];
+      order[plan->nWrite][1] = page;
+      plan->nWrite++;
+    }
+  }
+  qsort(order, plan->nWrite, sizeof(order[0]), compareWrite);
+  for (int i = 0; i < plan->nWrite; ++i)
+    plan->writePage[i] = (int)order[i][1];
+
+  return true;
+}
+
+bool Sync_Execute(const char* dir, SyncPlan* plan, SyncReport* report) {
+  memset(report, 0, sizeof(SyncReport));
+  int size = capacity();
+  bool ok = true;
+
+  long long start = getTimeUs();
+  long long downUs  = 0;   // 下载特征文件的总耗时，用于估算全量重写
+  long long storeUs = 0;   // 存储模板的总耗时
+  long long emptyUs = 0;
+
+  if (plan->useEmpty) {
+    long long t = getTimeUs();
+    ok = PS_Empty();
+    emptyUs = getTimeUs() - t;
+    report->nCommand++;
+    report->bytes += SYNC_EMPTY_BYTES;
+    if (ok)
+      memset(plan->moduleHash, 0, sizeof(SyncHash) * size);
+  }
+
+  for (int i = 0; ok && i < plan->nDelete; ++i) {
+    ok = PS_DeleteChar(plan->deleteStart[i], plan->deleteCount[i]);
+    report->nCommand++;
+    report->bytes += SYNC_DELETE_BYTES;
+    for (int page = plan->deleteStart[i]; ok && page < plan->deleteStart[i] + plan->deleteCount[i]; ++page)
+      plan->moduleHash[page] = 0;
+  }
+
+  SyncHash loaded = 0;  // 当前 CharBuffer1 中特征文件的哈希
+  uchar buf[768];
+  for (int i = 0; ok && i < plan->nWrite; ++i) {
+    int page = plan->writePage[i];
+    long long t = getTimeUs();
+    if (plan->storeHash[page] != loaded) {
+      if (!readCharFile(dir, page, buf)) {
+        g_error_code = 0xC2;
+        ok = false;
+        break;
+      }
+      loaded = 0;
+      ok = PS_DownCharFromBuf(1, buf, 768);
+      report->nCommand++;
+      report->nDownChar++;
+      report->bytes += SYNC_DOWNCHAR_BYTES + charFileWireBytes();
+      if (!ok)
+        break;
+      loaded = plan->storeHash[page];
+    }
+    downUs += getTimeUs() - t;
+
+    t = getTimeUs();
+    ok = PS_StoreChar(1, page);
+    report->nCommand++;
+    report->bytes += SYNC_STORE_BYTES;
+    storeUs += getTimeUs() - t;
+    if (ok)
+      plan->moduleHash[page] = plan->storeHash[page];
+  }
+
+  report->timeUs = getTimeUs() - start;
+
+  // 全量重写：PS_Empty，然后每个模板 PS_DownChar + PS_StoreChar
+  long long perWrite = SYNC_DOWNCHAR_BYTES + charFileWireBytes() + SYNC_STORE_BYTES;
+  report->fullBytes = SYNC_EMPTY_BYTES + plan->nStore * perWrite;
+  if (report->nDownChar > 0) {
+    // 以本次实测的下载、存储速度估算
+    report->fullTimeUs = emptyUs + plan->nStore * (downUs / report->nDownChar + storeUs / plan->nWrite);
+  }
+  else {
+    // 没有实测数据，按波特率估算传输时间(每字节10位)
+    int baud = g_as608.baud_rate > 0 ? g_as608.baud_rate : 57600;
+    report->fullTimeUs = report->fullBytes * 10 * 1000000LL / baud;
+  }
+
+  Sync_SaveState(dir, plan->serial, g_as608.chip_addr, plan->moduleHash, size);
+  return ok;
+}
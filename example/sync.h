@@ -0,0 +1,85 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+#ifndef __SYNC_H__
+#define __SYNC_H__
+
+#include "../as608.h"
+
+/*
+ * 主机指纹库 与 模块指纹库 的差量同步
+ *
+ * 主机指纹库(权威数据)是一个目录，每个模板是一个768字节的特征文件，
+ *   文件名为页码，如 "dir/7.char" 对应模块指纹库的第7号位置。
+ * 模块中每一页的内容哈希无法直接读取，同步时记录在 "dir/.sync_[芯片地址]_[串口]" 中，
+ *   每行格式为 "页码 哈希值"，表示该页最近一次同步写入模块的内容。
+ *   多个模块常使用相同的默认芯片地址，所以记录文件同时以串口设备区分，
+ *   如 "/dev/ttyAMA0" 对应 "dir/.sync_ffffffff_dev_ttyAMA0"。
+*/
+
+#define SYNC_MAX_PAGES 512
+
+typedef unsigned long long SyncHash;
+
+typedef struct _SyncPlan {
+  char serial[32];               // 模块所在的串口设备，用于定位记录文件
+  bool useEmpty;                 // 是否先清空模块(所有已占用页都需删除或重写时)
+  int  nDelete;                  // 删除区间个数
+  int  deleteStart[SYNC_MAX_PAGES];
+  int  deleteCount[SYNC_MAX_PAGES];
+  int  nWrite;                   // 需要写入的页数
+  int  writePage[SYNC_MAX_PAGES];  // 按内容哈希分组，同组的页只下载一次特征文件
+  int  nMissing;                 // 模块中缺少的页
+  int  nStale;                   // 内容过期的页
+  int  nExtra;                   // 模块中多余的页
+  int  nStore;                   // 主机指纹库中的模板总数
+  SyncHash storeHash[SYNC_MAX_PAGES];   // 主机指纹库每一页的哈希，0表示不存在
+  SyncHash moduleHash[SYNC_MAX_PAGES];  // 模块每一页的哈希，0表示空页或未知
+} SyncPlan;
+
+typedef struct _SyncReport {
+  int  nDownChar;        // 实际下载特征文件的次数
+  int  nCommand;         // 实际发送的指令包个数
+  long long bytes;       // 实际传输的字节数(指令包+应答包+数据包)
+  long long fullBytes;   // 全量重写(PS_Empty + 逐个写入)需要传输的字节数
+  long long timeUs;      // 实际耗时
+  long long fullTimeUs;  // 全量重写的估计耗时
+} SyncReport;
+
+// 计算特征文件的哈希值(FNV-1a 64位)
+SyncHash Sync_Hash(const uchar* pData, int size);
+
+// 读取主机指纹库，hashes[page]为0表示该页不存在
+int  Sync_LoadStore(const char* dir, SyncHash* hashes, int size);
+
+// 读写模块内容哈希的记录文件
+bool Sync_LoadState(const char* dir, const char* serial, uint chipAddr, SyncHash* hashes, int size);
+bool Sync_SaveState(const char* dir, const char* serial, uint chipAddr, const SyncHash* hashes, int size);
+
+// 根据模块索引表、模块内容哈希和主机指纹库，生成同步计划
+//   verify为true时，不信任记录的哈希，对主机指纹库中也存在的已占用页，
+//   通过 PS_LoadChar + PS_UpChar 重新读取并计算哈希(发现在同步之外被修改的页)
+bool Sync_Plan(const char* dir, const char* serial, bool verify, SyncPlan* plan);
+
+// 执行同步计划，并更新模块内容哈希的记录文件
+bool Sync_Execute(const char* dir, SyncPlan* plan, SyncReport* report);
+
+#endif // __SYNC_H__
@@ -23,45 +23,15 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
 
-// 去除文件中的空格
-// 仅适合本例，用于处理配置文件，数据量很小
-void trimSpaceInFile(const char* filename) {
-  FILE* fp = fopen(filename, "r");
-  if (!fp)
-    return;
-
-  char lineBuf[64] = { 0 };
-  char writeBuf[1024] = { 0 }; // 除了空白字符全部读入writeBuf中，包括换行符'\n'
-  int offset = 0;
-  while (!feof(fp)) {
-    fgets(lineBuf, 64, fp);
-    if (feof(fp))
-      break;
-    for (int i = 0, len = strlen(lineBuf); i < len; ++i) {
-      if (lineBuf[i] != ' ' && lineBuf[i] != '\t') {
-        if (lineBuf[i] == '\n' && offset > 0 && writeBuf[offset-1] == '\n')
-          continue;
-        writeBuf[offset++] = lineBuf[i];
-      }
-    }
-  }
-
-  fclose(fp);
-  fp = fopen(filename, "w+"); // 覆盖写入
-  if (!fp)
-    return;
-  fwrite(writeBuf, 1, strlen(writeBuf), fp);
-  fclose(fp);
-}
-
-// 去除字符串首尾空格 和 换行符
+// 去除字符串首尾空白字符 和 换行符
 void trim(const char* strIn, char* strOut) {
   int i = 0;
   int j = strlen(strIn) - 1;
-  while (strIn[i] == ' ')
+  while (strIn[i] == ' ' || strIn[i] == '\t')
     ++i;
-  while (strIn[j] == ' ' || strIn[j] == '\n')
+  while (j >= i && (strIn[j] == ' ' || strIn[j] == '\t' || strIn[j] == '\n' || strIn[j] == '\r'))
     --j;
   strncpy(strOut, strIn+i, j-i+1);
   strOut[j-i+1] = 0;
@@ -85,3 +55,23 @@ unsigned int toUInt(const char* str) {
   return ret;
 }
 
+// 获取单调时钟的当前时间，单位微秒
+long long getTimeUs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+bool deviceFilePath(char* path, int size, const char* dir, const char* prefix,
+                    unsigned int chipAddr, const char* serial) {
+  while (*serial == '/')
+    ++serial;
+  int len = snprintf(path, size, "%s/%s%08x_%s", dir, prefix, chipAddr, serial);
+  if (len < 0 || len >= size)
+    return false;
+  for (char* p = path + len - strlen(serial); *p; ++p) {
+    if (*p == '/')
+      *p = '_';
+  }
+  return true;
+}
@@ -22,19 +22,19 @@
 #ifndef __UTILS_H__
 #define __UTILS_H__
 
+#include <stdbool.h>
+
 typedef struct _Config {
   unsigned int address;
   unsigned int password;
   int has_password;
   int baudrate;
   int detect_pin;
+  char detect_chip[16];   // 检测引脚所在的 GPIO 字符设备，空为 wiringPi，"fake" 为模拟
   char serial[16];
 } Config;
 
 
-// 去除文件中所有空白字符(空格和制表符)
-void trimSpaceInFile(const char* filename);
-
 // 把字符串转为整型
 void trim(const char* strIn, char* strOut);
 
@@ -44,5 +44,14 @@ int toInt(const char* str);
 // 把 *十六进制* 字符串转为无符号整型
 unsigned int toUInt(const char* str);
 
+// 获取单调时钟的当前时间，单位微秒
+long long getTimeUs();
+
+// 按芯片地址和串口设备区分的文件路径，如 "dir/.fpsock_ffffffff_dev_ttyAMA0"
+//   多个模块常使用相同的默认芯片地址，只按地址区分会混用其他模块的状态。
+//   串口路径中的 '/' 换为 '_'。返回值：false(路径超出size)
+bool deviceFilePath(char* path, int size, const char* dir, const char* prefix,
+                    unsigned int chipAddr, const char* serial);
+
 
 #endif // __UTILS_H__
@@ -0,0 +1,349 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+#include "./vdb.h"
+#include "./utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+extern AS608 g_as608;
+extern uchar g_error_code;
+
+/*
+ * 模拟时使用的耗时估计(毫秒)，57600波特率，数据包大小128
+ *   768字节特征文件实际传输 6*139=834 字节，约145毫秒
+*/
+#define SIM_SEARCH_HIT_MS    120   // 高速搜索命中
+#define SIM_SEARCH_MISS_MS   300   // 高速搜索整个指纹库未命中
+#define SIM_CHARFILE_MS      145   // PS_UpChar 或 PS_DownChar
+#define SIM_MATCH_MS         40    // PS_Match
+#define SIM_STORE_MS         60    // PS_StoreChar，写FLASH
+
+static bool stateFileName(const char* dir, const char* serial, char* filename, int size) {
+  if (deviceFilePath(filename, size, dir, ".vdb_", g_as608.chip_addr, serial))
+    return true;
+  g_error_code = 0xC2;
+  return false;
+}
+
+void Vdb_Init(VdbCache* cache, int capacity, int policy) {
+  memset(cache, 0, sizeof(VdbCache));
+  if (capacity <= 0 || capacity > VDB_MAX_PAGES)
+    capacity = VDB_MAX_PAGES;
+  cache->capacity = capacity;
+  cache->policy = policy;
+  for (int page = 0; page < VDB_MAX_PAGES; ++page)
+    cache->uid[page] = -1;
+}
+
+int Vdb_Find(const VdbCache* cache, int uid) {
+  for (int page = 0; page < cache->capacity; ++page) {
+    if (cache->uid[page] == uid)
+      return page;
+  }
+  return -1;
+}
+
+void Vdb_Touch(VdbCache* cache, int page) {
+  cache->lastUse[page] = ++cache->tick;
+  cache->hits[page]++;
+}
+
+// 页的"热度"，越小越先被替换
+static double priority(const VdbCache* cache, int page) {
+  switch (cache->policy) {
+  case VDB_LFU:
+    return cache->hits[page] + (double)cache->lastUse[page] / (cache->tick + 1);
+  case VDB_LRFU:
+    // 访问次数每翻一倍，相当于晚使用了 capacity/4 次
+    return cache->lastUse[page] + cache->capacity / 4.0 * log2(1.0 + cache->hits[page]);
+  case VDB_LRU:
+  default:
+    return cache->lastUse[page];
+  }
+}
+
+int Vdb_Victim(const VdbCache* cache) {
+  int victim = -1;
+  for (int page = 0; page < cache->capacity; ++page) {
+    if (cache->uid[page] == -1)
+      return page;
+    if (cache->uid[page] == -2 && cache->evictUnmanaged && victim == -1)
+      victim = page;
+  }
+  if (victim != -1)
+    return victim;
+
+  double coldest = 0;
+  for (int page = 0; page < cache->capacity; ++page) {
+    if (cache->uid[page] < 0)
+      continue;
+    double p = priority(cache, page);
+    if (victim == -1 || p < coldest) {
+      victim = page;
+      coldest = p;
+    }
+  }
+  return victim;
+}
+
+void Vdb_Assign(VdbCache* cache, int page, int uid) {
+  cache->uid[page] = uid;
+  cache->hits[page] = 0;
+  Vdb_Touch(cache, page);
+}
+
+bool Vdb_Load(const char* dir, const char* serial, VdbCache* cache) {
+  bool evictUnmanaged = cache->evictUnmanaged;
+  Vdb_Init(cache, g_as608.capacity, cache->policy);
+  cache->evictUnmanaged = evictUnmanaged;
+
+  // 模块中已占用的页
+  uchar bitmap[64] = { 0 };
+  if (!PS_ReadIndexBitmap(bitmap, 64))
+    return false;
+  for (int page = PS_NextUsedPage(0); page != -1 && page < cache->capacity; page = PS_NextUsedPage(page + 1))
+    cache->uid[page] = -2;
+
+  char filename[256] = { 0 };
+  if (!stateFileName(dir, serial, filename, sizeof(filename)))
+    return false;
+  FILE* fp = fopen(filename, "r");
+  if (!fp)
+    return true;
+
+  int page = 0, uid = 0;
+  unsigned lastUse = 0, hits = 0;
+  fscanf(fp, "%u", &cache->tick);
+  while (fscanf(fp, "%d %d %u %u", &page, &uid, &lastUse, &hits) == 4) {
+    // 以索引表为准，模块中不存在的页不再使用
+    if (page < 0 || page >= cache->capacity || cache->uid[page] != -2)
+      continue;
+    cache->uid[page] = uid;
+    cache->lastUse[page] = lastUse;
+    cache->hits[page] = hits;
+  }
+
+  fclose(fp);
+  return true;
+}
+
+bool Vdb_Save(const char* dir, const char* serial, const VdbCache* cache) {
+  char filename[256] = { 0 };
+  if (!stateFileName(dir, serial, filename, sizeof(filename)))
+    return false;
+  FILE* fp = fopen(filename, "w+");
+  if (!fp) {
+    g_error_code = 0xC2;
+    return false;
+  }
+
+  fprintf(fp, "%u\n", cache->tick);
+  for (int page = 0; page < cache->capacity; ++page) {
+    if (cache->uid[page] >= 0)
+      fprintf(fp, "%d %d %u %u\n", page, cache->uid[page], cache->lastUse[page], cache->hits[page]);
+  }
+
+  fclose(fp);
+  return true;
+}
+
+static bool readUserFile(const char* dir, int uid, uchar* buf) {
+  char filename[256] = { 0 };
+  snprintf(filename, sizeof(filename), "%s/%d.char", dir, uid);
+  FILE* fp = fopen(filename, "rb");
+  if (!fp)
+    return false;
+  int size = fread(buf, 1, 768, fp);
+  fclose(fp);
+  return size == 768;
+}
+
+bool Vdb_Identify(const char* dir, VdbCache* cache, Matcher* matcher,
+                  int* pUid, int* pScore, bool* pHit) {
+  *pUid = -1;
+  *pScore = 0;
+  *pHit = false;
+
+  // 1.模块中高速搜索
+  int page = 0;
+  if (PS_HighSpeedSearch(1, 0, cache->capacity, &page, pScore)) {
+    if (page >= cache->capacity || cache->uid[page] < 0) {
+      // 命中了不受管理的页，无法对应到用户
+      g_error_code = 0x09;
+      return false;
+    }
+    Vdb_Touch(cache, page);
+    *pUid = cache->uid[page];
+    *pHit = true;
+    return true;
+  }
+  if (g_error_code != 0x09)
+    return false;
+
+  // 2.未命中，在主机指纹库中比对
+  uchar probe[768];
+  if (!PS_UpCharToBuf(1, probe, 768))
+    return false;
+
+  MatchResult results[VDB_CANDIDATES];
+  int n = Matcher_Search(matcher, probe, VDB_CANDIDATES, 0, results);
+
+  // 3.候选用户下载到 CharBuffer2，与 CharBuffer1 精确比对，确认后换入
+  uchar tpl[768];
+  for (int i = 0; i < n; ++i) {
+    if (results[i].score <= 0 || !readUserFile(dir, results[i].id, tpl))
+      continue;
+    if (!PS_DownCharFromBuf(2, tpl, 768))
+      return false;
+    int score = 0;
+    if (!PS_Match(&score)) {
+      if (g_error_code == 0x08)
+        continue;
+      return false;
+    }
+
+    // 用户已在模块中(模块的模板没有搜索到)时覆盖原来的页，一个用户只占一页
+    int page = Vdb_Find(cache, results[i].id);
+    bool resident = (page != -1);
+    if (!resident)
+      page = Vdb_Victim(cache);
+    if (page == -1) {
+      g_error_code = 0xFF;   // 所有页都不受管理
+      return false;
+    }
+    if (!PS_StoreChar(2, page))
+      return false;
+    if (resident)
+      Vdb_Touch(cache, page);
+    else
+      Vdb_Assign(cache, page, results[i].id);
+    *pUid = results[i].id;
+    *pScore = score;
+    return true;
+  }
+
+  g_error_code = 0x09;
+  return false;
+}
+
+
+/******************************************************************
+ * 模拟
+******************************************************************/
+
+static int compareInt(const void* a, const void* b) {
+  return *(const int*)a - *(const int*)b;
+}
+
+// 按 Zipf 分布(指数为1)抽样，cdf为累积分布
+static int sampleZipf(const double* cdf, int n, unsigned* seed) {
+  double r = (double)rand_r(seed) / RAND_MAX;
+  int lo = 0, hi = n - 1;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (cdf[mid] < r)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+void Vdb_Simulate(int users, int capacity, int accesses) {
+  if (users <= 0 || capacity <= 0 || accesses <= 0 || capacity > VDB_MAX_PAGES)
+    return;
+
+  // 主机比对的实际耗时
+  Matcher* matcher = Matcher_Create(0);
+  if (!matcher)
+    return;
+  unsigned seed = 2019;
+  uchar buf[768];
+  for (int i = 0; i < users; ++i) {
+    for (int j = 0; j < 768; ++j)
+      buf[j] = (rand_r(&seed) % 4 == 0) ? rand_r(&seed) & 0xff : 0;
+    Matcher_Add(matcher, i, buf);
+  }
+  MatchResult results[VDB_CANDIDATES];
+  long long start = getTimeUs();
+  for (int i = 0; i < 10; ++i)
+    Matcher_Search(matcher, buf, VDB_CANDIDATES, 0, results);
+  int hostMs = (int)((getTimeUs() - start) / 10 / 1000);
+  Matcher_Destroy(matcher);
+
+  double* cdf = (double*)malloc(sizeof(double) * users);
+  int* latency = (int*)malloc(sizeof(int) * accesses);
+  int* trace = (int*)malloc(sizeof(int) * accesses);
+  if (!cdf || !latency || !trace) {
+    free(cdf); free(latency); free(trace);
+    return;
+  }
+
+  double total = 0;
+  for (int i = 0; i < users; ++i)
+    total += 1.0 / (i + 1);
+  double acc = 0;
+  for (int i = 0; i < users; ++i) {
+    acc += 1.0 / (i + 1) / total;
+    cdf[i] = acc;
+  }
+  // 用户ID打乱，避免热门用户的ID恰好相邻
+  for (int i = 0; i < accesses; ++i)
+    trace[i] = (sampleZipf(cdf, users, &seed) * 7919) % users;
+
+  int hitMs  = SIM_SEARCH_HIT_MS;
+  int missMs = SIM_SEARCH_MISS_MS + SIM_CHARFILE_MS + hostMs + SIM_CHARFILE_MS + SIM_MATCH_MS + SIM_STORE_MS;
+  printf("users=%d capacity=%d accesses=%d (Zipf s=1)\n", users, capacity, accesses);
+  printf("estimated latency: hit=%dms miss=%dms (host match %dms)\n", hitMs, missMs, hostMs);
+  printf("%6s %9s %9s %9s %9s %9s\n", "policy", "hit rate", "mean(ms)", "p50(ms)", "p90(ms)", "p99(ms)");
+
+  const char* names[3] = { "LRU", "LFU", "LRFU" };
+  static VdbCache cache;
+  for (int policy = VDB_LRU; policy <= VDB_LRFU; ++policy) {
+    Vdb_Init(&cache, capacity, policy);
+    int hits = 0;
+    long long sum = 0;
+    for (int i = 0; i < accesses; ++i) {
+      int page = Vdb_Find(&cache, trace[i]);
+      if (page >= 0) {
+        Vdb_Touch(&cache, page);
+        latency[i] = hitMs;
+        hits++;
+      }
+      else {
+        Vdb_Assign(&cache, Vdb_Victim(&cache), trace[i]);
+        latency[i] = missMs;
+      }
+      sum += latency[i];
+    }
+    qsort(latency, accesses, sizeof(int), compareInt);
+    printf("%6s %8.1f%% %9.1f %9d %9d %9d\n", names[policy], 100.0 * hits / accesses,
+        (double)sum / accesses, latency[accesses / 2], latency[accesses * 9 / 10], latency[accesses * 99 / 100]);
+  }
+
+  free(cdf);
+  free(latency);
+  free(trace);
+}
@@ -0,0 +1,87 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+#ifndef __VDB_H__
+#define __VDB_H__
+
+#include "../as608.h"
+#include "./matcher.h"
+
+/*
+ * 虚拟指纹库：主机指纹库为权威数据，模块的指纹库作为缓存
+ *
+ * 主机指纹库是一个目录，每个用户一个特征文件 "dir/[用户ID].char"，用户数不受限制。
+ * 模块的每一页缓存一个用户，页与用户的对应关系记录在 "dir/.vdb_[芯片地址]_[串口]"。
+ * 识别时先在模块中高速搜索(命中)；未命中时把特征文件上传到主机比对，
+ *   候选用户经模块 PS_Match 确认后换入模块，按淘汰策略替换最冷的页。
+ * 不受管理的页(在虚拟指纹库之外录入的模板)默认不会被替换，除非设置 evictUnmanaged。
+*/
+
+#define VDB_MAX_PAGES   512
+#define VDB_CANDIDATES  3     // 未命中时最多换入验证的候选个数
+
+enum {
+  VDB_LRU  = 0,   // 最近最少使用
+  VDB_LFU  = 1,   // 最不经常使用
+  VDB_LRFU = 2    // 兼顾使用时间和次数
+};
+
+typedef struct _VdbCache {
+  int capacity;
+  int policy;
+  bool evictUnmanaged;             // 是否可以替换不受管理的页
+  unsigned tick;                   // 逻辑时钟，每次访问加1
+  int      uid[VDB_MAX_PAGES];     // 页缓存的用户ID，-1表示空页，-2表示不受管理的已占用页
+  unsigned lastUse[VDB_MAX_PAGES];
+  unsigned hits[VDB_MAX_PAGES];
+} VdbCache;
+
+void Vdb_Init(VdbCache* cache, int capacity, int policy);
+
+// 查找用户所在的页，不在模块中返回-1
+int  Vdb_Find(const VdbCache* cache, int uid);
+
+// 记录一次访问
+void Vdb_Touch(VdbCache* cache, int page);
+
+// 选择被替换的页：空页 > 不受管理的页(evictUnmanaged时) > 按淘汰策略最冷的页，没有可替换的页返回-1
+int  Vdb_Victim(const VdbCache* cache);
+
+// 页换入新用户
+void Vdb_Assign(VdbCache* cache, int page, int uid);
+
+// 读写对应关系，并与模块的索引表核对，serial 为模块所在的串口设备
+bool Vdb_Load(const char* dir, const char* serial, VdbCache* cache);
+bool Vdb_Save(const char* dir, const char* serial, const VdbCache* cache);
+
+/*
+ * 以 CharBuffer1 中的特征识别用户
+ * 参数：matcher(加载了主机指纹库的比对器)
+ *      pUid, pScore(识别结果)  pHit(是否在模块中命中)
+ * 返回值：true(识别成功)，false(未识别或出现错误，错误码见g_error_code)
+*/
+bool Vdb_Identify(const char* dir, VdbCache* cache, Matcher* matcher,
+                  int* pUid, int* pScore, bool* pHit);
+
+// 用合成的访问序列(Zipf分布)模拟各淘汰策略的命中率和识别延时分布
+void Vdb_Simulate(int users, int capacity, int accesses);
+
+#endif // __VDB_H__
@@ -0,0 +1,96 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+
+#include "./watch.h"
+#include "./utils.h"
+
+#include <stdio.h>
+#include <time.h>
+
+extern uchar g_error_code;
+
+// 输出 JSON 字符串
+static void printJsonString(const char* str) {
+  putchar('"');
+  for (; *str; ++str) {
+    if (*str == '"' || *str == '\\')
+      printf("\\%c", *str);
+    else if ((unsigned char)*str < 0x20)
+      printf("\\u%04x", *str);
+    else
+      putchar(*str);
+  }
+  putchar('"');
+}
+
+// 识别一次，输出一行 JSON
+static void identifyOnce(CaptureCtl* capture, long long edgeUs) {
+  long long wakeUs = getTimeUs();
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  // 等待手指放稳后采集图像，没有放好(0x02)时在预算内重试
+  CaptureResult result;
+  bool ok = Capture_Image(capture, 0, &result);
+  int captures = result.attempts;
+  long long imageUs = getTimeUs();
+
+  long long charUs = imageUs;
+  if (ok) {
+    ok = PS_GenChar(1);
+    charUs = getTimeUs();
+  }
+
+  int pageID = -1, score = 0;
+  long long searchUs = charUs;
+  if (ok) {
+    ok = PS_SearchPlanned(1, true, NULL, &pageID, &score);
+    searchUs = getTimeUs();
+  }
+
+  const char* event = ok ? "match" : (g_error_code == 0x09 ? "nomatch" : "error");
+  printf("{\"time\":%ld.%03ld,\"event\":\"%s\"", (long)now.tv_sec, now.tv_nsec / 1000000, event);
+  if (ok)
+    printf(",\"page\":%d,\"score\":%d", pageID, score);
+  else if (g_error_code != 0x09) {
+    printf(",\"code\":\"%02X\",\"desc\":", g_error_code);
+    printJsonString(PS_GetErrorDesc());
+  }
+  printf(",\"captures\":%d,\"wake_ms\":%.1f,\"image_ms\":%.1f,\"genchar_ms\":%.1f,\"search_ms\":%.1f,\"total_ms\":%.1f}\n",
+         captures,
+         (wakeUs - edgeUs) / 1000.0,
+         (imageUs - wakeUs) / 1000.0,
+         (charUs - imageUs) / 1000.0,
+         (searchUs - charUs) / 1000.0,
+         (searchUs - edgeUs) / 1000.0);
+  fflush(stdout);
+}
+
+void Watch_Run(CaptureCtl* capture, int count) {
+  for (int i = 0; count <= 0 || i < count; ++i) {
+    long long edgeUs = 0;
+    Gpio_WaitLevel(capture->line, true, -1, &edgeUs);
+    identifyOnce(capture, edgeUs);
+    Gpio_WaitLevel(capture->line, false, -1, NULL);
+  }
+}
@@ -0,0 +1,46 @@
+/*
+  Copyright (c) 2019  Leopard-C
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*/
+
+
+
+#ifndef __WATCH_H__
+#define __WATCH_H__
+
+#include "../as608.h"
+#include "./capture.h"
+
+/*
+ * 连续识别(watch)：等待手指按下，采集图像 → 生成特征 → 高速搜索，
+ *   每次识别输出一行 JSON，手指离开后回到空闲状态。
+ *
+ * 按 gpio.h 的边沿事件等待手指，空闲时不占用 CPU，按下后立即唤醒；
+ *   由 capture.h 的控制器等待手指放稳后采集，captures 为采集的次数。
+ *
+ * 输出(每次识别一行，时间单位为毫秒)：
+ *   {"time":1760000000.123,"event":"match","page":3,"score":87,"captures":1,
+ *    "wake_ms":0.1,"image_ms":412.5,"genchar_ms":281.0,"search_ms":36.2,"total_ms":729.8}
+ *   event 为 match、nomatch 或 error(另有 code、desc)
+*/
+
+// 连续识别 count 次，count<=0 表示一直运行
+void Watch_Run(CaptureCtl* capture, int count);
+
+#endif // __WATCH_H__